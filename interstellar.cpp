@@ -8,12 +8,27 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <chrono>
+#include <deque>
+#include <queue>
+#include <list>
+#include <condition_variable>
+#include <functional>
 #include <algorithm>
 #include <cmath>
 #include <string_view>
 #include <array>
 #include <sstream>
 #include <iomanip>
+#include <fstream>
+#include <filesystem>
+#include <bit>
+
+#ifdef __linux
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace INTERSTELLAR_NAMESPACE {
     namespace Engine {
@@ -398,6 +413,7 @@ namespace INTERSTELLAR_NAMESPACE {
             type::rawseti rawseti;
             type::remove remove;
             type::replace replace;
+            type::resume resume;
             type::setallocf setallocf;
             type::setfenv setfenv;
             type::setfield setfield;
@@ -507,6 +523,7 @@ namespace INTERSTELLAR_NAMESPACE {
                 include(hndle, rawseti, start);
                 include(hndle, remove, start);
                 include(hndle, replace, start);
+                include(hndle, resume, start);
                 include(hndle, setallocf, start);
                 include(hndle, setfenv, start);
                 include(hndle, setfield, start);
@@ -1003,1648 +1020,5998 @@ namespace INTERSTELLAR_NAMESPACE {
 
     using namespace API;
 
-    namespace Tracker {
-        Signal::Handle* signal;
+    namespace Reflection::Executor {
+        void post(lua_State* L);
+        void park(lua_State* L, std::chrono::steady_clock::time_point until);
+    }
 
-        std::unordered_map<std::string, lua_Closure>& get_opening() {
-            static std::unordered_map<std::string, lua_Closure> m;
-            return m;
-        }
+    namespace Metrics {
+        // Histograms are log-linear with 8 buckets per power of two, so a bucket is never off by more than 12.5%
+        static const size_t sub_bits = 3;
+        static const size_t sub_count = 1 << sub_bits;
+        static const size_t value_bits = 40; // ~18 minutes in nanoseconds, anything longer lands in the last bucket
+        static const size_t bucket_count = (value_bits - sub_bits + 1) * sub_count;
+        static const size_t histogram_slots = bucket_count + 2; // buckets, count, sum
+
+        static const size_t page_size = 512;
+        static const size_t page_limit = 64;
+        static const size_t gauge_limit = 256;
+
+        // The first slots are a sink for metrics that couldn't be registered
+        static const size_t slot_start = histogram_slots;
+
+        enum class metric_kind : uint8_t {
+            counter,
+            gauge,
+            histogram,
+            probe
+        };
+
+        struct metric_info {
+            std::string name;
+            std::string help;
+            metric_kind kind;
+            metric handle;
+            metric_probe callback;
+        };
+
+        struct metric_page {
+            std::atomic<uint64_t> slots[page_size] = {};
+        };
+
+        // Only ever written by its own thread, so plain loads & stores are enough and nothing is contended
+        struct metric_shard {
+            std::atomic<metric_page*> pages[page_limit] = {};
+
+            ~metric_shard()
+            {
+                for (auto& page : pages) delete page.load();
+            }
+        };
 
-        std::unordered_map<std::string, lua_Closure>& get_closing() {
-            static std::unordered_map<std::string, lua_Closure> m;
-            return m;
-        }
+        static std::mutex registry_mtx;
+        static std::vector<metric_info> registry;
+        static size_t slot_next = slot_start;
+        static size_t gauge_next = 1;
+        static std::atomic<int64_t> gauges[gauge_limit] = {};
 
-        std::unordered_map<uintptr_t, state_tracking*>& get_mapping() {
-            static std::unordered_map<uintptr_t, state_tracking*> m;
-            return m;
-        }
+        // Guards the live shards & what exited threads left behind, never held while calling out
+        static std::mutex shards_mtx;
+        static std::vector<metric_shard*> shards;
+        static metric_shard retired;
 
-        std::unordered_map<std::string, state_tracking*>& get_imapping() {
-            static std::unordered_map<std::string, state_tracking*> m;
-            return m;
+        static void merge(metric_shard& into, metric_shard& from)
+        {
+            for (size_t p = 0; p < page_limit; p++) {
+                metric_page* page = from.pages[p].load(std::memory_order_acquire);
+                if (page == nullptr) continue;
+
+                metric_page* target = into.pages[p].load(std::memory_order_relaxed);
+                if (target == nullptr) {
+                    target = new metric_page();
+                    into.pages[p].store(target, std::memory_order_release);
+                }
+
+                for (size_t i = 0; i < page_size; i++) {
+                    uint64_t value = page->slots[i].load(std::memory_order_relaxed);
+                    if (value != 0) target->slots[i].store(target->slots[i].load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+                }
+            }
         }
 
-        static std::shared_ptr<std::mutex> access_mtx;
-        static std::shared_ptr<std::mutex> global_mtx;
-        static std::unique_ptr<std::unique_lock<std::mutex>> global_lock;
-        std::atomic<unsigned int> expecting;
+        // Folds the thread's shard into retired when it exits, so short lived workers don't lose what they counted
+        struct shard_holder {
+            metric_shard* shard = nullptr;
 
-        void increment()
-        {
-            expecting++;
-        }
+            ~shard_holder()
+            {
+                if (shard == nullptr) return;
+                std::lock_guard<std::mutex> guard(shards_mtx);
+                merge(retired, *shard);
+                shards.erase(std::remove(shards.begin(), shards.end(), shard), shards.end());
+                delete shard;
+            }
+        };
 
-        void decrement()
-        {
-            if (expecting == 0) return;
-            expecting--;
-        }
+        static thread_local shard_holder local;
 
-        void runtime()
+        static std::atomic<uint64_t>& slot(size_t index)
         {
-            global_lock->unlock();
-            while (expecting > 0) {}
-            global_lock->lock();
+            metric_shard* shard = local.shard;
+            if (shard == nullptr) {
+                shard = new metric_shard();
+                std::lock_guard<std::mutex> guard(shards_mtx);
+                shards.push_back(shard);
+                local.shard = shard;
+            }
+
+            auto& entry = shard->pages[index / page_size];
+            metric_page* page = entry.load(std::memory_order_relaxed);
+            if (page == nullptr) {
+                page = new metric_page();
+                entry.store(page, std::memory_order_release);
+            }
+
+            return page->slots[index % page_size];
         }
 
-        uintptr_t id(lua_State* L) {
-            return (uintptr_t)L;
+        static void bump(size_t index, uint64_t value)
+        {
+            std::atomic<uint64_t>& target = slot(index);
+            target.store(target.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
         }
 
-        state_tracking* get_tracker(lua_State* L)
+        static size_t bucket_of(uint64_t value)
         {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            uintptr_t id = (uintptr_t)L;
-            auto& mapping = get_mapping();
-            auto res = mapping.find(id);
-            if (res == mapping.end()) return nullptr;
-            return res->second;
+            if (value < sub_count) return (size_t)value;
+            size_t top = std::bit_width(value) - 1;
+            if (top >= value_bits) return bucket_count - 1;
+            return (top - sub_bits + 1) * sub_count + (size_t)((value >> (top - sub_bits)) & (sub_count - 1));
         }
 
-        state_tracking* get_tracker(void* L)
+        // First value past the bucket
+        static uint64_t bucket_end(size_t bucket)
         {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            uintptr_t id = (uintptr_t)L;
-            auto& mapping = get_mapping();
-            auto res = mapping.find(id);
-            if (res == mapping.end()) return nullptr;
-            return res->second;
+            if (bucket < sub_count) return bucket + 1;
+            size_t top = bucket / sub_count + sub_bits - 1;
+            return ((uint64_t)(sub_count + bucket % sub_count) << (top - sub_bits)) + (1ull << (top - sub_bits));
         }
 
-        state_tracking* get_tracker(uintptr_t L)
+        // Names go out as is in both formats, so they're held to what prometheus allows: [a-zA-Z_:][a-zA-Z0-9_:]*
+        static bool valid(const std::string& name)
         {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            auto& mapping = get_mapping();
-            auto res = mapping.find(L);
-            if (res == mapping.end()) return nullptr;
-            return res->second;
+            if (name.empty() || std::isdigit((unsigned char)name[0])) return false;
+            return std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isalnum(c) || c == '_' || c == ':'; });
         }
 
-        state_tracking* get_tracker(std::string name)
+        static metric enroll(std::string name, std::string help, metric_kind kind, metric_probe callback = nullptr)
         {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            auto& imapping = get_imapping();
-            auto res = imapping.find(name);
-            if (res == imapping.end()) return nullptr;
-            return res->second;
+            if (!valid(name)) return 0;
+
+            std::lock_guard<std::mutex> guard(registry_mtx);
+            for (auto& info : registry) {
+                if (info.name == name) return info.kind == kind ? info.handle : 0;
+            }
+
+            metric handle = 0;
+            if (kind == metric_kind::counter || kind == metric_kind::histogram) {
+                size_t needs = kind == metric_kind::counter ? 1 : histogram_slots;
+                if (slot_next + needs > page_size * page_limit) return 0;
+                handle = (metric)slot_next;
+                slot_next += needs;
+            }
+            else if (kind == metric_kind::gauge) {
+                if (gauge_next >= gauge_limit) return 0;
+                handle = (metric)gauge_next++;
+            }
+
+            registry.push_back(metric_info{ name, help, kind, handle, callback });
+            return handle;
         }
 
-        lua_State* is_state(lua_State* L) {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            uintptr_t id = (uintptr_t)L;
-            auto& mapping = get_mapping();
-            if (mapping.find(id) == mapping.end()) return nullptr;
-            return (lua_State*)L;
+        metric counter(std::string name, std::string help)
+        {
+            return enroll(name, help, metric_kind::counter);
         }
 
-        lua_State* is_state(uintptr_t L) {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            auto& mapping = get_mapping();
-            if (mapping.find(L) == mapping.end()) return nullptr;
-            return (lua_State*)L;
+        metric gauge(std::string name, std::string help)
+        {
+            return enroll(name, help, metric_kind::gauge);
         }
 
-        lua_State* is_state(void* L) {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            uintptr_t id = (uintptr_t)L;
-            auto& mapping = get_mapping();
-            if (mapping.find(id) == mapping.end()) return nullptr;
-            return (lua_State*)L;
+        metric histogram(std::string name, std::string help)
+        {
+            return enroll(name, help, metric_kind::histogram);
         }
 
-        lua_State* is_state(std::string name) {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            auto& imapping = get_imapping();
-            auto res = imapping.find(name);
-            if (res == imapping.end()) return nullptr;
-            return res->second->state.self;
+        void probe(std::string name, metric_probe callback, std::string help)
+        {
+            enroll(name, help, metric_kind::probe, callback);
         }
 
-        lua_State* get_root()
+        void add(metric counter, uint64_t value)
         {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            auto& mapping = get_mapping();
-            for (auto& entry : mapping) {
-                if (entry.second->parent.self != nullptr) {
-                    return entry.second->state.self;
-                }
-            }
-            return nullptr;
+            bump(counter, value);
         }
 
-        bool is_root(lua_State* L)
+        void set(metric gauge, int64_t value)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr) {
-                return tracker->parent.self == nullptr;
-            }
-            return false;
+            gauges[gauge].store(value, std::memory_order_relaxed);
         }
 
-        bool is_root(void* L)
+        void shift(metric gauge, int64_t delta)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr) {
-                return tracker->parent.self == nullptr;
-            }
-            return false;
+            gauges[gauge].fetch_add(delta, std::memory_order_relaxed);
         }
 
-        bool is_root(uintptr_t L)
+        void observe(metric histogram, uint64_t nanoseconds)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr) {
-                return tracker->parent.self == nullptr;
-            }
-            return false;
+            bump(histogram + bucket_of(nanoseconds), 1);
+            bump(histogram + bucket_count, 1);
+            bump(histogram + bucket_count + 1, nanoseconds);
         }
 
-        bool is_root(std::string name)
+        void observe(metric histogram, std::chrono::steady_clock::time_point since)
         {
-            state_tracking* tracker = get_tracker(name);
-            if (tracker != nullptr) {
-                return tracker->parent.self == nullptr;
-            }
-            return false;
+            observe(histogram, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count());
         }
 
-        bool is_internal(lua_State* L)
+        // Sums a range of slots over every shard, live or retired
+        static void collect(size_t index, size_t count, std::vector<uint64_t>& values)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr) {
-                return tracker->internal;
-            }
-            return false;
+            values.assign(count, 0);
+
+            std::lock_guard<std::mutex> guard(shards_mtx);
+            auto gather = [index, count, &values](metric_shard& shard) {
+                for (size_t i = 0; i < count; i++) {
+                    metric_page* page = shard.pages[(index + i) / page_size].load(std::memory_order_acquire);
+                    if (page != nullptr) values[i] += page->slots[(index + i) % page_size].load(std::memory_order_relaxed);
+                }
+            };
+
+            gather(retired);
+            for (metric_shard* shard : shards) gather(*shard);
         }
 
-        bool is_internal(void* L)
+        uint64_t get_counter(metric counter)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr) {
-                return tracker->internal;
-            }
-            return false;
+            std::vector<uint64_t> values;
+            collect(counter, 1, values);
+            return values[0];
         }
 
-        bool is_internal(uintptr_t L)
+        int64_t get_gauge(metric gauge)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr) {
-                return tracker->internal;
-            }
-            return false;
+            return gauges[gauge].load(std::memory_order_relaxed);
         }
 
-        bool is_internal(std::string name)
+        static histogram_stats summarize(const std::vector<uint64_t>& values)
         {
-            state_tracking* tracker = get_tracker(name);
-            if (tracker != nullptr) {
-                return tracker->internal;
-            }
-            return false;
+            histogram_stats stats;
+            stats.count = values[bucket_count];
+            stats.sum = values[bucket_count + 1];
+            if (stats.count == 0) return stats;
+
+            // percentiles & max are the end of their bucket
+            auto percentile = [&values, &stats](double rank) {
+                uint64_t target = std::max<uint64_t>(1, (uint64_t)std::ceil(rank * stats.count));
+                uint64_t seen = 0;
+                for (size_t i = 0; i < bucket_count; i++) {
+                    seen += values[i];
+                    if (seen >= target) return bucket_end(i) - 1;
+                }
+                return bucket_end(bucket_count - 1) - 1;
+            };
+
+            stats.p50 = percentile(0.50);
+            stats.p90 = percentile(0.90);
+            stats.p99 = percentile(0.99);
+            stats.max = percentile(1.0);
+            return stats;
         }
 
-        bool is_threaded(lua_State* L)
+        histogram_stats get_histogram(metric histogram)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr) {
-                return tracker->threaded;
-            }
-            return false;
+            std::vector<uint64_t> values;
+            collect(histogram, histogram_slots, values);
+            return summarize(values);
         }
 
-        bool is_threaded(void* L)
+        static std::vector<metric_info> listing()
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr) {
-                return tracker->threaded;
-            }
-            return false;
+            std::lock_guard<std::mutex> guard(registry_mtx);
+            return registry;
         }
 
-        bool is_threaded(uintptr_t L)
+        static std::string number(double value)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr) {
-                return tracker->threaded;
-            }
-            return false;
+            std::ostringstream stream;
+            stream << std::setprecision(17) << value;
+            return stream.str();
         }
 
-        bool is_threaded(std::string name)
+        // Help text may only escape backslashes & newlines
+        static std::string escape(const std::string& help)
         {
-            state_tracking* tracker = get_tracker(name);
-            if (tracker != nullptr) {
-                return tracker->threaded;
+            std::string out;
+            for (char c : help) {
+                if (c == '\\') out += "\\\\";
+                else if (c == '\n') out += "\\n";
+                else out += c;
             }
-            return false;
+            return out;
         }
 
-        std::vector<lua_State*> get_children(lua_State* L)
+        std::string prometheus()
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr && tracker->children.size() > 0) {
-                std::vector<lua_State*> ret;
-                ret.reserve(tracker->children.size());
-                for (const auto& entry : tracker->children) {
-                    ret.push_back(entry.self);
+            std::string out;
+            std::vector<uint64_t> values;
+
+            for (auto& info : listing()) {
+                if (info.help.size() > 0) out += "# HELP " + info.name + " " + escape(info.help) + "\n";
+
+                switch (info.kind) {
+                case metric_kind::counter:
+                    out += "# TYPE " + info.name + " counter\n";
+                    out += info.name + " " + std::to_string(get_counter(info.handle)) + "\n";
+                    break;
+                case metric_kind::gauge:
+                    out += "# TYPE " + info.name + " gauge\n";
+                    out += info.name + " " + std::to_string(get_gauge(info.handle)) + "\n";
+                    break;
+                case metric_kind::probe:
+                    out += "# TYPE " + info.name + " gauge\n";
+                    out += info.name + " " + number(info.callback()) + "\n";
+                    break;
+                case metric_kind::histogram: {
+                    out += "# TYPE " + info.name + " histogram\n";
+                    collect(info.handle, histogram_slots, values);
+
+                    // every other power of two from ~1us to ~17s, those line up with bucket edges exactly
+                    uint64_t cumulative = 0;
+                    size_t bucket = 0;
+                    for (size_t power = 10; power <= 34; power += 2) {
+                        uint64_t edge = 1ull << power;
+                        while (bucket < bucket_count && bucket_end(bucket) <= edge) cumulative += values[bucket++];
+                        out += info.name + "_bucket{le=\"" + number((double)edge / 1e9) + "\"} " + std::to_string(cumulative) + "\n";
+                    }
+                    out += info.name + "_bucket{le=\"+Inf\"} " + std::to_string(values[bucket_count]) + "\n";
+                    out += info.name + "_sum " + number((double)values[bucket_count + 1] / 1e9) + "\n";
+                    out += info.name + "_count " + std::to_string(values[bucket_count]) + "\n";
+                    break;
+                }
                 }
-                return ret;
             }
-            return std::vector<lua_State*>();
+
+            return out;
         }
 
-        std::vector<lua_State*> get_children(void* L)
+        std::string json()
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr && tracker->children.size() > 0) {
-                std::vector<lua_State*> ret;
-                ret.reserve(tracker->children.size());
-                for (const auto& entry : tracker->children) {
-                    ret.push_back(entry.self);
+            std::string counters, gauges_out, histograms;
+            std::vector<uint64_t> values;
+
+            auto append = [](std::string& into, const std::string& name, const std::string& value) {
+                if (into.size() > 0) into += ",";
+                into += "\"" + name + "\":" + value;
+            };
+
+            for (auto& info : listing()) {
+                switch (info.kind) {
+                case metric_kind::counter:
+                    append(counters, info.name, std::to_string(get_counter(info.handle)));
+                    break;
+                case metric_kind::gauge:
+                    append(gauges_out, info.name, std::to_string(get_gauge(info.handle)));
+                    break;
+                case metric_kind::probe:
+                    append(gauges_out, info.name, number(info.callback()));
+                    break;
+                case metric_kind::histogram: {
+                    collect(info.handle, histogram_slots, values);
+                    histogram_stats stats = summarize(values);
+                    append(histograms, info.name,
+                        "{\"count\":" + std::to_string(stats.count) +
+                        ",\"sum\":" + number((double)stats.sum / 1e9) +
+                        ",\"p50\":" + number((double)stats.p50 / 1e9) +
+                        ",\"p90\":" + number((double)stats.p90 / 1e9) +
+                        ",\"p99\":" + number((double)stats.p99 / 1e9) +
+                        ",\"max\":" + number((double)stats.max / 1e9) + "}");
+                    break;
+                }
                 }
-                return ret;
             }
-            return std::vector<lua_State*>();
+
+            return "{\"counters\":{" + counters + "},\"gauges\":{" + gauges_out + "},\"histograms\":{" + histograms + "}}";
         }
 
-        std::vector<lua_State*> get_children(uintptr_t L)
+        int lsnapshot(lua_State* L)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr && tracker->children.size() > 0) {
-                std::vector<lua_State*> ret;
-                ret.reserve(tracker->children.size());
-                for (const auto& entry : tracker->children) {
-                    ret.push_back(entry.self);
+            lua::newtable(L);
+            lua::newtable(L);
+            lua::newtable(L);
+            lua::newtable(L);
+
+            for (auto& info : listing()) {
+                switch (info.kind) {
+                case metric_kind::counter:
+                    lua::pushnumber(L, (double)get_counter(info.handle));
+                    lua::setcfield(L, -4, info.name);
+                    break;
+                case metric_kind::gauge:
+                    lua::pushnumber(L, (double)get_gauge(info.handle));
+                    lua::setcfield(L, -3, info.name);
+                    break;
+                case metric_kind::probe:
+                    lua::pushnumber(L, info.callback());
+                    lua::setcfield(L, -3, info.name);
+                    break;
+                case metric_kind::histogram: {
+                    histogram_stats stats = get_histogram(info.handle);
+                    lua::newtable(L);
+                    lua::pushnumber(L, (double)stats.count);
+                    lua::setfield(L, -2, "count");
+                    lua::pushnumber(L, (double)stats.sum / 1e9);
+                    lua::setfield(L, -2, "sum");
+                    lua::pushnumber(L, (double)stats.p50 / 1e9);
+                    lua::setfield(L, -2, "p50");
+                    lua::pushnumber(L, (double)stats.p90 / 1e9);
+                    lua::setfield(L, -2, "p90");
+                    lua::pushnumber(L, (double)stats.p99 / 1e9);
+                    lua::setfield(L, -2, "p99");
+                    lua::pushnumber(L, (double)stats.max / 1e9);
+                    lua::setfield(L, -2, "max");
+                    lua::setcfield(L, -2, info.name);
+                    break;
+                }
                 }
-                return ret;
             }
-            return std::vector<lua_State*>();
+
+            lua::setfield(L, -4, "histograms");
+            lua::setfield(L, -3, "gauges");
+            lua::setfield(L, -2, "counters");
+            return 1;
         }
 
-        std::vector<lua_State*> get_children(std::string name)
+        int lprometheus(lua_State* L)
         {
-            state_tracking* tracker = get_tracker(name);
-            if (tracker != nullptr && tracker->children.size() > 0) {
-                std::vector<lua_State*> ret;
-                ret.reserve(tracker->children.size());
-                for (const auto& entry : tracker->children) {
-                    ret.push_back(entry.self);
-                }
-                return ret;
-            }
-            return std::vector<lua_State*>();
+            lua::pushcstring(L, prometheus());
+            return 1;
         }
 
-        lua_State* get_parent(lua_State* L)
+        int ljson(lua_State* L)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr && tracker->parent.self != nullptr) {
-                return tracker->parent.self;
-            }
-            return nullptr;
+            lua::pushcstring(L, json());
+            return 1;
         }
 
-        lua_State* get_parent(void* L)
+        int ladd(lua_State* L)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr && tracker->parent.self != nullptr) {
-                return tracker->parent.self;
-            }
-            return nullptr;
+            std::string name = luaL::checkcstring(L, 1);
+            if (!valid(name)) luaL::argerror(L, 1, "metric names must match [a-zA-Z_:][a-zA-Z0-9_:]*");
+            metric handle = counter(name);
+            add(handle, (uint64_t)std::max(0.0, luaL::optnumber(L, 2, 1)));
+            return 0;
         }
 
-        lua_State* get_parent(uintptr_t L)
+        int lset(lua_State* L)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker != nullptr && tracker->parent.self != nullptr) {
-                return tracker->parent.self;
-            }
-            return nullptr;
+            std::string name = luaL::checkcstring(L, 1);
+            if (!valid(name)) luaL::argerror(L, 1, "metric names must match [a-zA-Z_:][a-zA-Z0-9_:]*");
+            metric handle = gauge(name);
+            set(handle, (int64_t)luaL::checknumber(L, 2));
+            return 0;
         }
 
-        lua_State* get_parent(std::string name)
+        int lobserve(lua_State* L)
         {
-            state_tracking* tracker = get_tracker(name);
-            if (tracker != nullptr && tracker->parent.self != nullptr) {
-                return tracker->parent.self;
-            }
-            return nullptr;
+            std::string name = luaL::checkcstring(L, 1);
+            if (!valid(name)) luaL::argerror(L, 1, "metric names must match [a-zA-Z_:][a-zA-Z0-9_:]*");
+            metric handle = histogram(name);
+            observe(handle, (uint64_t)(std::max(0.0, luaL::checknumber(L, 2)) * 1e9));
+            return 0;
         }
 
-        bool should_lock(lua_State* target, lua_State* source)
+        static constexpr luaL_Reg metrics_functions[] = {
+            { "snapshot", lsnapshot },
+            { "prometheus", lprometheus },
+            { "json", ljson },
+            { "add", ladd },
+            { "set", lset },
+            { "observe", lobserve },
+            { nullptr, nullptr }
+        };
+
+        void push(lua_State* L, UMODULE hndle)
         {
-            return target != source && (Tracker::is_threaded(target) || Tracker::is_threaded(target) != Tracker::is_threaded(source));
+            lua::newtable(L);
+            luaL::makelib(L, nullptr, metrics_functions);
         }
 
-        std::string get_name(lua_State* L)
+        void api()
         {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            uintptr_t id = (uintptr_t)L;
-            auto& mapping = get_mapping();
-            auto res = mapping.find(id);
-            if (res != mapping.end()) {
-                return res->second->name;
-            }
-            return "";
+            Reflection::add("metrics", push);
         }
+    }
 
-        std::vector<std::pair<std::string, lua_State*>> get_states() {
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            std::vector<std::pair<std::string, lua_State*>> list;
+    namespace Log {
+        struct log_line {
+            std::chrono::steady_clock::time_point stamp;
+            std::string text;
+        };
+
+        // Single producer (the owning thread), single consumer (the writer) ring, neither side ever waits on the other
+        struct log_ring {
+            std::unique_ptr<log_line[]> lines;
+            size_t mask;
+            alignas(64) std::atomic<size_t> head = 0;
+            alignas(64) std::atomic<size_t> tail = 0;
+            std::atomic<bool> retired = false;
+
+            log_ring(size_t capacity)
+            {
+                size_t size = 2;
+                while (size < capacity) size <<= 1;
+                lines.reset(new log_line[size]);
+                mask = size - 1;
+            }
 
-            auto& mapping = get_mapping();
-            for (auto& object : mapping) {
-                std::string name = object.second->name;
-                lua_State* L = object.second->state.self;
-                list.push_back(std::pair<std::string, lua_State*>(name, L));
+            bool push(log_line&& line)
+            {
+                size_t position = head.load(std::memory_order_relaxed);
+                if (position - tail.load(std::memory_order_acquire) > mask) return false;
+                lines[position & mask] = std::move(line);
+                head.store(position + 1, std::memory_order_release);
+                return true;
             }
 
-            return list;
-        }
+            bool pop(log_line& line)
+            {
+                size_t position = tail.load(std::memory_order_relaxed);
+                if (position == head.load(std::memory_order_acquire)) return false;
+                line = std::move(lines[position & mask]);
+                tail.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        };
 
-        // since cross-states should be able to talk back and forth
-        static std::mutex global_cross_mutex;
+        // Marks the thread's ring once it exits, the writer drops it after emptying it
+        struct ring_owner {
+            std::shared_ptr<log_ring> ring;
 
-        std::unordered_map<uintptr_t, unsigned int>& get_cross_trace() {
-            static std::unordered_map<uintptr_t, unsigned int> m;
-            return m;
-        }
+            ~ring_owner()
+            {
+                if (ring) ring->retired.store(true, std::memory_order_release);
+            }
+        };
 
-        std::unordered_map<uintptr_t, std::unique_ptr<std::unique_lock<std::mutex>>>& get_cross_locks() {
-            static std::unordered_map<uintptr_t, std::unique_ptr<std::unique_lock<std::mutex>>> m;
-            return m;
-        }
+        static std::atomic<level> threshold = level::info;
+        static std::atomic<double> rate = 0;
+        static std::atomic<double> burst = 0;
+        static std::atomic<size_t> capacity = 1024;
 
-        void cross_lock(lua_State* target, lua_State* source)
-        {
-            std::scoped_lock lock(global_cross_mutex);
+        static std::mutex rings_mtx;
+        static std::vector<std::shared_ptr<log_ring>> rings;
+        static thread_local ring_owner owned;
+        static std::once_flag started;
+        static std::atomic<bool> stopping = false;
+        static std::thread worker;
 
-            auto target_tracker = get_tracker(target);
-            auto target_ptr = target_tracker->state.pointer;
-            auto source_ptr = get_tracker(source)->state.pointer;
+        // Held by whoever is writing out, so lines from one drain always land in order
+        static std::mutex sink_mtx;
+        static FILE* sink = nullptr;
+        static std::string sink_path;
+        static size_t sink_size = 0;
+        static size_t sink_keep = 0;
+        static size_t sink_written = 0;
 
-            auto& cross_trace = get_cross_trace();
-            auto& cross_locks = get_cross_locks();
+        static std::atomic<uint64_t> written = 0;
+        static std::atomic<uint64_t> dropped = 0;
+        static std::atomic<uint64_t> limited = 0;
 
-            if (cross_trace[target_ptr] == 0) {
-                auto mutex = target_tracker->mutex;
-                auto guard = std::make_unique<std::unique_lock<std::mutex>>(*mutex);
-                cross_locks[target_ptr] = std::move(guard);
-            }
+        static const char* level_names[] = { "debug", "info", "warn", "error", "none" };
 
-            cross_trace[target_ptr]++;
-            cross_trace[source_ptr]++;
+        void set_level(level minimum)
+        {
+            threshold.store(minimum, std::memory_order_relaxed);
         }
 
-        void cross_unlock(lua_State* target, lua_State* source)
+        level get_level()
         {
-            std::scoped_lock lock(global_cross_mutex);
-
-            auto target_ptr = get_tracker(target)->state.pointer;
-            auto source_ptr = get_tracker(source)->state.pointer;
-
-            auto& cross_trace = get_cross_trace();
-            auto& cross_locks = get_cross_locks();
-
-            if (--cross_trace[target_ptr] == 0) {
-                cross_locks.erase(target_ptr);
-            }
-
-            if (--cross_trace[source_ptr] == 0) {
-                cross_locks.erase(source_ptr);
-            }
+            return threshold.load(std::memory_order_relaxed);
         }
 
-        std::unique_lock<std::mutex> lock(lua_State* L)
+        void set_rate(double lines, double saved)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker == nullptr) {
-                return std::unique_lock<std::mutex>();
-            }
-            return std::unique_lock<std::mutex>(*tracker->mutex);
+            rate.store(std::max(0.0, lines), std::memory_order_relaxed);
+            burst.store(saved > 0 ? saved : std::max(1.0, lines), std::memory_order_relaxed);
         }
 
-        std::unique_lock<std::mutex> lock(void* L)
+        void set_capacity(size_t lines)
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker == nullptr) {
-                return std::unique_lock<std::mutex>();
-            }
-            return std::unique_lock<std::mutex>(*tracker->mutex);
+            capacity.store(std::max((size_t)2, lines), std::memory_order_relaxed);
         }
 
-        std::unique_lock<std::mutex> lock(uintptr_t L)
+        // Moves path to path.1, path.1 to path.2 and so on, the oldest one past keep is removed
+        void rotate()
         {
-            state_tracking* tracker = get_tracker(L);
-            if (tracker == nullptr) {
-                return std::unique_lock<std::mutex>();
+            if (sink != nullptr) fclose(sink);
+            sink = nullptr;
+
+            std::error_code ec;
+            if (sink_keep > 0) {
+                std::filesystem::remove(sink_path + "." + std::to_string(sink_keep), ec);
+                for (size_t i = sink_keep; i > 1; i--) {
+                    std::filesystem::rename(sink_path + "." + std::to_string(i - 1), sink_path + "." + std::to_string(i), ec);
+                }
+                std::filesystem::rename(sink_path, sink_path + ".1", ec);
             }
-            return std::unique_lock<std::mutex>(*tracker->mutex);
+
+            sink = fopen(sink_path.c_str(), sink_keep > 0 ? "ab" : "wb");
+            sink_written = 0;
         }
 
-        std::unique_lock<std::mutex> lock(std::string name)
+        bool set_file(std::string path, size_t size, size_t keep)
         {
-            state_tracking* tracker = get_tracker(name);
-            if (tracker == nullptr) {
-                return std::unique_lock<std::mutex>();
+            std::lock_guard<std::mutex> guard(sink_mtx);
+
+            FILE* file = nullptr;
+            if (path.size() > 0) {
+                file = fopen(path.c_str(), "ab");
+                if (file == nullptr) return false;
             }
-            return std::unique_lock<std::mutex>(*tracker->mutex);
-        }
 
-        void listen(lua_State* L, std::string name, bool internal, lua_State* parent)
-        {
-            uintptr_t id = (uintptr_t)L;
+            if (sink != nullptr) fclose(sink);
+            sink = file;
+            sink_path = path;
+            sink_size = size;
+            sink_keep = keep;
 
-            if (name.size() > 0) {
-                state_tracking* tracker = new state_tracking();
-                tracker->threaded = false;
-                tracker->internal = internal;
-                tracker->name = name;
-                tracker->state.self = L;
-                tracker->parent.self = parent;
-                tracker->children = std::vector<state_union>();
-                tracker->mutex = global_mtx;
+            std::error_code ec;
+            sink_written = file != nullptr ? (size_t)std::filesystem::file_size(path, ec) : 0;
+            if (ec) sink_written = 0;
+            return true;
+        }
 
-                if (parent != nullptr)
-                {
-                    state_tracking* parent_tracker = Tracker::get_tracker(parent);
-                    state_union u; u.self = L;
-                    parent_tracker->children.push_back(u);
-                }
+        void drain()
+        {
+            std::vector<std::shared_ptr<log_ring>> current;
+            {
+                std::lock_guard<std::mutex> guard(rings_mtx);
+                current = rings;
+            }
 
-                auto& mapping = get_mapping();
-                auto& imapping = get_imapping();
+            std::lock_guard<std::mutex> guard(sink_mtx);
 
-                std::unique_lock<std::mutex> guard_access(*access_mtx);
-                mapping.emplace(id, tracker);
-                imapping.emplace(name, tracker);
-                if (guard_access.owns_lock()) guard_access.unlock(); guard_access.release();
+            std::vector<log_line> pending;
+            log_line line;
+            for (auto& ring : current) {
+                while (ring->pop(line)) pending.push_back(std::move(line));
+            }
 
-                auto& dispatch = get_opening();
-                for (auto& [key, callback] : dispatch) {
-                    callback(L);
-                }
+            // threads that exited are only let go of once there's nothing left in their ring
+            {
+                std::lock_guard<std::mutex> rings_guard(rings_mtx);
+                rings.erase(std::remove_if(rings.begin(), rings.end(), [](auto& ring) {
+                    return ring->retired.load(std::memory_order_acquire) && ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed);
+                }), rings.end());
+            }
 
-                for (auto& state : Tracker::get_states()) {
-                    lua_State* S = state.second;
+            if (pending.empty()) return;
 
-                    if (S == L) continue;
+            std::stable_sort(pending.begin(), pending.end(), [](const log_line& a, const log_line& b) {
+                return a.stamp < b.stamp;
+            });
 
-                    std::unique_lock<std::mutex> guard;
-                    bool threaded = Tracker::is_threaded(S);
-                    if (threaded) {
-                        guard = Tracker::lock(S);
-                    }
+            std::string buffer;
+            for (auto& entry : pending) {
+                buffer += entry.text;
 
-                    if (!signal->has(S, "open")) {
-                        if (guard.owns_lock()) guard.unlock(); guard.release();
-                        continue;
-                    };
+                // rotate on line boundaries so a line is never split across files
+                if (sink != nullptr && sink_size > 0 && sink_written + buffer.size() >= sink_size) {
+                    fwrite(buffer.data(), 1, buffer.size(), sink);
+                    buffer.clear();
+                    rotate();
 
-                    lua::pushcstring(S, name);
-                    Reflection::push_state(S, L);
-                    signal->fire(S, "open", 2);
-                    if (guard.owns_lock()) guard.unlock(); guard.release();
+                    // a failed reopen leaves sink empty, so the rest of the batch falls through to stdout below
                 }
             }
+
+            FILE* target = sink != nullptr ? sink : stdout;
+            fwrite(buffer.data(), 1, buffer.size(), target);
+            fflush(target);
+            sink_written += buffer.size();
         }
 
-        void listen(lua_State* L, std::string name, std::shared_ptr<std::mutex> mtx, bool internal, lua_State* parent)
+        void flush()
         {
-            uintptr_t id = (uintptr_t)L;
+            drain();
+        }
 
-            if (name.size() > 0) {
-                state_tracking* tracker = new state_tracking();
-                tracker->threaded = true;
-                tracker->internal = internal;
-                tracker->name = name;
-                tracker->state.self = L;
-                tracker->parent.self = parent;
-                tracker->children = std::vector<state_union>();
+        void writer()
+        {
+            while (!stopping.load(std::memory_order_acquire)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                drain();
+            }
+        }
 
-                if (parent != nullptr)
+        // Runs at exit, the writer is joined first so it's gone before static destructors take down the rings and the sink
+        void shutdown()
+        {
+            stopping.store(true, std::memory_order_release);
+            if (worker.joinable()) worker.join();
+            drain();
+        }
+
+        log_ring& local()
+        {
+            if (!owned.ring) {
+                owned.ring = std::make_shared<log_ring>(capacity.load(std::memory_order_relaxed));
                 {
-                    state_tracking* parent_tracker = Tracker::get_tracker(parent);
-                    state_union u; u.self = L;
-                    parent_tracker->children.push_back(u);
+                    std::lock_guard<std::mutex> guard(rings_mtx);
+                    rings.push_back(owned.ring);
                 }
 
-                tracker->mutex = mtx;
-
-                auto& mapping = get_mapping();
-                auto& imapping = get_imapping();
-
-                std::unique_lock<std::mutex> guard_access(*access_mtx);
-                mapping.emplace(id, tracker);
-                imapping.emplace(name, tracker);
-                if (guard_access.owns_lock()) guard_access.unlock(); guard_access.release();
+                std::call_once(started, []() {
+                    worker = std::thread(writer);
+                    std::atexit(shutdown);
+                });
+            }
+            return *owned.ring;
+        }
 
-                auto& dispatch = get_opening();
-                for (auto& [key, callback] : dispatch) {
-                    callback(L);
-                }
+        void write(level severity, std::string_view source, std::string_view text)
+        {
+            static Metrics::metric lines = Metrics::counter("interstellar_log_lines_total", "Lines logged");
+            static Metrics::metric overflows = Metrics::counter("interstellar_log_dropped_total", "Lines dropped because the writing thread's ring was full");
 
-                for (auto& state : Tracker::get_states()) {
-                    lua_State* S = state.second;
+            if (severity < get_level() || severity == level::none) return;
 
-                    if (S == L) continue;
+            std::string line;
+            line.reserve(source.size() + text.size() + 12);
+            line += "[";
+            line += source;
+            line += "] ";
+            if (severity != level::info) {
+                line += level_names[(size_t)severity];
+                line += ": ";
+            }
+            line += text;
+            line += "\n";
 
-                    std::unique_lock<std::mutex> guard;
-                    bool threaded = Tracker::is_threaded(S);
-                    if (threaded) {
-                        guard = Tracker::lock(S);
-                    }
+            if (!local().push(log_line{ std::chrono::steady_clock::now(), std::move(line) })) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                Metrics::add(overflows);
+                return;
+            }
 
-                    if (!signal->has(S, "open")) {
-                        if (guard.owns_lock()) guard.unlock(); guard.release();
-                        continue;
-                    };
+            written.fetch_add(1, std::memory_order_relaxed);
+            Metrics::add(lines);
+        }
 
-                    lua::pushcstring(S, name);
-                    Reflection::push_state(S, L);
-                    signal->fire(S, "open", 2);
-                    if (guard.owns_lock()) guard.unlock(); guard.release();
-                }
-            }
+        log_stats get_stats()
+        {
+            log_stats stats;
+            stats.written = written.load(std::memory_order_relaxed);
+            stats.dropped = dropped.load(std::memory_order_relaxed);
+            stats.limited = limited.load(std::memory_order_relaxed);
+            return stats;
         }
 
-        inline void _destruct(state_tracking* tracker)
+        // Takes a token from the state's bucket, false if it is out of them
+        bool admit(lua_State* L)
         {
-            if (tracker == nullptr) return;
+            static Metrics::metric throttled = Metrics::counter("interstellar_log_limited_total", "Lines dropped for going over their state's rate");
 
-            std::string name = tracker->name;
-            lua_State* L = tracker->state.self;
+            double lines = rate.load(std::memory_order_relaxed);
+            if (lines <= 0) return true;
 
-            if (tracker->parent.self != nullptr) {
-                state_tracking* parent_tracker = get_tracker(tracker->parent.self);
-                if (parent_tracker != nullptr) {
-                    std::remove(parent_tracker->children.begin(), parent_tracker->children.end(), tracker->state);
-                }
+            std::shared_ptr<Tracker::state_tracking> tracker = Tracker::get_tracker(Tracker::id(L));
+            if (tracker == nullptr) return true;
+
+            Tracker::log_bucket& bucket = tracker->logging;
+            double saved = burst.load(std::memory_order_relaxed);
+            auto now = std::chrono::steady_clock::now();
+
+            if (!bucket.primed) {
+                bucket.primed = true;
+                bucket.tokens = saved;
+            }
+            else {
+                bucket.tokens = std::min(saved, bucket.tokens + std::chrono::duration<double>(now - bucket.refill).count() * lines);
             }
+            bucket.refill = now;
 
-            for (auto& state : Tracker::get_states()) {
-                lua_State* S = state.second;
+            if (bucket.tokens < 1) {
+                limited.fetch_add(1, std::memory_order_relaxed);
+                Metrics::add(throttled);
+                return false;
+            }
 
-                if (S == L) continue;
+            bucket.tokens -= 1;
+            return true;
+        }
 
-                std::unique_lock<std::mutex> guard;
-                bool threaded = Tracker::is_threaded(S);
-                if (threaded) {
-                    guard = Tracker::lock(S);
-                }
+        // Joins the arguments by tabs, going through tostring (at index) for anything that isn't a string or number
+        std::string concat(lua_State* L, int first, int last, int tostring)
+        {
+            std::string line;
+            for (int i = first; i <= last; ++i) {
+                if (i > first) line += "\t";
 
-                if (!signal->has(S, "open")) {
-                    if (guard.owns_lock()) guard.unlock(); guard.release();
+                if (lua::isstring(L, i) || lua::isnumber(L, i)) {
+                    line += lua::tocstring(L, i);
                     continue;
-                };
+                }
 
-                lua::pushcstring(S, name);
-                Reflection::push_state(S, L);
-                signal->fire(S, "open", 2);
-                if (guard.owns_lock()) guard.unlock(); guard.release();
+                lua::pushvalue(L, tostring);
+                lua::pushvalue(L, i);
+                lua::call(L, 1, 1);
+                line += lua::tocstring(L, -1);
+                lua::pop(L, 1);
             }
-
-            auto& mapping = get_mapping();
-            auto& imapping = get_imapping();
-
-            std::lock_guard<std::mutex> guard(*access_mtx);
-            mapping.erase(tracker->state.pointer);
-            imapping.erase(tracker->name);
-            delete tracker;
+            return line;
         }
 
-        void destroy(lua_State* L)
+        std::string source(lua_State* L)
         {
-            _destruct(get_tracker(L));
+            std::string name = Tracker::get_name(L);
+            if (name.size() < 1) name = "unknown";
+            return name;
         }
 
-        void destroy(uintptr_t L)
+        // Writes the first nargs arguments at severity, for print & the log library
+        int log(lua_State* L, level severity, int nargs, int tostring)
         {
-            _destruct(get_tracker(L));
-        }
+            if (severity < get_level() || !admit(L)) return 0;
 
-        void destroy(void* L)
-        {
-            _destruct(get_tracker(L));
+            std::string line = concat(L, 1, nargs, tostring);
+            write(severity, source(L), line);
+            return 0;
         }
 
-        void destroy(std::string name)
+        int llog(lua_State* L, level severity)
         {
-            _destruct(get_tracker(name));
-        }
+            int nargs = lua::gettop(L);
 
-        void pre_remove(lua_State* L) {
-            state_tracking* tracker = get_tracker(L);
+            lua::pushvalue(L, indexer::global);
+            lua::getfield(L, -1, "tostring");
+            lua::remove(L, -2);
 
-            if (tracker == nullptr) return;
+            return log(L, severity, nargs, nargs + 1);
+        }
 
-            for (auto& state : tracker->children)
-            {
-                if (Tracker::is_internal(state.self)) continue;
-                Reflection::close(state.self);
+        int ldebug(lua_State* L) { return llog(L, level::debug); }
+        int linfo(lua_State* L) { return llog(L, level::info); }
+        int lwarn(lua_State* L) { return llog(L, level::warn); }
+        int lerror(lua_State* L) { return llog(L, level::error); }
+
+        int llevel(lua_State* L)
+        {
+            if (lua::isstring(L, 1)) {
+                std::string name = lua::tocstring(L, 1);
+                auto found = std::find_if(std::begin(level_names), std::end(level_names), [&name](const char* entry) { return name == entry; });
+                if (found == std::end(level_names)) {
+                    luaL::argerror(L, 1, "expected debug, info, warn, error or none");
+                    return 0;
+                }
+                set_level((level)(found - std::begin(level_names)));
             }
 
-            destroy(L);
+            lua::pushcstring(L, level_names[(size_t)get_level()]);
+            return 1;
+        }
 
-            auto lock = Tracker::lock(L);
-            auto& dispatch = get_closing();
-            for (auto& [key, callback] : dispatch) {
-                callback(L);
-            }
-            if (lock.owns_lock()) lock.unlock(); lock.release();
+        int lrate(lua_State* L)
+        {
+            set_rate(luaL::checknumber(L, 1), luaL::optnumber(L, 2, 0));
+            return 0;
         }
 
-        void post_remove(lua_State* L) {
-            auto lock = Tracker::lock(L);
-            Class::cleanup(L);
-            if (lock.owns_lock()) lock.unlock(); lock.release();
+        int lflush(lua_State* L)
+        {
+            flush();
+            return 0;
         }
 
-        void on_open(std::string name, lua_Closure callback)
+        int lstats(lua_State* L)
         {
-            auto& dispatch = get_opening();
-            dispatch.emplace(name, callback);
+            log_stats stats = get_stats();
+            lua::newtable(L);
+            lua::pushnumber(L, (double)stats.written);
+            lua::setfield(L, -2, "written");
+            lua::pushnumber(L, (double)stats.dropped);
+            lua::setfield(L, -2, "dropped");
+            lua::pushnumber(L, (double)stats.limited);
+            lua::setfield(L, -2, "limited");
+            return 1;
         }
 
-        void on_close(std::string name, lua_Closure callback)
+        static constexpr luaL_Reg log_functions[] = {
+            { "debug", ldebug },
+            { "info", linfo },
+            { "warn", lwarn },
+            { "error", lerror },
+            { "level", llevel },
+            { "rate", lrate },
+            { "flush", lflush },
+            { "stats", lstats },
+            { nullptr, nullptr }
+        };
+
+        void push(lua_State* L, UMODULE hndle)
         {
-            auto& dispatch = get_closing();
-            dispatch.emplace(name, callback);
+            lua::newtable(L);
+            luaL::makelib(L, nullptr, log_functions);
         }
 
-        inline void init()
+        void api()
         {
-            signal = Signal::create();
-            access_mtx = std::make_shared<std::mutex>();
-            global_mtx = std::make_shared<std::mutex>();
-            global_lock = std::make_unique<std::unique_lock<std::mutex>>(*global_mtx);
-            global_lock->unlock();
-            global_lock->lock();
+            Reflection::add("log", push);
         }
     }
 
-    namespace Class {
-        std::unordered_map<uintptr_t, std::vector<class_store>> mapping;
-        std::unordered_map<uintptr_t, unsigned char> offsets;
+    namespace Tracker {
+        Signal::Handle* signal;
 
-        bool existsbyname(lua_State* L, std::string name)
-        {
-            uintptr_t id = Tracker::id(L);
+        std::unordered_map<std::string, lua_Closure>& get_opening() {
+            static std::unordered_map<std::string, lua_Closure> m;
+            return m;
+        }
 
-            if (mapping.find(id) == mapping.end()) {
-                return false;
-            }
+        std::unordered_map<std::string, lua_Closure>& get_closing() {
+            static std::unordered_map<std::string, lua_Closure> m;
+            return m;
+        }
 
-            for (auto& entry : mapping[id]) {
-                if (entry.name == name) {
-                    return true;
-                }
+        defer_queue::~defer_queue()
+        {
+            defer_node* node = head.exchange(nullptr);
+            while (node != nullptr) {
+                defer_node* next = node->next;
+                delete node;
+                node = next;
             }
 
-            return false;
+            node = carried;
+            while (node != nullptr) {
+                defer_node* next = node->next;
+                delete node;
+                node = next;
+            }
         }
 
-        class_store getbyname(lua_State* L, std::string name)
+        completion_queue::~completion_queue()
         {
-            uintptr_t id = Tracker::id(L);
+            completion* work = head.exchange(nullptr);
+            while (work != nullptr) {
+                completion* next = work->next;
+                delete work;
+                work = next;
+            }
 
-            if (mapping.find(id) == mapping.end()) {
-                return {};
+            work = carried;
+            while (work != nullptr) {
+                completion* next = work->next;
+                delete work;
+                work = next;
             }
+        }
 
-            for (auto& entry : mapping[id]) {
-                if (entry.name == name) {
+        // Readers grab the current snapshot without locking, writers copy and republish it under access_mtx
+        static std::atomic<std::shared_ptr<const state_registry>> registry = std::make_shared<const state_registry>();
+        static std::shared_ptr<std::mutex> access_mtx;
+        static std::atomic<uint64_t> registry_writes = 0;
+        static std::atomic<uint64_t> registry_contended = 0;
+        static std::atomic<uint64_t> registry_hold = 0;
+        static std::atomic<uint64_t> registry_hold_max = 0;
+
+        std::shared_ptr<const state_registry> snapshot()
+        {
+            return registry.load(std::memory_order_acquire);
+        }
+
+        void update(const std::function<void(state_registry&)>& change)
+        {
+            std::unique_lock<std::mutex> guard(*access_mtx, std::try_to_lock);
+            if (!guard.owns_lock()) {
+                registry_contended++;
+                guard.lock();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+
+            auto next = std::make_shared<state_registry>(*registry.load(std::memory_order_relaxed));
+            change(*next);
+            registry.store(std::shared_ptr<const state_registry>(std::move(next)), std::memory_order_release);
+
+            uint64_t held = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            registry_writes++;
+            registry_hold += held;
+            uint64_t peak = registry_hold_max;
+            while (held > peak && !registry_hold_max.compare_exchange_weak(peak, held)) {}
+        }
+
+        registry_stats get_stats()
+        {
+            registry_stats stats;
+            stats.writes = registry_writes;
+            stats.contended = registry_contended;
+            stats.hold = registry_hold;
+            stats.hold_max = registry_hold_max;
+            return stats;
+        }
+
+        static std::shared_ptr<std::mutex> global_mtx;
+        static std::unique_ptr<std::unique_lock<std::mutex>> global_lock;
+        std::atomic<unsigned int> expecting;
+
+        // Callers from other threads park on this until the root thread hands global_mtx over
+        // They are let in explicitly, so a batch really caps how many get through before the root takes the lock back
+        static std::mutex handoff_mtx;
+        static std::condition_variable handoff_cv; // the root waiting on callers to finish
+        static std::condition_variable admission_cv; // callers waiting to be let in
+        static bool handoff_open = false;
+        static std::atomic<unsigned int> handoff_admitted = 0;
+        static std::atomic<unsigned int> handoff_served = 0;
+        static std::atomic<unsigned int> handoff_batch = 0;
+        static unsigned int handoff_spin = 0;
+        static std::atomic<unsigned int> handoff_budget = 0;
+        static handoff_stats handoff;
+
+        void set_handoff(unsigned int batch, unsigned int spin)
+        {
+            std::lock_guard<std::mutex> guard(handoff_mtx);
+            handoff_batch = batch;
+            handoff_spin = spin;
+            handoff_budget = spin;
+        }
+
+        handoff_stats get_handoff()
+        {
+            std::lock_guard<std::mutex> guard(handoff_mtx);
+            return handoff;
+        }
+
+        void increment()
+        {
+            expecting++;
+
+            std::unique_lock<std::mutex> guard(handoff_mtx);
+            admission_cv.wait(guard, []() {
+                return handoff_open && (handoff_batch == 0 || handoff_admitted < handoff_batch);
+            });
+            handoff_admitted++;
+        }
+
+        void decrement()
+        {
+            unsigned int current = expecting;
+            while (current > 0 && !expecting.compare_exchange_weak(current, current - 1)) {}
+            if (current == 0) return;
+
+            {
+                std::lock_guard<std::mutex> guard(handoff_mtx);
+                handoff_served++;
+            }
+            handoff_cv.notify_one();
+        }
+
+        void runtime()
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            {
+                std::lock_guard<std::mutex> guard(handoff_mtx);
+                handoff_open = true;
+                handoff_admitted = 0;
+                handoff_served = 0;
+            }
+            admission_cv.notify_all();
+
+            global_lock->unlock();
+
+            // done once everyone let in is through and nobody else waits, or once this tick's batch is used up
+            auto done = []() {
+                unsigned int admitted = handoff_admitted;
+                if (handoff_served != admitted) return false;
+                return expecting == 0 || (handoff_batch > 0 && admitted >= handoff_batch);
+            };
+
+            bool pending = !done();
+            unsigned int budget = handoff_budget;
+            unsigned int spins = 0;
+            while (pending && spins < budget && !done()) {
+                std::this_thread::yield();
+                spins++;
+            }
+
+            std::unique_lock<std::mutex> guard(handoff_mtx);
+            if (!done()) {
+                handoff_budget = budget / 2;
+                handoff_cv.wait(guard, done);
+            }
+            else if (pending) {
+                handoff_budget = std::min(handoff_spin, budget * 2 + 1);
+            }
+
+            // whoever didn't make it in waits for the next tick
+            handoff_open = false;
+            unsigned int served = handoff_served;
+            guard.unlock();
+
+            global_lock->lock();
+
+            uint64_t waited = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            guard.lock();
+            handoff.ticks++;
+            handoff.served += served;
+            handoff.last = waited;
+            handoff.total += waited;
+            if (waited > handoff.max) handoff.max = waited;
+        }
+
+        // Coroutines are tracked as the state they belong to
+        uintptr_t id(lua_State* L) {
+            using namespace Engine;
+            return (uintptr_t)mainthread(G(L));
+        }
+
+        std::shared_ptr<state_tracking> get_tracker(lua_State* L)
+        {
+            auto current = snapshot();
+            auto res = current->mapping.find((uintptr_t)L);
+            if (res == current->mapping.end()) return nullptr;
+            return res->second;
+        }
+
+        std::shared_ptr<state_tracking> get_tracker(void* L)
+        {
+            auto current = snapshot();
+            auto res = current->mapping.find((uintptr_t)L);
+            if (res == current->mapping.end()) return nullptr;
+            return res->second;
+        }
+
+        std::shared_ptr<state_tracking> get_tracker(uintptr_t L)
+        {
+            auto current = snapshot();
+            auto res = current->mapping.find(L);
+            if (res == current->mapping.end()) return nullptr;
+            return res->second;
+        }
+
+        std::shared_ptr<state_tracking> get_tracker(std::string name)
+        {
+            auto current = snapshot();
+            auto res = current->imapping.find(name);
+            if (res == current->imapping.end()) return nullptr;
+            return res->second;
+        }
+
+        lua_State* is_state(lua_State* L) {
+            auto current = snapshot();
+            if (current->mapping.find((uintptr_t)L) == current->mapping.end()) return nullptr;
+            return (lua_State*)L;
+        }
+
+        lua_State* is_state(uintptr_t L) {
+            auto current = snapshot();
+            if (current->mapping.find(L) == current->mapping.end()) return nullptr;
+            return (lua_State*)L;
+        }
+
+        lua_State* is_state(void* L) {
+            auto current = snapshot();
+            if (current->mapping.find((uintptr_t)L) == current->mapping.end()) return nullptr;
+            return (lua_State*)L;
+        }
+
+        lua_State* is_state(std::string name) {
+            auto current = snapshot();
+            auto res = current->imapping.find(name);
+            if (res == current->imapping.end()) return nullptr;
+            return res->second->state.self;
+        }
+
+        lua_State* get_root()
+        {
+            auto current = snapshot();
+            for (auto& entry : current->mapping) {
+                if (entry.second->parent.self != nullptr) {
+                    return entry.second->state.self;
+                }
+            }
+            return nullptr;
+        }
+
+        bool is_root(lua_State* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) {
+                return tracker->parent.self == nullptr;
+            }
+            return false;
+        }
+
+        bool is_root(void* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) {
+                return tracker->parent.self == nullptr;
+            }
+            return false;
+        }
+
+        bool is_root(uintptr_t L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) {
+                return tracker->parent.self == nullptr;
+            }
+            return false;
+        }
+
+        bool is_root(std::string name)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(name);
+            if (tracker != nullptr) {
+                return tracker->parent.self == nullptr;
+            }
+            return false;
+        }
+
+        bool is_internal(lua_State* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) {
+                return tracker->internal;
+            }
+            return false;
+        }
+
+        bool is_internal(void* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) {
+                return tracker->internal;
+            }
+            return false;
+        }
+
+        bool is_internal(uintptr_t L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) {
+                return tracker->internal;
+            }
+            return false;
+        }
+
+        bool is_internal(std::string name)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(name);
+            if (tracker != nullptr) {
+                return tracker->internal;
+            }
+            return false;
+        }
+
+        bool is_threaded(lua_State* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) {
+                return tracker->threaded;
+            }
+            return false;
+        }
+
+        bool is_threaded(void* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) {
+                return tracker->threaded;
+            }
+            return false;
+        }
+
+        bool is_threaded(uintptr_t L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) {
+                return tracker->threaded;
+            }
+            return false;
+        }
+
+        bool is_threaded(std::string name)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(name);
+            if (tracker != nullptr) {
+                return tracker->threaded;
+            }
+            return false;
+        }
+
+        std::vector<lua_State*> get_children(lua_State* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr && tracker->children.size() > 0) {
+                std::vector<lua_State*> ret;
+                ret.reserve(tracker->children.size());
+                for (const auto& entry : tracker->children) {
+                    ret.push_back(entry.self);
+                }
+                return ret;
+            }
+            return std::vector<lua_State*>();
+        }
+
+        std::vector<lua_State*> get_children(void* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr && tracker->children.size() > 0) {
+                std::vector<lua_State*> ret;
+                ret.reserve(tracker->children.size());
+                for (const auto& entry : tracker->children) {
+                    ret.push_back(entry.self);
+                }
+                return ret;
+            }
+            return std::vector<lua_State*>();
+        }
+
+        std::vector<lua_State*> get_children(uintptr_t L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr && tracker->children.size() > 0) {
+                std::vector<lua_State*> ret;
+                ret.reserve(tracker->children.size());
+                for (const auto& entry : tracker->children) {
+                    ret.push_back(entry.self);
+                }
+                return ret;
+            }
+            return std::vector<lua_State*>();
+        }
+
+        std::vector<lua_State*> get_children(std::string name)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(name);
+            if (tracker != nullptr && tracker->children.size() > 0) {
+                std::vector<lua_State*> ret;
+                ret.reserve(tracker->children.size());
+                for (const auto& entry : tracker->children) {
+                    ret.push_back(entry.self);
+                }
+                return ret;
+            }
+            return std::vector<lua_State*>();
+        }
+
+        lua_State* get_parent(lua_State* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr && tracker->parent.self != nullptr) {
+                return tracker->parent.self;
+            }
+            return nullptr;
+        }
+
+        lua_State* get_parent(void* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr && tracker->parent.self != nullptr) {
+                return tracker->parent.self;
+            }
+            return nullptr;
+        }
+
+        lua_State* get_parent(uintptr_t L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr && tracker->parent.self != nullptr) {
+                return tracker->parent.self;
+            }
+            return nullptr;
+        }
+
+        lua_State* get_parent(std::string name)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(name);
+            if (tracker != nullptr && tracker->parent.self != nullptr) {
+                return tracker->parent.self;
+            }
+            return nullptr;
+        }
+
+        bool should_lock(lua_State* target, lua_State* source)
+        {
+            return target != source && (Tracker::is_threaded(target) || Tracker::is_threaded(target) != Tracker::is_threaded(source));
+        }
+
+        std::string get_name(lua_State* L)
+        {
+            auto current = snapshot();
+            auto res = current->mapping.find((uintptr_t)L);
+            if (res != current->mapping.end()) {
+                return res->second->name;
+            }
+            return "";
+        }
+
+        std::vector<std::pair<std::string, lua_State*>> get_states() {
+            std::vector<std::pair<std::string, lua_State*>> list;
+
+            auto current = snapshot();
+            list.reserve(current->mapping.size());
+            for (auto& object : current->mapping) {
+                std::string name = object.second->name;
+                lua_State* L = object.second->state.self;
+                list.push_back(std::pair<std::string, lua_State*>(name, L));
+            }
+
+            return list;
+        }
+
+        // since cross-states should be able to talk back and forth
+        static std::mutex global_cross_mutex;
+
+        std::unordered_map<uintptr_t, unsigned int>& get_cross_trace() {
+            static std::unordered_map<uintptr_t, unsigned int> m;
+            return m;
+        }
+
+        std::unordered_map<uintptr_t, std::unique_ptr<std::unique_lock<std::mutex>>>& get_cross_locks() {
+            static std::unordered_map<uintptr_t, std::unique_ptr<std::unique_lock<std::mutex>>> m;
+            return m;
+        }
+
+        void cross_lock(lua_State* target, lua_State* source)
+        {
+            std::scoped_lock lock(global_cross_mutex);
+
+            auto target_tracker = get_tracker(target);
+            auto target_ptr = target_tracker->state.pointer;
+            auto source_ptr = get_tracker(source)->state.pointer;
+
+            auto& cross_trace = get_cross_trace();
+            auto& cross_locks = get_cross_locks();
+
+            if (cross_trace[target_ptr] == 0) {
+                auto mutex = target_tracker->mutex;
+                auto guard = std::make_unique<std::unique_lock<std::mutex>>(*mutex);
+                cross_locks[target_ptr] = std::move(guard);
+            }
+
+            cross_trace[target_ptr]++;
+            cross_trace[source_ptr]++;
+        }
+
+        void cross_unlock(lua_State* target, lua_State* source)
+        {
+            std::scoped_lock lock(global_cross_mutex);
+
+            auto target_ptr = get_tracker(target)->state.pointer;
+            auto source_ptr = get_tracker(source)->state.pointer;
+
+            auto& cross_trace = get_cross_trace();
+            auto& cross_locks = get_cross_locks();
+
+            if (--cross_trace[target_ptr] == 0) {
+                cross_locks.erase(target_ptr);
+            }
+
+            if (--cross_trace[source_ptr] == 0) {
+                cross_locks.erase(source_ptr);
+            }
+        }
+
+        std::shared_ptr<state_waker> get_waker(uintptr_t L)
+        {
+            auto current = snapshot();
+            auto res = current->mapping.find(L);
+            if (res == current->mapping.end()) return nullptr;
+            return res->second->waker;
+        }
+
+        inline void _wake(uintptr_t L)
+        {
+            std::shared_ptr<state_waker> waker = get_waker(L);
+            if (waker == nullptr) return;
+
+            std::unique_lock<std::mutex> guard(waker->mutex);
+            if (waker->queued) {
+                // already queued or ticking, make it go around once more
+                waker->pending = true;
+                return;
+            }
+            waker->queued = true;
+            guard.unlock();
+
+            Reflection::Executor::post((lua_State*)L);
+        }
+
+        void wake(lua_State* L)
+        {
+            _wake((uintptr_t)L);
+        }
+
+        void wake(void* L)
+        {
+            _wake((uintptr_t)L);
+        }
+
+        void wake(uintptr_t L)
+        {
+            _wake(L);
+        }
+
+        void wake(std::string name)
+        {
+            lua_State* L = is_state(name);
+            if (L == nullptr) return;
+            _wake((uintptr_t)L);
+        }
+
+        bool post(uintptr_t L, completion* work)
+        {
+            // the snapshot holds onto the tracker, so the queue outlives a state closing underneath us
+            auto current = snapshot();
+            auto res = current->mapping.find(L);
+            if (res == current->mapping.end()) {
+                delete work;
+                return false;
+            }
+
+            completion_queue& queue = *res->second->completions;
+            completion* head = queue.head.load(std::memory_order_relaxed);
+            do {
+                work->next = head;
+            } while (!queue.head.compare_exchange_weak(head, work, std::memory_order_release, std::memory_order_relaxed));
+            queue.posted++;
+
+            _wake(L);
+            return true;
+        }
+
+        bool post(lua_State* L, completion* work)
+        {
+            return post(id(L), work);
+        }
+
+        // Called by the executor once a parked state's deadline is up
+        void alarm(lua_State* L)
+        {
+            std::shared_ptr<state_waker> waker = get_waker((uintptr_t)L);
+            if (waker == nullptr) return;
+
+            std::unique_lock<std::mutex> guard(waker->mutex);
+            if (waker->queued || std::chrono::steady_clock::now() < waker->deadline) return;
+            waker->queued = true;
+            guard.unlock();
+
+            Reflection::Executor::post(L);
+        }
+
+        void sleep(lua_State* L, std::chrono::steady_clock::time_point until)
+        {
+            std::shared_ptr<state_waker> waker = get_waker((uintptr_t)L);
+            if (waker == nullptr) return;
+
+            std::unique_lock<std::mutex> guard(waker->mutex);
+            if (waker->pending || until <= std::chrono::steady_clock::now()) {
+                waker->pending = false;
+                guard.unlock();
+                Reflection::Executor::post(L);
+                return;
+            }
+            waker->queued = false;
+            waker->deadline = until;
+            guard.unlock();
+
+            Reflection::Executor::park(L, until);
+        }
+
+        // Only pays for the clock when someone else is holding the state
+        static std::unique_lock<std::mutex> contend(std::mutex& mutex)
+        {
+            static Metrics::metric waited = Metrics::histogram("interstellar_lock_wait_seconds", "Time spent waiting on a contended state lock");
+            static Metrics::metric contended = Metrics::counter("interstellar_lock_contended_total", "State locks that were already held when requested");
+
+            std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+            if (lock.owns_lock()) return lock;
+
+            auto start = std::chrono::steady_clock::now();
+            lock.lock();
+            Metrics::add(contended);
+            Metrics::observe(waited, start);
+            return lock;
+        }
+
+        std::unique_lock<std::mutex> lock(lua_State* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker == nullptr) {
+                return std::unique_lock<std::mutex>();
+            }
+            return contend(*tracker->mutex);
+        }
+
+        std::unique_lock<std::mutex> lock(void* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker == nullptr) {
+                return std::unique_lock<std::mutex>();
+            }
+            return contend(*tracker->mutex);
+        }
+
+        std::unique_lock<std::mutex> lock(uintptr_t L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker == nullptr) {
+                return std::unique_lock<std::mutex>();
+            }
+            return contend(*tracker->mutex);
+        }
+
+        std::unique_lock<std::mutex> lock(std::string name)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(name);
+            if (tracker == nullptr) {
+                return std::unique_lock<std::mutex>();
+            }
+            return contend(*tracker->mutex);
+        }
+
+        static std::shared_ptr<state_allocator> get_allocator(lua_State* L);
+
+        void listen(lua_State* L, std::string name, bool internal, lua_State* parent)
+        {
+            uintptr_t id = (uintptr_t)L;
+
+            if (name.size() > 0) {
+                std::shared_ptr<state_tracking> tracker = std::make_shared<state_tracking>();
+                tracker->threaded = false;
+                tracker->internal = internal;
+                tracker->name = name;
+                tracker->state.self = L;
+                tracker->parent.self = parent;
+                tracker->children = std::vector<state_union>();
+                tracker->mutex = global_mtx;
+                tracker->defers = std::make_shared<defer_queue>();
+                tracker->completions = std::make_shared<completion_queue>();
+                tracker->allocator = get_allocator(L);
+
+                if (parent != nullptr)
+                {
+                    std::shared_ptr<state_tracking> parent_tracker = Tracker::get_tracker(parent);
+                    state_union u; u.self = L;
+                    parent_tracker->children.push_back(u);
+                }
+
+                update([&](state_registry& next) {
+                    next.mapping.emplace(id, tracker);
+                    next.imapping.emplace(name, tracker);
+                });
+
+                auto& dispatch = get_opening();
+                for (auto& [key, callback] : dispatch) {
+                    callback(L);
+                }
+
+                auto states = snapshot();
+                for (auto& [key, state] : states->mapping) {
+                    lua_State* S = state->state.self;
+
+                    if (S == L) continue;
+
+                    std::unique_lock<std::mutex> guard;
+                    bool threaded = state->threaded;
+                    if (threaded) {
+                        guard = Tracker::lock(S);
+                    }
+
+                    if (!signal->has(S, "open")) {
+                        if (guard.owns_lock()) guard.unlock(); guard.release();
+                        continue;
+                    };
+
+                    lua::pushcstring(S, name);
+                    Reflection::push_state(S, L);
+                    signal->fire(S, "open", 2);
+                    if (guard.owns_lock()) guard.unlock(); guard.release();
+                }
+            }
+        }
+
+        void listen(lua_State* L, std::string name, std::shared_ptr<std::mutex> mtx, bool internal, lua_State* parent)
+        {
+            uintptr_t id = (uintptr_t)L;
+
+            if (name.size() > 0) {
+                std::shared_ptr<state_tracking> tracker = std::make_shared<state_tracking>();
+                tracker->threaded = true;
+                tracker->internal = internal;
+                tracker->name = name;
+                tracker->state.self = L;
+                tracker->parent.self = parent;
+                tracker->children = std::vector<state_union>();
+
+                if (parent != nullptr)
+                {
+                    std::shared_ptr<state_tracking> parent_tracker = Tracker::get_tracker(parent);
+                    state_union u; u.self = L;
+                    parent_tracker->children.push_back(u);
+                }
+
+                tracker->mutex = mtx;
+                tracker->waker = std::make_shared<state_waker>();
+                tracker->defers = std::make_shared<defer_queue>();
+                tracker->completions = std::make_shared<completion_queue>();
+                tracker->allocator = get_allocator(L);
+
+                update([&](state_registry& next) {
+                    next.mapping.emplace(id, tracker);
+                    next.imapping.emplace(name, tracker);
+                });
+
+                auto& dispatch = get_opening();
+                for (auto& [key, callback] : dispatch) {
+                    callback(L);
+                }
+
+                auto states = snapshot();
+                for (auto& [key, state] : states->mapping) {
+                    lua_State* S = state->state.self;
+
+                    if (S == L) continue;
+
+                    std::unique_lock<std::mutex> guard;
+                    bool threaded = state->threaded;
+                    if (threaded) {
+                        guard = Tracker::lock(S);
+                    }
+
+                    if (!signal->has(S, "open")) {
+                        if (guard.owns_lock()) guard.unlock(); guard.release();
+                        continue;
+                    };
+
+                    lua::pushcstring(S, name);
+                    Reflection::push_state(S, L);
+                    signal->fire(S, "open", 2);
+                    if (guard.owns_lock()) guard.unlock(); guard.release();
+                }
+            }
+        }
+
+        inline void _destruct(std::shared_ptr<state_tracking> tracker)
+        {
+            if (tracker == nullptr) return;
+
+            std::string name = tracker->name;
+            lua_State* L = tracker->state.self;
+
+            if (tracker->parent.self != nullptr) {
+                std::shared_ptr<state_tracking> parent_tracker = get_tracker(tracker->parent.self);
+                if (parent_tracker != nullptr) {
+                    std::remove(parent_tracker->children.begin(), parent_tracker->children.end(), tracker->state);
+                }
+            }
+
+            auto states = snapshot();
+            for (auto& [key, state] : states->mapping) {
+                lua_State* S = state->state.self;
+
+                if (S == L) continue;
+
+                std::unique_lock<std::mutex> guard;
+                bool threaded = state->threaded;
+                if (threaded) {
+                    guard = Tracker::lock(S);
+                }
+
+                if (!signal->has(S, "open")) {
+                    if (guard.owns_lock()) guard.unlock(); guard.release();
+                    continue;
+                };
+
+                lua::pushcstring(S, name);
+                Reflection::push_state(S, L);
+                signal->fire(S, "open", 2);
+                if (guard.owns_lock()) guard.unlock(); guard.release();
+            }
+
+            // the tracker itself is freed once the last snapshot holding it is gone
+            update([&](state_registry& next) {
+                next.mapping.erase(tracker->state.pointer);
+                next.imapping.erase(tracker->name);
+            });
+        }
+
+        void destroy(lua_State* L)
+        {
+            _destruct(get_tracker(L));
+        }
+
+        void destroy(uintptr_t L)
+        {
+            _destruct(get_tracker(L));
+        }
+
+        void destroy(void* L)
+        {
+            _destruct(get_tracker(L));
+        }
+
+        void destroy(std::string name)
+        {
+            _destruct(get_tracker(name));
+        }
+
+        // Accounting allocator wrapped around whatever the state was created with
+        // Lua hands us the old size on every free & realloc, so nothing has to be stored per block
+        // Pool & arena carve small blocks out of aligned chunks, so a block belongs to us only if its chunk does
+        static const size_t chunk_size = 64 * 1024;
+        static const size_t block_step = 16;
+        static const size_t pool_limit = 512;
+        static const size_t arena_limit = 8 * 1024;
+
+        struct state_allocator {
+            Engine::global_State* global;
+            lua_Alloc base;
+            void* base_ud;
+            alloc_policy policy;
+            std::atomic<size_t> used = 0;
+            std::atomic<size_t> peak = 0;
+            std::atomic<size_t> reserved = 0;
+            std::atomic<size_t> soft = 0;
+            std::atomic<size_t> hard = 0;
+            std::atomic<size_t> trigger = 0;
+            std::atomic<uint64_t> allocations = 0;
+            std::atomic<uint64_t> failures = 0;
+            std::atomic<uint64_t> overdrawn = 0;
+            std::atomic<uint64_t> pressured = 0;
+            std::atomic<bool> pressure = false;
+
+            std::array<void*, arena_limit / block_step> free_lists = {}; // pool only uses the first pool_limit / block_step
+            char* cursor = nullptr;
+            char* end = nullptr;
+            std::unordered_set<uintptr_t> chunks;
+
+            ~state_allocator()
+            {
+                for (uintptr_t chunk : chunks) {
+                    ::operator delete((void*)chunk, std::align_val_t(chunk_size));
+                }
+            }
+        };
+
+        static std::mutex allocators_mtx;
+        static std::unordered_map<uintptr_t, std::shared_ptr<state_allocator>> allocators;
+
+        static size_t block_round(size_t size)
+        {
+            return (size + block_step - 1) & ~(block_step - 1);
+        }
+
+        static bool block_owned(state_allocator* a, void* ptr)
+        {
+            return a->chunks.find((uintptr_t)ptr & ~(uintptr_t)(chunk_size - 1)) != a->chunks.end();
+        }
+
+        static void* block_carve(state_allocator* a, size_t size)
+        {
+            if (a->cursor == nullptr || a->cursor + size > a->end) {
+                void* chunk = ::operator new(chunk_size, std::align_val_t(chunk_size), std::nothrow);
+                if (chunk == nullptr) return nullptr;
+                a->chunks.insert((uintptr_t)chunk);
+                a->reserved.fetch_add(chunk_size, std::memory_order_relaxed);
+                a->cursor = (char*)chunk;
+                a->end = a->cursor + chunk_size;
+            }
+
+            void* block = a->cursor;
+            a->cursor += size;
+            return block;
+        }
+
+        static void* block_acquire(state_allocator* a, size_t size)
+        {
+            size = block_round(size);
+            void*& head = a->free_lists[size / block_step - 1];
+            if (head != nullptr) {
+                void* block = head;
+                head = *(void**)block;
+                return block;
+            }
+            return block_carve(a, size);
+        }
+
+        static void block_release(state_allocator* a, void* ptr, size_t size)
+        {
+            size = block_round(size);
+            if (a->policy == alloc_policy::arena && (char*)ptr + size == a->cursor) {
+                // the arena's most recent block goes straight back to the chunk
+                a->cursor = (char*)ptr;
+                return;
+            }
+
+            void*& head = a->free_lists[size / block_step - 1];
+            *(void**)ptr = head;
+            head = ptr;
+        }
+
+        static void* block_reallocate(state_allocator* a, void* ptr, size_t osize, size_t nsize)
+        {
+            if (a->policy == alloc_policy::system) {
+                return a->base(a->base_ud, ptr, osize, nsize);
+            }
+
+            size_t limit = a->policy == alloc_policy::pool ? pool_limit : arena_limit;
+
+            // blocks from before the allocator was put in, or too large for a chunk, stay with the base allocator
+            if (ptr != nullptr && (osize > limit || !block_owned(a, ptr))) {
+                return a->base(a->base_ud, ptr, osize, nsize);
+            }
+
+            if (nsize == 0) {
+                if (ptr != nullptr) block_release(a, ptr, osize);
+                return nullptr;
+            }
+
+            if (ptr == nullptr) {
+                return nsize <= limit ? block_acquire(a, nsize) : a->base(a->base_ud, nullptr, 0, nsize);
+            }
+
+            if (nsize <= limit) {
+                if (block_round(osize) == block_round(nsize)) return ptr;
+
+                if (a->policy == alloc_policy::arena && (char*)ptr + block_round(osize) == a->cursor && (char*)ptr + block_round(nsize) <= a->end) {
+                    a->cursor = (char*)ptr + block_round(nsize);
+                    return ptr;
+                }
+            }
+
+            void* moved = nsize <= limit ? block_acquire(a, nsize) : a->base(a->base_ud, nullptr, 0, nsize);
+            if (moved == nullptr) {
+                // shrinking must not fail, keep the block as is
+                return nsize < osize ? ptr : nullptr;
+            }
+
+            memcpy(moved, ptr, std::min(osize, nsize));
+            block_release(a, ptr, osize);
+            return moved;
+        }
+
+        // Walks the frames the way LuaJIT's unwinder does, true when a memory error raised on L would be caught
+        static bool is_protected(Engine::lua_State* L)
+        {
+            using namespace Engine;
+            void* cf = L->cframe;
+            TValue* frame = L->base - 1;
+            TValue* bot = tvref(L->stack) + LJ_FR2;
+            while (cf != nullptr) {
+                if (cframe_canyield(cf) || cframe_nres(cframe_raw(cf)) < 0) return true;
+                if (frame <= bot) return false;
+
+                switch (frame_typep(frame)) {
+                    case FRAME_LUA:
+                    case FRAME_LUAP:
+                        frame = frame_prevl(frame);
+                        break;
+                    case FRAME_C:
+                        cf = cframe_prev(cframe_raw(cf));
+                        frame = frame_prevd(frame);
+                        break;
+                    case FRAME_CP:
+                    case FRAME_PCALL:
+                    case FRAME_PCALLH:
+                        return true;
+                    default:
+                        frame = frame_prevd(frame);
+                        break;
+                }
+            }
+            return false;
+        }
+
+        static void* state_allocate(void* ud, void* ptr, size_t osize, size_t nsize)
+        {
+            state_allocator* a = (state_allocator*)ud;
+            if (ptr == nullptr) osize = 0;
+
+            size_t used = a->used.load(std::memory_order_relaxed);
+            if (nsize > osize) {
+                size_t hard = a->hard.load(std::memory_order_relaxed);
+                if (hard != 0 && used + (nsize - osize) > hard) {
+                    // a refusal outside of any protected call panics the whole process, so let it through and collect next tick
+                    using namespace Engine;
+                    GCobj* current = gcref(a->global->cur_L);
+                    if (current != nullptr && is_protected(gco2th(current))) {
+                        a->failures.fetch_add(1, std::memory_order_relaxed);
+                        a->pressure.store(true, std::memory_order_relaxed);
+                        return nullptr;
+                    }
+                    a->overdrawn.fetch_add(1, std::memory_order_relaxed);
+                    a->pressure.store(true, std::memory_order_relaxed);
+                }
+            }
+
+            void* block = block_reallocate(a, ptr, osize, nsize);
+            if (block == nullptr && nsize != 0) {
+                a->failures.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            // a kept shrink still counts as the smaller size, lua frees it with that later
+            used = used + nsize > osize ? used + nsize - osize : 0;
+            a->used.store(used, std::memory_order_relaxed);
+            if (nsize > osize) {
+                if (ptr == nullptr) a->allocations.fetch_add(1, std::memory_order_relaxed);
+                if (used > a->peak.load(std::memory_order_relaxed)) a->peak.store(used, std::memory_order_relaxed);
+
+                size_t trigger = a->trigger.load(std::memory_order_relaxed);
+                if (trigger != 0 && used > trigger && !a->pressure.load(std::memory_order_relaxed)) {
+                    a->pressure.store(true, std::memory_order_relaxed);
+                }
+            }
+
+            return block;
+        }
+
+        static std::shared_ptr<state_allocator> get_allocator(lua_State* L)
+        {
+            std::lock_guard<std::mutex> guard(allocators_mtx);
+            auto it = allocators.find(id(L));
+            if (it == allocators.end()) return nullptr;
+            return it->second;
+        }
+
+        bool allocator(lua_State* L, alloc_policy policy, size_t soft, size_t hard)
+        {
+            using namespace Engine;
+            std::lock_guard<std::mutex> guard(allocators_mtx);
+            if (allocators.find(id(L)) != allocators.end()) return false;
+
+        #if LJ_64 && !LJ_GC64
+            // chunks from the system allocator won't land in the low 2GB this build needs
+            policy = alloc_policy::system;
+        #endif
+
+            std::shared_ptr<state_allocator> a = std::make_shared<state_allocator>();
+            a->global = G(L);
+            a->base = lua::getallocf(L, &a->base_ud);
+            a->policy = policy;
+            a->soft = soft;
+            a->hard = hard;
+            a->trigger = soft;
+
+            // everything allocated so far is freed through us later, so it starts out counted
+            a->used = (size_t)lua::gc(L, LUA_GCCOUNT, 0) * 1024 + (size_t)lua::gc(L, LUA_GCCOUNTB, 0);
+            a->peak = a->used.load();
+
+            lua::setallocf(L, state_allocate, a.get());
+            allocators.emplace(id(L), a);
+            return true;
+        }
+
+        bool set_quota(lua_State* L, size_t soft, size_t hard)
+        {
+            std::shared_ptr<state_allocator> a = get_allocator(L);
+            if (a == nullptr) return false;
+            a->soft = soft;
+            a->hard = hard;
+            a->trigger = soft;
+            return true;
+        }
+
+        memory_stats get_memory(lua_State* L)
+        {
+            memory_stats stats;
+            std::shared_ptr<state_allocator> a = get_allocator(L);
+            if (a == nullptr) return stats;
+
+            stats.tracked = true;
+            stats.policy = a->policy;
+            stats.used = a->used.load(std::memory_order_relaxed);
+            stats.peak = a->peak.load(std::memory_order_relaxed);
+            stats.reserved = a->reserved.load(std::memory_order_relaxed);
+            stats.soft = a->soft.load(std::memory_order_relaxed);
+            stats.hard = a->hard.load(std::memory_order_relaxed);
+            stats.allocations = a->allocations.load(std::memory_order_relaxed);
+            stats.failures = a->failures.load(std::memory_order_relaxed);
+            stats.overdrawn = a->overdrawn.load(std::memory_order_relaxed);
+            stats.pressured = a->pressured.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        std::vector<std::pair<std::string, memory_stats>> get_memory()
+        {
+            std::vector<std::pair<std::string, memory_stats>> result;
+            auto states = snapshot();
+            for (auto& [name, tracker] : states->imapping) {
+                memory_stats stats = get_memory(tracker->state.self);
+                if (stats.tracked) result.push_back(std::pair(name, stats));
+            }
+            return result;
+        }
+
+        // Collects a state that went over its soft quota, must be called from the state's own tick
+        void relieve(lua_State* L, state_tracking& tracker)
+        {
+            state_allocator* a = tracker.allocator.get();
+            if (a == nullptr || !a->pressure.load(std::memory_order_relaxed)) return;
+
+            lua::gc(L, LUA_GCCOLLECT, 0);
+            a->pressured.fetch_add(1, std::memory_order_relaxed);
+
+            // whatever is still alive is the new floor, so we don't collect every tick over a large live set
+            size_t soft = a->soft.load(std::memory_order_relaxed);
+            size_t used = a->used.load(std::memory_order_relaxed);
+            a->trigger = soft == 0 ? 0 : std::max(soft, used + soft / 4);
+            a->pressure = false;
+        }
+
+        void relieve(lua_State* L)
+        {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+            if (tracker != nullptr) relieve(L, *tracker);
+        }
+
+        void pre_remove(lua_State* L) {
+            std::shared_ptr<state_tracking> tracker = get_tracker(L);
+
+            if (tracker == nullptr) return;
+
+            for (auto& state : tracker->children)
+            {
+                if (Tracker::is_internal(state.self)) continue;
+                Reflection::close(state.self);
+            }
+
+            destroy(L);
+
+            // untracked now, so the lock comes from the tracker itself, this waits out a tick already running on a worker
+            std::unique_lock<std::mutex> lock(*tracker->mutex);
+            auto& dispatch = get_closing();
+            for (auto& [key, callback] : dispatch) {
+                callback(L);
+            }
+            if (lock.owns_lock()) lock.unlock(); lock.release();
+        }
+
+        void post_remove(lua_State* L) {
+            auto lock = Tracker::lock(L);
+            Class::cleanup(L);
+            if (lock.owns_lock()) lock.unlock(); lock.release();
+
+            // the state is gone, so nothing allocates from this anymore
+            std::lock_guard<std::mutex> guard(allocators_mtx);
+            allocators.erase(id(L));
+        }
+
+        void on_open(std::string name, lua_Closure callback)
+        {
+            auto& dispatch = get_opening();
+            dispatch.emplace(name, callback);
+        }
+
+        void on_close(std::string name, lua_Closure callback)
+        {
+            auto& dispatch = get_closing();
+            dispatch.emplace(name, callback);
+        }
+
+        inline void init()
+        {
+            signal = Signal::create();
+            access_mtx = std::make_shared<std::mutex>();
+            global_mtx = std::make_shared<std::mutex>();
+            global_lock = std::make_unique<std::unique_lock<std::mutex>>(*global_mtx);
+            global_lock->unlock();
+            global_lock->lock();
+        }
+    }
+
+    namespace Class {
+        // Names are interned once into process wide types, so every state agrees on what a type means
+        struct class_table {
+            std::vector<class_store> entries; // indexed by type
+        };
+
+        static std::mutex intern_mtx;
+        static std::unordered_map<std::string, class_type> interned;
+        static std::vector<std::string> names = { "" };
+
+        static std::mutex mapping_mtx;
+        static std::unordered_map<uintptr_t, std::unique_ptr<class_table>> mapping;
+        static std::atomic<uint64_t> generation = 0;
+
+        class_type intern(std::string name)
+        {
+            thread_local std::unordered_map<std::string, class_type> cache;
+            auto res = cache.find(name);
+            if (res != cache.end()) return res->second;
+
+            std::lock_guard<std::mutex> guard(intern_mtx);
+            auto existing = interned.find(name);
+            class_type type;
+            if (existing != interned.end()) {
+                type = existing->second;
+            }
+            else {
+                type = (class_type)names.size();
+                names.push_back(name);
+                interned.emplace(name, type);
+            }
+
+            cache.emplace(std::move(name), type);
+            return type;
+        }
+
+        std::string nameof(class_type type)
+        {
+            std::lock_guard<std::mutex> guard(intern_mtx);
+            if (type >= names.size()) return "";
+            return names[type];
+        }
+
+        // Coroutines share their main state's classes
+        inline uintptr_t owner(lua_State* L)
+        {
+            using namespace Engine;
+            return (uintptr_t)mainthread(G(L));
+        }
+
+        class_table* get_table(lua_State* L, bool create = false)
+        {
+            thread_local uintptr_t cached_id = 0;
+            thread_local uint64_t cached_generation = 0;
+            thread_local class_table* cached_table = nullptr;
+
+            uintptr_t id = owner(L);
+            uint64_t current = generation.load(std::memory_order_acquire);
+            if (cached_table != nullptr && cached_id == id && cached_generation == current) {
+                return cached_table;
+            }
+
+            std::lock_guard<std::mutex> guard(mapping_mtx);
+            auto res = mapping.find(id);
+            if (res == mapping.end()) {
+                if (!create) return nullptr;
+                res = mapping.emplace(id, std::make_unique<class_table>()).first;
+            }
+
+            cached_id = id;
+            cached_generation = current;
+            cached_table = res->second.get();
+            return cached_table;
+        }
+
+        inline class_store* find(lua_State* L, class_type type)
+        {
+            class_table* table = get_table(L);
+            if (table == nullptr || type >= table->entries.size()) return nullptr;
+            class_store* entry = &table->entries[type];
+            if (entry->reference == 0) return nullptr;
+            return entry;
+        }
+
+        bool existsbyname(lua_State* L, std::string name)
+        {
+            return find(L, intern(name)) != nullptr;
+        }
+
+        class_store getbyname(lua_State* L, std::string name)
+        {
+            class_store* entry = find(L, intern(name));
+            if (entry == nullptr) return {};
+            return *entry;
+        }
+
+        bool existsbytype(lua_State* L, class_type type)
+        {
+            return find(L, type) != nullptr;
+        }
+
+        class_store getbytype(lua_State* L, class_type type)
+        {
+            class_store* entry = find(L, type);
+            if (entry == nullptr) return {};
+            return *entry;
+        }
+
+        bool existsbyreference(lua_State* L, int reference)
+        {
+            class_table* table = get_table(L);
+            if (table == nullptr) return false;
+
+            for (auto& entry : table->entries) {
+                if (entry.reference != 0 && entry.reference == reference) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        class_store getbyreference(lua_State* L, int reference)
+        {
+            class_table* table = get_table(L);
+            if (table == nullptr) return {};
+
+            for (auto& entry : table->entries) {
+                if (entry.reference != 0 && entry.reference == reference) {
                     return entry;
                 }
             }
 
-            return {};
-        }
+            return {};
+        }
+
+        class_type create(lua_State* L, std::string name)
+        {
+            class_table* table = get_table(L, true);
+            lua::newtable(L);
+            lua::pushvalue(L, -1);
+            int reference = luaL::newref(L, -1);
+
+            class_type type = intern(name);
+
+            if (table->entries.size() <= type) {
+                table->entries.resize(type + 1);
+            }
+
+            table->entries[type] = {
+                name,
+                type,
+                reference
+            };
+
+            lua::pushcstring(L, name);
+            lua::setfield(L, -2, "__class");
+
+            lua::pushnumber(L, type);
+            lua::setfield(L, -2, "__type");
+
+            lua::pushnumber(L, reference);
+            lua::setfield(L, -2, "__reference");
+
+            return type;
+        }
+
+        void inherits(lua_State* L, std::string name, int index) {
+            class_store other = getbyname(L, name);
+            if (other.reference == 0) return;
+            if (!lua::istable(L, index)) return;
+            lua::pushvalue(L, index);
+
+            lua::getfield(L, -1, "__index");
+            if (lua::istable(L, -1)) {
+                lua::pushref(L, other.reference);
+                lua::setmetatable(L, -2);
+            }
+            else if (lua::isnil(L, -1)) {
+                lua::pop(L);
+                lua::newtable(L);
+                lua::pushref(L, other.reference);
+                lua::setmetatable(L, -2);
+                lua::pushvalue(L, -1);
+                lua::setfield(L, -2, "__index");
+            }
+            lua::pop(L);
+
+            lua::pushref(L, other.reference);
+            lua::setfield(L, -2, "__inheritance");
+
+            lua::pop(L);
+        }
+
+        bool metatable(lua_State* L, class_type type) {
+            class_store handle = getbytype(L, type);
+
+            if (handle.reference == 0) {
+                return false;
+            }
+
+            lua::pushref(L, handle.reference);
+
+            return true;
+        }
+
+        bool metatable(lua_State* L, std::string name) {
+            class_store handle = getbyname(L, name);
+
+            if (handle.reference == 0) {
+                return false;
+            }
+
+            lua::pushref(L, handle.reference);
+
+            return true;
+        }
+
+        void spawn(lua_State* L, void* data, class_type type) {
+            class_store handle = getbytype(L, type);
+
+            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
+            *udata = { data, handle.type };
+
+            if (handle.reference != 0) {
+                lua::pushref(L, handle.reference);
+                lua::setmetatable(L, -2);
+            }
+        }
+
+        void spawn_weak(lua_State* L, void* data, class_type type) {
+            class_store handle = getbytype(L, type);
+
+            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
+            *udata = { data, handle.type };
+
+            if (handle.reference != 0) {
+                lua::newtable(L);
+                lua::pushref(L, handle.reference);
+
+                if (lua::istable(L, -1)) {
+                    lua::pushnil(L);
+                    while (lua::next(L, -2)) {
+                        lua::pushvalue(L, -2);
+                        lua::insert(L, -2);
+                        lua::settable(L, -5);
+                    }
+                }
+                lua::pop(L);
+                lua::setmetatable(L, -2);
+            }
+        }
+
+        void spawn_store(lua_State* L, void* data, class_type type) {
+            class_store handle = getbytype(L, type);
+
+            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
+            *udata = { data, handle.type };
+
+            if (handle.reference != 0) {
+                lua::newtable(L);
+                lua::pushref(L, handle.reference);
+
+                if (lua::istable(L, -1)) {
+                    lua::pushnil(L);
+                    while (lua::next(L, -2)) {
+                        lua::pushvalue(L, -2);
+                        lua::insert(L, -2);
+                        lua::settable(L, -5);
+                    }
+                }
+                lua::pop(L);
+
+                lua::newtable(L);
+
+                lua::pushvalue(L, -1);
+                lua::setfield(L, -3, "__store");
+
+                lua::pushvalue(L, -1);
+                lua::pushref(L, handle.reference);
+                lua::setmetatable(L, -2);
+                lua::setfield(L, -3, "__index");
+
+                lua::pushvalue(L, -1);
+                lua::pushref(L, handle.reference);
+                lua::setmetatable(L, -2);
+                lua::setfield(L, -3, "__newindex");
+
+                // TODO: push a cfunction here to get the true table of this...
+                
+                lua::pop(L);
+
+                lua::setmetatable(L, -2);
+            }
+        }
+
+        void spawn(lua_State* L, void* data, std::string name) {
+            class_store handle = getbyname(L, name);
+
+            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
+            *udata = { data, handle.type };
+            
+            if (handle.reference != 0) {
+                lua::pushref(L, handle.reference);
+                lua::setmetatable(L, -2);
+            }
+        }
+
+        void spawn_weak(lua_State* L, void* data, std::string name) {
+            class_store handle = getbyname(L, name);
+
+            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
+            *udata = { data, handle.type };
+
+            if (handle.reference != 0) {
+                lua::newtable(L);
+                lua::pushref(L, handle.reference);
+
+                if (lua::istable(L, -1)) {
+                    lua::pushnil(L);
+                    while (lua::next(L, -2)) {
+                        lua::pushvalue(L, -2);
+                        lua::insert(L, -2);
+                        lua::settable(L, -5);
+                    }
+                }
+                lua::pop(L);
+                lua::setmetatable(L, -2);
+            }
+        }
+
+        void spawn_store(lua_State* L, void* data, std::string name) {
+            class_store handle = getbyname(L, name);
+
+            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
+            *udata = { data, handle.type };
+
+            if (handle.reference != 0) {
+                lua::newtable(L);
+                lua::pushref(L, handle.reference);
+
+                if (lua::istable(L, -1)) {
+                    lua::pushnil(L);
+                    while (lua::next(L, -2)) {
+                        lua::pushvalue(L, -2);
+                        lua::insert(L, -2);
+                        lua::settable(L, -5);
+                    }
+                }
+                lua::pop(L);
+
+                lua::newtable(L);
+
+                lua::pushvalue(L, -1);
+                lua::setfield(L, -3, "__store");
+
+                lua::pushvalue(L, -1);
+                lua::pushref(L, handle.reference);
+                lua::setmetatable(L, -2);
+                lua::setfield(L, -3, "__index");
+
+                lua::pushvalue(L, -1);
+                lua::pushref(L, handle.reference);
+                lua::setmetatable(L, -2);
+                lua::setfield(L, -3, "__newindex");
+
+                // TODO: push a cfunction here to get the true table of this...
+
+                lua::pop(L);
+
+                lua::setmetatable(L, -2);
+            }
+        }
+
+        bool is(lua_State* L, int index, class_type type) {
+            if (type == 0 || !lua::isuserdata(L, index)) {
+                return false;
+            }
+
+            class_udata* udata = (class_udata*)lua::touserdata(L, index);
+
+            if (udata == nullptr) return false;
+
+            return udata->type == type;
+        }
+
+        bool is(lua_State* L, int index, std::string name) {
+            if (!lua::isuserdata(L, index)) {
+                return false;
+            }
+
+            class_udata* udata = (class_udata*)lua::touserdata(L, index);
+
+            if (udata == nullptr) return false;
+
+            return udata->type == intern(name);
+        }
+
+        void* to(lua_State* L, int index)
+        {
+            class_udata* udata = (class_udata*)lua::touserdata(L, index);
+            return udata->data;
+        }
+
+        void* check(lua_State* L, int index, class_type type)
+        {
+            class_udata* udata = (class_udata*)luaL::checkuserdata(L, index);
+            if (type == 0 || udata->type != type) {
+                luaL::error(L, "invalid userdata class, expected %s", nameof(type).c_str());
+                return nullptr;
+            }
+            return udata->data;
+        }
+
+        void* check(lua_State* L, int index, std::string name)
+        {
+            return check(L, index, intern(name));
+        }
+
+        void cleanup(lua_State* L)
+        {
+            // L is already closed here, so it's used as the key as is
+            std::lock_guard<std::mutex> guard(mapping_mtx);
+            mapping.erase((uintptr_t)L);
+            generation++;
+        }
+    }
+
+    namespace Reflection {
+        // Caches what it takes to move lua functions between states
+        // Dumps are keyed by prototype, loads are kept per target state so a transfer only has to make a new closure
+        namespace Bytecode {
+            struct dump_entry {
+                uint64_t fingerprint;
+                std::shared_ptr<const std::string> bytecode;
+                std::list<const void*>::iterator order;
+            };
+
+            struct load_entry {
+                std::shared_ptr<const std::string> bytecode;
+                int reference;
+                std::list<size_t>::iterator order;
+            };
+
+            // Loaded functions of one state, order runs from most to least recently used
+            struct load_cache {
+                std::unordered_map<size_t, load_entry> entries;
+                std::list<size_t> order;
+            };
+
+            struct compile_entry {
+                uint64_t check;
+                uint64_t parse;
+                std::shared_ptr<const std::string> bytecode;
+                std::list<uint64_t>::iterator order;
+            };
+
+            static std::mutex cache_mtx;
+            static size_t cache_limit = 1024;
+            static cache_stats stats;
+            static std::unordered_map<const void*, dump_entry> dumps;
+            static std::list<const void*> dump_order;
+            static std::unordered_map<lua_State*, load_cache> loads;
+            static bool compile_enabled = false;
+            static std::string compile_directory = "";
+            static std::unordered_map<uint64_t, compile_entry> compiles;
+            static std::list<uint64_t> compile_order;
+
+            void set_limit(size_t limit)
+            {
+                std::lock_guard<std::mutex> guard(cache_mtx);
+                cache_limit = limit;
+            }
+
+            size_t get_limit()
+            {
+                std::lock_guard<std::mutex> guard(cache_mtx);
+                return cache_limit;
+            }
+
+            cache_stats get_stats()
+            {
+                std::lock_guard<std::mutex> guard(cache_mtx);
+                cache_stats current = stats;
+                current.size = dumps.size();
+                current.compiled = compiles.size();
+                return current;
+            }
+
+            // Cheap identity check of a prototype, so a recycled address isn't mistaken for the old function
+            uint64_t fingerprint(Engine::GCproto* proto)
+            {
+                using namespace Engine;
+                uint64_t hash = 14695981039346656037ull;
+                auto mix = [&hash](const void* data, size_t size) {
+                    const unsigned char* bytes = (const unsigned char*)data;
+                    for (size_t i = 0; i < size; i++) {
+                        hash ^= bytes[i];
+                        hash *= 1099511628211ull;
+                    }
+                };
+
+                mix(proto_bc(proto), proto->sizebc * sizeof(BCIns));
+                char* constants = mref(proto->k, char);
+                mix(constants - proto->sizekgc * sizeof(GCRef), proto->sizekgc * sizeof(GCRef) + proto->sizekn * sizeof(TValue));
+                mix(&proto->sizeuv, sizeof(proto->sizeuv));
+                mix(&proto->firstline, sizeof(proto->firstline));
+                mix(&proto->numline, sizeof(proto->numline));
+                return hash;
+            }
+
+            std::shared_ptr<const std::string> dump(lua_State* L, int index)
+            {
+                using namespace Engine;
+                GCproto* proto = funcproto(funcV(lua::toraw(L, index)));
+                uint64_t print = fingerprint(proto);
+
+                std::unique_lock<std::mutex> guard(cache_mtx);
+                auto res = dumps.find(proto);
+                if (res != dumps.end() && res->second.fingerprint == print) {
+                    stats.dump_hits++;
+                    dump_order.splice(dump_order.begin(), dump_order, res->second.order);
+                    return res->second.bytecode;
+                }
+                stats.dump_misses++;
+                guard.unlock();
+
+                auto bytecode = std::make_shared<const std::string>(luaL::dump(L, index));
+
+                guard.lock();
+                res = dumps.find(proto);
+                if (res != dumps.end()) {
+                    dump_order.erase(res->second.order);
+                    dumps.erase(res);
+                }
+
+                if (cache_limit == 0) return bytecode;
+
+                dump_order.push_front(proto);
+                dumps.emplace(proto, dump_entry{ print, bytecode, dump_order.begin() });
+
+                while (dumps.size() > cache_limit) {
+                    dumps.erase(dump_order.back());
+                    dump_order.pop_back();
+                    stats.evictions++;
+                }
+
+                return bytecode;
+            }
+
+            // Compile cache on disk, one file per key holding this header and then the bytecode
+            struct disk_header {
+                char magic[4];
+                uint32_t format;
+                uint64_t key;
+                uint64_t check;
+                uint64_t source;
+                uint64_t parse;
+                uint64_t size;
+            };
+
+            struct mapped_file {
+                const char* data = nullptr;
+                size_t size = 0;
+                #ifdef __linux
+                int descriptor = -1;
+                #else
+                HANDLE file = INVALID_HANDLE_VALUE;
+                HANDLE mapping = NULL;
+                #endif
+
+                mapped_file(const std::string& path)
+                {
+                    #ifdef __linux
+                    descriptor = ::open(path.c_str(), O_RDONLY);
+                    if (descriptor < 0) return;
+                    struct stat info;
+                    if (fstat(descriptor, &info) != 0 || info.st_size <= 0) return;
+                    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+                    if (view == MAP_FAILED) return;
+                    data = (const char*)view;
+                    size = (size_t)info.st_size;
+                    #else
+                    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+                    if (file == INVALID_HANDLE_VALUE) return;
+                    LARGE_INTEGER length;
+                    if (!GetFileSizeEx(file, &length) || length.QuadPart <= 0) return;
+                    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                    if (mapping == NULL) return;
+                    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    if (view == NULL) return;
+                    data = (const char*)view;
+                    size = (size_t)length.QuadPart;
+                    #endif
+                }
+
+                ~mapped_file()
+                {
+                    #ifdef __linux
+                    if (data != nullptr) munmap((void*)data, size);
+                    if (descriptor >= 0) ::close(descriptor);
+                    #else
+                    if (data != nullptr) UnmapViewOfFile(data);
+                    if (mapping != NULL) CloseHandle(mapping);
+                    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+                    #endif
+                }
+            };
+
+            void set_compile(bool enabled)
+            {
+                std::lock_guard<std::mutex> guard(cache_mtx);
+                compile_enabled = enabled;
+                if (!enabled) {
+                    compiles.clear();
+                    compile_order.clear();
+                }
+            }
+
+            bool set_directory(std::string path)
+            {
+                if (path.size() > 0) {
+                    std::error_code error;
+                    std::filesystem::create_directories(path, error);
+                    if (!std::filesystem::is_directory(path, error)) return false;
+                }
+
+                std::lock_guard<std::mutex> guard(cache_mtx);
+                compile_directory = path;
+                return true;
+            }
+
+            // Bytecode isn't portable between LuaJIT builds, so whatever engine is loaded is part of the key
+            const std::string& engine(lua_State* L)
+            {
+                static std::once_flag once;
+                static std::string version;
+                std::call_once(once, [L]() {
+                    int top = lua::gettop(L);
+                    version = "interstellar " INTERSTELLAR_VERSION;
+                    lua::getfield(L, indexer::global, "jit");
+                    if (lua::istable(L, -1)) {
+                        lua::getfield(L, -1, "version");
+                        if (lua::isstring(L, -1)) version += " " + lua::tocstring(L, -1);
+                    }
+                    lua::settop(L, top);
+                    version += " gc64=" + std::to_string(LJ_GC64) + " fr2=" + std::to_string(LJ_FR2) + " ptr=" + std::to_string(sizeof(void*));
+                });
+                return version;
+            }
+
+            uint64_t compile_key(const std::string& version, const std::string& source, const std::string& name)
+            {
+                uint64_t hash = 14695981039346656037ull;
+                auto mix = [&hash](const std::string& data) {
+                    for (unsigned char byte : data) {
+                        hash ^= byte;
+                        hash *= 1099511628211ull;
+                    }
+                    hash ^= 0xFF;
+                    hash *= 1099511628211ull;
+                };
+                mix(version);
+                mix(name);
+                mix(source);
+                return hash;
+            }
+
+            std::string compile_path(uint64_t key)
+            {
+                std::stringstream stream;
+                stream << std::hex << std::setw(16) << std::setfill('0') << key << ".ljbc";
+                return (std::filesystem::path(compile_directory) / stream.str()).string();
+            }
+
+            void remember(uint64_t key, uint64_t check, uint64_t parse, std::shared_ptr<const std::string> bytecode)
+            {
+                auto res = compiles.find(key);
+                if (res != compiles.end()) {
+                    compile_order.erase(res->second.order);
+                    compiles.erase(res);
+                }
+
+                if (cache_limit == 0) return;
+
+                compile_order.push_front(key);
+                compiles.emplace(key, compile_entry{ check, parse, bytecode, compile_order.begin() });
+
+                while (compiles.size() > cache_limit) {
+                    compiles.erase(compile_order.back());
+                    compile_order.pop_back();
+                    stats.evictions++;
+                }
+            }
+
+            // Writes to a temporary first, so readers only ever see whole files
+            void store(const std::string& path, const disk_header& header, const std::string& bytecode)
+            {
+                std::stringstream suffix;
+                suffix << ".tmp" << std::this_thread::get_id();
+                std::string temporary = path + suffix.str();
+
+                {
+                    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+                    if (!file) return;
+                    file.write((const char*)&header, sizeof(header));
+                    file.write(bytecode.data(), bytecode.size());
+                    if (!file) {
+                        file.close();
+                        std::error_code error;
+                        std::filesystem::remove(temporary, error);
+                        return;
+                    }
+                }
+
+                std::error_code error;
+                std::filesystem::rename(temporary, path, error);
+                if (error) std::filesystem::remove(temporary, error);
+            }
+
+            // Drop-in for luaL::loadbufferx on source, served from the cache where possible
+            int loadbuffer(lua_State* L, const std::string& source, const std::string& name)
+            {
+                using namespace std::chrono;
+
+                std::unique_lock<std::mutex> guard(cache_mtx);
+                if (!compile_enabled || (source.size() > 0 && source[0] == '\x1b')) {
+                    guard.unlock();
+                    return luaL::loadbufferx(L, source.c_str(), source.size(), name.c_str(), 0);
+                }
+                std::string directory = compile_directory;
+                guard.unlock();
+
+                uint64_t key = compile_key(engine(L), source, name);
+                uint64_t check = std::hash<std::string>{}(source);
+                auto start = steady_clock::now();
+
+                guard.lock();
+                auto res = compiles.find(key);
+                if (res != compiles.end() && res->second.check == check) {
+                    std::shared_ptr<const std::string> bytecode = res->second.bytecode;
+                    uint64_t parse = res->second.parse;
+                    compile_order.splice(compile_order.begin(), compile_order, res->second.order);
+                    guard.unlock();
+
+                    if (luaL::loadbufferx(L, bytecode->data(), bytecode->size(), name.c_str(), "b") == 0) {
+                        uint64_t took = (uint64_t)duration_cast<microseconds>(steady_clock::now() - start).count();
+                        guard.lock();
+                        stats.compile_hits++;
+                        if (parse > took) stats.compile_saved += parse - took;
+                        return 0;
+                    }
+
+                    lua::pop(L);
+                    guard.lock();
+                    res = compiles.find(key);
+                    if (res != compiles.end()) {
+                        compile_order.erase(res->second.order);
+                        compiles.erase(res);
+                    }
+                    stats.compile_rejected++;
+                }
+                guard.unlock();
+
+                if (directory.size() > 0) {
+                    std::string path = compile_path(key);
+                    bool rejected = false;
+                    {
+                        mapped_file file(path);
+                        disk_header header;
+                        if (file.data != nullptr && file.size >= sizeof(header)) {
+                            memcpy(&header, file.data, sizeof(header));
+                            if (memcmp(header.magic, "ISBC", 4) == 0 && header.format == 1 && header.key == key && header.check == check
+                                && header.source == source.size() && header.size == file.size - sizeof(header)) {
+                                const char* bytecode = file.data + sizeof(header);
+                                if (luaL::loadbufferx(L, bytecode, (size_t)header.size, name.c_str(), "b") == 0) {
+                                    uint64_t took = (uint64_t)duration_cast<microseconds>(steady_clock::now() - start).count();
+                                    auto shared = std::make_shared<const std::string>(bytecode, (size_t)header.size);
+                                    guard.lock();
+                                    stats.compile_disk_hits++;
+                                    if (header.parse > took) stats.compile_saved += header.parse - took;
+                                    remember(key, check, header.parse, shared);
+                                    return 0;
+                                }
+                                lua::pop(L);
+                            }
+                            rejected = true;
+                        }
+                    }
+
+                    if (rejected) {
+                        std::error_code error;
+                        std::filesystem::remove(path, error);
+                        guard.lock();
+                        stats.compile_rejected++;
+                        guard.unlock();
+                    }
+                }
+
+                int status = luaL::loadbufferx(L, source.c_str(), source.size(), name.c_str(), 0);
+                if (status != 0) return status;
+
+                uint64_t parse = (uint64_t)duration_cast<microseconds>(steady_clock::now() - start).count();
+                auto bytecode = std::make_shared<const std::string>(luaL::dump(L, -1));
+
+                guard.lock();
+                stats.compile_misses++;
+                if (bytecode->size() == 0) return 0;
+                remember(key, check, parse, bytecode);
+                guard.unlock();
+
+                if (directory.size() > 0) {
+                    disk_header header = { { 'I', 'S', 'B', 'C' }, 1, key, check, source.size(), parse, bytecode->size() };
+                    store(compile_path(key), header, *bytecode);
+                }
+
+                return 0;
+            }
+
+            std::string load(lua_State* L, std::shared_ptr<const std::string> bytecode)
+            {
+                using namespace Engine;
+                size_t hash = std::hash<std::string>{}(*bytecode);
+
+                std::unique_lock<std::mutex> guard(cache_mtx);
+                auto& cache = loads[L];
+                auto res = cache.entries.find(hash);
+                if (res != cache.entries.end() && *res->second.bytecode == *bytecode) {
+                    stats.load_hits++;
+                    cache.order.splice(cache.order.begin(), cache.order, res->second.order);
+                    int reference = res->second.reference;
+                    guard.unlock();
+
+                    // reuse the loaded prototype, but give it a closure (and upvalues) of its own
+                    lua::pushref(L, reference);
+                    lua::pushlfunction(L, funcproto(funcV(lua::toraw(L, -1))));
+                    lua::getfenv(L, -2);
+                    lua::setfenv(L, -2);
+                    lua::remove(L, -2);
+                    return "";
+                }
+                stats.load_misses++;
+                guard.unlock();
+
+                std::string err = Reflection::compile(L, *bytecode, "");
+                if (err.size() > 0) {
+                    return err;
+                }
+
+                guard.lock();
+                if (cache_limit == 0) return "";
+
+                auto existing = cache.entries.find(hash);
+                if (existing != cache.entries.end()) {
+                    luaL::rmref(L, existing->second.reference);
+                    cache.order.erase(existing->second.order);
+                    cache.entries.erase(existing);
+                }
+
+                while (cache.entries.size() >= cache_limit) {
+                    auto last = cache.entries.find(cache.order.back());
+                    luaL::rmref(L, last->second.reference);
+                    cache.entries.erase(last);
+                    cache.order.pop_back();
+                    stats.evictions++;
+                }
+
+                // the function stays on the stack for the caller, the cache keeps a reference of its own
+                lua::pushvalue(L, -1);
+                cache.order.push_front(hash);
+                cache.entries.emplace(hash, load_entry{ bytecode, luaL::newref(L, -1), cache.order.begin() });
+                return "";
+            }
+
+            void cleanup(lua_State* L)
+            {
+                std::lock_guard<std::mutex> guard(cache_mtx);
+                loads.erase(L);
+            }
+
+            int lcache(lua_State* L)
+            {
+                if (lua::isnumber(L, 1)) {
+                    set_limit((size_t)std::max(0.0, lua::tonumber(L, 1)));
+                }
+
+                cache_stats current = get_stats();
+
+                lua::newtable(L);
+                lua::pushnumber(L, (double)current.dump_hits);
+                lua::setfield(L, -2, "dump_hits");
+                lua::pushnumber(L, (double)current.dump_misses);
+                lua::setfield(L, -2, "dump_misses");
+                lua::pushnumber(L, (double)current.load_hits);
+                lua::setfield(L, -2, "load_hits");
+                lua::pushnumber(L, (double)current.load_misses);
+                lua::setfield(L, -2, "load_misses");
+                lua::pushnumber(L, (double)current.evictions);
+                lua::setfield(L, -2, "evictions");
+                lua::pushnumber(L, (double)current.size);
+                lua::setfield(L, -2, "size");
+                lua::pushnumber(L, (double)get_limit());
+                lua::setfield(L, -2, "limit");
+                lua::pushnumber(L, (double)current.compile_hits);
+                lua::setfield(L, -2, "compile_hits");
+                lua::pushnumber(L, (double)current.compile_disk_hits);
+                lua::setfield(L, -2, "compile_disk_hits");
+                lua::pushnumber(L, (double)current.compile_misses);
+                lua::setfield(L, -2, "compile_misses");
+                lua::pushnumber(L, (double)current.compile_rejected);
+                lua::setfield(L, -2, "compile_rejected");
+                lua::pushnumber(L, (double)current.compile_saved / 1000000.0);
+                lua::setfield(L, -2, "compile_saved");
+                lua::pushnumber(L, (double)current.compiled);
+                lua::setfield(L, -2, "compiled");
+                return 1;
+            }
+
+            void api()
+            {
+                Tracker::on_close("bytecode", cleanup);
+            }
+        }
+
+        // Flat snapshot format used to move values between states
+        // Tables and functions get an id in the order they are first seen, later sightings just refer back to it
+        // Strings are interned the same way, so repeated keys are only written once
+        namespace snapshot_tag {
+            constexpr unsigned char nil = 0;
+            constexpr unsigned char boolean_false = 1;
+            constexpr unsigned char boolean_true = 2;
+            constexpr unsigned char number = 3;
+            constexpr unsigned char string = 4;
+            constexpr unsigned char string_ref = 5;
+            constexpr unsigned char table = 6;
+            constexpr unsigned char table_end = 7;
+            constexpr unsigned char object_ref = 8;
+            constexpr unsigned char lfunction = 9;
+            constexpr unsigned char cfunction = 10;
+            constexpr unsigned char userdata = 11;
+            constexpr unsigned char frozen = 12;
+        }
+
+        struct snapshot_encoder {
+            lua_State* L;
+            std::string& buffer;
+            std::unordered_map<const void*, uint64_t> objects = {};
+            std::unordered_map<const void*, uint64_t> strings = {}; // interned GCstr, or the GCproto for bytecode
+            std::unordered_set<const void*> building = {}; // C closures whose upvalues are still being written
+            int failed = 0;
+        };
+
+        struct snapshot_decoder {
+            lua_State* L;
+            const std::string& buffer;
+            size_t offset = 0;
+            int objects = 0;
+            uint64_t count = 0;
+            std::vector<std::pair<size_t, size_t>> strings = {};
+            std::string error = "";
+        };
+
+        inline void snapshot_varint(std::string& buffer, uint64_t value)
+        {
+            while (value >= 0x80) {
+                buffer.push_back((char)(value | 0x80));
+                value >>= 7;
+            }
+            buffer.push_back((char)value);
+        }
+
+        inline bool snapshot_varint(snapshot_decoder& state, uint64_t& value)
+        {
+            value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (state.offset >= state.buffer.size()) return false;
+                unsigned char byte = (unsigned char)state.buffer[state.offset++];
+                value |= (uint64_t)(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) return true;
+            }
+            return false;
+        }
+
+        inline bool snapshot_read(snapshot_decoder& state, void* data, size_t size)
+        {
+            if (state.buffer.size() - state.offset < size) return false;
+            memcpy(data, state.buffer.data() + state.offset, size);
+            state.offset += size;
+            return true;
+        }
+
+        // Lua interns strings, so the object the bytes came from stands in for their content
+        void snapshot_string(snapshot_encoder& state, const void* key, const char* data, size_t size)
+        {
+            auto res = state.strings.find(key);
+            if (res != state.strings.end()) {
+                state.buffer.push_back(snapshot_tag::string_ref);
+                snapshot_varint(state.buffer, res->second);
+                return;
+            }
+
+            state.strings.emplace(key, state.strings.size());
+            state.buffer.push_back(snapshot_tag::string);
+            snapshot_varint(state.buffer, size);
+            state.buffer.append(data, size);
+        }
+
+        bool snapshot_string(snapshot_decoder& state, size_t& offset, size_t& size)
+        {
+            if (state.offset >= state.buffer.size()) return false;
+            unsigned char tag = (unsigned char)state.buffer[state.offset++];
+            uint64_t value = 0;
+            if (!snapshot_varint(state, value)) return false;
+
+            if (tag == snapshot_tag::string_ref) {
+                if (value >= state.strings.size()) return false;
+                offset = state.strings[value].first;
+                size = state.strings[value].second;
+                return true;
+            }
+
+            if (tag != snapshot_tag::string || state.buffer.size() - state.offset < value) return false;
+            offset = state.offset;
+            size = (size_t)value;
+            state.offset += size;
+            state.strings.push_back(std::pair(offset, size));
+            return true;
+        }
+
+        // Immutable tables that live outside of every lua heap, all states read the one copy
+        namespace Frozen {
+            struct frozen_string {
+                size_t hash;
+                std::string data;
+            };
+
+            struct frozen_table;
+
+            struct frozen_value {
+                unsigned char type = datatype::nil;
+                union {
+                    bool boolean;
+                    double number;
+                    const frozen_string* string;
+                    const frozen_table* table;
+                };
+                frozen_value() : number(0) {}
+            };
+
+            struct frozen_slot {
+                frozen_value key;
+                frozen_value value;
+            };
+
+            struct frozen_table {
+                size_t index = 0;
+                size_t count = 0;
+                std::vector<frozen_value> array;
+                std::vector<frozen_slot> slots; // open addressing, a nil key is an empty slot
+            };
+
+            struct frozen_root {
+                uint64_t id = 0;
+                std::unordered_map<std::string_view, std::unique_ptr<frozen_string>> strings; // keys view into the interned string itself
+                std::deque<frozen_table> tables;
+                ~frozen_root();
+            };
+
+            struct frozen_ref {
+                std::shared_ptr<frozen_root> root;
+                const frozen_table* table;
+            };
+
+            static std::mutex roots_mtx;
+            static std::atomic<uint64_t> root_ids = 0;
+            static std::unordered_map<uint64_t, std::weak_ptr<frozen_root>> roots;
+            static std::unordered_map<std::string, std::shared_ptr<frozen_root>> names;
+
+            frozen_root::~frozen_root()
+            {
+                std::lock_guard<std::mutex> guard(roots_mtx);
+                roots.erase(id);
+            }
+
+            inline size_t hash_number(double value)
+            {
+                if (value == 0) value = 0; // -0 and 0 are the same key
+                return std::hash<double>{}(value);
+            }
+
+            inline size_t hash_string(const char* data, size_t size)
+            {
+                return std::hash<std::string_view>{}(std::string_view(data, size));
+            }
+
+            size_t hash_value(const frozen_value& value)
+            {
+                switch (value.type)
+                {
+                case datatype::boolean:
+                    return value.boolean ? 2 : 1;
+                case datatype::number:
+                    return hash_number(value.number);
+                case datatype::string:
+                    return value.string->hash;
+                default:
+                    return std::hash<const void*>{}(value.table);
+                }
+            }
+
+            struct frozen_builder {
+                lua_State* L;
+                frozen_root& root;
+                std::unordered_map<const void*, frozen_table*> seen = {};
+                int failed = 0;
+            };
+
+            const frozen_table* build_table(frozen_builder& state, int index);
+
+            bool build_value(frozen_builder& state, int index, frozen_value& output)
+            {
+                lua_State* L = state.L;
+                int type = lua::gettype(L, index);
+                output.type = (unsigned char)type;
+
+                switch (type)
+                {
+                case datatype::nil:
+                    return true;
+                case datatype::boolean: {
+                    output.boolean = lua::toboolean(L, index);
+                    return true;
+                }
+                case datatype::number: {
+                    output.number = lua::tonumber(L, index);
+                    return true;
+                }
+                case datatype::string: {
+                    size_t size = 0;
+                    const char* data = lua::tolstring(L, index, &size);
+                    auto res = state.root.strings.find(std::string_view(data, size));
+                    if (res == state.root.strings.end()) {
+                        auto interned = std::make_unique<frozen_string>(frozen_string{ hash_string(data, size), std::string(data, size) });
+                        std::string_view key = interned->data;
+                        res = state.root.strings.emplace(key, std::move(interned)).first;
+                    }
+                    output.string = res->second.get();
+                    return true;
+                }
+                case datatype::table: {
+                    output.table = build_table(state, index);
+                    return output.table != nullptr;
+                }
+                default: {
+                    state.failed = type;
+                    return false;
+                }
+                }
+            }
+
+            const frozen_table* build_table(frozen_builder& state, int index)
+            {
+                lua_State* L = state.L;
+                if (index < 0 && index > indexer::registry) {
+                    index = lua::gettop(L) + index + 1;
+                }
+
+                const void* pointer = lua::topointer(L, index);
+                auto res = state.seen.find(pointer);
+                if (res != state.seen.end()) return res->second;
+
+                frozen_table& table = state.root.tables.emplace_back();
+                table.index = state.root.tables.size() - 1;
+                state.seen.emplace(pointer, &table);
+
+                if (!lua::checkstack(L, 4)) {
+                    state.failed = datatype::table;
+                    return nullptr;
+                }
+
+                size_t length = lua::objlen(L, index);
+                table.array.resize(length);
+                for (size_t i = 0; i < length; i++) {
+                    lua::rawgeti(L, index, (int)i + 1);
+                    bool ok = build_value(state, -1, table.array[i]);
+                    lua::pop(L);
+                    if (!ok) return nullptr;
+                }
+
+                std::vector<frozen_slot> entries;
+                lua::pushnil(L);
+                while (lua::next(L, index)) {
+                    if (lua::gettype(L, -2) == datatype::number) {
+                        double key = lua::tonumber(L, -2);
+                        if (key >= 1 && key <= (double)length && key == (double)(size_t)key) {
+                            lua::pop(L);
+                            continue;
+                        }
+                    }
+
+                    frozen_slot& entry = entries.emplace_back();
+                    if (!build_value(state, -2, entry.key) || !build_value(state, -1, entry.value)) {
+                        lua::pop(L, 2);
+                        return nullptr;
+                    }
+                    lua::pop(L);
+                }
+
+                table.count = entries.size();
+                if (entries.size() > 0) {
+                    size_t capacity = 2;
+                    while (capacity < entries.size() * 2) capacity <<= 1;
+                    table.slots.resize(capacity);
+
+                    size_t mask = capacity - 1;
+                    for (frozen_slot& entry : entries) {
+                        size_t slot = hash_value(entry.key) & mask;
+                        while (table.slots[slot].key.type != datatype::nil) slot = (slot + 1) & mask;
+                        table.slots[slot] = entry;
+                    }
+                }
+
+                return &table;
+            }
+
+            // Finds the slot of the key at index, -1 if it's not there
+            long long locate(lua_State* L, const frozen_table* table, int index)
+            {
+                if (table->slots.size() == 0) return -1;
+
+                int type = lua::gettype(L, index);
+                size_t hash = 0;
+                double number = 0;
+                const char* data = nullptr;
+                size_t size = 0;
+                const frozen_table* pointer = nullptr;
+
+                switch (type)
+                {
+                case datatype::boolean:
+                    hash = lua::toboolean(L, index) ? 2 : 1;
+                    break;
+                case datatype::number:
+                    number = lua::tonumber(L, index);
+                    hash = hash_number(number);
+                    break;
+                case datatype::string:
+                    data = lua::tolstring(L, index, &size);
+                    hash = hash_string(data, size);
+                    break;
+                case datatype::userdata: {
+                    if (!Class::is<frozen_ref>(L, index)) return -1;
+                    pointer = Class::to<frozen_ref>(L, index)->table;
+                    type = datatype::table;
+                    hash = std::hash<const void*>{}(pointer);
+                    break;
+                }
+                default:
+                    return -1;
+                }
+
+                size_t mask = table->slots.size() - 1;
+                for (size_t slot = hash & mask; table->slots[slot].key.type != datatype::nil; slot = (slot + 1) & mask) {
+                    const frozen_value& key = table->slots[slot].key;
+                    if (key.type != type) continue;
+
+                    switch (type)
+                    {
+                    case datatype::boolean:
+                        if (key.boolean == (hash == 2)) return (long long)slot;
+                        break;
+                    case datatype::number:
+                        if (key.number == number) return (long long)slot;
+                        break;
+                    case datatype::string:
+                        if (key.string->hash == hash && key.string->data.size() == size && memcmp(key.string->data.data(), data, size) == 0) return (long long)slot;
+                        break;
+                    default:
+                        if (key.table == pointer) return (long long)slot;
+                        break;
+                    }
+                }
+
+                return -1;
+            }
+
+            int frozen__index(lua_State* L);
+            int frozen__newindex(lua_State* L);
+            int frozen__len(lua_State* L);
+            int frozen__pairs(lua_State* L);
+            int frozen__eq(lua_State* L);
+            int frozen__tostring(lua_State* L);
+
+            void push_table(lua_State* L, const std::shared_ptr<frozen_root>& root, const frozen_table* table)
+            {
+                if (!Class::existsbytype(L, Class::ClassTag<frozen_ref>::get())) {
+                    Class::create<frozen_ref>(L, "reflection.frozen");
+
+                    lua::pushcfunction(L, frozen__index);
+                    lua::setfield(L, -2, "__index");
+
+                    lua::pushcfunction(L, frozen__newindex);
+                    lua::setfield(L, -2, "__newindex");
+
+                    lua::pushcfunction(L, frozen__len);
+                    lua::setfield(L, -2, "__len");
+
+                    lua::pushcfunction(L, frozen__pairs);
+                    lua::setfield(L, -2, "__pairs");
+
+                    lua::pushcfunction(L, frozen__eq);
+                    lua::setfield(L, -2, "__eq");
+
+                    lua::pushcfunction(L, frozen__tostring);
+                    lua::setfield(L, -2, "__tostring");
+
+                    lua::pop(L);
+                }
+
+                Class::emplace<frozen_ref>(L, frozen_ref{ root, table });
+            }
+
+            void push_value(lua_State* L, const std::shared_ptr<frozen_root>& root, const frozen_value& value)
+            {
+                switch (value.type)
+                {
+                case datatype::boolean:
+                    lua::pushboolean(L, value.boolean);
+                    break;
+                case datatype::number:
+                    lua::pushnumber(L, value.number);
+                    break;
+                case datatype::string:
+                    lua::pushlstring(L, value.string->data.data(), value.string->data.size());
+                    break;
+                case datatype::table:
+                    push_table(L, root, value.table);
+                    break;
+                default:
+                    lua::pushnil(L);
+                    break;
+                }
+            }
+
+            int frozen__index(lua_State* L)
+            {
+                frozen_ref* ref = Class::check<frozen_ref>(L, 1);
+                const frozen_table* table = ref->table;
+
+                if (lua::gettype(L, 2) == datatype::number) {
+                    double key = lua::tonumber(L, 2);
+                    if (key >= 1 && key <= (double)table->array.size() && key == (double)(size_t)key) {
+                        push_value(L, ref->root, table->array[(size_t)key - 1]);
+                        return 1;
+                    }
+                }
+
+                long long slot = locate(L, table, 2);
+                if (slot < 0) {
+                    lua::pushnil(L);
+                    return 1;
+                }
+
+                push_value(L, ref->root, table->slots[(size_t)slot].value);
+                return 1;
+            }
+
+            int frozen__newindex(lua_State* L)
+            {
+                luaL::error(L, "attempt to modify a frozen table");
+                return 0;
+            }
+
+            int frozen__len(lua_State* L)
+            {
+                frozen_ref* ref = Class::check<frozen_ref>(L, 1);
+                lua::pushnumber(L, (double)ref->table->array.size());
+                return 1;
+            }
+
+            // Walks the array part, then the slots, in a single position space
+            int frozen_next(lua_State* L)
+            {
+                frozen_ref* ref = Class::check<frozen_ref>(L, 1);
+                const frozen_table* table = ref->table;
+                size_t length = table->array.size();
+                size_t position = 0;
+
+                if (!lua::isnil(L, 2)) {
+                    double key = lua::gettype(L, 2) == datatype::number ? lua::tonumber(L, 2) : 0;
+                    if (key >= 1 && key <= (double)length && key == (double)(size_t)key) {
+                        position = (size_t)key;
+                    }
+                    else {
+                        long long slot = locate(L, table, 2);
+                        if (slot < 0) {
+                            luaL::error(L, "invalid key to 'next'");
+                            return 0;
+                        }
+                        position = length + (size_t)slot + 1;
+                    }
+                }
+
+                for (; position < length; position++) {
+                    if (table->array[position].type == datatype::nil) continue;
+                    lua::pushnumber(L, (double)(position + 1));
+                    push_value(L, ref->root, table->array[position]);
+                    return 2;
+                }
+
+                for (size_t slot = position - length; slot < table->slots.size(); slot++) {
+                    const frozen_slot& entry = table->slots[slot];
+                    if (entry.key.type == datatype::nil) continue;
+                    push_value(L, ref->root, entry.key);
+                    push_value(L, ref->root, entry.value);
+                    return 2;
+                }
+
+                lua::pushnil(L);
+                return 1;
+            }
+
+            int frozen__pairs(lua_State* L)
+            {
+                Class::check<frozen_ref>(L, 1);
+                lua::pushcfunction(L, frozen_next);
+                lua::pushvalue(L, 1);
+                lua::pushnil(L);
+                return 3;
+            }
+
+            int frozen__eq(lua_State* L)
+            {
+                if (!Class::is<frozen_ref>(L, 1) || !Class::is<frozen_ref>(L, 2)) {
+                    lua::pushboolean(L, false);
+                    return 1;
+                }
+                lua::pushboolean(L, Class::to<frozen_ref>(L, 1)->table == Class::to<frozen_ref>(L, 2)->table);
+                return 1;
+            }
+
+            int frozen__tostring(lua_State* L)
+            {
+                frozen_ref* ref = Class::check<frozen_ref>(L, 1);
+                lua::pushcstring(L, "reflection.frozen: " + std::to_string(ref->table->array.size() + ref->table->count));
+                return 1;
+            }
+
+            // Frozen proxies travel through snapshots by identity, never by content
+            bool encode(std::string& buffer, lua_State* L, int index, unsigned char tag)
+            {
+                if (!Class::is<frozen_ref>(L, index)) return false;
+                frozen_ref* ref = Class::to<frozen_ref>(L, index);
+
+                buffer.push_back(tag);
+                snapshot_varint(buffer, ref->root->id);
+                snapshot_varint(buffer, ref->table->index);
+                return true;
+            }
+
+            std::string decode(lua_State* L, uint64_t id, uint64_t index)
+            {
+                std::shared_ptr<frozen_root> root;
+                {
+                    std::lock_guard<std::mutex> guard(roots_mtx);
+                    auto res = roots.find(id);
+                    if (res != roots.end()) root = res->second.lock();
+                }
+
+                if (!root) return "frozen table is no longer alive";
+                if (index >= root->tables.size()) return "frozen table index out of range";
+
+                push_table(L, root, &root->tables[(size_t)index]);
+                return "";
+            }
+        }
+
+        std::string freeze(lua_State* L, int index, std::string name)
+        {
+            using namespace Frozen;
+
+            if (lua::gettype(L, index) != datatype::table) {
+                return "expected table";
+            }
+
+            std::shared_ptr<frozen_root> root = std::make_shared<frozen_root>();
+            root->id = ++root_ids;
+
+            frozen_builder state{ L, *root };
+            int top = lua::gettop(L);
+            if (build_table(state, index) == nullptr) {
+                lua::settop(L, top);
+                return std::string() + "freeze unsupported datatype: " + lua::gettypename(L, state.failed);
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(roots_mtx);
+                roots.emplace(root->id, root);
+                if (name.size() > 0) names[name] = root;
+            }
+
+            push_table(L, root, &root->tables.front());
+            return "";
+        }
+
+        bool frozen(lua_State* L, std::string name)
+        {
+            using namespace Frozen;
+
+            std::shared_ptr<frozen_root> root;
+            {
+                std::lock_guard<std::mutex> guard(roots_mtx);
+                auto res = names.find(name);
+                if (res == names.end()) return false;
+                root = res->second;
+            }
+
+            push_table(L, root, &root->tables.front());
+            return true;
+        }
+
+        void thaw(std::string name)
+        {
+            std::shared_ptr<Frozen::frozen_root> root;
+            std::lock_guard<std::mutex> guard(Frozen::roots_mtx);
+            auto res = Frozen::names.find(name);
+            if (res == Frozen::names.end()) return;
+            root = std::move(res->second); // released after the lock, the root unregisters itself
+            Frozen::names.erase(res);
+        }
+
+        bool snapshot_encode(snapshot_encoder& state, int index, bool raw = false)
+        {
+            lua_State* L = state.L;
+            int type = lua::gettype(L, index);
+
+            switch (type)
+            {
+            case datatype::nil:
+            case datatype::proto: {
+                // TODO: prototype transfering, probably gonna have to do some alloc resize here with GC...
+                state.buffer.push_back(snapshot_tag::nil);
+                return true;
+            }
+            case datatype::boolean: {
+                state.buffer.push_back(lua::toboolean(L, index) ? snapshot_tag::boolean_true : snapshot_tag::boolean_false);
+                return true;
+            }
+            case datatype::number: {
+                double value = lua::tonumber(L, index);
+                state.buffer.push_back(snapshot_tag::number);
+                state.buffer.append((const char*)&value, sizeof(value));
+                return true;
+            }
+            case datatype::string: {
+                using namespace Engine;
+                size_t size = 0;
+                const char* data = lua::tolstring(L, index, &size);
+                snapshot_string(state, strV(lua::toraw(L, index)), data, size);
+                return true;
+            }
+            case datatype::table: {
+                const void* pointer = lua::topointer(L, index);
+                auto res = state.objects.find(pointer);
+                if (res != state.objects.end()) {
+                    state.buffer.push_back(snapshot_tag::object_ref);
+                    snapshot_varint(state.buffer, res->second);
+                    return true;
+                }
+                state.objects.emplace(pointer, state.objects.size());
+
+                if (!lua::checkstack(L, 4)) {
+                    state.failed = datatype::none;
+                    return false;
+                }
+
+                state.buffer.push_back(snapshot_tag::table);
+
+                // metatables don't carry over, so those go across as an empty table
+                if (!raw && lua::getmetatable(L, index)) {
+                    lua::pop(L);
+                    snapshot_varint(state.buffer, 0);
+                    state.buffer.push_back(snapshot_tag::table_end);
+                    return true;
+                }
+
+                // array part goes first without keys
+                size_t length = lua::objlen(L, index);
+                snapshot_varint(state.buffer, length);
+                for (size_t i = 1; i <= length; i++) {
+                    lua::rawgeti(L, index, (int)i);
+                    bool ok = snapshot_encode(state, lua::gettop(L));
+                    lua::pop(L);
+                    if (!ok) return false;
+                }
+
+                lua::pushnil(L);
+                while (lua::next(L, index) != 0) {
+                    int top = lua::gettop(L);
+
+                    if (lua::gettype(L, top - 1) == datatype::number) {
+                        double key = lua::tonumber(L, top - 1);
+                        if (key >= 1 && key <= (double)length && key == std::floor(key)) {
+                            lua::pop(L);
+                            continue;
+                        }
+                    }
+
+                    if (!snapshot_encode(state, top - 1) || !snapshot_encode(state, top)) {
+                        lua::pop(L, 2);
+                        return false;
+                    }
+
+                    lua::pop(L);
+                }
+
+                state.buffer.push_back(snapshot_tag::table_end);
+                return true;
+            }
+            case datatype::function: {
+                using namespace Engine;
+                const void* pointer = lua::topointer(L, index);
+                auto res = state.objects.find(pointer);
+                if (res != state.objects.end()) {
+                    // a C closure is only made once its upvalues are, so a reference back into it would decode to nil
+                    if (state.building.count(pointer) > 0) {
+                        state.failed = type;
+                        return false;
+                    }
+
+                    state.buffer.push_back(snapshot_tag::object_ref);
+                    snapshot_varint(state.buffer, res->second);
+                    return true;
+                }
+                state.objects.emplace(pointer, state.objects.size());
+
+                if (!lua::checkstack(L, 4)) {
+                    state.failed = datatype::none;
+                    return false;
+                }
+
+                GCfunc* object = funcV(lua::toraw(L, index));
+                if (object->l.ffid == FF_LUA) {
+                    auto btcode = Bytecode::dump(L, index);
+                    state.buffer.push_back(snapshot_tag::lfunction);
+                    snapshot_string(state, funcproto(object), btcode->data(), btcode->size());
+                }
+                else {
+                    lua_CFunction func = object->c.f;
+                    state.buffer.push_back(snapshot_tag::cfunction);
+                    state.buffer.append((const char*)&func, sizeof(func));
+                    state.building.insert(pointer);
+                }
+
+                lua_Debug ar;
+                int upvalues = 0;
+                lua::pushvalue(L, index);
+                if (lua::getinfo(L, ">u", &ar)) {
+                    upvalues = ar.nups;
+                }
+
+                snapshot_varint(state.buffer, upvalues);
+                for (int i = 1; i <= upvalues; ++i) {
+                    if (lua::getupvalue(L, index, i) == nullptr) {
+                        lua::pushnil(L);
+                    }
+                    bool ok = snapshot_encode(state, lua::gettop(L));
+                    lua::pop(L);
+                    if (!ok) return false;
+                }
+
+                state.building.erase(pointer);
+                return true;
+            }
+            case datatype::userdata: {
+                using namespace Engine;
+                if (Frozen::encode(state.buffer, L, index, snapshot_tag::frozen)) return true;
+
+                GCobj* object = gcval(lua::toraw(L, index));
+                MSize len = object->ud.len;
+
+                state.buffer.push_back(snapshot_tag::userdata);
+                snapshot_varint(state.buffer, len);
+                state.buffer.append((const char*)lua::touserdata(L, index), len);
+                state.buffer.push_back((char)object->ud.udtype);
+                state.buffer.push_back((char)object->ud.unused2);
+                return true;
+            }
+            default: {
+                state.failed = type;
+                return false;
+            }
+            }
+        }
+
+        bool snapshot_decode(snapshot_decoder& state)
+        {
+            lua_State* L = state.L;
+
+            if (state.offset >= state.buffer.size()) return false;
+            unsigned char tag = (unsigned char)state.buffer[state.offset];
+
+            switch (tag)
+            {
+            case snapshot_tag::nil: {
+                state.offset++;
+                lua::pushnil(L);
+                return true;
+            }
+            case snapshot_tag::boolean_false:
+            case snapshot_tag::boolean_true: {
+                state.offset++;
+                lua::pushboolean(L, tag == snapshot_tag::boolean_true);
+                return true;
+            }
+            case snapshot_tag::number: {
+                state.offset++;
+                double value = 0;
+                if (!snapshot_read(state, &value, sizeof(value))) return false;
+                lua::pushnumber(L, value);
+                return true;
+            }
+            case snapshot_tag::string:
+            case snapshot_tag::string_ref: {
+                size_t offset = 0, size = 0;
+                if (!snapshot_string(state, offset, size)) return false;
+                lua::pushlstring(L, state.buffer.data() + offset, size);
+                return true;
+            }
+            case snapshot_tag::object_ref: {
+                state.offset++;
+                uint64_t id = 0;
+                if (!snapshot_varint(state, id) || id >= state.count) return false;
+                lua::rawgeti(L, state.objects, (int)id + 1);
+                return true;
+            }
+            case snapshot_tag::table: {
+                state.offset++;
+                uint64_t id = state.count++;
+                uint64_t length = 0;
+                if (!snapshot_varint(state, length)) return false;
+                if (!lua::checkstack(L, 4)) return false;
+
+                lua::createtable(L, (int)length, 0);
+                lua::pushvalue(L, -1);
+                lua::rawseti(L, state.objects, (int)id + 1);
+
+                for (uint64_t i = 1; i <= length; i++) {
+                    if (!snapshot_decode(state)) return false;
+                    if (lua::isnil(L, -1)) {
+                        lua::pop(L);
+                        continue;
+                    }
+                    lua::rawseti(L, -2, (int)i);
+                }
+
+                while (true) {
+                    if (state.offset >= state.buffer.size()) return false;
+                    if ((unsigned char)state.buffer[state.offset] == snapshot_tag::table_end) {
+                        state.offset++;
+                        break;
+                    }
+                    if (!snapshot_decode(state)) return false;
+                    if (!snapshot_decode(state)) return false;
+                    lua::rawset(L, -3);
+                }
+
+                return true;
+            }
+            case snapshot_tag::lfunction: {
+                state.offset++;
+                uint64_t id = state.count++;
+                size_t offset = 0, size = 0;
+                if (!snapshot_string(state, offset, size)) return false;
+                if (!lua::checkstack(L, 4)) return false;
+
+                std::string err = Bytecode::load(L, std::make_shared<const std::string>(state.buffer, offset, size));
+                if (err.size() > 0) {
+                    state.error = err;
+                    return false;
+                }
+
+                lua::pushvalue(L, -1);
+                lua::rawseti(L, state.objects, (int)id + 1);
+
+                uint64_t upvalues = 0;
+                if (!snapshot_varint(state, upvalues)) return false;
+                for (uint64_t i = 1; i <= upvalues; i++) {
+                    if (!snapshot_decode(state)) return false;
+                    if (lua::setupvalue(L, -2, (int)i) == nullptr) lua::pop(L);
+                }
+
+                return true;
+            }
+            case snapshot_tag::cfunction: {
+                state.offset++;
+                uint64_t id = state.count++;
+                lua_CFunction func = nullptr;
+                if (!snapshot_read(state, &func, sizeof(func))) return false;
+
+                // upvalues have to exist before the closure does, so these can't refer back to it
+                uint64_t upvalues = 0;
+                if (!snapshot_varint(state, upvalues)) return false;
+                if (!lua::checkstack(L, (int)upvalues + 4)) return false;
+                for (uint64_t i = 1; i <= upvalues; i++) {
+                    if (!snapshot_decode(state)) return false;
+                }
+
+                lua::pushcclosure(L, func, (int)upvalues);
+                lua::pushvalue(L, -1);
+                lua::rawseti(L, state.objects, (int)id + 1);
+                return true;
+            }
+            case snapshot_tag::frozen: {
+                state.offset++;
+                uint64_t id = 0, index = 0;
+                if (!snapshot_varint(state, id) || !snapshot_varint(state, index)) return false;
+
+                state.error = Frozen::decode(L, id, index);
+                return state.error.size() == 0;
+            }
+            case snapshot_tag::userdata: {
+                using namespace Engine;
+                state.offset++;
+                uint64_t len = 0;
+                if (!snapshot_varint(state, len) || state.buffer.size() - state.offset < len + 2) return false;
+
+                void* udata = (void*)lua::newuserdata(L, (size_t)len);
+                memcpy(udata, state.buffer.data() + state.offset, (size_t)len);
+                state.offset += (size_t)len;
+
+                GCobj* tobject = gcval(lua::toraw(L, -1));
+                tobject->ud.udtype = (uint8_t)state.buffer[state.offset++];
+                tobject->ud.unused2 = (uint8_t)state.buffer[state.offset++];
+                return true;
+            }
+            default:
+                return false;
+            }
+        }
+
+        int encode(lua_State* L, int index, std::string& buffer, bool raw)
+        {
+            if (index < 0 && index > indexer::registry) {
+                index = lua::gettop(L) + index + 1;
+            }
+
+            int top = lua::gettop(L);
+            snapshot_encoder state{ L, buffer };
+            if (!snapshot_encode(state, index, raw)) {
+                lua::settop(L, top);
+                return state.failed;
+            }
+            return 0;
+        }
+
+        int encode(lua_State* L, int index, std::string& buffer)
+        {
+            return encode(L, index, buffer, false);
+        }
+
+        std::string decode(lua_State* L, const std::string& buffer)
+        {
+            int top = lua::gettop(L);
+
+            lua::newtable(L);
+            snapshot_decoder state{ L, buffer };
+            state.objects = lua::gettop(L);
+
+            if (!snapshot_decode(state)) {
+                lua::settop(L, top);
+                if (state.error.size() > 0) return state.error;
+                return "malformed snapshot";
+            }
+
+            lua::remove(L, state.objects);
+            return "";
+        }
+
+        inline int _transfer(lua_State* from, lua_State* to, int index, bool no_error, bool raw)
+        {
+            std::string buffer;
+            int type = encode(from, index, buffer, raw);
+            if (type != 0) {
+                if (no_error) {
+                    return type;
+                }
+                luaL::error(to, (std::string() + "reflection unsupported datatype: " + lua::gettypename(from, type)).c_str());
+                return type;
+            }
+
+            std::string err = decode(to, buffer);
+            if (err.size() > 0) {
+                if (no_error) {
+                    return datatype::none;
+                }
+                luaL::error(to, (std::string() + "reflection transfer error: " + err).c_str());
+                return datatype::none;
+            }
+
+            return 0;
+        }
+
+        int transfer_table(lua_State* from, lua_State* to, int source, bool no_error)
+        {
+            return _transfer(from, to, source, no_error, true);
+        }
+
+        int transfer(lua_State* from, lua_State* to, int index, bool no_error)
+        {
+            return _transfer(from, to, index, no_error, false);
+        }
+
+        std::string compile(lua_State* L, std::string source, std::string name)
+        {
+            if (Bytecode::loadbuffer(L, source, name) != 0) {
+                size_t size = 0;
+                const char* error = lua::tolstring(L, -1, &size);
+                lua::pop(L);
+                return std::string(error, size);
+            }
+
+            push(L);
+            lua::setfenv(L, -2);
+
+            return "";
+        }
+
+        std::string execute(lua_State* L, std::string source, std::string name)
+        {
+            if (Bytecode::loadbuffer(L, source, name) != 0) {
+                size_t size = 0;
+                const char* error = lua::tolstring(L, -1, &size);
+                lua::pop(L);
+                return std::string(error, size);
+            }
+
+            push(L);
+            lua::setfenv(L, -2);
+
+            if (lua::tcall(L, 0, 0) != 0) {
+                size_t size = 0;
+                const char* error = lua::tolstring(L, -1, &size);
+                lua::pop(L);
+                return std::string(error, size);
+            }
+
+            return "";
+        }
+
+        std::unordered_map<std::string, lua_Threaded>& get_threaded()
+        {
+            static std::unordered_map<std::string, lua_Threaded> m;
+            return m;
+        }
+
+        void on_threaded(std::string name, lua_Threaded callback)
+        {
+            auto& dispatch = get_threaded();
+            dispatch.emplace(name, callback);
+        }
+
+        namespace Task {
+            typedef void (*lua_Task_Error) (API::lua_State* L, std::string error);
+
+            std::unordered_map<std::string, lua_Task_Error>& get_on_error()
+            {
+                static std::unordered_map<std::string, lua_Task_Error> m = std::unordered_map<std::string, lua_Task_Error>();
+                return m;
+            }
+
+            void add_error(std::string name, lua_Task_Error callback)
+            {
+                auto& on_error = get_on_error();
+                on_error.emplace(name, callback);
+            }
+
+            void remove_error(std::string name)
+            {
+                auto& on_error = get_on_error();
+                on_error.erase(name);
+            }
+
+            std::unordered_set<lua_State*>& get_tracing()
+            {
+                static std::unordered_set<lua_State*> m;
+                return m;
+            }
+
+            struct timer_entry {
+                std::chrono::steady_clock::time_point when;
+                uint64_t id;
+            };
+
+            struct timer_handle {
+                int reference;
+                std::chrono::steady_clock::duration interval;
+            };
+
+            // 4-ary min-heap of pending timers, cancelled ones are left in and skipped once they surface
+            struct timer_queue {
+                std::vector<timer_entry> heap;
+                std::unordered_map<uint64_t, timer_handle> live;
+
+                void push(timer_entry entry)
+                {
+                    heap.push_back(entry);
+                    size_t i = heap.size() - 1;
+                    while (i > 0) {
+                        size_t parent = (i - 1) / 4;
+                        if (heap[parent].when <= heap[i].when) break;
+                        std::swap(heap[parent], heap[i]);
+                        i = parent;
+                    }
+                }
+
+                void pop()
+                {
+                    heap.front() = heap.back();
+                    heap.pop_back();
+                    sift(0);
+                }
+
+                void sift(size_t i)
+                {
+                    size_t size = heap.size();
+                    while (true) {
+                        size_t first = i * 4 + 1;
+                        if (first >= size) break;
+
+                        size_t best = first;
+                        size_t last = std::min(first + 4, size);
+                        for (size_t child = first + 1; child < last; child++) {
+                            if (heap[child].when < heap[best].when) best = child;
+                        }
+
+                        if (heap[i].when <= heap[best].when) break;
+                        std::swap(heap[i], heap[best]);
+                        i = best;
+                    }
+                }
+
+                timer_entry* top()
+                {
+                    while (!heap.empty() && live.find(heap.front().id) == live.end()) pop();
+                    if (heap.empty()) return nullptr;
+                    return &heap.front();
+                }
+
+                // Cancelled timers are only dropped once they reach the top, so once they make up most of the heap it's rebuilt from the live ones
+                void compact()
+                {
+                    if (heap.size() < 16 || live.size() * 2 >= heap.size()) return;
+
+                    heap.erase(std::remove_if(heap.begin(), heap.end(), [this](const timer_entry& entry) {
+                        return live.find(entry.id) == live.end();
+                    }), heap.end());
+
+                    for (size_t i = heap.size() / 4 + 1; i-- > 0; ) sift(i);
+                }
+            };
+
+            std::unordered_map<lua_State*, timer_queue>& get_timers()
+            {
+                static std::unordered_map<lua_State*, timer_queue> m;
+                return m;
+            }
+
+            static uint64_t timer_ids = 0;
+
+            struct think_schedule {
+                std::chrono::steady_clock::time_point next;
+                std::chrono::steady_clock::duration interval;
+                bool custom = false;
+                bool active = false;
+            };
+
+            std::unordered_map<lua_State*, think_schedule>& get_schedules()
+            {
+                static std::unordered_map<lua_State*, think_schedule> m;
+                return m;
+            }
+
+            std::unique_ptr<std::mutex>& mtx()
+            {
+                static std::unique_ptr<std::mutex> mtx = std::make_unique<std::mutex>();
+                return mtx;
+            }
+
+            static std::chrono::steady_clock::duration think_interval = std::chrono::milliseconds(10);
+
+            void set_interval(double interval)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                think_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(interval)
+                );
+            }
+
+            void set_interval(lua_State* L, double interval)
+            {
+                std::unique_lock<std::mutex> guard(*mtx());
+                auto& schedule = get_schedules()[L];
+                schedule.interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(interval)
+                );
+                schedule.custom = true;
+                schedule.next = std::chrono::steady_clock::now();
+                guard.unlock();
+                Tracker::wake(L);
+            }
+
+            // Steps the collector at the end of ticks, so its work lands where the state would be idle anyway
+            // Lua's own collector is pushed back while paced, it only comes in if the steps fall behind
+            static const size_t gc_buckets = 16;
+            static const int gc_backstop = 400;
+
+            struct gc_pacer {
+                std::chrono::steady_clock::duration budget = std::chrono::steady_clock::duration::zero();
+                bool custom = false;
+                bool paced = false;
+                int pause = 0;
+                double scale = 1;
+                int step = 0;
+                double rate = 0;
+                size_t count = 0;
+                std::chrono::steady_clock::time_point last;
+                uint64_t steps = 0;
+                uint64_t cycles = 0;
+                std::chrono::steady_clock::duration total = std::chrono::steady_clock::duration::zero();
+                std::chrono::steady_clock::duration max = std::chrono::steady_clock::duration::zero();
+                std::array<uint64_t, gc_buckets> buckets = {};
+            };
+
+            std::unordered_map<lua_State*, gc_pacer>& get_pacers()
+            {
+                static std::unordered_map<lua_State*, gc_pacer> m;
+                return m;
+            }
+
+            static std::chrono::steady_clock::duration gc_budget = std::chrono::steady_clock::duration::zero();
+
+            void set_gc(double budget)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                gc_budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(std::max(0.0, budget))
+                );
+            }
+
+            void set_gc(lua_State* L, double budget)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& pacer = get_pacers()[L];
+                pacer.budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(std::max(0.0, budget))
+                );
+                pacer.custom = true;
+            }
+
+            gc_stats get_gc(lua_State* L)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                gc_stats stats;
+
+                auto& pacers = get_pacers();
+                auto ipacer = pacers.find(L);
+                if (ipacer == pacers.end()) {
+                    stats.budget = std::chrono::duration<double, std::milli>(gc_budget).count();
+                    stats.buckets.resize(gc_buckets);
+                    return stats;
+                }
+
+                gc_pacer& pacer = ipacer->second;
+                stats.budget = std::chrono::duration<double, std::milli>(pacer.custom ? pacer.budget : gc_budget).count();
+                stats.step = pacer.step;
+                stats.rate = pacer.rate;
+                stats.steps = pacer.steps;
+                stats.cycles = pacer.cycles;
+                stats.total = std::chrono::duration<double, std::milli>(pacer.total).count();
+                stats.max = std::chrono::duration<double, std::milli>(pacer.max).count();
+                stats.buckets.assign(pacer.buckets.begin(), pacer.buckets.end());
+
+                // percentiles land on the upper bound of their bucket
+                auto percentile = [&pacer, &stats](double rank) {
+                    uint64_t target = (uint64_t)std::ceil(rank * pacer.steps);
+                    uint64_t seen = 0;
+                    for (size_t i = 0; i < gc_buckets - 1; i++) {
+                        seen += pacer.buckets[i];
+                        if (seen >= target) return std::min(stats.max, (double)(1ull << i) / 1000.0);
+                    }
+                    return stats.max;
+                };
+
+                if (pacer.steps > 0) {
+                    stats.p50 = percentile(0.50);
+                    stats.p90 = percentile(0.90);
+                    stats.p99 = percentile(0.99);
+                }
+
+                return stats;
+            }
+
+            static size_t heap_size(lua_State* L)
+            {
+                return (size_t)lua::gc(L, LUA_GCCOUNT, 0) * 1024 + (size_t)lua::gc(L, LUA_GCCOUNTB, 0);
+            }
+
+            // Pays the collector for what was allocated since the last tick, within the tick's budget
+            void pace(lua_State* L)
+            {
+                std::unique_lock<std::mutex> guard(*mtx());
+                auto& pacers = get_pacers();
+                auto ipacer = pacers.find(L);
+                if (ipacer == pacers.end()) {
+                    if (gc_budget == std::chrono::steady_clock::duration::zero()) return;
+                    ipacer = pacers.emplace(L, gc_pacer()).first;
+                }
+
+                // get_gc reads the pacer from any thread, so it's snapshotted here and only stored back under the lock
+                // erasing it waits for close, so the reference outlives the unlocked stretch below
+                gc_pacer& pacer = ipacer->second;
+                auto budget = pacer.custom ? pacer.budget : gc_budget;
+                bool paced = pacer.paced;
+                int pause = pacer.pause;
+                size_t last_count = pacer.count;
+                auto last = pacer.last;
+                double scale = pacer.scale;
+                guard.unlock();
+
+                if (budget == std::chrono::steady_clock::duration::zero()) {
+                    if (paced) {
+                        lua::gc(L, LUA_GCSETPAUSE, pause);
+                        guard.lock();
+                        pacer.paced = false;
+                    }
+                    return;
+                }
+
+                auto clock = std::chrono::steady_clock::now();
+                size_t count = heap_size(L);
+
+                if (!paced) {
+                    pause = lua::gc(L, LUA_GCSETPAUSE, gc_backstop);
+                    guard.lock();
+                    pacer.pause = pause;
+                    pacer.paced = true;
+                    pacer.count = count;
+                    pacer.last = clock;
+                    return;
+                }
+
+                double elapsed = std::chrono::duration<double>(clock - last).count();
+                double allocated = count > last_count ? (count - last_count) / 1024.0 : 0;
+
+                // idle states leave it to the backstop pause instead of stepping the collector every tick
+                if (allocated == 0) {
+                    guard.lock();
+                    if (elapsed > 0) pacer.rate = pacer.rate * 0.75;
+                    pacer.count = count;
+                    pacer.last = clock;
+                    return;
+                }
+
+                // the step is what this tick allocated, scaled by how well earlier steps fit the budget
+                int step = (int)std::clamp(allocated * scale, 8.0, 8192.0);
+
+                std::array<uint64_t, gc_buckets> buckets = {};
+                std::chrono::steady_clock::duration spent = std::chrono::steady_clock::duration::zero();
+                std::chrono::steady_clock::duration longest = std::chrono::steady_clock::duration::zero();
+                uint64_t steps = 0;
+                uint64_t cycles = 0;
 
-        bool existsbytype(lua_State* L, unsigned char type)
-        {
-            uintptr_t id = Tracker::id(L);
+                do {
+                    auto before = std::chrono::steady_clock::now();
+                    int finished = lua::gc(L, LUA_GCSTEP, step);
+                    auto took = std::chrono::steady_clock::now() - before;
 
-            if (mapping.find(id) == mapping.end()) {
-                return false;
-            }
+                    uint64_t micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(took).count();
+                    size_t bucket = 0;
+                    while (bucket < gc_buckets - 1 && micros >= (1ull << bucket)) bucket++;
+                    buckets[bucket]++;
 
-            for (auto& entry : mapping[id]) {
-                if (entry.type == type) {
-                    return true;
-                }
+                    spent += took;
+                    longest = std::max(longest, took);
+                    steps++;
+
+                    if (finished) {
+                        cycles++;
+                        break;
+                    }
+                } while (spent + longest < budget && heap_size(L) > last_count);
+
+                if (longest > budget) scale = std::max(0.25, scale * 0.5);
+                else if (longest * 4 < budget) scale = std::min(16.0, scale * 1.25);
+
+                size_t remaining = heap_size(L);
+                auto finished = std::chrono::steady_clock::now();
+
+                guard.lock();
+                if (elapsed > 0) pacer.rate = pacer.rate * 0.75 + (allocated / elapsed) * 0.25;
+                pacer.scale = scale;
+                pacer.step = step;
+                pacer.count = remaining;
+                pacer.last = finished;
+                pacer.steps += steps;
+                pacer.cycles += cycles;
+                pacer.total += spent;
+                pacer.max = std::max(pacer.max, longest);
+                for (size_t i = 0; i < gc_buckets; i++) pacer.buckets[i] += buckets[i];
+            }
+
+            // Bounds how long a tick runs lua for, checked from a count hook so a runaway callback can't hold up every other state
+            // Past the deadline callbacks are aborted, or in yield mode parked as a coroutine to resume next tick
+            struct tick_slice {
+                std::chrono::steady_clock::duration budget = std::chrono::steady_clock::duration::zero();
+                bool custom = false;
+                bool yield = false;
+                std::chrono::steady_clock::time_point deadline;
+                bool armed = false;
+                bool expired = false;
+                bool preempted = false;
+                lua_Hook chained = nullptr;
+                int chained_mask = 0;
+                int chained_count = 0;
+                lua_State* thread = nullptr;
+                std::vector<int> parked;
+                std::atomic<bool> behind = false;
+                uint64_t overruns = 0;
+            };
+
+            std::unordered_map<lua_State*, tick_slice>& get_slices()
+            {
+                static std::unordered_map<lua_State*, tick_slice> m;
+                return m;
             }
 
-            return false;
-        }
+            static std::chrono::steady_clock::duration tick_budget = std::chrono::steady_clock::duration::zero();
+            static int tick_instructions = 1000;
+            static thread_local tick_slice* current_slice = nullptr;
 
-        class_store getbytype(lua_State* L, unsigned char type)
-        {
-            uintptr_t id = Tracker::id(L);
+            void set_budget(double budget, int instructions)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                tick_budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(std::max(0.0, budget))
+                );
+                tick_instructions = std::max(1, instructions);
+            }
 
-            if (mapping.find(id) == mapping.end()) {
-                return {};
+            void set_budget(lua_State* L, double budget, bool yield)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& slice = get_slices()[L];
+                slice.budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(std::max(0.0, budget))
+                );
+                slice.custom = true;
+                slice.yield = yield;
             }
 
-            for (auto& entry : mapping[id]) {
-                if (entry.type == type) {
-                    return entry;
+            // When a threaded state should next run, it is parked until then unless woken
+            std::chrono::steady_clock::time_point deadline(lua_State* L)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto clock = std::chrono::steady_clock::now();
+
+                // never park for longer than a second, in case a wake is missed
+                auto until = clock + std::chrono::seconds(1);
+
+                auto tracker = Tracker::get_tracker(L);
+                if (tracker != nullptr && tracker->defers->head.load(std::memory_order_relaxed) != nullptr) {
+                    return clock;
                 }
-            }
 
-            return {};
-        }
+                if (tracker != nullptr && tracker->completions->head.load(std::memory_order_relaxed) != nullptr) {
+                    return clock;
+                }
 
-        bool existsbyreference(lua_State* L, int reference)
-        {
-            uintptr_t id = Tracker::id(L);
+                // the last tick ran out of budget, pick up where it left off
+                auto& slices = get_slices();
+                auto islice = slices.find(L);
+                if (islice != slices.end() && islice->second.behind.load(std::memory_order_relaxed)) {
+                    return clock;
+                }
 
-            if (mapping.find(id) == mapping.end()) {
-                return false;
-            }
+                auto& timers = get_timers();
+                auto itimers = timers.find(L);
+                if (itimers != timers.end()) {
+                    timer_entry* entry = itimers->second.top();
+                    if (entry != nullptr && entry->when < until) until = entry->when;
+                }
 
-            for (auto& entry : mapping[id]) {
-                if (entry.reference == reference) {
-                    return true;
+                auto& schedules = get_schedules();
+                auto ischedule = schedules.find(L);
+                if (ischedule != schedules.end() && ischedule->second.active && ischedule->second.next < until) {
+                    until = ischedule->second.next;
                 }
+
+                return until;
             }
 
-            return false;
-        }
+            void push(lua_State* L)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& in_threading = get_tracing();
+                in_threading.emplace(L);
+            }
 
-        class_store getbyreference(lua_State* L, int reference)
-        {
-            uintptr_t id = Tracker::id(L);
+            void pop(lua_State* L)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& in_threading = get_tracing();
+                in_threading.erase(L);
+            }
+
+            int lis_threaded(lua_State* L)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& in_threading = get_tracing();
+                lua::pushboolean(L, in_threading.find(L) != in_threading.end());
+                return 1;
+            }
 
-            if (mapping.find(id) == mapping.end()) {
-                return {};
+            int ldefer(lua_State* L)
+            {
+                luaL::checkfunction(L, 1);
+                std::shared_ptr<Tracker::state_tracking> tracker = Tracker::get_tracker(L);
+                if (tracker == nullptr) return 0;
+
+                auto& queue = *tracker->defers;
+                Tracker::defer_node* node = new Tracker::defer_node{ nullptr, luaL::newref(L, 1) };
+                Tracker::defer_node* head = queue.head.load(std::memory_order_relaxed);
+                do {
+                    node->next = head;
+                } while (!queue.head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+                queue.pushed++;
+
+                Tracker::wake(L);
+                return 0;
             }
 
-            for (auto& entry : mapping[id]) {
-                if (entry.reference == reference) {
-                    return entry;
-                }
+            int lstats(lua_State* L)
+            {
+                std::shared_ptr<Tracker::state_tracking> tracker = Tracker::get_tracker(L);
+                if (tracker == nullptr) return 0;
+
+                auto& queue = *tracker->defers;
+                lua::newtable(L);
+                lua::pushnumber(L, (double)queue.pushed);
+                lua::setfield(L, -2, "deferred");
+                lua::pushnumber(L, (double)queue.drained);
+                lua::setfield(L, -2, "drained");
+                lua::pushnumber(L, (double)queue.drains);
+                lua::setfield(L, -2, "drains");
+                lua::pushnumber(L, (double)queue.batch_max);
+                lua::setfield(L, -2, "batch_max");
+                lua::pushnumber(L, (double)tracker->completions->posted);
+                lua::setfield(L, -2, "posted");
+                lua::pushnumber(L, (double)tracker->completions->completed);
+                lua::setfield(L, -2, "completed");
+                return 1;
             }
 
-            return {};
-        }
+            uint64_t schedule(lua_State* L, double delay, int index, double interval)
+            {
+                // timers belong to the state even when a coroutine of it schedules them
+                lua_State* state = (lua_State*)Tracker::id(L);
 
-        unsigned char create(lua_State* L, std::string name)
-        {
-            uintptr_t id = Tracker::id(L);
-            lua::newtable(L);
-            lua::pushvalue(L, -1);
-            int reference = luaL::newref(L, -1);
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& queue = get_timers()[state];
 
-            if (offsets[id] == 0)
-                offsets[id] = 51;
-            unsigned char type = offsets[id]++;
+                auto duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(delay)
+                );
 
-            class_store entry = {
-                name,
-                type,
-                reference
-            };
+                uint64_t id = ++timer_ids;
+                queue.live.emplace(id, timer_handle{
+                    luaL::newref(L, index),
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval))
+                });
+                queue.push(timer_entry{ std::chrono::steady_clock::now() + duration, id });
 
-            if (mapping.find(id) == mapping.end()) {
-                mapping[id] = std::vector<class_store>();
+                Tracker::wake(state);
+                return id;
             }
 
-            mapping[id].push_back(entry);
+            int ldelay(lua_State* L)
+            {
+                double delay = luaL::checknumber(L, 1);
+                luaL::checkfunction(L, 2);
+                lua::pushnumber(L, (double)schedule(L, delay, 2, 0));
+                return 1;
+            }
 
-            lua::pushcstring(L, name);
-            lua::setfield(L, -2, "__class");
+            int levery(lua_State* L)
+            {
+                double interval = luaL::checknumber(L, 1);
+                luaL::checkfunction(L, 2);
+                if (interval <= 0) {
+                    luaL::argerror(L, 1, "interval must be above 0");
+                    return 0;
+                }
+                lua::pushnumber(L, (double)schedule(L, interval, 2, interval));
+                return 1;
+            }
 
-            lua::pushnumber(L, type);
-            lua::setfield(L, -2, "__type");
+            uint64_t delay(lua_State* L, double delay, int index)
+            {
+                return schedule(L, delay, index, 0);
+            }
 
-            lua::pushnumber(L, reference);
-            lua::setfield(L, -2, "__reference");
+            bool cancel(lua_State* L, uint64_t timer)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
 
-            return type;
-        }
+                auto& timers = get_timers();
+                auto itimers = timers.find((lua_State*)Tracker::id(L));
+                if (itimers == timers.end()) return false;
 
-        void inherits(lua_State* L, std::string name, int index) {
-            class_store other = getbyname(L, name);
-            if (other.reference == 0) return;
-            if (!lua::istable(L, index)) return;
-            lua::pushvalue(L, index);
+                auto& live = itimers->second.live;
+                auto handle = live.find(timer);
+                if (handle == live.end()) return false;
 
-            lua::getfield(L, -1, "__index");
-            if (lua::istable(L, -1)) {
-                lua::pushref(L, other.reference);
-                lua::setmetatable(L, -2);
+                luaL::rmref(L, handle->second.reference);
+                live.erase(handle);
+                itimers->second.compact();
+                return true;
             }
-            else if (lua::isnil(L, -1)) {
-                lua::pop(L);
-                lua::newtable(L);
-                lua::pushref(L, other.reference);
-                lua::setmetatable(L, -2);
-                lua::pushvalue(L, -1);
-                lua::setfield(L, -2, "__index");
+
+            int lcancel(lua_State* L)
+            {
+                uint64_t id = (uint64_t)luaL::checknumber(L, 1);
+                lua::pushboolean(L, cancel(L, id));
+                return 1;
             }
-            lua::pop(L);
 
-            lua::pushref(L, other.reference);
-            lua::setfield(L, -2, "__inheritance");
+            int linterval(lua_State* L)
+            {
+                if (lua::isnumber(L, 1)) {
+                    set_interval(L, lua::tonumber(L, 1));
+                }
 
-            lua::pop(L);
-        }
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& schedule = get_schedules()[L];
+                auto interval = schedule.custom ? schedule.interval : think_interval;
+                lua::pushnumber(L, std::chrono::duration<double>(interval).count());
+                return 1;
+            }
 
-        bool metatable(lua_State* L, unsigned char type) {
-            class_store handle = getbytype(L, type);
+            int lgc(lua_State* L)
+            {
+                if (lua::isnumber(L, 1)) {
+                    set_gc(L, lua::tonumber(L, 1));
+                }
 
-            if (handle.reference == 0) {
-                return false;
+                gc_stats stats = get_gc(L);
+                lua::newtable(L);
+                lua::pushnumber(L, stats.budget);
+                lua::setfield(L, -2, "budget");
+                lua::pushnumber(L, stats.step);
+                lua::setfield(L, -2, "step");
+                lua::pushnumber(L, stats.rate);
+                lua::setfield(L, -2, "rate");
+                lua::pushnumber(L, (double)stats.steps);
+                lua::setfield(L, -2, "steps");
+                lua::pushnumber(L, (double)stats.cycles);
+                lua::setfield(L, -2, "cycles");
+                lua::pushnumber(L, stats.total);
+                lua::setfield(L, -2, "total");
+                lua::pushnumber(L, stats.max);
+                lua::setfield(L, -2, "max");
+                lua::pushnumber(L, stats.p50);
+                lua::setfield(L, -2, "p50");
+                lua::pushnumber(L, stats.p90);
+                lua::setfield(L, -2, "p90");
+                lua::pushnumber(L, stats.p99);
+                lua::setfield(L, -2, "p99");
+
+                lua::newtable(L);
+                for (size_t i = 0; i < stats.buckets.size(); i++) {
+                    lua::pushnumber(L, (double)stats.buckets[i]);
+                    lua::rawseti(L, -2, (int)i + 1);
+                }
+                lua::setfield(L, -2, "buckets");
+                return 1;
             }
 
-            lua::pushref(L, handle.reference);
+            int lbudget(lua_State* L)
+            {
+                if (lua::isnumber(L, 1)) {
+                    set_budget(L, lua::tonumber(L, 1), lua::toboolean(L, 2));
+                }
 
-            return true;
-        }
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& slices = get_slices();
+                auto islice = slices.find(L);
 
-        bool metatable(lua_State* L, std::string name) {
-            class_store handle = getbyname(L, name);
+                lua::newtable(L);
+                if (islice == slices.end()) {
+                    lua::pushnumber(L, std::chrono::duration<double>(tick_budget).count());
+                    lua::setfield(L, -2, "budget");
+                    return 1;
+                }
 
-            if (handle.reference == 0) {
-                return false;
+                tick_slice& slice = islice->second;
+                lua::pushnumber(L, std::chrono::duration<double>(slice.custom ? slice.budget : tick_budget).count());
+                lua::setfield(L, -2, "budget");
+                lua::pushboolean(L, slice.yield);
+                lua::setfield(L, -2, "yield");
+                lua::pushnumber(L, (double)slice.overruns);
+                lua::setfield(L, -2, "overruns");
+                lua::pushnumber(L, (double)slice.parked.size());
+                lua::setfield(L, -2, "parked");
+                return 1;
             }
 
-            lua::pushref(L, handle.reference);
+            // Stands in for the callback of an async function called from a task.async coroutine
+            // The module's completion calls it like it would the callback, which resumes the coroutine awaiting it right there
+            // The awaiting coroutine & any results held for later live in the userdata's environment, so neither goes through the registry
+            struct awaitable_handle {
+                lua_State* waiter = nullptr;
+                bool done = false;
+                int results = 0;
+            };
 
-            return true;
-        }
+            // Coroutines started through task.async by main state, true while parked on an awaitable
+            std::unordered_map<uintptr_t, std::unordered_map<lua_State*, bool>>& get_asyncs()
+            {
+                static std::unordered_map<uintptr_t, std::unordered_map<lua_State*, bool>> m;
+                return m;
+            }
 
-        void spawn(lua_State* L, void* data, unsigned char type) {
-            class_store handle = getbytype(L, type);
+            static uintptr_t main_of(lua_State* L)
+            {
+                using namespace Engine;
+                return (uintptr_t)mainthread(G(L));
+            }
 
-            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
-            *udata = { data, handle.type };
+            // Runs an async coroutine until it awaits or returns, on error the traceback is left on top of L
+            int async_resume(lua_State* L, lua_State* thread, int nargs)
+            {
+                std::unique_lock<std::mutex> guard(*mtx());
+                get_asyncs()[main_of(thread)][thread] = false;
+                guard.unlock();
 
-            if (handle.reference != 0) {
-                lua::pushref(L, handle.reference);
-                lua::setmetatable(L, -2);
-            }
-        }
+                int status = lua::resume(thread, nargs);
 
-        void spawn_weak(lua_State* L, void* data, unsigned char type) {
-            class_store handle = getbytype(L, type);
+                guard.lock();
+                auto& asyncs = get_asyncs()[main_of(thread)];
+                if (status == LUA_YIELD && asyncs[thread]) return 0;
+                asyncs.erase(thread);
+                guard.unlock();
 
-            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
-            *udata = { data, handle.type };
+                if (status == 0) {
+                    lua::settop(thread, 0);
+                    return 0;
+                }
 
-            if (handle.reference != 0) {
-                lua::newtable(L);
-                lua::pushref(L, handle.reference);
+                if (status == LUA_YIELD) {
+                    lua::pushcstring(L, "attempt to yield from task.async outside of await");
+                    return LUA_ERRRUN;
+                }
 
-                if (lua::istable(L, -1)) {
-                    lua::pushnil(L);
-                    while (lua::next(L, -2)) {
-                        lua::pushvalue(L, -2);
-                        lua::insert(L, -2);
-                        lua::settable(L, -5);
+                std::string err = lua::tocstring(thread, -1);
+                luaL::traceback(L, thread, err.c_str(), 0);
+                return status;
+            }
+
+            int awaitable_call(lua_State* L)
+            {
+                awaitable_handle* handle = (awaitable_handle*)Class::check(L, 1, Class::ClassTag<awaitable_handle>::get());
+                if (handle->done) return 0;
+                handle->done = true;
+
+                int results = lua::gettop(L) - 1;
+
+                // nobody is waiting yet, hold onto the results for when they do
+                if (handle->waiter == nullptr) {
+                    lua::getfenv(L, 1);
+                    for (int i = 1; i <= results; i++) {
+                        lua::pushvalue(L, i + 1);
+                        lua::rawseti(L, -2, i);
                     }
+                    handle->results = results;
+                    lua::pop(L);
+                    return 0;
                 }
-                lua::pop(L);
-                lua::setmetatable(L, -2);
-            }
-        }
 
-        void spawn_store(lua_State* L, void* data, unsigned char type) {
-            class_store handle = getbytype(L, type);
+                lua_State* thread = handle->waiter;
+                handle->waiter = nullptr;
 
-            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
-            *udata = { data, handle.type };
+                lua::xmove(L, thread, results);
 
-            if (handle.reference != 0) {
-                lua::newtable(L);
-                lua::pushref(L, handle.reference);
+                // the thread stays on our stack while it runs, so the environment can let go of it
+                lua::getfenv(L, 1);
+                lua::getfield(L, -1, "thread");
+                lua::pushnil(L);
+                lua::setfield(L, -3, "thread");
+                lua::remove(L, -2);
 
-                if (lua::istable(L, -1)) {
-                    lua::pushnil(L);
-                    while (lua::next(L, -2)) {
-                        lua::pushvalue(L, -2);
-                        lua::insert(L, -2);
-                        lua::settable(L, -5);
-                    }
-                }
-                lua::pop(L);
+                if (async_resume(L, thread, results)) return lua::error(L);
+                return 0;
+            }
 
-                lua::newtable(L);
+            int awaitable__tostring(lua_State* L)
+            {
+                awaitable_handle* handle = (awaitable_handle*)Class::check(L, 1, Class::ClassTag<awaitable_handle>::get());
+                lua::pushcstring(L, handle->done ? "awaitable: done" : "awaitable: pending");
+                return 1;
+            }
 
-                lua::pushvalue(L, -1);
-                lua::setfield(L, -3, "__store");
+            void push_awaitable_class(lua_State* L)
+            {
+                if (Class::existsbytype(L, Class::ClassTag<awaitable_handle>::get())) return;
 
-                lua::pushvalue(L, -1);
-                lua::pushref(L, handle.reference);
-                lua::setmetatable(L, -2);
-                lua::setfield(L, -3, "__index");
+                Class::create<awaitable_handle>(L, "awaitable");
 
-                lua::pushvalue(L, -1);
-                lua::pushref(L, handle.reference);
-                lua::setmetatable(L, -2);
-                lua::setfield(L, -3, "__newindex");
+                lua::pushcfunction(L, awaitable_call);
+                lua::setfield(L, -2, "__call");
+
+                lua::pushcfunction(L, awaitable__tostring);
+                lua::setfield(L, -2, "__tostring");
 
-                // TODO: push a cfunction here to get the true table of this...
-                
                 lua::pop(L);
+            }
 
-                lua::setmetatable(L, -2);
+            bool awaiting(lua_State* L)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& asyncs = get_asyncs();
+                auto iasyncs = asyncs.find(main_of(L));
+                return iasyncs != asyncs.end() && iasyncs->second.find(L) != iasyncs->second.end();
             }
-        }
 
-        void spawn(lua_State* L, void* data, std::string name) {
-            class_store handle = getbyname(L, name);
+            int awaitable(lua_State* L)
+            {
+                push_awaitable_class(L);
+                Class::emplace<awaitable_handle>(L);
+                lua::newtable(L);
+                lua::setfenv(L, -2);
+                lua::pushvalue(L, -1);
+                return luaL::newref(L, -1);
+            }
 
-            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
-            *udata = { data, handle.type };
-            
-            if (handle.reference != 0) {
-                lua::pushref(L, handle.reference);
-                lua::setmetatable(L, -2);
+            void reject(lua_State* L, int reference, std::string error)
+            {
+                lua::pushref(L, reference);
+                if (!Class::is(L, -1, Class::ClassTag<awaitable_handle>::get())) {
+                    lua::pop(L);
+                    return;
+                }
+
+                lua::pushnil(L);
+                lua::pushcstring(L, error);
+                if (lua::tcall(L, 2, 0)) {
+                    std::string err = lua::tocstring(L, -1);
+                    lua::pop(L);
+                    auto& on_error = get_on_error();
+                    for (auto const& handle : on_error) handle.second(L, err);
+                }
             }
-        }
 
-        void spawn_weak(lua_State* L, void* data, std::string name) {
-            class_store handle = getbyname(L, name);
+            int lasync(lua_State* L)
+            {
+                luaL::checkfunction(L, 1);
+                int nargs = lua::gettop(L) - 1;
 
-            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
-            *udata = { data, handle.type };
+                lua_State* thread = lua::newthread(L);
+                lua::insert(L, 1);
+                lua::xmove(L, thread, nargs + 1);
 
-            if (handle.reference != 0) {
-                lua::newtable(L);
-                lua::pushref(L, handle.reference);
+                if (async_resume(L, thread, nargs)) return lua::error(L);
+                return 0;
+            }
 
-                if (lua::istable(L, -1)) {
-                    lua::pushnil(L);
-                    while (lua::next(L, -2)) {
-                        lua::pushvalue(L, -2);
-                        lua::insert(L, -2);
-                        lua::settable(L, -5);
+            int lawait(lua_State* L)
+            {
+                // anything that isn't an awaitable is already a result
+                if (!Class::is(L, 1, Class::ClassTag<awaitable_handle>::get())) return lua::gettop(L);
+
+                awaitable_handle* handle = (awaitable_handle*)Class::to(L, 1);
+                if (handle->done) {
+                    if (handle->results == 0) return 0;
+                    lua::getfenv(L, 1);
+                    int table = lua::gettop(L);
+                    for (int i = 1; i <= handle->results; i++) {
+                        lua::rawgeti(L, table, i);
                     }
+                    return handle->results;
                 }
+
+                if (handle->waiter != nullptr) return luaL::error(L, "awaitable is already being awaited");
+
+                std::unique_lock<std::mutex> guard(*mtx());
+                auto& asyncs = get_asyncs()[main_of(L)];
+                auto iasync = asyncs.find(L);
+                bool inside = iasync != asyncs.end();
+                if (inside) iasync->second = true;
+                guard.unlock();
+
+                if (!inside) return luaL::error(L, "attempt to await outside of task.async");
+
+                handle->waiter = L;
+                lua::getfenv(L, 1);
+                lua::pushthread(L);
+                lua::setfield(L, -2, "thread");
                 lua::pop(L);
-                lua::setmetatable(L, -2);
+
+                // whatever completes the awaitable gets passed back as our results
+                return lua::yield(L, 0);
             }
-        }
 
-        void spawn_store(lua_State* L, void* data, std::string name) {
-            class_store handle = getbyname(L, name);
+            Signal::Handle* signal()
+            {
+                static Signal::Handle* tasker = Signal::create();
+                return tasker;
+            }
 
-            class_udata* udata = (class_udata*)lua::newuserdata(L, sizeof(class_udata));
-            *udata = { data, handle.type };
+            static void budget_hook(lua_State* L, lua_Debug* ar)
+            {
+                tick_slice* slice = current_slice;
+                if (slice == nullptr) return;
 
-            if (handle.reference != 0) {
-                lua::newtable(L);
-                lua::pushref(L, handle.reference);
+                // whatever hook was there before us still sees the events it asked for
+                if (slice->chained != nullptr && (ar->event != LUA_HOOKCOUNT || (slice->chained_mask & LUA_MASKCOUNT))) {
+                    slice->chained(L, ar);
+                }
 
-                if (lua::istable(L, -1)) {
-                    lua::pushnil(L);
-                    while (lua::next(L, -2)) {
-                        lua::pushvalue(L, -2);
-                        lua::insert(L, -2);
-                        lua::settable(L, -5);
-                    }
+                if (ar->event != LUA_HOOKCOUNT || !slice->armed || std::chrono::steady_clock::now() < slice->deadline) return;
+
+                if (!slice->expired) {
+                    slice->expired = true;
+                    slice->overruns++;
                 }
-                lua::pop(L);
 
-                lua::newtable(L);
+                // only the coroutine we resumed ourselves can be parked, anything nested in it gets aborted instead
+                // a C frame that can't be yielded across (pcall, metamethods called from C...) gets the abort as well
+                using namespace Engine;
+                if (slice->yield && L == slice->thread && cframe_canyield(L->cframe)) {
+                    slice->preempted = true;
+                    lua::yield(L, 0);
+                    return;
+                }
 
-                lua::pushvalue(L, -1);
-                lua::setfield(L, -3, "__store");
+                luaL::error(L, "tick budget of %.3fms exceeded", std::chrono::duration<double, std::milli>(slice->budget).count());
+            }
 
-                lua::pushvalue(L, -1);
-                lua::pushref(L, handle.reference);
-                lua::setmetatable(L, -2);
-                lua::setfield(L, -3, "__index");
+            // Arms the state's tick budget, nullptr if it has none
+            // A hook that is already set (debuggers, the profiler) gets chained behind ours for the tick and put back after
+            tick_slice* begin_slice(lua_State* L)
+            {
+                std::unique_lock<std::mutex> guard(*mtx());
+                auto& slices = get_slices();
+                auto islice = slices.find(L);
+                if (islice == slices.end()) {
+                    if (tick_budget == std::chrono::steady_clock::duration::zero()) return nullptr;
+                    islice = slices.emplace(std::piecewise_construct, std::forward_as_tuple(L), std::forward_as_tuple()).first;
+                }
 
-                lua::pushvalue(L, -1);
-                lua::pushref(L, handle.reference);
-                lua::setmetatable(L, -2);
-                lua::setfield(L, -3, "__newindex");
+                tick_slice* slice = &islice->second;
+                if (!slice->custom) slice->budget = tick_budget;
+                int instructions = tick_instructions;
+                guard.unlock();
 
-                // TODO: push a cfunction here to get the true table of this...
+                slice->expired = false;
+                slice->armed = slice->budget != std::chrono::steady_clock::duration::zero();
 
-                lua::pop(L);
+                // parked callbacks still get resumed if the budget was taken away since
+                if (!slice->armed && slice->parked.empty()) return nullptr;
 
-                lua::setmetatable(L, -2);
-            }
-        }
+                slice->deadline = std::chrono::steady_clock::now() + slice->budget;
+                current_slice = slice;
+                if (slice->armed) {
+                    slice->chained = lua::gethook(L);
+                    slice->chained_mask = slice->chained != nullptr ? lua::gethookmask(L) : 0;
+                    slice->chained_count = slice->chained != nullptr ? lua::gethookcount(L) : 0;
 
-        bool is(lua_State* L, int index, unsigned char type) {
-            if (!lua::isuserdata(L, index)) {
-                return false;
+                    // a chained count hook is called at whichever of the two counts is finer
+                    if ((slice->chained_mask & LUA_MASKCOUNT) && slice->chained_count > 0) instructions = std::min(instructions, slice->chained_count);
+                    lua::sethook(L, budget_hook, slice->chained_mask | LUA_MASKCOUNT, instructions);
+                }
+                return slice;
             }
 
-            class_udata* udata = (class_udata*)lua::touserdata(L, index);
+            void end_slice(lua_State* L, tick_slice* slice)
+            {
+                if (slice == nullptr) return;
 
-            if (udata == nullptr) return false;
+                // if lua replaced our hook during the tick, that one stays
+                if (slice->armed && lua::gethook(L) == budget_hook) lua::sethook(L, slice->chained, slice->chained_mask, slice->chained_count);
+                slice->armed = false;
+                slice->chained = nullptr;
+                slice->behind = slice->expired || !slice->parked.empty();
+                current_slice = nullptr;
+            }
 
-            return udata->type == type;
-        }
+            hook_entry get_hook(lua_State* L)
+            {
+                tick_slice* slice = current_slice;
+                lua_Hook hook = lua::gethook(L);
+                if (slice != nullptr && slice->armed && hook == budget_hook) {
+                    return hook_entry{ slice->chained, slice->chained_mask, slice->chained_count };
+                }
+                return hook_entry{ hook, hook != nullptr ? lua::gethookmask(L) : 0, hook != nullptr ? lua::gethookcount(L) : 0 };
+            }
 
-        bool is(lua_State* L, int index, std::string name) {
-            if (!lua::isuserdata(L, index)) {
-                return false;
+            void set_hook(lua_State* L, hook_entry entry)
+            {
+                tick_slice* slice = current_slice;
+                if (slice != nullptr && slice->armed && lua::gethook(L) == budget_hook) {
+                    // the budget keeps its instruction count until the tick is over, only the events it passes on change
+                    slice->chained = entry.hook;
+                    slice->chained_mask = entry.hook != nullptr ? entry.mask : 0;
+                    slice->chained_count = entry.hook != nullptr ? entry.count : 0;
+                    lua::sethook(L, budget_hook, slice->chained_mask | LUA_MASKCOUNT, lua::gethookcount(L));
+                    return;
+                }
+                lua::sethook(L, entry.hook, entry.mask, entry.count);
             }
 
-            class_udata* udata = (class_udata*)lua::touserdata(L, index);
+            // Resumes a coroutine under the slice, same contract as tcall (the thread is expected on top of L and gets popped)
+            int slice_resume(lua_State* L, tick_slice* slice, lua_State* thread, int nargs)
+            {
+                slice->thread = thread;
+                slice->preempted = false;
+                int status = lua::resume(thread, nargs);
+                slice->thread = nullptr;
+
+                if (status == LUA_YIELD && slice->preempted) {
+                    luaL::traceback(L, thread, "tick budget exceeded, resuming next tick", 0);
+                    std::string err = lua::tocstring(L, -1);
+                    lua::pop(L);
 
-            if (udata == nullptr) return false;
+                    // newref pops the thread, which is what our contract asks for
+                    slice->parked.push_back(luaL::newref(L, -1));
 
-            class_store handle = getbyname(L, name);
+                    auto& on_error = get_on_error();
+                    for (auto const& handle : on_error) handle.second(L, err);
+                    return 0;
+                }
 
-            return udata->type == handle.type;
-        }
+                if (status == 0) {
+                    lua::pop(L);
+                    return 0;
+                }
 
-        void* to(lua_State* L, int index)
-        {
-            class_udata* udata = (class_udata*)lua::touserdata(L, index);
-            return udata->data;
-        }
+                if (status == LUA_YIELD) {
+                    lua::pop(L);
+                    lua::pushcstring(L, "attempt to yield from a task callback");
+                    return LUA_ERRRUN;
+                }
 
-        void* check(lua_State* L, int index, unsigned char type)
-        {
-            class_udata* udata = (class_udata*)luaL::checkuserdata(L, index);
-            class_store handle = getbytype(L, type);
-            if (udata->type != handle.type) {
-                luaL::error(L, "invalid userdata class, expected %s", handle.name.c_str());
-                return nullptr;
+                std::string err = lua::tocstring(thread, -1);
+                luaL::traceback(L, thread, err.c_str(), 0);
+                lua::remove(L, -2);
+                return status;
             }
-            return udata->data;
-        }
 
-        void* check(lua_State* L, int index, std::string name)
-        {
-            class_udata* udata = (class_udata*)luaL::checkuserdata(L, index);
-            class_store handle = getbyname(L, name);
-            if (udata->type != handle.type) {
-                luaL::error(L, "invalid userdata class, expected %s", handle.name.c_str());
-                return nullptr;
+            // Calls the function on top of the stack like tcall, but in yield mode it runs as a coroutine that can be parked
+            int slice_call(lua_State* L, tick_slice* slice)
+            {
+                if (slice == nullptr || !slice->yield || !slice->armed) return lua::tcall(L, 0, 0);
+
+                lua_State* thread = lua::newthread(L);
+                lua::insert(L, -2);
+                lua::xmove(L, thread, 1);
+                return slice_resume(L, slice, thread, 0);
             }
-            return udata->data;
-        }
 
-        void cleanup(lua_State* L)
-        {
-            uintptr_t id = Tracker::id(L);
-            mapping.erase(id);
-            offsets.erase(id);
-        }
-    }
+            // Picks parked callbacks back up, oldest first
+            void run_parked(lua_State* L, tick_slice* slice)
+            {
+                if (slice == nullptr || slice->parked.empty()) return;
 
-    namespace Reflection {
-        int transfer_table(lua_State* from, lua_State* to, int source, bool no_error)
-        {
-            lua::newtable(to);
+                std::vector<int> parked;
+                parked.swap(slice->parked);
+
+                for (size_t i = 0; i < parked.size(); i++) {
+                    if (slice->expired) {
+                        slice->parked.insert(slice->parked.end(), parked.begin() + i, parked.end());
+                        break;
+                    }
 
-            lua::pushvalue(from, source);
-            lua::pushnil(from);
+                    lua::pushref(L, parked[i]);
+                    luaL::rmref(L, parked[i]);
 
-            while (lua::next(from, -2) != 0) {
-                // TODO: we need to add a check for cyclic tables!
-                if (lua::istable(from, -1)) {
-                    if (lua::rawequal(from, -1, -3)) {
-                        lua::pop(from, 1);
-                        continue;
+                    if (slice_resume(L, slice, lua::tothread(L, -1), 0)) {
+                        std::string err = lua::tocstring(L, -1);
+                        lua::pop(L);
+                        auto& on_error = get_on_error();
+                        for (auto const& handle : on_error) handle.second(L, err);
                     }
                 }
+            }
 
-                int err = transfer(from, to, -2, no_error);
-                if (err != 0) {
-                    lua::pop(from, 2);
-                    lua::pop(to, 1);
-                    return err;
+            // Swaps out everything deferred so far in one go and runs it in the order it was queued
+            void run_defers(lua_State* L, Tracker::defer_queue& queue, tick_slice* slice)
+            {
+                static Metrics::metric defers_ran = Metrics::counter("interstellar_defers_total", "Deferred callbacks run");
+                Tracker::defer_node* node = queue.head.exchange(nullptr, std::memory_order_acquire);
+                if (node == nullptr && queue.carried == nullptr) return;
+
+                // producers push onto the front, so flip it back around
+                Tracker::defer_node* ordered = nullptr;
+                uint64_t count = 0;
+                while (node != nullptr) {
+                    Tracker::defer_node* next = node->next;
+                    node->next = ordered;
+                    ordered = node;
+                    node = next;
+                    count++;
                 }
 
-                err = transfer(from, to, -1, no_error);
-                if (err != 0) {
-                    lua::pop(from, 2);
-                    lua::pop(to, 2);
-                    return err;
+                if (count > 0) {
+                    queue.drains++;
+                    queue.drained += count;
+                    if (count > queue.batch_max) queue.batch_max = count;
                 }
 
-                lua::settable(to, -3);
+                // what the last tick's budget cut off goes ahead of anything newer
+                if (queue.carried != nullptr) {
+                    Tracker::defer_node* tail = queue.carried;
+                    while (tail->next != nullptr) tail = tail->next;
+                    tail->next = ordered;
+                    ordered = queue.carried;
+                    queue.carried = nullptr;
+                }
 
-                lua::pop(from, 1);
-            }
+                while (ordered != nullptr) {
+                    if (slice != nullptr && slice->expired) {
+                        queue.carried = ordered;
+                        break;
+                    }
 
-            lua::pop(from, 1);
+                    Tracker::defer_node* next = ordered->next;
+                    int reference = ordered->reference;
+                    delete ordered;
+                    ordered = next;
 
-            return 0;
-        }
+                    lua::pushref(L, reference);
+                    luaL::rmref(L, reference);
+                    Metrics::add(defers_ran);
 
-        int transfer(lua_State* from, lua_State* to, int index, bool no_error)
-        {
-            int type = lua::gettype(from, index);
+                    if (slice_call(L, slice)) {
+                        std::string err = lua::tocstring(L, -1);
+                        lua::pop(L);
+                        auto& on_error = get_on_error();
+                        for (auto const& handle : on_error) handle.second(L, err);
+                    }
+                }
+            }
 
-            switch (type)
+            // Completes everything posted to the state so far, oldest first, same budget rules as defers
+            void run_completions(lua_State* L, Tracker::completion_queue& queue, tick_slice* slice)
             {
-            case datatype::nil: {
-                lua::pushnil(to);
-                break;
-            }
-            case datatype::number: {
-                lua::pushnumber(to, lua::tonumber(from, index));
-                break;
-            }
-            case datatype::string: {
-                lua::pushcstring(to, lua::tocstring(from, index));
-                break;
-            }
-            case datatype::boolean: {
-                lua::pushboolean(to, lua::toboolean(from, index));
-                break;
-            }
-            case datatype::proto: {
-                using namespace Engine;
-                TValue* value = lua::toraw(from, index);
-                GCproto* object = protoV(value);
+                static Metrics::metric completed = Metrics::counter("interstellar_completions_total", "Async completions run by their state");
+
+                Tracker::completion* work = queue.head.exchange(nullptr, std::memory_order_acquire);
+                if (work == nullptr && queue.carried == nullptr) return;
 
-                lua::pushnil(to); // TODO: prototype transfering, probably gonna have to do some alloc resize here with GC...
+                Tracker::completion* ordered = nullptr;
+                while (work != nullptr) {
+                    Tracker::completion* next = work->next;
+                    work->next = ordered;
+                    ordered = work;
+                    work = next;
+                }
+
+                if (queue.carried != nullptr) {
+                    Tracker::completion* tail = queue.carried;
+                    while (tail->next != nullptr) tail = tail->next;
+                    tail->next = ordered;
+                    ordered = queue.carried;
+                    queue.carried = nullptr;
+                }
+
+                while (ordered != nullptr) {
+                    if (slice != nullptr && slice->expired) {
+                        queue.carried = ordered;
+                        break;
+                    }
 
-                break;
+                    Tracker::completion* next = ordered->next;
+                    ordered->complete(L);
+                    delete ordered;
+                    ordered = next;
+
+                    queue.completed++;
+                    Metrics::add(completed);
+                }
             }
-            case datatype::function: {
-                using namespace Engine;
-                TValue* value = lua::toraw(from, index);
-                GCfunc* object = funcV(value);
 
-                if (object->l.ffid == FF_LUA) {
-                    std::string fname = ""; // TODO: placeholder for now
-                    std::string btcode = luaL::dump(from, index);
+            // Fires every timer of the state that is due, guard must be held
+            void run_timers(lua_State* L, std::unique_lock<std::mutex>& guard, tick_slice* slice)
+            {
+                static Metrics::metric timers_fired = Metrics::counter("interstellar_timers_total", "Timers fired");
+                auto& timers = get_timers();
+                auto itimers = timers.find(L);
+                if (itimers == timers.end()) return;
 
-                    std::string err = Reflection::compile(to, btcode, fname);
+                auto& queue = itimers->second;
+                auto clock = std::chrono::steady_clock::now();
 
-                    if (err.size() > 0) {
-                        if (no_error) {
-                            return type;
+                while (true) {
+                    // out of budget, whatever is due stays due for the next tick
+                    if (slice != nullptr && slice->expired) break;
+
+                    timer_entry* entry = queue.top();
+                    if (entry == nullptr || clock < entry->when) break;
+
+                    timer_entry due = *entry;
+                    queue.pop();
+
+                    timer_handle timer = queue.live[due.id];
+                    lua::pushref(L, timer.reference);
+
+                    if (timer.interval.count() > 0) {
+                        // repeat off the previous deadline so we don't drift, skipping any we fell behind on
+                        auto next = due.when + timer.interval;
+                        if (next <= clock) {
+                            next += ((clock - next) / timer.interval + 1) * timer.interval;
                         }
-                        luaL::error(to, (std::string() + "reflection transfer error: " + lua::gettypename(from, type) + " -> " + err).c_str());
-                        break;
+                        queue.push(timer_entry{ next, due.id });
                     }
-                    
-                    lua_Debug ar;
-                    lua::pushvalue(from, index);
-                    if (lua::getinfo(from, ">u", &ar) && ar.nups > 0) {
-                        for (int i = 1; i <= ar.nups; ++i) {
-                            const char* name = lua::getupvalue(from, index, i);
-                            if (name == nullptr) break;
-                            int err = transfer(from, to, -1, no_error);
-                            lua::pop(from);
-                            if (err != 0) {
-                                return err;
-                            }
-                            lua::setupvalue(to, -2, i);
-                        }
+                    else {
+                        queue.live.erase(due.id);
+                        luaL::rmref(L, timer.reference);
                     }
-                }
-                else {
-                    lua_Debug ar;
-                    size_t upvalues = 0;
-                    lua::pushvalue(from, index);
-                    if (lua::getinfo(from, ">u", &ar) && ar.nups > 0) {
-                        upvalues = ar.nups;
 
-                        for (int i = 1; i <= upvalues; ++i) {
-                            const char* name = lua::getupvalue(from, index, i);
-                            if (name == nullptr) break;
-                            int err = transfer(from, to, -1, no_error);
-                            lua::pop(from);
-                            if (err != 0) {
-                                lua::pop(to, i);
-                                return err;
-                            }
-                        }
+                    guard.unlock();
+                    Metrics::add(timers_fired);
+                    if (slice_call(L, slice)) {
+                        std::string err = lua::tocstring(L, -1);
+                        lua::pop(L);
+                        auto& on_error = get_on_error();
+                        for (auto const& handle : on_error) handle.second(L, err);
                     }
+                    guard.lock();
+                }
+            }
+
+            void runtime_threaded(lua_State* L)
+            {
+                static Signal::Handle* tasker = signal();
+                static Metrics::metric elapsed = Metrics::histogram("interstellar_task_threaded_seconds", "Time taken by a threaded state's tick");
+                auto start = std::chrono::steady_clock::now();
+
+                // close holds this lock while freeing the state, and untracks it first, so whoever gets it second sees it's gone
+                auto lock = Tracker::lock(L);
+                if (!lock.owns_lock() || Tracker::is_state(L) == nullptr) return;
+                Task::push(L);
+
+                tick_slice* slice = begin_slice(L);
+                run_parked(L, slice);
+
+                std::shared_ptr<Tracker::state_tracking> tracker = Tracker::get_tracker(L);
+                if (tracker != nullptr) run_defers(L, *tracker->defers, slice);
+                if (tracker != nullptr) run_completions(L, *tracker->completions, slice);
+
+                std::unique_lock<std::mutex> guard(*mtx());
 
-                    lua::pushcclosure(to, object->c.f, upvalues);
+                run_timers(L, guard, slice);
+
+                // a think that doesn't fit in the budget anymore waits for the next tick
+                // cleanup waits on the state lock we hold, this keeps a state that's already untracked from getting its schedule back
+                auto& schedules = get_schedules();
+                auto ischedule = schedules.find(L);
+                if (ischedule == schedules.end() && Tracker::is_state(L) != nullptr) ischedule = schedules.emplace(L, think_schedule()).first;
+
+                bool thinking = false;
+                if (ischedule != schedules.end()) {
+                    auto& schedule = ischedule->second;
+                    auto clock = std::chrono::steady_clock::now();
+                    thinking = clock >= schedule.next && (slice == nullptr || !slice->expired);
+                    if (thinking) schedule.next = clock + (schedule.custom ? schedule.interval : think_interval);
                 }
 
-                break;
-            }
-            case datatype::userdata: {
-                using namespace Engine;
-                TValue* value = lua::toraw(from, index);
-                GCobj* object = gcval(value);
-                MSize len = object->ud.len;
+                guard.unlock();
 
-                void* data = lua::touserdata(from, index);
-                void* udata = (void*)lua::newuserdata(to, len);
-                memcpy(udata, data, len);
+                if (thinking && tasker->has(L, "think")) tasker->fire(L, "think");
+                end_slice(L, slice);
 
-                TValue* tvalue = lua::toraw(to, -1);
-                GCobj* tobject = gcval(tvalue);
-                tobject->ud.udtype = object->ud.udtype;
-                tobject->ud.unused2 = object->ud.unused2;
-                break;
-            }
-            case datatype::table: {
-                if (lua::getmetatable(from, index)) {
-                    lua::pop(from);
-                    lua::newtable(to);
-                    return 0;
-                }
-                int err = transfer_table(from, to, index, no_error);
-                if (err != 0) {
-                    return err;
-                }
-                break;
-            }
-            default: {
-                if (no_error) {
-                    return type;
+                if (tracker != nullptr) Tracker::relieve(L, *tracker);
+
+                auto& dispatch = get_threaded();
+                for (auto& [key, callback] : dispatch) {
+                    callback(L);
                 }
-                luaL::error(to, (std::string() + "reflection unsupported datatype: " + lua::gettypename(from, type)).c_str());
-                break;
-            }
-            }
 
-            return 0;
-        }
+                // only wake up for think when someone is listening
+                bool active = tasker->has(L, "think");
+                guard.lock();
+                ischedule = schedules.find(L);
+                if (ischedule != schedules.end()) ischedule->second.active = active;
+                guard.unlock();
 
-        std::string compile(lua_State* L, std::string source, std::string name)
-        {
-            if (luaL::loadbufferx(L, source.c_str(), source.size(), name.c_str(), 0) != 0) {
-                size_t size = 0;
-                const char* error = lua::tolstring(L, -1, &size);
-                lua::pop(L);
-                return std::string(error, size);
-            }
+                pace(L);
 
-            push(L);
-            lua::setfenv(L, -2);
+                Task::pop(L);
+                if (lock.owns_lock()) lock.unlock(); lock.release();
+                Metrics::observe(elapsed, start);
+            }
 
-            return "";
-        }
+            void runtime()
+            {
+                static Signal::Handle* tasker = signal();
+                static Metrics::metric elapsed = Metrics::histogram("interstellar_task_runtime_seconds", "Time taken by a tick over every unthreaded state");
+                auto start = std::chrono::steady_clock::now();
 
-        std::string execute(lua_State* L, std::string source, std::string name)
-        {
-            if (luaL::loadbufferx(L, source.c_str(), source.size(), name.c_str(), 0) != 0) {
-                size_t size = 0;
-                const char* error = lua::tolstring(L, -1, &size);
-                lua::pop(L);
-                return std::string(error, size);
-            }
+                std::unique_lock<std::mutex> guard(*mtx());
 
-            push(L);
-            lua::setfenv(L, -2);
+                auto states = Tracker::snapshot();
+                for (auto& [id, tracker] : states->mapping) {
+                    lua_State* L = tracker->state.self;
+                    if (tracker->threaded) continue;
 
-            if (lua::tcall(L, 0, 0) != 0) {
-                size_t size = 0;
-                const char* error = lua::tolstring(L, -1, &size);
-                lua::pop(L);
-                return std::string(error, size);
-            }
+                    guard.unlock();
+                    tick_slice* slice = begin_slice(L);
+                    run_parked(L, slice);
+                    run_defers(L, *tracker->defers, slice);
+                    run_completions(L, *tracker->completions, slice);
+                    guard.lock();
 
-            return "";
-        }
+                    run_timers(L, guard, slice);
 
-        std::unordered_map<std::string, lua_Threaded>& get_threaded()
-        {
-            static std::unordered_map<std::string, lua_Threaded> m;
-            return m;
-        }
+                    bool thinking = tasker->has(L, "think") && (slice == nullptr || !slice->expired);
+                    guard.unlock();
+                    if (thinking) tasker->fire(L, "think");
+                    end_slice(L, slice);
+                    Tracker::relieve(L, *tracker);
+                    pace(L);
+                    guard.lock();
+                }
 
-        void on_threaded(std::string name, lua_Threaded callback)
-        {
-            auto& dispatch = get_threaded();
-            dispatch.emplace(name, callback);
-        }
+                guard.unlock();
+                Metrics::observe(elapsed, start);
+            }
 
-        namespace Task {
-            typedef void (*lua_Task_Error) (API::lua_State* L, std::string error);
+            void cleanup(lua_State* L)
+            {
+                std::lock_guard<std::mutex> guard(*mtx());
+                auto& timers = get_timers();
+                timers.erase(L);
+                auto& schedules = get_schedules();
+                schedules.erase(L);
+                auto& pacers = get_pacers();
+                pacers.erase(L);
+                auto& slices = get_slices();
+                slices.erase(L);
+                auto& asyncs = get_asyncs();
+                asyncs.erase((uintptr_t)L);
+            }
+
+            static constexpr luaL_Reg task_functions[] = {
+                { "isthreaded", lis_threaded },
+                { "defer", ldefer },
+                { "delay", ldelay },
+                { "every", levery },
+                { "cancel", lcancel },
+                { "stats", lstats },
+                { "interval", linterval },
+                { "gc", lgc },
+                { "budget", lbudget },
+                { "async", lasync },
+                { "await", lawait },
+                { nullptr, nullptr }
+            };
 
-            std::unordered_map<std::string, lua_Task_Error>& get_on_error()
+            void push_stack(lua_State* L, UMODULE _)
             {
-                static std::unordered_map<std::string, lua_Task_Error> m = std::unordered_map<std::string, lua_Task_Error>();
-                return m;
+                static Signal::Handle* tasker = signal();
+                tasker->api_imm(L, "think");
+
+                luaL::makelib(L, nullptr, task_functions);
             }
 
-            void add_error(std::string name, lua_Task_Error callback)
+            void api()
             {
-                auto& on_error = get_on_error();
-                on_error.emplace(name, callback);
+                Tracker::on_close("task", cleanup);
+                Reflection::add("task", push_stack);
             }
+        }
 
-            void remove_error(std::string name)
+        namespace Executor {
+            struct worker {
+                std::mutex mutex;
+                std::deque<lua_State*> queue;
+            };
+
+            // worker_count & launched are only touched under config_mtx, workers is filled once and never resized after launched is set
+            static std::mutex config_mtx;
+            static unsigned int worker_count = 0;
+            static unsigned int launched = 0;
+            static std::vector<std::unique_ptr<worker>> workers;
+            static std::once_flag started;
+            static std::atomic<unsigned int> queued = 0;
+            static std::atomic<unsigned int> rotation = 0;
+            static thread_local int worker_index = -1;
+
+            static std::mutex idle_mtx;
+            static std::condition_variable idle_cv;
+
+            typedef std::pair<std::chrono::steady_clock::time_point, lua_State*> alarm_entry;
+            static std::priority_queue<alarm_entry, std::vector<alarm_entry>, std::greater<alarm_entry>> alarms;
+            static std::mutex alarm_mtx;
+            static std::condition_variable alarm_cv;
+
+            void set_workers(unsigned int count)
             {
-                auto& on_error = get_on_error();
-                on_error.erase(name);
+                std::lock_guard<std::mutex> guard(config_mtx);
+                if (launched > 0) return;
+                worker_count = count;
             }
 
-            std::unordered_set<lua_State*>& get_tracing()
+            unsigned int get_workers()
             {
-                static std::unordered_set<lua_State*> m;
-                return m;
+                std::lock_guard<std::mutex> guard(config_mtx);
+                if (launched > 0) return launched;
+                if (worker_count > 0) return worker_count;
+                return std::max(1u, std::thread::hardware_concurrency());
             }
 
-            std::unordered_map<lua_State*, std::vector<int>>& get_defers()
+            // Pops from our own queue first, otherwise steals from the back of another worker
+            lua_State* take(size_t index)
             {
-                static std::unordered_map<lua_State*, std::vector<int>> m;
-                return m;
+                size_t count = workers.size();
+                for (size_t i = 0; i < count; i++) {
+                    auto& target = *workers[(index + i) % count];
+                    std::lock_guard<std::mutex> guard(target.mutex);
+                    if (target.queue.empty()) continue;
+
+                    lua_State* L;
+                    if (i == 0) {
+                        L = target.queue.front();
+                        target.queue.pop_front();
+                    }
+                    else {
+                        L = target.queue.back();
+                        target.queue.pop_back();
+                    }
+
+                    queued--;
+                    return L;
+                }
+                return nullptr;
             }
 
-            std::unordered_map<lua_State*, std::vector<std::pair<std::chrono::steady_clock::time_point, int>>>& get_timers()
+            void work(size_t index)
             {
-                static std::unordered_map<lua_State*, std::vector<std::pair<std::chrono::steady_clock::time_point, int>>> m;
-                return m;
+                worker_index = (int)index;
+
+                while (true) {
+                    lua_State* L = take(index);
+
+                    if (L == nullptr) {
+                        std::unique_lock<std::mutex> guard(idle_mtx);
+                        idle_cv.wait(guard, []() { return queued > 0; });
+                        continue;
+                    }
+
+                    if (Tracker::is_state(L) == nullptr) continue;
+
+                    Task::runtime_threaded(L);
+                    Tracker::sleep(L, Task::deadline(L));
+                }
             }
 
-            std::unique_ptr<std::mutex>& mtx()
+            void alarming()
             {
-                static std::unique_ptr<std::mutex> mtx = std::make_unique<std::mutex>();
-                return mtx;
+                std::unique_lock<std::mutex> guard(alarm_mtx);
+
+                while (true) {
+                    if (alarms.empty()) {
+                        alarm_cv.wait(guard);
+                        continue;
+                    }
+
+                    auto until = alarms.top().first;
+                    if (std::chrono::steady_clock::now() < until) {
+                        alarm_cv.wait_until(guard, until);
+                        continue;
+                    }
+
+                    lua_State* L = alarms.top().second;
+                    alarms.pop();
+
+                    guard.unlock();
+                    Tracker::alarm(L);
+                    guard.lock();
+                }
             }
 
-            void push(lua_State* L)
+            void start()
             {
-                std::lock_guard<std::mutex> guard(*mtx());
-                auto& in_threading = get_tracing();
-                in_threading.emplace(L);
+                std::call_once(started, []() {
+                    unsigned int count = get_workers();
+                    {
+                        std::lock_guard<std::mutex> guard(config_mtx);
+                        launched = count;
+                    }
+
+                    workers.reserve(count);
+                    for (unsigned int i = 0; i < count; i++) {
+                        workers.push_back(std::make_unique<worker>());
+                    }
+
+                    for (unsigned int i = 0; i < count; i++) {
+                        std::thread(work, (size_t)i).detach();
+                    }
+
+                    std::thread(alarming).detach();
+                });
             }
 
-            void pop(lua_State* L)
+            void post(lua_State* L)
             {
-                std::lock_guard<std::mutex> guard(*mtx());
-                auto& in_threading = get_tracing();
-                in_threading.erase(L);
+                start();
+
+                // ticks queued from a worker stay local to it, everything else is spread around
+                size_t index = worker_index >= 0 ? (size_t)worker_index : (size_t)(rotation++ % workers.size());
+                {
+                    std::lock_guard<std::mutex> guard(workers[index]->mutex);
+                    workers[index]->queue.push_back(L);
+                    queued++;
+                }
+
+                {
+                    std::lock_guard<std::mutex> guard(idle_mtx);
+                }
+                idle_cv.notify_one();
             }
 
-            int lis_threaded(lua_State* L)
+            void park(lua_State* L, std::chrono::steady_clock::time_point until)
             {
-                std::lock_guard<std::mutex> guard(*mtx());
-                auto& in_threading = get_tracing();
-                lua::pushboolean(L, in_threading.find(L) != in_threading.end());
-                return 1;
+                start();
+
+                std::unique_lock<std::mutex> guard(alarm_mtx);
+                bool earliest = alarms.empty() || until < alarms.top().first;
+                alarms.push(alarm_entry(until, L));
+                guard.unlock();
+
+                if (earliest) alarm_cv.notify_one();
             }
+        }
 
-            int ldefer(lua_State* L)
+        namespace Jobs {
+            struct lane {
+                std::mutex mutex;
+                std::condition_variable cv;
+                std::array<std::deque<std::pair<job, std::chrono::steady_clock::time_point>>, 3> queues;
+                unsigned int threads = 0;
+                unsigned int running = 0;
+                unsigned int idle = 0;
+                unsigned int busy = 0;
+                size_t queued = 0;
+                size_t limit = 0;
+                uint64_t completed = 0;
+                uint64_t overflowed = 0;
+
+                std::once_flag measured;
+                Metrics::metric depth = 0;
+                Metrics::metric active = 0;
+                Metrics::metric waited = 0;
+            };
+
+            static std::array<lane, 4> lanes;
+            static const char* lane_names[] = { "io", "cpu", "network", "stream" };
+
+            const char* name(kind type)
             {
-                luaL::checkfunction(L, 1);
-                std::lock_guard<std::mutex> guard(*mtx());
-                auto& defers = get_defers();
-                if (defers.find(L) == defers.end()) {
-                    defers.emplace(L, std::vector<int>());
-                }
-                defers[L].push_back(luaL::newref(L, 1));
-                return 0;
+                return lane_names[(size_t)type];
             }
 
-            int ldelay(lua_State* L)
+            unsigned int default_threads(kind type)
             {
-                double delay = luaL::checknumber(L, 1);
-                luaL::checkfunction(L, 2);
-                std::lock_guard<std::mutex> guard(*mtx());
-                auto& defers = get_timers();
-                if (defers.find(L) == defers.end()) {
-                    defers.emplace(L, std::vector<std::pair<std::chrono::steady_clock::time_point, int>>());
+                switch (type) {
+                case kind::cpu:
+                    return std::max(1u, std::thread::hardware_concurrency());
+                case kind::network:
+                    return 8;
+                case kind::stream:
+                    return 16;
+                default:
+                    return 4;
                 }
-                auto duration = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
-                    std::chrono::duration<double>(delay)
-                );
-                defers[L].push_back(std::pair(std::chrono::steady_clock::now() + duration, luaL::newref(L, 2)));
-                return 0;
             }
 
-            Signal::Handle* signal()
+            lane& get(kind type)
             {
-                static Signal::Handle* tasker = Signal::create();
-                return tasker;
+                lane& target = lanes[(size_t)type];
+                std::call_once(target.measured, [&target, type]() {
+                    std::string prefix = std::string("interstellar_jobs_") + name(type);
+                    target.depth = Metrics::gauge(prefix + "_queued", "Blocking work waiting on a thread");
+                    target.active = Metrics::gauge(prefix + "_busy", "Threads running blocking work");
+                    target.waited = Metrics::histogram(prefix + "_wait_seconds", "Time blocking work spent queued");
+                });
+                return target;
             }
 
-            void runtime_threaded(lua_State* L)
+            void work(lane* target)
             {
-                static Signal::Handle* tasker = signal();
-                auto lock = Tracker::lock(L);
-                Task::push(L);
+                std::unique_lock<std::mutex> guard(target->mutex);
 
-                std::unique_lock<std::mutex> guard(*mtx());
+                while (true) {
+                    // threads above a lowered count leave once they're out of work
+                    if (target->running > target->threads) {
+                        target->running--;
+                        return;
+                    }
+
+                    auto queue = std::find_if(target->queues.begin(), target->queues.end(), [](auto& queue) { return !queue.empty(); });
+                    if (queue == target->queues.end()) {
+                        target->idle++;
+                        target->cv.wait(guard);
+                        target->idle--;
+                        continue;
+                    }
 
-                auto& defers = get_defers();
-                auto idefers = defers.find(L);
-                if (idefers != defers.end()) {
-                    auto& list = idefers->second;
-                    for (int entry : list) {
-                        lua::pushref(L, entry);
-                        luaL::rmref(L, entry);
+                    auto [callback, since] = std::move(queue->front());
+                    queue->pop_front();
+                    target->queued--;
+                    target->busy++;
+                    guard.unlock();
 
-                        auto it = std::find(list.begin(), list.end(), entry);
-                        if (it != list.end()) list.erase(it);
+                    Metrics::shift(target->depth, -1);
+                    Metrics::observe(target->waited, since);
+                    Metrics::shift(target->active, 1);
+                    callback();
+                    Metrics::shift(target->active, -1);
 
-                        guard.unlock();
-                        if (lua::tcall(L, 0, 0)) {
-                            std::string err = lua::tocstring(L, -1);
-                            lua::pop(L);
-                            auto& on_error = get_on_error();
-                            for (auto const& handle : on_error) handle.second(L, err);
-                        }
-                        guard.lock();
-                    }
+                    guard.lock();
+                    target->busy--;
+                    target->completed++;
                 }
+            }
 
-                auto& timers = get_timers();
-                auto itimers = timers.find(L);
-                if (itimers != timers.end()) {
-                    auto& list = itimers->second;
-                    auto clock = std::chrono::steady_clock::now();
-                    for (auto& entry : list) {
+            void set_threads(kind type, unsigned int count)
+            {
+                lane& target = get(type);
+                {
+                    std::lock_guard<std::mutex> guard(target.mutex);
+                    target.threads = count > 0 ? count : default_threads(type);
+                }
+                target.cv.notify_all();
+            }
 
-                        if (clock < entry.first) {
-                            continue;
-                        }
+            unsigned int get_threads(kind type)
+            {
+                lane& target = get(type);
+                std::lock_guard<std::mutex> guard(target.mutex);
+                return target.threads > 0 ? target.threads : default_threads(type);
+            }
+
+            void set_limit(kind type, size_t limit)
+            {
+                lane& target = get(type);
+                std::lock_guard<std::mutex> guard(target.mutex);
+                target.limit = limit;
+            }
 
-                        lua::pushref(L, entry.second);
-                        luaL::rmref(L, entry.second);
+            size_t get_limit(kind type)
+            {
+                lane& target = get(type);
+                std::lock_guard<std::mutex> guard(target.mutex);
+                return target.limit;
+            }
 
-                        auto it = std::find(list.begin(), list.end(), entry);
-                        if (it != list.end()) list.erase(it);
+            bool submit(kind type, job work, priority level)
+            {
+                lane& target = get(type);
+                std::unique_lock<std::mutex> guard(target.mutex);
 
-                        guard.unlock();
-                        if (lua::tcall(L, 0, 0)) {
-                            std::string err = lua::tocstring(L, -1);
-                            lua::pop(L);
-                            auto& on_error = get_on_error();
-                            for (auto const& handle : on_error) handle.second(L, err);
-                        }
-                        guard.lock();
-                    }
-                }
+                // past the limit work still queues, running it here would block whichever state submitted it
+                bool within = target.limit == 0 || target.queued < target.limit;
+                if (!within) target.overflowed++;
+
+                if (target.threads == 0) target.threads = default_threads(type);
 
+                target.queues[(size_t)level].emplace_back(std::move(work), std::chrono::steady_clock::now());
+                target.queued++;
+
+                // only start another thread when the idle ones can't cover what's queued
+                bool spawn = target.queued > target.idle && target.running < target.threads;
+                if (spawn) target.running++;
                 guard.unlock();
 
-                if (tasker->has(L, "think")) tasker->fire(L, "think");
+                Metrics::shift(target.depth, 1);
 
-                auto& dispatch = get_threaded();
-                for (auto& [key, callback] : dispatch) {
-                    callback(L);
-                }
+                if (spawn) std::thread(Jobs::work, &target).detach();
+                else target.cv.notify_one();
 
-                Task::pop(L);
-                if (lock.owns_lock()) lock.unlock(); lock.release();
+                return within;
             }
 
-            void runtime()
+            job_stats get_stats(kind type)
             {
-                static Signal::Handle* tasker = signal();
+                lane& target = get(type);
+                std::lock_guard<std::mutex> guard(target.mutex);
 
-                std::unique_lock<std::mutex> guard(*mtx());
+                job_stats stats;
+                stats.threads = target.threads > 0 ? target.threads : default_threads(type);
+                stats.running = target.running;
+                stats.busy = target.busy;
+                stats.queued = target.queued;
+                stats.limit = target.limit;
+                stats.completed = target.completed;
+                stats.overflowed = target.overflowed;
+                return stats;
+            }
+        }
+
+        std::unordered_map<std::string, lua_Runtime>& get_runtimes()
+        {
+            static std::unordered_map<std::string, lua_Runtime> m;
+            return m;
+        }
+
+        void on_runtime(std::string name, lua_Runtime callback)
+        {
+            auto& dispatch = get_runtimes();
+            dispatch.emplace(name, callback);
+        }
 
-                for (auto& state : Tracker::get_states()) {
-                    lua_State* L = state.second;
-                    if (Tracker::is_threaded(L)) continue;
+        void runtime()
+        {
+            auto& dispatch = get_runtimes();
+            for (auto& [key, callback] : dispatch) {
+                callback();
+            }
+            Task::runtime();
+        }
 
-                    auto& defers = get_defers();
-                    auto idefers = defers.find(L);
-                    if (idefers != defers.end()) {
-                        auto& list = idefers->second;
-                        for (auto& entry : list) {
+        // Keeps fresh states (libs already opened) ready so open doesn't pay for them
+        namespace Pool {
+            struct latency_samples {
+                std::vector<double> samples;
+                size_t next = 0;
+                uint64_t count = 0;
+                double max = 0;
+            };
 
-                            lua::pushref(L, entry);
-                            luaL::rmref(L, entry);
+            static std::mutex pool_mtx;
+            static std::condition_variable pool_cv;
+            static std::once_flag pool_started;
+            static std::deque<lua_State*> ready;
+            static size_t pool_size = 0;
+            static latency_samples pooled_latency;
+            static latency_samples cold_latency;
+            static const size_t latency_window = 1024;
 
-                            auto it = std::find(list.begin(), list.end(), entry);
-                            if (it != list.end()) list.erase(it);
+            lua_State* create()
+            {
+                lua_State* L = luaL::newstate();
 
-                            guard.unlock();
-                            if (lua::tcall(L, 0, 0)) {
-                                std::string err = lua::tocstring(L, -1);
-                                lua::pop(L);
-                                auto& on_error = get_on_error();
-                                for (auto const& handle : on_error) handle.second(L, err);
-                            }
-                            guard.lock();
-                        }
-                    }
+                lua::gc(L, 0, 0);
+                luaL::openlibs(L);
+                lua::gc(L, 1, -1);
 
-                    auto& timers = get_timers();
-                    auto itimers = timers.find(L);
-                    if (itimers != timers.end()) {
-                        auto& list = itimers->second;
-                        auto clock = std::chrono::steady_clock::now();
-                        for (auto& entry : list) {
+                return L;
+            }
 
-                            if (clock < entry.first) {
-                                continue;
-                            }
+            void fill()
+            {
+                std::unique_lock<std::mutex> guard(pool_mtx);
 
-                            lua::pushref(L, entry.second);
-                            luaL::rmref(L, entry.second);
+                while (true) {
+                    pool_cv.wait(guard, []() { return ready.size() < pool_size; });
 
-                            auto it = std::find(list.begin(), list.end(), entry);
-                            if (it != list.end()) list.erase(it);
+                    guard.unlock();
+                    lua_State* L = create();
+                    guard.lock();
 
-                            guard.unlock();
-                            if (lua::tcall(L, 0, 0)) {
-                                std::string err = lua::tocstring(L, -1);
-                                lua::pop(L);
-                                auto& on_error = get_on_error();
-                                for (auto const& handle : on_error) handle.second(L, err);
-                            }
-                            guard.lock();
-                        }
+                    if (ready.size() < pool_size) {
+                        ready.push_back(L);
+                        continue;
                     }
 
-                    if (!tasker->has(L, "think")) continue;
                     guard.unlock();
-                    tasker->fire(L, "think");
+                    lua::close(L);
                     guard.lock();
                 }
+            }
 
-                guard.unlock();
+            void set_size(size_t size)
+            {
+                std::vector<lua_State*> excess;
+                {
+                    std::lock_guard<std::mutex> guard(pool_mtx);
+                    pool_size = size;
+                    while (ready.size() > size) {
+                        excess.push_back(ready.back());
+                        ready.pop_back();
+                    }
+                }
+
+                for (lua_State* L : excess) {
+                    lua::close(L);
+                }
+
+                if (size > 0) {
+                    std::call_once(pool_started, []() {
+                        std::thread(fill).detach();
+                    });
+                }
+
+                pool_cv.notify_one();
             }
 
-            void cleanup(lua_State* L)
+            size_t get_size()
             {
-                std::lock_guard<std::mutex> guard(*mtx());
-                auto& defers = get_defers();
-                defers.erase(L);
-                auto& timers = get_timers();
-                timers.erase(L);
+                std::lock_guard<std::mutex> guard(pool_mtx);
+                return pool_size;
             }
 
-            void push_stack(lua_State* L, UMODULE _)
+            size_t get_ready()
             {
-                static Signal::Handle* tasker = signal();
-                tasker->api_imm(L, "think");
+                std::lock_guard<std::mutex> guard(pool_mtx);
+                return ready.size();
+            }
 
-                lua::pushcfunction(L, lis_threaded);
-                lua::setfield(L, -2, "isthreaded");
+            lua_State* take()
+            {
+                std::unique_lock<std::mutex> guard(pool_mtx);
+                if (ready.empty()) return nullptr;
 
-                lua::pushcfunction(L, ldefer);
-                lua::setfield(L, -2, "defer");
+                lua_State* L = ready.front();
+                ready.pop_front();
+                guard.unlock();
 
-                lua::pushcfunction(L, ldelay);
-                lua::setfield(L, -2, "delay");
+                pool_cv.notify_one();
+                return L;
             }
 
-            void api()
+            void record(bool pooled, std::chrono::steady_clock::time_point start)
             {
-                Tracker::on_close("task", cleanup);
-                Reflection::add("task", push_stack);
+                double took = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                std::lock_guard<std::mutex> guard(pool_mtx);
+                latency_samples& latency = pooled ? pooled_latency : cold_latency;
+
+                if (latency.samples.size() < latency_window) latency.samples.push_back(took);
+                else latency.samples[latency.next] = took;
+                latency.next = (latency.next + 1) % latency_window;
+                latency.count++;
+                latency.max = std::max(latency.max, took);
             }
-        }
 
-        std::unordered_map<std::string, lua_Runtime>& get_runtimes()
-        {
-            static std::unordered_map<std::string, lua_Runtime> m;
-            return m;
-        }
+            open_latency get_latency(bool pooled)
+            {
+                std::vector<double> samples;
+                open_latency result;
+                {
+                    std::lock_guard<std::mutex> guard(pool_mtx);
+                    latency_samples& latency = pooled ? pooled_latency : cold_latency;
+                    samples = latency.samples;
+                    result.count = latency.count;
+                    result.max = latency.max;
+                }
 
-        void on_runtime(std::string name, lua_Runtime callback)
-        {
-            auto& dispatch = get_runtimes();
-            dispatch.emplace(name, callback);
-        }
+                if (samples.empty()) return result;
 
-        void runtime()
-        {
-            auto& dispatch = get_runtimes();
-            for (auto& [key, callback] : dispatch) {
-                callback();
+                std::sort(samples.begin(), samples.end());
+                auto percentile = [&samples](double rank) {
+                    return samples[std::min(samples.size() - 1, (size_t)(rank * samples.size()))];
+                };
+                result.p50 = percentile(0.50);
+                result.p90 = percentile(0.90);
+                result.p99 = percentile(0.99);
+                return result;
             }
-            Task::runtime();
         }
 
-        lua_State* open(std::string name, bool internal, bool threaded, lua_State* parent)
+        lua_State* open(std::string name, bool internal, bool threaded, lua_State* parent, Tracker::alloc_policy policy, size_t soft, size_t hard)
         {
             lua_State* exists = Tracker::is_state(name);
             if (exists != nullptr) {
                 return exists;
             }
 
-            lua_State* L = luaL::newstate();
+            auto start = std::chrono::steady_clock::now();
+
+            lua_State* L = Pool::take();
+            bool pooled = L != nullptr;
+            if (!pooled) {
+                L = Pool::create();
+            }
 
-            lua::gc(L, 0, 0);
-            luaL::openlibs(L);
-            lua::gc(L, 1, -1);
+            Tracker::allocator(L, policy, soft, hard);
 
             if (threaded) {
                 static Signal::Handle* tasker = Task::signal();
 
                 Tracker::listen(L, name, std::make_shared<std::mutex>(), internal, parent);
 
-                std::thread([L]() {
-                    while (Tracker::is_state(L) != nullptr) {
-                        Task::runtime_threaded(L);
-                    }
-                }).detach();
+                // ticks are picked up by the executor's workers from here on
+                Tracker::wake(L);
             }
             else {
                 Tracker::listen(L, name, internal, parent);
             }
 
+            Pool::record(pooled, start);
+
             return L;
         }
 
         void close(lua_State* L)
         {
             if (Tracker::is_threaded(L)) {
+                // pre_remove untracks the state, so its mutex is taken from the tracker we hold on to here
+                std::shared_ptr<Tracker::state_tracking> tracker = Tracker::get_tracker(L);
                 Tracker::pre_remove(L);
-                auto lock = Tracker::lock(L);
+                std::unique_lock<std::mutex> lock;
+                if (tracker != nullptr) lock = std::unique_lock<std::mutex>(*tracker->mutex);
                 lua::close(L);
                 if (lock.owns_lock()) lock.unlock(); lock.release();
                 Tracker::post_remove(L);
@@ -2668,10 +7035,47 @@ namespace INTERSTELLAR_NAMESPACE {
             libraries.push_back(std::pair(name, callback));
         }
 
-        void push(lua_State* L)
+        // __index of the global table, builds a library the first time it's read
+        // upvalue 1 is whatever __index was there before us, upvalue 2 marks the libraries already built
+        int materialize(lua_State* L)
         {
-            uintptr_t id = Tracker::id(L);
+            if (lua::gettype(L, 2) == datatype::string) {
+                std::string name = lua::tocstring(L, 2);
+                for (const auto& callback : libraries) {
+                    if (callback.first != name) continue;
+
+                    callback.second(L, process);
+                    lua::pushvalue(L, 2);
+                    lua::pushvalue(L, -2);
+                    lua::rawset(L, 1);
+
+                    lua::pushboolean(L, true);
+                    lua::setcfield(L, upvalueindex(2), name);
+                    return 1;
+                }
+            }
+
+            lua::pushvalue(L, upvalueindex(1));
+
+            if (lua::isfunction(L, -1)) {
+                lua::pushvalue(L, 1);
+                lua::pushvalue(L, 2);
+                lua::call(L, 2, 1);
+                return 1;
+            }
+
+            if (lua::istable(L, -1)) {
+                lua::pushvalue(L, 2);
+                lua::gettable(L, -2);
+                return 1;
+            }
+
+            lua::pushnil(L);
+            return 1;
+        }
 
+        void push(lua_State* L)
+        {
             lua::pushvalue(L, indexer::global);
 
             for (const auto& callback : functions) {
@@ -2679,10 +7083,82 @@ namespace INTERSTELLAR_NAMESPACE {
                 lua::setcfield(L, -2, callback.first);
             }
 
+            if (!lua::getmetatable(L, -1)) {
+                lua::newtable(L);
+                lua::pushvalue(L, -1);
+                lua::setmetatable(L, -3);
+            }
+
+            lua::pushcstring(L, "__libraries");
+            lua::rawget(L, -2);
+            if (!lua::istable(L, -1)) {
+                lua::pop(L);
+                lua::newtable(L);
+                lua::pushcstring(L, "__libraries");
+                lua::pushvalue(L, -2);
+                lua::rawset(L, -4);
+            }
+
+            lua::pushcstring(L, "__index");
+            lua::rawget(L, -3);
+            if (lua::tocfunction(L, -1) != materialize) {
+                lua::pushvalue(L, -2);
+                lua::pushcclosure(L, materialize, 2);
+                lua::pushcstring(L, "__index");
+                lua::insert(L, -2);
+                lua::rawset(L, -4);
+            }
+            else {
+                lua::pop(L);
+            }
+
+            // libraries extending what is already there (string, math...) never reach __index, so they go now
+            for (const auto& callback : libraries) {
+                lua::getfield(L, -1, callback.first.c_str());
+                bool built = lua::toboolean(L, -1);
+                lua::pop(L);
+                if (built) continue;
+
+                lua::pushcstring(L, callback.first);
+                lua::rawget(L, -4);
+                bool exists = !lua::isnil(L, -1);
+                lua::pop(L);
+                if (!exists) continue;
+
+                callback.second(L, process);
+                lua::setcfield(L, -4, callback.first);
+
+                lua::pushboolean(L, true);
+                lua::setcfield(L, -2, callback.first);
+            }
+
+            lua::pop(L, 2);
+        }
+
+        void build(lua_State* L)
+        {
+            push(L);
+
+            lua::pushvalue(L, indexer::global);
+            lua::getmetatable(L, -1);
+            lua::pushcstring(L, "__libraries");
+            lua::rawget(L, -2);
+
             for (const auto& callback : libraries) {
+                lua::getfield(L, -1, callback.first.c_str());
+                bool built = lua::toboolean(L, -1);
+                lua::pop(L);
+                if (built) continue;
+
+                lua::pushcstring(L, callback.first);
                 callback.second(L, process);
+                lua::rawset(L, -5);
+
+                lua::pushboolean(L, true);
                 lua::setcfield(L, -2, callback.first);
             }
+
+            lua::pop(L, 3);
         }
     }
 
@@ -2708,7 +7184,10 @@ namespace INTERSTELLAR_NAMESPACE {
         if (ret != 0) { errorcode = ret; return ret; }
 
         Tracker::init();
+        Metrics::api();
+        Log::api();
         Reflection::Task::api();
+        Reflection::Bytecode::api();
 
         return 0;
     }
@@ -2897,6 +7376,69 @@ namespace INTERSTELLAR_NAMESPACE::Reflection {
         return 1;
     }
 
+    const char* policy_names[] = { "system", "pool", "arena" };
+
+    void push_memory(lua_State* L, Tracker::memory_stats stats)
+    {
+        lua::newtable(L);
+        lua::pushcstring(L, policy_names[(size_t)stats.policy]);
+        lua::setfield(L, -2, "policy");
+        lua::pushnumber(L, (double)stats.used);
+        lua::setfield(L, -2, "used");
+        lua::pushnumber(L, (double)stats.peak);
+        lua::setfield(L, -2, "peak");
+        lua::pushnumber(L, (double)stats.reserved);
+        lua::setfield(L, -2, "reserved");
+        lua::pushnumber(L, (double)stats.soft);
+        lua::setfield(L, -2, "soft");
+        lua::pushnumber(L, (double)stats.hard);
+        lua::setfield(L, -2, "hard");
+        lua::pushnumber(L, (double)stats.allocations);
+        lua::setfield(L, -2, "allocations");
+        lua::pushnumber(L, (double)stats.failures);
+        lua::setfield(L, -2, "failures");
+        lua::pushnumber(L, (double)stats.overdrawn);
+        lua::setfield(L, -2, "overdrawn");
+        lua::pushnumber(L, (double)stats.pressured);
+        lua::setfield(L, -2, "pressured");
+    }
+
+    int lua_state_memory(lua_State* L)
+    {
+        lua_State* state = Tracker::is_state(Class::check(L, 1, "lua.state"));
+        if (state == nullptr) {
+            luaL::error(L, "invalid lua instance");
+            return 0;
+        }
+
+        Tracker::memory_stats stats = Tracker::get_memory(state);
+        if (!stats.tracked) {
+            return 0;
+        }
+
+        push_memory(L, stats);
+        return 1;
+    }
+
+    int lua_state_quota(lua_State* L)
+    {
+        lua_State* state = Tracker::is_state(Class::check(L, 1, "lua.state"));
+        if (state == nullptr) {
+            luaL::error(L, "invalid lua instance");
+            return 0;
+        }
+
+        if (Tracker::get_parent(state) != L) {
+            luaL::error(L, "cannot set quota of lua_State without parented ownership");
+            return 0;
+        }
+
+        size_t soft = (size_t)std::max(0.0, luaL::optnumber(L, 2, 0));
+        size_t hard = (size_t)std::max(0.0, luaL::optnumber(L, 3, 0));
+        lua::pushboolean(L, Tracker::set_quota(state, soft, hard));
+        return 1;
+    }
+
     namespace CAPI {
         std::vector<lua_State*> stack_target;
         std::vector<lua_State*> stack_origin;
@@ -3747,6 +8289,12 @@ namespace INTERSTELLAR_NAMESPACE::Reflection {
             lua::pushcfunction(L, lua_state_children);
             lua::setfield(L, -2, "children");
 
+            lua::pushcfunction(L, lua_state_memory);
+            lua::setfield(L, -2, "memory");
+
+            lua::pushcfunction(L, lua_state_quota);
+            lua::setfield(L, -2, "quota");
+
             lua::pushcfunction(L, CAPI::lua_state_stack);
             lua::setfield(L, -2, "stack");
 
@@ -3778,6 +8326,111 @@ namespace INTERSTELLAR_NAMESPACE::Reflection {
         return 1;
     }
 
+    void push_latency(lua_State* L, Pool::open_latency latency)
+    {
+        lua::newtable(L);
+        lua::pushnumber(L, (double)latency.count);
+        lua::setfield(L, -2, "count");
+        lua::pushnumber(L, latency.p50);
+        lua::setfield(L, -2, "p50");
+        lua::pushnumber(L, latency.p90);
+        lua::setfield(L, -2, "p90");
+        lua::pushnumber(L, latency.p99);
+        lua::setfield(L, -2, "p99");
+        lua::pushnumber(L, latency.max);
+        lua::setfield(L, -2, "max");
+    }
+
+    int pooll(lua_State* L)
+    {
+        if (lua::isnumber(L, 1)) {
+            Pool::set_size((size_t)std::max(0.0, lua::tonumber(L, 1)));
+        }
+
+        lua::newtable(L);
+        lua::pushnumber(L, (double)Pool::get_size());
+        lua::setfield(L, -2, "size");
+        lua::pushnumber(L, (double)Pool::get_ready());
+        lua::setfield(L, -2, "ready");
+        push_latency(L, Pool::get_latency(true));
+        lua::setfield(L, -2, "pooled");
+        push_latency(L, Pool::get_latency(false));
+        lua::setfield(L, -2, "cold");
+        return 1;
+    }
+
+    int jobsl(lua_State* L)
+    {
+        if (lua::isstring(L, 1)) {
+            std::string type = lua::tocstring(L, 1);
+            auto found = std::find_if(std::begin(Jobs::lane_names), std::end(Jobs::lane_names), [&type](const char* name) { return type == name; });
+            if (found == std::end(Jobs::lane_names)) {
+                luaL::argerror(L, 1, "expected io, cpu, network or stream");
+                return 0;
+            }
+
+            Jobs::kind kind = (Jobs::kind)(found - std::begin(Jobs::lane_names));
+            if (lua::isnumber(L, 2)) Jobs::set_threads(kind, (unsigned int)std::max(0.0, lua::tonumber(L, 2)));
+            if (lua::isnumber(L, 3)) Jobs::set_limit(kind, (size_t)std::max(0.0, lua::tonumber(L, 3)));
+        }
+
+        lua::newtable(L);
+        for (Jobs::kind kind : { Jobs::kind::io, Jobs::kind::cpu, Jobs::kind::network, Jobs::kind::stream }) {
+            Jobs::job_stats stats = Jobs::get_stats(kind);
+            lua::newtable(L);
+            lua::pushnumber(L, (double)stats.threads);
+            lua::setfield(L, -2, "threads");
+            lua::pushnumber(L, (double)stats.running);
+            lua::setfield(L, -2, "running");
+            lua::pushnumber(L, (double)stats.busy);
+            lua::setfield(L, -2, "busy");
+            lua::pushnumber(L, (double)stats.queued);
+            lua::setfield(L, -2, "queued");
+            lua::pushnumber(L, (double)stats.limit);
+            lua::setfield(L, -2, "limit");
+            lua::pushnumber(L, (double)stats.completed);
+            lua::setfield(L, -2, "completed");
+            lua::pushnumber(L, (double)stats.overflowed);
+            lua::setfield(L, -2, "overflowed");
+            lua::setfield(L, -2, Jobs::name(kind));
+        }
+        return 1;
+    }
+
+    int freezel(lua_State* L)
+    {
+        luaL::checktable(L, 1);
+        std::string name = "";
+        if (!lua::isnil(L, 2)) name = luaL::checkcstring(L, 2);
+
+        std::string err = freeze(L, 1, name);
+
+        if (err.size() > 0) {
+            luaL::error(L, err.c_str());
+            return 0;
+        }
+
+        return 1;
+    }
+
+    int frozenl(lua_State* L)
+    {
+        std::string name = luaL::checkcstring(L, 1);
+
+        if (!frozen(L, name)) {
+            lua::pushnil(L);
+        }
+
+        return 1;
+    }
+
+    int thawl(lua_State* L)
+    {
+        std::string name = luaL::checkcstring(L, 1);
+        thaw(name);
+        return 0;
+    }
+
     int executel(lua_State* L)
     {
         std::string source = luaL::checkcstring(L, 1);
@@ -3835,11 +8488,11 @@ namespace INTERSTELLAR_NAMESPACE::Reflection {
     int all_l(lua_State* L)
     {
         lua::newtable(L);
-        auto list = Tracker::get_states();
+        auto states = Tracker::snapshot();
 
-        for (auto& pair : list) {
-            push_state(L, pair.second);
-            lua::setcfield(L, -2, pair.first);
+        for (auto& [name, state] : states->imapping) {
+            push_state(L, state->state.self);
+            lua::setcfield(L, -2, name);
         }
 
         return 1;
@@ -3859,55 +8512,7 @@ namespace INTERSTELLAR_NAMESPACE::Reflection {
 
     int printl(lua_State* L)
     {
-        int nargs = lua::gettop(L);
-        std::vector<std::string> args;
-
-        for (int i = 1; i <= nargs; ++i) {
-            if (lua::isstring(L, i) || lua::isnumber(L, i)) {
-                args.push_back(lua::tocstring(L, i));
-            }
-            else {
-                lua::pushvalue(L, upvalueindex(1));
-                lua::pushvalue(L, i);
-                lua::call(L, 1, 1);
-                args.push_back(lua::tocstring(L, -1));
-                lua::pop(L, 1);
-            }
-        }
-
-        std::string line;
-        for (size_t i = 0; i < args.size(); ++i) {
-            line += args[i];
-            if (i < args.size() - 1) {
-                line += "\t";
-            }
-        }
-
-        std::string name = Tracker::get_name(L);
-        if (name.size() < 1) {
-            name = "unknown";
-        }
-
-        line = "[" + name + "] " + line + "\n";
-
-        printf(line.c_str());
-
-        /*lua_State* target = Tracker::get_root();
-        if (target == nullptr) return 0;
-
-        lua::pushvalue(target, indexer::global);
-        lua::getfield(target, -1, "print");
-        lua::remove(target, -2);
-
-        if (lua::isfunction(target, -1)) {
-            lua::pushcstring(target, line);
-            lua::pcall(target, 1, 0, 0);
-        }
-        else {
-            lua::pop(target);
-        }*/
-
-        return 0;
+        return Log::log(L, Log::level::info, lua::gettop(L), upvalueindex(1));
     }
 
     int openl(lua_State* L)
@@ -3932,10 +8537,24 @@ namespace INTERSTELLAR_NAMESPACE::Reflection {
             return 0;
         }
 
+        Tracker::alloc_policy policy = Tracker::alloc_policy::system;
+        if (lua::gettype(L, 3) > datatype::nil) {
+            std::string allocator = luaL::checkcstring(L, 3);
+            if (allocator == "pool") policy = Tracker::alloc_policy::pool;
+            else if (allocator == "arena") policy = Tracker::alloc_policy::arena;
+            else if (allocator != "system") {
+                luaL::argerror(L, 3, "expected system, pool or arena");
+                return 0;
+            }
+        }
+
+        size_t soft = (size_t)std::max(0.0, luaL::optnumber(L, 4, 0));
+        size_t hard = (size_t)std::max(0.0, luaL::optnumber(L, 5, 0));
+
         lua_State* state;
 
         if (lua::isboolean(L, 2) && lua::toboolean(L, 2)) {
-            state = Reflection::open(name, false, true, L);
+            state = Reflection::open(name, false, true, L, policy, soft, hard);
 
             auto lock = Tracker::lock(state);
 
@@ -3947,7 +8566,7 @@ namespace INTERSTELLAR_NAMESPACE::Reflection {
             if (lock.owns_lock()) lock.unlock(); lock.release();
         }
         else {
-            state = Reflection::open(name, false, false, L);
+            state = Reflection::open(name, false, false, L, policy, soft, hard);
             lua::pushvalue(state, indexer::global);
             lua::getfield(state, -1, "tostring");
             lua::pushcclosure(state, printl, 1);
@@ -3982,36 +8601,41 @@ namespace INTERSTELLAR_NAMESPACE::Reflection {
         return 0;
     }
 
-    void push(lua_State* L, UMODULE handle)
+    int memoryl(lua_State* L)
     {
         lua::newtable(L);
+        for (auto& [name, stats] : Tracker::get_memory()) {
+            push_memory(L, stats);
+            lua::setcfield(L, -2, name);
+        }
+        return 1;
+    }
 
-        lua::pushcfunction(L, compilel);
-        lua::setfield(L, -2, "compile");
-
-        lua::pushcfunction(L, executel);
-        lua::setfield(L, -2, "execute");
-
-        lua::pushcfunction(L, is_l);
-        lua::setfield(L, -2, "is");
-
-        lua::pushcfunction(L, getl);
-        lua::setfield(L, -2, "get");
-
-        lua::pushcfunction(L, all_l);
-        lua::setfield(L, -2, "all");
-
-        lua::pushcfunction(L, current_l);
-        lua::setfield(L, -2, "current");
-
-        lua::pushcfunction(L, openl);
-        lua::setfield(L, -2, "open");
+    static constexpr luaL_Reg reflection_functions[] = {
+        { "compile", compilel },
+        { "execute", executel },
+        { "is", is_l },
+        { "get", getl },
+        { "all", all_l },
+        { "current", current_l },
+        { "open", openl },
+        { "close", closel },
+        { "stack", CAPI::stackl },
+        { "cache", Bytecode::lcache },
+        { "pool", pooll },
+        { "jobs", jobsl },
+        { "freeze", freezel },
+        { "frozen", frozenl },
+        { "thaw", thawl },
+        { "memory", memoryl },
+        { nullptr, nullptr }
+    };
 
-        lua::pushcfunction(L, closel);
-        lua::setfield(L, -2, "close");
+    void push(lua_State* L, UMODULE handle)
+    {
+        lua::newtable(L);
 
-        lua::pushcfunction(L, CAPI::stackl);
-        lua::setfield(L, -2, "stack");
+        luaL::makelib(L, nullptr, reflection_functions);
 
         Tracker::signal->api(L);
         lua::setfield(L, -2, "listener");
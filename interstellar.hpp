@@ -14,6 +14,11 @@
 #include <thread>
 #include <atomic>
 #include <memory>
+#include <new>
+#include <utility>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
 
 // TODO: prepare for more architecture support as per LuaJIT's supported OS & Archs
 
@@ -574,6 +579,7 @@ namespace INTERSTELLAR_NAMESPACE {
                 typedef void (*rawseti)(lua_State*, int, int);
                 typedef void (*remove)(lua_State*, int);
                 typedef void (*replace)(lua_State*, int);
+                typedef int (*resume)(lua_State*, int);
                 typedef void (*setallocf)(lua_State*, lua_Alloc, void*);
                 typedef int (*setfenv)(lua_State*, int);
                 typedef void (*setfield)(lua_State*, int, const char*);
@@ -663,6 +669,7 @@ namespace INTERSTELLAR_NAMESPACE {
             extern type::rawseti rawseti;
             extern type::remove remove;
             extern type::replace replace;
+            extern type::resume resume;
             extern type::setallocf setallocf;
             extern type::setfenv setfenv;
             extern type::setfield setfield;
@@ -768,6 +775,89 @@ namespace INTERSTELLAR_NAMESPACE {
         extern int fetch(UMODULE hndle);
     }
 
+    // Process wide counters, gauges & histograms, updates land in a per-thread shard and are only summed on export
+    // Registering the same name twice hands back the same metric, so callers can just keep a static one around
+    namespace Metrics {
+        typedef uint32_t metric;
+
+        // Summed snapshot of a histogram, values are in nanoseconds
+        struct histogram_stats {
+            uint64_t count = 0;
+            uint64_t sum = 0;
+            uint64_t p50 = 0;
+            uint64_t p90 = 0;
+            uint64_t p99 = 0;
+            uint64_t max = 0;
+        };
+
+        // Names must match [a-zA-Z_:][a-zA-Z0-9_:]*, anything else gets a handle that counts into nothing
+        extern metric counter(std::string name, std::string help = "");
+        extern metric gauge(std::string name, std::string help = "");
+        extern metric histogram(std::string name, std::string help = "");
+
+        // Gauges that are read when exporting instead of being kept up to date, like the length of a queue
+        typedef double (*metric_probe) ();
+        extern void probe(std::string name, metric_probe callback, std::string help = "");
+
+        extern void add(metric counter, uint64_t value = 1);
+        extern void set(metric gauge, int64_t value);
+        extern void shift(metric gauge, int64_t delta);
+        extern void observe(metric histogram, uint64_t nanoseconds);
+        extern void observe(metric histogram, std::chrono::steady_clock::time_point since);
+
+        extern uint64_t get_counter(metric counter);
+        extern int64_t get_gauge(metric gauge);
+        extern histogram_stats get_histogram(metric histogram);
+
+        // Text exposition format, histograms are exported in seconds
+        extern std::string prometheus();
+        extern std::string json();
+
+        extern void push(API::lua_State* L, UMODULE hndle);
+        extern void api();
+    }
+
+    // Buffered output for print & the log library, lines go into a ring owned by the writing thread and a background thread writes them out
+    // Lines that don't fit in the ring, or go over a state's rate, are dropped and counted instead of holding up the state
+    namespace Log {
+        enum class level : uint8_t {
+            debug,
+            info,
+            warn,
+            error,
+            none
+        };
+
+        struct log_stats {
+            uint64_t written = 0;
+            uint64_t dropped = 0; // the writing thread's ring was full
+            uint64_t limited = 0; // over the rate of the state writing them
+        };
+
+        // Lines below this level are skipped, print logs at info
+        extern void set_level(level minimum);
+        extern level get_level();
+
+        // Lines per second each state may log, burst is how many it can save up (defaults to a second's worth), 0 is unlimited
+        extern void set_rate(double lines, double burst = 0);
+
+        // Lines each thread can have waiting on the writer, only rings made afterwards pick it up
+        extern void set_capacity(size_t lines);
+
+        // Writes into a file instead of stdout, once it grows past size bytes it's moved to path.1 (and so on, up to keep), empty goes back to stdout
+        extern bool set_file(std::string path, size_t size = 0, size_t keep = 0);
+
+        extern void write(level severity, std::string_view source, std::string_view text);
+
+        // Writes out whatever is waiting right away
+        extern void flush();
+
+        extern log_stats get_stats();
+
+        extern void push(API::lua_State* L, UMODULE hndle);
+        extern void api();
+    }
+
     // This is used to track lua_State's by name.
     // TODO: Probably need to add some spinning locks here for the upcoming multi-threaded lua_State's
     namespace Tracker {
@@ -781,9 +871,63 @@ namespace INTERSTELLAR_NAMESPACE {
             return lhs.pointer == rhs.pointer;
         }
 
+        // Used to hand threaded states to the executor when there is work for them
+        struct state_waker {
+            std::mutex mutex;
+            std::chrono::steady_clock::time_point deadline;
+            bool pending = false;
+            bool queued = false;
+        };
+
+        // Deferred function references, pushed onto from any thread and drained whole by the state itself
+        struct defer_node {
+            defer_node* next;
+            int reference;
+        };
+
+        struct defer_queue {
+            std::atomic<defer_node*> head = nullptr;
+            defer_node* carried = nullptr; // left over from a drain that ran out of tick budget, only touched by the state
+            std::atomic<uint64_t> pushed = 0;
+            uint64_t drained = 0;
+            uint64_t drains = 0;
+            uint64_t batch_max = 0;
+            ~defer_queue();
+        };
+
+        // Work finished off the state's thread, posted from anywhere and completed by the state itself during its tick
+        // Anything still queued when the state closes is deleted without completing, so it must not hold onto lua
+        struct completion {
+            completion* next = nullptr;
+            virtual ~completion() = default;
+            virtual void complete(API::lua_State* L) = 0;
+        };
+
+        struct completion_queue {
+            std::atomic<completion*> head = nullptr;
+            completion* carried = nullptr; // left over from a drain that ran out of tick budget, only touched by the state
+            std::atomic<uint64_t> posted = 0;
+            uint64_t completed = 0;
+            ~completion_queue();
+        };
+
+        // Rate of lines a state may log, only touched by whoever holds the state
+        struct log_bucket {
+            double tokens = 0;
+            std::chrono::steady_clock::time_point refill;
+            bool primed = false;
+        };
+
+        struct state_allocator;
+
         struct state_tracking {
             std::string name;
             std::shared_ptr<std::mutex> mutex;
+            std::shared_ptr<state_waker> waker;
+            std::shared_ptr<defer_queue> defers;
+            std::shared_ptr<completion_queue> completions;
+            std::shared_ptr<state_allocator> allocator; // set when the state is tracked, so ticks skip the allocator lookup
+            log_bucket logging;
             state_union state;
             std::vector<state_union> children;
             state_union parent;
@@ -791,16 +935,70 @@ namespace INTERSTELLAR_NAMESPACE {
             bool internal;
         };
 
+        // Immutable view of every tracked state, swapped out as a whole when states open or close
+        struct state_registry {
+            std::unordered_map<uintptr_t, std::shared_ptr<state_tracking>> mapping;
+            std::unordered_map<std::string, std::shared_ptr<state_tracking>> imapping;
+        };
+
+        // Writer side statistics of the registry, times are in nanoseconds
+        struct registry_stats {
+            uint64_t writes = 0;
+            uint64_t contended = 0;
+            uint64_t hold = 0;
+            uint64_t hold_max = 0;
+        };
+
+        // Root thread handing global_mtx over to callers from other threads, times are in nanoseconds
+        struct handoff_stats {
+            uint64_t ticks = 0;
+            uint64_t served = 0;
+            uint64_t last = 0;
+            uint64_t total = 0;
+            uint64_t max = 0;
+        };
+
+        // Allocator a state runs on, both carve small blocks out of chunks and reuse freed ones by size class
+        // Pool covers blocks up to 512 bytes, arena up to 8KB and grows its most recent block in place (string builders, short-lived sandboxes)
+        // Chunks are only given back when the state closes, so a state keeps the footprint of its peak
+        enum class alloc_policy : uint8_t {
+            system,
+            pool,
+            arena
+        };
+
+        // Allocation accounting of a state in bytes, quotas of 0 are unlimited
+        struct memory_stats {
+            bool tracked = false;
+            alloc_policy policy = alloc_policy::system;
+            size_t used = 0;
+            size_t peak = 0;
+            size_t reserved = 0; // chunks held by pool or arena
+            size_t soft = 0;
+            size_t hard = 0;
+            uint64_t allocations = 0;
+            uint64_t failures = 0; // refused by the hard quota or out of memory
+            uint64_t overdrawn = 0; // let past the hard quota because nothing would have caught the error
+            uint64_t pressured = 0; // times the soft quota forced a collection
+        };
+
         typedef void (*lua_Closure) (API::lua_State* L);
 
         extern void increment();
         extern void decrement();
         extern void runtime();
+
+        // Limits how many waiting callers get through per runtime (0 = all) and how often to spin before parking
+        // Callers are let in by the root thread, the rest wait in increment for the next runtime
+        extern void set_handoff(unsigned int batch, unsigned int spin = 0);
+        extern handoff_stats get_handoff();
+
         extern uintptr_t id(API::lua_State* L);
-        extern state_tracking* get_tracker(API::lua_State* L);
-        extern state_tracking* get_tracker(void* L);
-        extern state_tracking* get_tracker(uintptr_t L);
-        extern state_tracking* get_tracker(std::string name);
+        // Shares ownership so the tracker outlives a concurrent close for as long as the caller holds it
+        extern std::shared_ptr<state_tracking> get_tracker(API::lua_State* L);
+        extern std::shared_ptr<state_tracking> get_tracker(void* L);
+        extern std::shared_ptr<state_tracking> get_tracker(uintptr_t L);
+        extern std::shared_ptr<state_tracking> get_tracker(std::string name);
         extern API::lua_State* is_state(API::lua_State* L);
         extern API::lua_State* is_state(uintptr_t L);
         extern API::lua_State* is_state(void* L);
@@ -829,12 +1027,23 @@ namespace INTERSTELLAR_NAMESPACE {
         extern bool should_lock(API::lua_State* target, API::lua_State* source);
         extern std::string get_name(API::lua_State* L);
         extern std::vector<std::pair<std::string, API::lua_State*>> get_states();
+        extern std::shared_ptr<const state_registry> snapshot();
+        extern registry_stats get_stats();
         extern std::unique_lock<std::mutex> lock(API::lua_State* L);
         extern std::unique_lock<std::mutex> lock(void* L);
         extern std::unique_lock<std::mutex> lock(uintptr_t L);
         extern std::unique_lock<std::mutex> lock(std::string name);
         extern void cross_lock(API::lua_State* target, API::lua_State* source);
         extern void cross_unlock(API::lua_State* target, API::lua_State* source);
+        extern void wake(API::lua_State* L);
+        extern void wake(void* L);
+        extern void wake(uintptr_t L);
+        extern void wake(std::string name);
+
+        // Hands the completion to the state's queue and wakes it, if the state is gone it is deleted and false is returned
+        extern bool post(uintptr_t L, completion* work);
+        extern bool post(API::lua_State* L, completion* work);
+        extern void sleep(API::lua_State* L, std::chrono::steady_clock::time_point until);
         extern void listen(API::lua_State* L, std::string name, bool internal = false, API::lua_State* parent = nullptr);
         extern void listen(API::lua_State* L, std::string name, std::shared_ptr<std::mutex> guard, bool internal = false, API::lua_State* parent = nullptr);
         extern void destroy(API::lua_State* L);
@@ -845,45 +1054,163 @@ namespace INTERSTELLAR_NAMESPACE {
         extern void post_remove(API::lua_State* L);
         extern void on_open(std::string name, lua_Closure callback);
         extern void on_close(std::string name, lua_Closure callback);
+
+        // Puts L on an accounting allocator, best done right after the state is created, dropped by post_remove
+        // Going over the soft quota collects on the state's next tick, going over the hard quota fails the allocation
+        // Only allocations under a pcall, cpcall or resume are failed, elsewhere the error would panic so they go through and collect next tick
+        extern bool allocator(API::lua_State* L, alloc_policy policy, size_t soft = 0, size_t hard = 0);
+        extern bool set_quota(API::lua_State* L, size_t soft, size_t hard);
+        extern memory_stats get_memory(API::lua_State* L);
+        extern std::vector<std::pair<std::string, memory_stats>> get_memory();
+        extern void relieve(API::lua_State* L);
+        extern void relieve(API::lua_State* L, state_tracking& tracker);
         extern inline void init();
     }
 
     // Responsible for tracking and handling metatables with userdatas
     // (Not made to replace already known class implementations)
     namespace Class {
+        // Class types are interned from their names and are the same in every state
+        typedef uint32_t class_type;
+
         struct class_udata {
             void* data;
-            unsigned char type;
+            class_type type;
         };
 
         struct class_store {
             std::string name = "";
-            unsigned char type = 0;
+            class_type type = 0;
             int reference = 0;
         };
 
+        extern class_type intern(std::string name);
+        extern std::string nameof(class_type type);
         extern bool existsbyname(API::lua_State* L, std::string name);
         extern class_store getbyname(API::lua_State* L, std::string name);
-        extern bool existsbytype(API::lua_State* L, unsigned char type);
-        extern class_store getbytype(API::lua_State* L, unsigned char type);
+        extern bool existsbytype(API::lua_State* L, class_type type);
+        extern class_store getbytype(API::lua_State* L, class_type type);
         extern bool existsbyreference(API::lua_State* L, int reference);
         extern class_store getbyreference(API::lua_State* L, int reference);
-        extern unsigned char create(API::lua_State* L, std::string name);
+        extern class_type create(API::lua_State* L, std::string name);
         extern void inherits(API::lua_State* L, std::string name, int index = -1);
-        extern bool metatable(API::lua_State* L, unsigned char type);
+        extern bool metatable(API::lua_State* L, class_type type);
         extern bool metatable(API::lua_State* L, std::string name);
-        extern void spawn(API::lua_State* L, void* data, unsigned char type);
-        extern void spawn_weak(API::lua_State* L, void* data, unsigned char type);
-        extern void spawn_store(API::lua_State* L, void* data, unsigned char type);
+        extern void spawn(API::lua_State* L, void* data, class_type type);
+        extern void spawn_weak(API::lua_State* L, void* data, class_type type);
+        extern void spawn_store(API::lua_State* L, void* data, class_type type);
         extern void spawn(API::lua_State* L, void* data, std::string name);
         extern void spawn_weak(API::lua_State* L, void* data, std::string name);
         extern void spawn_store(API::lua_State* L, void* data, std::string name);
-        extern bool is(API::lua_State* L, int index, unsigned char type);
+        extern bool is(API::lua_State* L, int index, class_type type);
         extern bool is(API::lua_State* L, int index, std::string name);
         extern void* to(API::lua_State* L, int index);
-        extern void* check(API::lua_State* L, int index, unsigned char type);
+        extern void* check(API::lua_State* L, int index, class_type type);
         extern void* check(API::lua_State* L, int index, std::string name);
         extern void cleanup(API::lua_State* L);
+
+        // Binds a C++ type to a class, so lookups skip the name entirely
+        template <typename T>
+        struct ClassTag {
+            static inline std::atomic<class_type> type = 0;
+
+            static class_type bind(std::string name) {
+                class_type interned = intern(name);
+                type.store(interned, std::memory_order_relaxed);
+                return interned;
+            }
+
+            static class_type get() {
+                return type.load(std::memory_order_relaxed);
+            }
+        };
+
+        // Userdata that holds the object itself right after its header, so there is one allocation per object
+        template <typename T>
+        struct class_inline {
+            class_udata header;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        // lua only guarantees this much alignment for userdata, anything stricter stays on the heap
+        constexpr size_t inline_alignment = 8;
+
+        // __gc for classes made through create<T>, handles both inline and heap objects
+        template <typename T>
+        int destroy(API::lua_State* L) {
+            if (!is(L, 1, ClassTag<T>::get())) return 0;
+
+            class_udata* udata = (class_udata*)API::lua::touserdata(L, 1);
+            if (udata->data == nullptr) return 0;
+
+            if constexpr (alignof(T) <= inline_alignment) {
+                if (udata->data == (void*)((class_inline<T>*)udata)->storage) {
+                    ((T*)udata->data)->~T();
+                    udata->data = nullptr;
+                    return 0;
+                }
+            }
+
+            delete (T*)udata->data;
+            udata->data = nullptr;
+            return 0;
+        }
+
+        // Creates the class's metatable with a generated __gc, leaving it on the stack like create
+        template <typename T>
+        class_type create(API::lua_State* L, std::string name) {
+            ClassTag<T>::bind(name);
+            class_type type = create(L, name);
+
+            API::lua::pushcfunction(L, destroy<T>);
+            API::lua::setfield(L, -2, "__gc");
+
+            return type;
+        }
+
+        // Constructs T inside the userdata it is pushed as, the class must already exist through create<T>
+        template <typename T, typename... Args>
+        T* emplace(API::lua_State* L, Args&&... args) {
+            class_type type = ClassTag<T>::get();
+            T* object;
+
+            if constexpr (alignof(T) <= inline_alignment) {
+                class_inline<T>* udata = (class_inline<T>*)API::lua::newuserdata(L, sizeof(class_inline<T>));
+                object = new (udata->storage) T(std::forward<Args>(args)...);
+                udata->header = { object, type };
+            }
+            else {
+                class_udata* udata = (class_udata*)API::lua::newuserdata(L, sizeof(class_udata));
+                object = new T(std::forward<Args>(args)...);
+                *udata = { object, type };
+            }
+
+            if (metatable(L, type)) {
+                API::lua::setmetatable(L, -2);
+            }
+
+            return object;
+        }
+
+        template <typename T>
+        bool is(API::lua_State* L, int index) {
+            return is(L, index, ClassTag<T>::get());
+        }
+
+        template <typename T>
+        T* to(API::lua_State* L, int index) {
+            return (T*)to(L, index);
+        }
+
+        template <typename T>
+        T* check(API::lua_State* L, int index) {
+            return (T*)check(L, index, ClassTag<T>::get());
+        }
+
+        template <typename T>
+        void spawn(API::lua_State* L, T* data) {
+            spawn(L, (void*)data, ClassTag<T>::get());
+        }
     }
 
     // Responsible for what context we execute in & provide
@@ -897,6 +1224,118 @@ namespace INTERSTELLAR_NAMESPACE {
             typedef void (*lua_Task_Error) (API::lua_State* L, std::string error);
             extern void add_error(std::string name, lua_Task_Error callback);
             extern void remove_error(std::string name);
+
+            // Sets the default think interval (in seconds) of threaded states
+            extern void set_interval(double interval);
+
+            // Sets the think interval (in seconds) of a threaded state
+            extern void set_interval(API::lua_State* L, double interval);
+
+            // Pauses of the collection steps taken at the end of ticks, times are in milliseconds
+            struct gc_stats {
+                double budget = 0;
+                int step = 0; // kilobytes per step
+                double rate = 0; // kilobytes allocated per second
+                uint64_t steps = 0;
+                uint64_t cycles = 0;
+                double total = 0;
+                double max = 0;
+                double p50 = 0;
+                double p90 = 0;
+                double p99 = 0;
+                std::vector<uint64_t> buckets; // bucket i counts pauses under 2^i microseconds, the last one counts the rest
+            };
+
+            // Sets the default time (in seconds) every tick may spend collecting, 0 leaves collection to lua
+            extern void set_gc(double budget);
+
+            // Sets the time (in seconds) a state's ticks may spend collecting, the step size follows its allocation rate
+            extern void set_gc(API::lua_State* L, double budget);
+            extern gc_stats get_gc(API::lua_State* L);
+
+            // Sets the default time (in seconds) a tick may run its defers, timers & think for, 0 is unbounded
+            // The clock is checked every so many instructions, what doesn't fit is left for the next tick
+            extern void set_budget(double budget, int instructions = 1000);
+
+            // Sets the tick budget of a state, yielding parks a callback that runs over and resumes it next tick instead of aborting it
+            // A callback caught inside a C frame that can't be yielded across is still aborted
+            extern void set_budget(API::lua_State* L, double budget, bool yield = false);
+
+            // A hook as luajit holds it
+            struct hook_entry {
+                API::lua_Hook hook = nullptr;
+                int mask = 0;
+                int count = 0;
+            };
+
+            // The hook of L as the tick budget sees it, while the budget is armed the hook set here is chained behind it and put back after the tick
+            extern hook_entry get_hook(API::lua_State* L);
+            extern void set_hook(API::lua_State* L, hook_entry entry);
+
+            // True when L is a coroutine started by task.async, async functions called without a callback should return an awaitable then
+            extern bool awaiting(API::lua_State* L);
+
+            // Pushes an awaitable and returns a reference that takes the place of a callback's, calling it with results resumes whoever awaits it
+            extern int awaitable(API::lua_State* L);
+
+            // Completes an awaitable with nil & the error, for failures that never reach the callback, anything else is left alone
+            extern void reject(API::lua_State* L, int reference, std::string error);
+
+            // Calls the function at index once after delay (in seconds) from the state's tick, returns an id to cancel it with
+            extern uint64_t delay(API::lua_State* L, double delay, int index);
+            extern bool cancel(API::lua_State* L, uint64_t timer);
+        }
+
+        // Multiplexes threaded states onto a fixed pool of workers
+        namespace Executor {
+            // Sets the amount of workers, 0 picks the hardware concurrency (only before the first threaded state opens)
+            extern void set_workers(unsigned int count);
+            extern unsigned int get_workers();
+        }
+
+        // Process wide threads for blocking work (file access, compression, requests) so modules never spawn their own
+        // Each class has its own queue & threads, which are started as work arrives and then kept around
+        namespace Jobs {
+            enum class kind : uint8_t {
+                io,
+                cpu,
+                network,
+                stream // long running network work, kept apart so it can't hold up requests
+            };
+
+            // Queued work is picked up from the highest priority first
+            enum class priority : uint8_t {
+                high,
+                normal,
+                low
+            };
+
+            typedef std::function<void()> job;
+
+            struct job_stats {
+                unsigned int threads = 0;
+                unsigned int running = 0; // threads started so far
+                unsigned int busy = 0;
+                size_t queued = 0;
+                size_t limit = 0;
+                uint64_t completed = 0;
+                uint64_t overflowed = 0; // queued while already past the limit
+            };
+
+            // Sets the most threads a class may start, 0 picks its default (4 for io, hardware concurrency for cpu, 8 for network, 16 for stream)
+            extern void set_threads(kind type, unsigned int count);
+            extern unsigned int get_threads(kind type);
+
+            // Sets how much queued work a class is expected to hold, 0 is unbounded
+            // Work past it still queues rather than running on the submitter (usually a state's own thread), it is counted as overflowed instead
+            extern void set_limit(kind type, size_t limit);
+            extern size_t get_limit(kind type);
+
+            // Queues work onto a class, false if the queue was already past its limit
+            extern bool submit(kind type, job work, priority level = priority::normal);
+
+            extern job_stats get_stats(kind type);
+            extern const char* name(kind type);
         }
         
         extern void on_threaded(std::string name, lua_Threaded callback);
@@ -906,18 +1345,86 @@ namespace INTERSTELLAR_NAMESPACE {
         extern int transfer_table(API::lua_State* from, API::lua_State* to, int source, bool no_error = false);
         extern int transfer(API::lua_State* from, API::lua_State* to, int index, bool no_error = false);
 
+        // Encodes a value into a flat buffer that any state can decode later, returns the unsupported datatype on failure
+        extern int encode(API::lua_State* L, int index, std::string& buffer);
+
+        // Decodes a buffer made by encode, pushing the value onto the stack, string is returned if there is an error
+        extern std::string decode(API::lua_State* L, const std::string& buffer);
+
+        // Freezes the table at index into one immutable copy shared by every state, pushing a read-only proxy to it
+        // Giving it a name publishes it for frozen(), string is returned if there is an error
+        extern std::string freeze(API::lua_State* L, int index, std::string name = "");
+
+        // Pushes the frozen table published under name, false if there is none
+        extern bool frozen(API::lua_State* L, std::string name);
+
+        // Unpublishes a frozen table, it is released once no proxy refers to it anymore
+        extern void thaw(std::string name);
+
+        // Caches function bytecode moved between states
+        namespace Bytecode {
+            struct cache_stats {
+                uint64_t dump_hits = 0;
+                uint64_t dump_misses = 0;
+                uint64_t load_hits = 0;
+                uint64_t load_misses = 0;
+                uint64_t evictions = 0;
+                size_t size = 0;
+                uint64_t compile_hits = 0;
+                uint64_t compile_disk_hits = 0;
+                uint64_t compile_misses = 0;
+                uint64_t compile_rejected = 0;
+                uint64_t compile_saved = 0; // microseconds of parsing skipped
+                size_t compiled = 0;
+            };
+
+            // Sets how many functions are kept (per target state for loads) before evicting, 0 disables caching
+            extern void set_limit(size_t limit);
+            extern size_t get_limit();
+            extern cache_stats get_stats();
+
+            // Caches compile & execute output by source, chunk name and engine build, off by default
+            extern void set_compile(bool enabled);
+
+            // Also keeps compiled bytecode under this directory across runs, empty keeps it in memory only
+            extern bool set_directory(std::string path);
+
+            // Same as luaL::loadbufferx on source, but goes through the compile cache when it's enabled
+            extern int loadbuffer(API::lua_State* L, const std::string& source, const std::string& name);
+        }
+
         // Compiles lua to a function, pushing it onto the stack, string is returned if there is an error
         extern std::string compile(API::lua_State* L, std::string source, std::string name);
 
         // Compiles & executes lua, string is returned if there is an error
         extern std::string execute(API::lua_State* L, std::string source, std::string name);
 
-        // Opens a new lua_State
-        extern API::lua_State* open(std::string name, bool internal = false, bool threaded = false, API::lua_State* parent = nullptr);
+        // Opens a new lua_State, quotas are in bytes (0 is unlimited)
+        extern API::lua_State* open(std::string name, bool internal = false, bool threaded = false, API::lua_State* parent = nullptr, Tracker::alloc_policy policy = Tracker::alloc_policy::system, size_t soft = 0, size_t hard = 0);
 
         // Closes a lua_State
         extern void close(API::lua_State* L);
 
+        // Pre-creates states in the background for open to take from
+        namespace Pool {
+            // Open latency in milliseconds, over the most recent opens
+            struct open_latency {
+                uint64_t count = 0;
+                double p50 = 0;
+                double p90 = 0;
+                double p99 = 0;
+                double max = 0;
+            };
+
+            // Sets how many states are kept ready, 0 disables pooling
+            extern void set_size(size_t size);
+            extern size_t get_size();
+            extern size_t get_ready();
+
+            // Latency of opens served from the pool, or created on the spot
+            extern open_latency get_latency(bool pooled);
+        }
+
         typedef void (*lua_CPush) (API::lua_State* L, UMODULE hndle);
 
         // Adds a cfunction to the API stack
@@ -927,7 +1434,13 @@ namespace INTERSTELLAR_NAMESPACE {
         extern void add(std::string name, lua_CPush callback);
 
         // Pushes the API interface, you can technically call this anywhere
+        // Libraries are built the first time they're read through the global table's __index, so until then pairs, next & rawget on _G don't see them
         extern void push(API::lua_State* L);
+
+        // Builds every library that hasn't been read yet, for states that walk their globals with pairs or rawget
+        // The lazy __index lives on _G's metatable, so a script that replaces it (setmetatable(_G, ...)) loses every library it hadn't read yet
+        // Call this after push for states that are allowed to do that
+        extern void build(API::lua_State* L);
     }
 
     // Initializes and calls Internal's fetch API, returns a number for failure
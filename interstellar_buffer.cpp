@@ -15,7 +15,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             push_buffer(L, lua::tocstring(L, 1));
             return 1;
         }
-        else if (Class::is(L, 1, "buffer")) {
+        else if (Class::is<Buffer>(L, 1)) {
             push_buffer(L, (Buffer*)Class::to(L, 1));
             return 1;
         }
@@ -28,19 +28,19 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     // Basics
 
     int buffer_size(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushnumber(L, data->size());
         return 1;
     }
 
     int buffer_peek(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushnumber(L, static_cast<uint8_t>(data->peek(luaL::checknumber(L, 2))));
         return 1;
     }
 
     int buffer_insert(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         uint64_t idx = luaL::checknumber(L, 2);
 
         for (int i = 3; i <= lua::gettop(L); i++) {
@@ -52,7 +52,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_push(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         for (int i = lua::gettop(L); i >= 2; i--) {
             uint8_t v = luaL::checknumber(L, i);
@@ -63,7 +63,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_push_back(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         size_t size = lua::gettop(L);
         for (int i = 2; i <= size; i++) {
@@ -75,25 +75,25 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_remove(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushnumber(L, static_cast<uint8_t>(data->remove(luaL::checknumber(L, 2))));
         return 1;
     }
 
     int buffer_shift(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushnumber(L, static_cast<uint8_t>(data->shift()));
         return 1;
     }
 
     int buffer_pop(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushnumber(L, static_cast<uint8_t>(data->pop()));
         return 1;
     }
 
     int buffer_substitute(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         long long begin = luaL::checknumber(L, 2);
         long long end = -1;
         if (lua::isnumber(L, 3)) {
@@ -106,7 +106,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_concat(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         Buffer* other = nullptr;
         if (lua::isnumber(L, 2)) {
@@ -115,7 +115,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
         else if (lua::isstring(L, 2)) {
             other = new Buffer(lua::tocstring(L, 2));
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             other = new Buffer((Buffer*)Class::to(L, 2));
         }
 
@@ -134,7 +134,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_arithmetic_add(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->arithmetic_add(lua::tonumber(L, 2)));
@@ -144,7 +144,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             push_buffer(L, data->arithmetic_add(lua::tocstring(L, 2)));
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             push_buffer(L, data->arithmetic_add((Buffer*)Class::to(L, 2)));
             return 1;
         }
@@ -156,7 +156,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_arithmetic_sub(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->arithmetic_sub(lua::tonumber(L, 2)));
@@ -166,7 +166,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             push_buffer(L, data->arithmetic_sub(lua::tocstring(L, 2)));
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             push_buffer(L, data->arithmetic_sub((Buffer*)Class::to(L, 2)));
             return 1;
         }
@@ -178,7 +178,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_arithmetic_mul(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->arithmetic_mul(lua::tonumber(L, 2)));
@@ -188,7 +188,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             push_buffer(L, data->arithmetic_mul(lua::tocstring(L, 2)));
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             push_buffer(L, data->arithmetic_mul((Buffer*)Class::to(L, 2)));
             return 1;
         }
@@ -200,7 +200,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_arithmetic_div(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->arithmetic_div(lua::tonumber(L, 2)));
@@ -210,7 +210,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             push_buffer(L, data->arithmetic_div(lua::tocstring(L, 2)));
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             push_buffer(L, data->arithmetic_div((Buffer*)Class::to(L, 2)));
             return 1;
         }
@@ -222,7 +222,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_arithmetic_pow(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->arithmetic_pow(lua::tonumber(L, 2)));
@@ -233,7 +233,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             delete temp;
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             Buffer* temp = (Buffer*)Class::to(L, 2);
             push_buffer(L, data->arithmetic_pow(temp->to_integer()));
             return 1;
@@ -248,7 +248,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_equal(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         Buffer* other = nullptr;
         if (lua::isnumber(L, 2)) {
@@ -257,7 +257,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
         else if (lua::isstring(L, 2)) {
             other = new Buffer(lua::tocstring(L, 2));
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             other = new Buffer((Buffer*)Class::to(L, 2));
         }
 
@@ -274,7 +274,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_notequal(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         Buffer* other = nullptr;
         if (lua::isnumber(L, 2)) {
@@ -283,7 +283,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
         else if (lua::isstring(L, 2)) {
             other = new Buffer(lua::tocstring(L, 2));
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             other = new Buffer((Buffer*)Class::to(L, 2));
         }
 
@@ -300,7 +300,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_lessthan(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         Buffer* other = nullptr;
         if (lua::isnumber(L, 2)) {
@@ -309,7 +309,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
         else if (lua::isstring(L, 2)) {
             other = new Buffer(lua::tocstring(L, 2));
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             other = new Buffer((Buffer*)Class::to(L, 2));
         }
 
@@ -326,7 +326,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_greaterthan(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         Buffer* other = nullptr;
         if (lua::isnumber(L, 2)) {
@@ -335,7 +335,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
         else if (lua::isstring(L, 2)) {
             other = new Buffer(lua::tocstring(L, 2));
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             other = new Buffer((Buffer*)Class::to(L, 2));
         }
 
@@ -354,14 +354,14 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_bitwise_not(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         push_buffer(L, data->bitwise_not());
         return 1;
     }
 
     int buffer_bitwise_or(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->bitwise_or(lua::tonumber(L, 2)));
@@ -371,7 +371,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             push_buffer(L, data->bitwise_or(lua::tocstring(L, 2)));
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             push_buffer(L, data->bitwise_or((Buffer*)Class::to(L, 2)));
             return 1;
         }
@@ -383,7 +383,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_bitwise_and(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->bitwise_and(lua::tonumber(L, 2)));
@@ -393,7 +393,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             push_buffer(L, data->bitwise_and(lua::tocstring(L, 2)));
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             push_buffer(L, data->bitwise_and((Buffer*)Class::to(L, 2)));
             return 1;
         }
@@ -405,7 +405,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_bitwise_xor(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->bitwise_xor(lua::tonumber(L, 2)));
@@ -415,7 +415,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             push_buffer(L, data->bitwise_xor(lua::tocstring(L, 2)));
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             push_buffer(L, data->bitwise_xor((Buffer*)Class::to(L, 2)));
             return 1;
         }
@@ -427,7 +427,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_bitwise_lshift(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->bitwise_lshift(lua::tonumber(L, 2)));
@@ -438,7 +438,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             delete temp;
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             Buffer* temp = (Buffer*)Class::to(L, 2);
             push_buffer(L, data->bitwise_lshift(temp->to_integer()));
             return 1;
@@ -451,7 +451,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_bitwise_rshift(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->bitwise_rshift(lua::tonumber(L, 2)));
@@ -462,7 +462,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             delete temp;
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             Buffer* temp = (Buffer*)Class::to(L, 2);
             push_buffer(L, data->bitwise_rshift(temp->to_integer()));
             return 1;
@@ -475,7 +475,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_bitwise_rol(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->bitwise_rol(lua::tonumber(L, 2)));
@@ -486,7 +486,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             delete temp;
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             Buffer* temp = (Buffer*)Class::to(L, 2);
             push_buffer(L, data->bitwise_rol(temp->to_integer()));
             return 1;
@@ -499,7 +499,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer_bitwise_ror(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
 
         if (lua::isnumber(L, 2)) {
             push_buffer(L, data->bitwise_ror(lua::tonumber(L, 2)));
@@ -510,7 +510,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             delete temp;
             return 1;
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             Buffer* temp = (Buffer*)Class::to(L, 2);
             push_buffer(L, data->bitwise_ror(temp->to_integer()));
             return 1;
@@ -524,13 +524,13 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     // Consumers
 
     int buffer_consumers_bytes(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         push_buffer(L, data->read_bytes(luaL::checknumber(L, 2)));
         return 1;
     }
 
     int buffer_consumers_uint8(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         if (lua::isnumber(L, 2)) {
             data->write_uint8(luaL::checknumber(L, 2));
             return 0;
@@ -540,7 +540,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_consumers_int8(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         if (lua::isnumber(L, 2)) {
             data->write_int8(luaL::checknumber(L, 2));
             return 0;
@@ -550,7 +550,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_consumers_uint16(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         if (lua::isnumber(L, 2)) {
             data->write_uint16(luaL::checknumber(L, 2));
             return 0;
@@ -560,7 +560,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_consumers_int16(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         if (lua::isnumber(L, 2)) {
             data->write_int16(luaL::checknumber(L, 2));
             return 0;
@@ -570,7 +570,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_consumers_uint32(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         if (lua::isnumber(L, 2)) {
             data->write_uint32(luaL::checknumber(L, 2));
             return 0;
@@ -580,7 +580,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_consumers_int32(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         if (lua::isnumber(L, 2)) {
             data->write_int32(luaL::checknumber(L, 2));
             return 0;
@@ -590,7 +590,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_consumers_uint64(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         if (lua::isnumber(L, 2)) {
             data->write_uint64(luaL::checknumber(L, 2));
             return 0;
@@ -600,7 +600,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_consumers_int64(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         if (lua::isnumber(L, 2)) {
             data->write_int64(luaL::checknumber(L, 2));
             return 0;
@@ -610,7 +610,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_consumers_uleb128(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         if (lua::isnumber(L, 2)) {
             data->write_uleb128(luaL::checknumber(L, 2));
             return 0;
@@ -622,25 +622,25 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     // Conversions
 
     int buffer_tonumber(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushnumber(L, data->to_integer());
         return 1;
     }
 
     int buffer_tostring(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushcstring(L, data->to_string());
         return 1;
     }
 
     int buffer_tohex(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushcstring(L, data->to_hex());
         return 1;
     }
 
     int buffer_totable(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         auto vec = data->to_vector();
 
         lua::newtable(L); // TODO: use regular table creation with pre-alloc
@@ -655,7 +655,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
     }
 
     int buffer_tobinary(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         auto vec = data->to_binary();
 
         lua::newtable(L); // TODO: use regular table creation with pre-alloc
@@ -671,70 +671,62 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     // Metatable
 
-    int buffer__gc(lua_State* L) {
-        if (Class::is(L, 1, "buffer")) {
-            Buffer* data = (Buffer*)Class::to(L, 1);
-            delete data;
-        }
-        return 0;
-    }
-
     int buffer__tostring(lua_State* L) {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushcstring(L, "buffer: " + std::to_string(data->size()));
         return 1;
     }
 
     int buffer__len(lua_State* L)
     {
-        Buffer* data = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* data = Class::check<Buffer>(L, 1);
         lua::pushnumber(L, data->size());
         return 1;
     }
 
     int buffer__add(lua_State* L)
     {
-        Buffer* a = (Buffer*)Class::check(L, 1, "buffer");
-        Buffer* b = (Buffer*)Class::check(L, 2, "buffer");
+        Buffer* a = Class::check<Buffer>(L, 1);
+        Buffer* b = Class::check<Buffer>(L, 2);
         push_buffer(L, a->arithmetic_add(b));
         return 1;
     }
 
     int buffer__sub(lua_State* L)
     {
-        Buffer* a = (Buffer*)Class::check(L, 1, "buffer");
-        Buffer* b = (Buffer*)Class::check(L, 2, "buffer");
+        Buffer* a = Class::check<Buffer>(L, 1);
+        Buffer* b = Class::check<Buffer>(L, 2);
         push_buffer(L, a->arithmetic_sub(b));
         return 1;
     }
 
     int buffer__mul(lua_State* L)
     {
-        Buffer* a = (Buffer*)Class::check(L, 1, "buffer");
-        Buffer* b = (Buffer*)Class::check(L, 2, "buffer");
+        Buffer* a = Class::check<Buffer>(L, 1);
+        Buffer* b = Class::check<Buffer>(L, 2);
         push_buffer(L, a->arithmetic_mul(b));
         return 1;
     }
 
     int buffer__div(lua_State* L)
     {
-        Buffer* a = (Buffer*)Class::check(L, 1, "buffer");
-        Buffer* b = (Buffer*)Class::check(L, 2, "buffer");
+        Buffer* a = Class::check<Buffer>(L, 1);
+        Buffer* b = Class::check<Buffer>(L, 2);
         push_buffer(L, a->arithmetic_div(b));
         return 1;
     }
 
     int buffer__pow(lua_State* L)
     {
-        Buffer* a = (Buffer*)Class::check(L, 1, "buffer");
-        Buffer* b = (Buffer*)Class::check(L, 2, "buffer");
+        Buffer* a = Class::check<Buffer>(L, 1);
+        Buffer* b = Class::check<Buffer>(L, 2);
         push_buffer(L, a->arithmetic_pow(b->to_integer()));
         return 1;
     }
 
     int buffer__concat(lua_State* L)
     {
-        Buffer* a = (Buffer*)Class::check(L, 1, "buffer");
+        Buffer* a = Class::check<Buffer>(L, 1);
 
         Buffer* b = nullptr;
         if (lua::isnumber(L, 2)) {
@@ -743,7 +735,7 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
         else if (lua::isstring(L, 2)) {
             b = new Buffer(lua::tocstring(L, 2));
         }
-        else if (Class::is(L, 2, "buffer")) {
+        else if (Class::is<Buffer>(L, 2)) {
             b = new Buffer((Buffer*)Class::to(L, 2));
         }
 
@@ -760,32 +752,32 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
 
     int buffer__eq(lua_State* L)
     {
-        Buffer* a = (Buffer*)Class::check(L, 1, "buffer");
-        Buffer* b = (Buffer*)Class::check(L, 2, "buffer");
+        Buffer* a = Class::check<Buffer>(L, 1);
+        Buffer* b = Class::check<Buffer>(L, 2);
         lua::pushboolean(L, a->is_equal(b));
         return 1;
     }
 
     int buffer__lt(lua_State* L)
     {
-        Buffer* a = (Buffer*)Class::check(L, 1, "buffer");
-        Buffer* b = (Buffer*)Class::check(L, 2, "buffer");
+        Buffer* a = Class::check<Buffer>(L, 1);
+        Buffer* b = Class::check<Buffer>(L, 2);
         lua::pushboolean(L, a->is_lessthan(b));
         return 1;
     }
 
     int buffer__le(lua_State* L)
     {
-        Buffer* a = (Buffer*)Class::check(L, 1, "buffer");
-        Buffer* b = (Buffer*)Class::check(L, 2, "buffer");
+        Buffer* a = Class::check<Buffer>(L, 1);
+        Buffer* b = Class::check<Buffer>(L, 2);
         lua::pushboolean(L, a->is_lessthan(b) || a->is_equal(b));
         return 1;
     }
 
-    void push_buffer_internal(lua_State* L, Buffer* data)
+    void push_buffer_class(lua_State* L)
     {
-        if (!Class::existsbyname(L, "buffer")) {
-            Class::create(L, "buffer");
+        if (!Class::existsbytype(L, Class::ClassTag<Buffer>::get())) {
+            Class::create<Buffer>(L, "buffer");
 
             lua::newtable(L);
 
@@ -965,50 +957,42 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
             lua::pushcfunction(L, buffer__le);
             lua::setfield(L, -2, "__le");
 
-            lua::pushcfunction(L, buffer__gc);
-            lua::setfield(L, -2, "__gc");
-
             lua::pushcfunction(L, buffer__tostring);
             lua::setfield(L, -2, "__tostring");
 
             lua::pop(L);
         }
-
-        Class::spawn(L, new Buffer(data), "buffer");
     }
 
     // TODO: Use generics later on for this..?
     void push_buffer(lua_State* L, Buffer* data)
     {
-        push_buffer_internal(L, data);
+        push_buffer_class(L);
+        Class::emplace<Buffer>(L, data);
     }
 
     void push_buffer(lua_State* L, long long data)
     {
-        Buffer* temp = new Buffer(data);
-        push_buffer_internal(L, temp);
-        delete temp;
+        push_buffer_class(L);
+        Class::emplace<Buffer>(L, data);
     }
 
     void push_buffer(lua_State* L, std::vector<std::byte> data)
     {
-        Buffer* temp = new Buffer(data);
-        push_buffer_internal(L, temp);
-        delete temp;
+        push_buffer_class(L);
+        Class::emplace<Buffer>(L, data);
     }
 
     void push_buffer(lua_State* L, std::vector<bool> data)
     {
-        Buffer* temp = new Buffer(data);
-        push_buffer_internal(L, temp);
-        delete temp;
+        push_buffer_class(L);
+        Class::emplace<Buffer>(L, data);
     }
 
     void push_buffer(lua_State* L, std::string data)
     {
-        Buffer* temp = new Buffer(data);
-        push_buffer_internal(L, temp);
-        delete temp;
+        push_buffer_class(L);
+        Class::emplace<Buffer>(L, data);
     }
 
     int buffer_fromnumber(lua_State* L)
@@ -1104,29 +1088,23 @@ namespace INTERSTELLAR_NAMESPACE::Buffer {
         return 1;
     }
 
+    static constexpr luaL_Reg buffer_functions[] = {
+        { "new", buffer_new },
+        { "hex", buffer_fromhex },
+        { "string", buffer_fromstring },
+        { "number", buffer_fromnumber },
+        { "bytes", buffer_frombytes },
+        { "binary", buffer_frombinary },
+        { nullptr, nullptr }
+    };
+
     void push(lua_State* L, UMODULE hndle)
     {
         lua::newtable(L);
 
         // TODO: we should have C++'s sizeof for different datatypes as static enums
 
-        lua::pushcfunction(L, buffer_new);
-        lua::setfield(L, -2, "new");
-
-        lua::pushcfunction(L, buffer_fromhex);
-        lua::setfield(L, -2, "hex");
-
-        lua::pushcfunction(L, buffer_fromstring);
-        lua::setfield(L, -2, "string");
-
-        lua::pushcfunction(L, buffer_fromnumber);
-        lua::setfield(L, -2, "number");
-
-        lua::pushcfunction(L, buffer_frombytes);
-        lua::setfield(L, -2, "bytes");
-
-        lua::pushcfunction(L, buffer_frombinary);
-        lua::setfield(L, -2, "binary");
+        luaL::makelib(L, nullptr, buffer_functions);
     }
 
     void api() {
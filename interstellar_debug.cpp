@@ -6,6 +6,10 @@
 #include <sstream>
 #include <iomanip>
 #include <atomic>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <algorithm>
 
 namespace INTERSTELLAR_NAMESPACE::Debug {
     using namespace API;
@@ -1103,6 +1107,341 @@ namespace INTERSTELLAR_NAMESPACE::Debug {
         }
     }
 
+    // Samples the running lua stack from a count hook, the hook reads the clock and only walks the stack once the interval is up
+    // Hooks belong to the whole state (every coroutine shares them), so profiles are kept per global state
+    namespace Profiler {
+        static const int max_depth = 128;
+
+        struct stack_hash {
+            size_t operator()(const std::vector<uint32_t>& stack) const
+            {
+                uint64_t hash = 14695981039346656037ull;
+                for (uint32_t frame : stack) {
+                    hash ^= frame;
+                    hash *= 1099511628211ull;
+                }
+                return (size_t)hash;
+            }
+        };
+
+        struct profile {
+            bool enabled = false;
+            std::chrono::steady_clock::duration interval;
+            std::chrono::steady_clock::time_point next;
+            std::chrono::steady_clock::time_point started;
+            std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::duration::zero();
+            std::atomic<std::chrono::steady_clock::rep> spent = 0; // every hook call counts, not only the ones that sample
+            std::atomic<bool> closed = false;
+            Reflection::Task::hook_entry chained; // whatever hook was there when we started, still sees the events it asked for
+            int instructions = 1000;
+            uint64_t samples = 0;
+            uint64_t truncated = 0;
+
+            // frames are interned by prototype (or C function), named the first time they are seen
+            std::unordered_map<const void*, uint32_t> interned;
+            std::vector<std::string> frames;
+            std::unordered_map<std::vector<uint32_t>, uint64_t, stack_hash> stacks;
+        };
+
+        std::mutex profiles_mutex;
+        std::unordered_map<Engine::global_State*, std::shared_ptr<profile>> profiles;
+
+        // The hook runs every few instructions, so it keeps the last profile it found per thread instead of looking it up under the lock
+        struct hook_cache {
+            Engine::global_State* global = nullptr;
+            std::shared_ptr<profile> target;
+        };
+
+        static thread_local hook_cache cached;
+
+        Engine::global_State* global(lua_State* L)
+        {
+            using namespace Engine;
+            return G(L);
+        }
+
+        std::string label(lua_State* L, int level)
+        {
+            lua_Debug ar;
+            if (!lua::getstack(L, level, &ar) || !lua::getinfo(L, "nS", &ar)) return "?";
+
+            std::string name = ar.name != nullptr ? ar.name : (strcmp(ar.what, "main") == 0 ? "main chunk" : "?");
+            if (strcmp(ar.what, "C") != 0) {
+                name += " (" + std::string(ar.short_src) + ":" + std::to_string(ar.linedefined) + ")";
+            }
+            else {
+                name += " [C]";
+            }
+
+            // semicolons separate frames in folded stacks
+            std::replace(name.begin(), name.end(), ';', ':');
+            std::replace(name.begin(), name.end(), '\n', ' ');
+            return name;
+        }
+
+        void record(lua_State* L, profile& target)
+        {
+            using namespace Engine;
+            static thread_local std::vector<uint32_t> stack;
+            stack.clear();
+
+            int level = 0;
+            for (; level < max_depth; level++) {
+                int size;
+                cTValue* frame = lj_debug_frame(L, level, &size);
+                if (!frame) break;
+                GCfunc* fn = frame_func(frame);
+                if (!fn) break;
+
+                const void* key = isluafunc(fn) ? (const void*)funcproto(fn)
+                    : isffunc(fn) ? (const void*)(uintptr_t)fn->c.ffid
+                    : (const void*)fn->c.f;
+
+                auto interned = target.interned.find(key);
+                if (interned == target.interned.end()) {
+                    interned = target.interned.emplace(key, (uint32_t)target.frames.size()).first;
+                    target.frames.push_back(label(L, level));
+                }
+                stack.push_back(interned->second);
+            }
+
+            if (stack.empty()) return;
+            if (level == max_depth) target.truncated++;
+
+            // outermost frame first, like the flamegraph tools expect
+            std::reverse(stack.begin(), stack.end());
+            target.stacks[stack]++;
+            target.samples++;
+        }
+
+        static profile* find(lua_State* L)
+        {
+            Engine::global_State* state = global(L);
+            if (cached.global == state && cached.target != nullptr && !cached.target->closed.load(std::memory_order_relaxed)) return cached.target.get();
+
+            std::lock_guard<std::mutex> guard(profiles_mutex);
+            auto iprofile = profiles.find(state);
+            cached.global = state;
+            cached.target = iprofile != profiles.end() ? iprofile->second : nullptr;
+            return cached.target.get();
+        }
+
+        void sample_hook(lua_State* L, lua_Debug* ar)
+        {
+            auto clock = std::chrono::steady_clock::now();
+            profile* target = find(L);
+            if (target == nullptr) {
+                if (Reflection::Task::get_hook(L).hook == sample_hook) Reflection::Task::set_hook(L, Reflection::Task::hook_entry());
+                return;
+            }
+
+            Reflection::Task::hook_entry chained = target->chained;
+            if (!target->enabled) {
+                // stopped while the tick budget had us chained, take ourselves off now that we're the hook again
+                if (Reflection::Task::get_hook(L).hook == sample_hook) Reflection::Task::set_hook(L, chained);
+            }
+            else if (ar->event == LUA_HOOKCOUNT && clock >= target->next) {
+                std::lock_guard<std::mutex> guard(profiles_mutex);
+
+                // samples we were too late for are skipped rather than bunched up
+                target->next = clock + target->interval;
+                record(L, *target);
+            }
+
+            target->spent.fetch_add((std::chrono::steady_clock::now() - clock).count(), std::memory_order_relaxed);
+
+            if (chained.hook != nullptr && (ar->event != LUA_HOOKCOUNT || (chained.mask & LUA_MASKCOUNT))) {
+                chained.hook(L, ar);
+            }
+        }
+
+        // Hooks are not thread safe in luajit, these must be called from the thread running the state (or with its lock held)
+        // If the tick budget is armed when starting, it is only picked back up from the next tick
+        bool start(lua_State* L, double rate, int instructions)
+        {
+            if (rate <= 0 || instructions <= 0) return false;
+
+            std::unique_lock<std::mutex> guard(profiles_mutex);
+            std::shared_ptr<profile>& entry = profiles[global(L)];
+            if (entry == nullptr) entry = std::make_shared<profile>();
+
+            profile& target = *entry;
+            if (!target.enabled) {
+                target.started = std::chrono::steady_clock::now();
+                target.next = target.started;
+
+                // a hook someone else set stays chained behind ours, like the tick budget does
+                Reflection::Task::hook_entry current = Reflection::Task::get_hook(L);
+                if (current.hook != sample_hook) target.chained = current;
+            }
+            target.enabled = true;
+            target.interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / rate));
+            target.instructions = instructions;
+
+            Reflection::Task::hook_entry hook{ sample_hook, target.chained.mask | LUA_MASKCOUNT, instructions };
+            if ((target.chained.mask & LUA_MASKCOUNT) && target.chained.count > 0) hook.count = std::min(instructions, target.chained.count);
+            guard.unlock();
+
+            Reflection::Task::set_hook(L, hook);
+            return true;
+        }
+
+        void stop(lua_State* L)
+        {
+            std::unique_lock<std::mutex> guard(profiles_mutex);
+            auto iprofile = profiles.find(global(L));
+            if (iprofile == profiles.end() || !iprofile->second->enabled) return;
+            profile& target = *iprofile->second;
+            target.enabled = false;
+            target.elapsed += std::chrono::steady_clock::now() - target.started;
+            Reflection::Task::hook_entry chained = target.chained;
+            guard.unlock();
+
+            if (Reflection::Task::get_hook(L).hook == sample_hook) Reflection::Task::set_hook(L, chained);
+        }
+
+        void reset(lua_State* L)
+        {
+            std::lock_guard<std::mutex> guard(profiles_mutex);
+            auto iprofile = profiles.find(global(L));
+            if (iprofile == profiles.end()) return;
+
+            profile& target = *iprofile->second;
+            target.samples = 0;
+            target.truncated = 0;
+            target.elapsed = std::chrono::steady_clock::duration::zero();
+            target.spent = 0;
+            target.started = std::chrono::steady_clock::now();
+            target.interned.clear();
+            target.frames.clear();
+            target.stacks.clear();
+        }
+
+        bool active(lua_State* L)
+        {
+            std::lock_guard<std::mutex> guard(profiles_mutex);
+            auto iprofile = profiles.find(global(L));
+            return iprofile != profiles.end() && iprofile->second->enabled;
+        }
+
+        std::string folded(lua_State* L)
+        {
+            std::lock_guard<std::mutex> guard(profiles_mutex);
+            auto iprofile = profiles.find(global(L));
+            if (iprofile == profiles.end()) return "";
+
+            profile& target = *iprofile->second;
+            std::string out;
+            for (auto& [stack, count] : target.stacks) {
+                for (size_t i = 0; i < stack.size(); i++) {
+                    if (i > 0) out += ";";
+                    out += target.frames[stack[i]];
+                }
+                out += " " + std::to_string(count) + "\n";
+            }
+            return out;
+        }
+
+        std::string escape(const std::string& input)
+        {
+            std::ostringstream out;
+            for (unsigned char c : input) {
+                if (c == '"' || c == '\\') out << '\\' << c;
+                else if (c < 0x20) out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+                else out << c;
+            }
+            return out.str();
+        }
+
+        std::string json(lua_State* L)
+        {
+            std::lock_guard<std::mutex> guard(profiles_mutex);
+            auto iprofile = profiles.find(global(L));
+            if (iprofile == profiles.end()) return "{\"samples\":0,\"frames\":[],\"stacks\":[]}";
+
+            profile& target = *iprofile->second;
+            auto elapsed = target.elapsed + (target.enabled ? std::chrono::steady_clock::now() - target.started : std::chrono::steady_clock::duration::zero());
+            double seconds = std::chrono::duration<double>(elapsed).count();
+
+            std::ostringstream out;
+            out << "{\"samples\":" << target.samples
+                << ",\"truncated\":" << target.truncated
+                << ",\"rate\":" << 1.0 / std::chrono::duration<double>(target.interval).count()
+                << ",\"elapsed\":" << seconds
+                << ",\"overhead\":" << (seconds > 0 ? std::chrono::duration<double>(std::chrono::steady_clock::duration(target.spent.load(std::memory_order_relaxed))).count() / seconds : 0.0)
+                << ",\"frames\":[";
+            for (size_t i = 0; i < target.frames.size(); i++) {
+                if (i > 0) out << ",";
+                out << "\"" << escape(target.frames[i]) << "\"";
+            }
+            out << "],\"stacks\":[";
+            bool first = true;
+            for (auto& [stack, count] : target.stacks) {
+                if (!first) out << ",";
+                first = false;
+                out << "{\"count\":" << count << ",\"frames\":[";
+                for (size_t i = 0; i < stack.size(); i++) {
+                    if (i > 0) out << ",";
+                    out << stack[i];
+                }
+                out << "]}";
+            }
+            out << "]}";
+            return out.str();
+        }
+
+        void cleanup(lua_State* L)
+        {
+            std::lock_guard<std::mutex> guard(profiles_mutex);
+            auto iprofile = profiles.find(global(L));
+            if (iprofile == profiles.end()) return;
+
+            // hooks holding on to it through their cache look it up again
+            iprofile->second->closed = true;
+            profiles.erase(iprofile);
+        }
+
+        int lstart(lua_State* L)
+        {
+            double rate = luaL::optnumber(L, 1, 1000);
+            int instructions = (int)luaL::optnumber(L, 2, 1000);
+            if (rate <= 0) luaL::argerror(L, 1, "rate must be positive");
+            if (instructions <= 0) luaL::argerror(L, 2, "instructions must be positive");
+            lua::pushboolean(L, start(L, rate, instructions));
+            return 1;
+        }
+
+        int lstop(lua_State* L)
+        {
+            stop(L);
+            return 0;
+        }
+
+        int lreset(lua_State* L)
+        {
+            reset(L);
+            return 0;
+        }
+
+        int lactive(lua_State* L)
+        {
+            lua::pushboolean(L, active(L));
+            return 1;
+        }
+
+        int lfolded(lua_State* L)
+        {
+            lua::pushcstring(L, folded(L));
+            return 1;
+        }
+
+        int ljson(lua_State* L)
+        {
+            lua::pushcstring(L, json(L));
+            return 1;
+        }
+    }
+
     #ifdef __linux
     #if defined(__INTEL_COMPILER) && (defined(__i386__) || defined(__x86_64__))
         static LJ_AINLINE uint32_t lj_fls(uint32_t x)
@@ -2297,6 +2636,7 @@ namespace INTERSTELLAR_NAMESPACE::Debug {
         uintptr_t id = Tracker::id(L);
         closure_link.erase(id);
         Hook::clear(L);
+        Profiler::cleanup(L);
     }
 
     int _registry(lua_State* L) {
@@ -2334,6 +2674,67 @@ namespace INTERSTELLAR_NAMESPACE::Debug {
         return 1;
     }
 
+    static constexpr luaL_Reg debug_functions[] = {
+        { "getregistry", _registry },
+        { "registry", _registry },
+        { "global", global },
+        { "env", env },
+        { "dump", dump },
+        { "newcclosure", newcclosure },
+        { "clone", clone },
+        { "replace", replace },
+        { "topointer", topointer },
+        { "frompointer", frompointer },
+        { "getconstant", getconstant },
+        { "getconstants", getconstants },
+        { "setconstant", setconstant },
+        { "toproto", toproto },
+        { "fromproto", fromproto },
+        { "getprotos", getprotos },
+        { "tosignature", tosignature },
+        { "fromsignature", fromsignature },
+        { "tscan", tscan },
+        { "tresolve", tresolve },
+        { "iscfunction", iscfunct },
+        { "islfunction", islfunct },
+        { "setbuiltin", setbuiltin },
+        { "getbuiltin", getbuiltin },
+        { "getlocal", getlocal },
+        { "setlocal", setlocal },
+        { "getupvalue", getupvalue },
+        { "setupvalue", setupvalue },
+        { "getupvalues", getupvalues },
+        { "validlevel", validlevel },
+        { "getcallstack", getcallstack },
+        { "typestack", typestack },
+        { "getgc", getgc },
+        { "getbase", getbase },
+        { nullptr, nullptr }
+    };
+
+    static constexpr luaL_Reg debug_hook_functions[] = {
+        { "sync", Hook::lsync },
+        { "async", Hook::lasync },
+        { "restore", Hook::lrestore },
+        { "original", Hook::loriginal },
+        { "is", Hook::lis },
+        { "inside", Hook::linside },
+        { "active", Hook::lactive },
+        { "enable", Hook::lenable },
+        { "disable", Hook::ldisable },
+        { nullptr, nullptr }
+    };
+
+    static constexpr luaL_Reg debug_profiler_functions[] = {
+        { "start", Profiler::lstart },
+        { "stop", Profiler::lstop },
+        { "reset", Profiler::lreset },
+        { "active", Profiler::lactive },
+        { "folded", Profiler::lfolded },
+        { "json", Profiler::ljson },
+        { nullptr, nullptr }
+    };
+
     void push(lua_State* L, UMODULE hndle)
     {
         Tracker::on_close("debug", cleanup);
@@ -2342,138 +2743,20 @@ namespace INTERSTELLAR_NAMESPACE::Debug {
         lua::getfield(L, -1, "debug");
         lua::remove(L, -2);
 
-        lua::pushcfunction(L, _registry);
-        lua::setfield(L, -2, "getregistry");
-
-        lua::pushcfunction(L, _registry);
-        lua::setfield(L, -2, "registry");
-
-        lua::pushcfunction(L, global);
-        lua::setfield(L, -2, "global");
-
-        lua::pushcfunction(L, env);
-        lua::setfield(L, -2, "env");
-
-        lua::pushcfunction(L, dump);
-        lua::setfield(L, -2, "dump");
-
-        lua::pushcfunction(L, newcclosure);
-        lua::setfield(L, -2, "newcclosure");
+        luaL::makelib(L, nullptr, debug_functions);
 
         lua::newtable(L);
 
-            lua::pushcfunction(L, Hook::lsync);
-            lua::setfield(L, -2, "sync");
-
-            lua::pushcfunction(L, Hook::lasync);
-            lua::setfield(L, -2, "async");
-
-            lua::pushcfunction(L, Hook::lrestore);
-            lua::setfield(L, -2, "restore");
-
-            lua::pushcfunction(L, Hook::loriginal);
-            lua::setfield(L, -2, "original");
-
-            lua::pushcfunction(L, Hook::lis);
-            lua::setfield(L, -2, "is");
-
-            lua::pushcfunction(L, Hook::linside);
-            lua::setfield(L, -2, "inside");
-
-            lua::pushcfunction(L, Hook::lactive);
-            lua::setfield(L, -2, "active");
-
-            lua::pushcfunction(L, Hook::lenable);
-            lua::setfield(L, -2, "enable");
-
-            lua::pushcfunction(L, Hook::ldisable);
-            lua::setfield(L, -2, "disable");
+            luaL::makelib(L, nullptr, debug_hook_functions);
 
         lua::setfield(L, -2, "hook");
 
-        lua::pushcfunction(L, clone);
-        lua::setfield(L, -2, "clone");
-
-        lua::pushcfunction(L, replace);
-        lua::setfield(L, -2, "replace");
-
-        lua::pushcfunction(L, topointer);
-        lua::setfield(L, -2, "topointer");
-
-        lua::pushcfunction(L, frompointer);
-        lua::setfield(L, -2, "frompointer");
-
-        lua::pushcfunction(L, getconstant);
-        lua::setfield(L, -2, "getconstant");
-
-        lua::pushcfunction(L, getconstants);
-        lua::setfield(L, -2, "getconstants");
-
-        lua::pushcfunction(L, setconstant);
-        lua::setfield(L, -2, "setconstant");
-
-        lua::pushcfunction(L, toproto);
-        lua::setfield(L, -2, "toproto");
-
-        lua::pushcfunction(L, fromproto);
-        lua::setfield(L, -2, "fromproto");
-
-        lua::pushcfunction(L, getprotos);
-        lua::setfield(L, -2, "getprotos");
-
-        lua::pushcfunction(L, tosignature);
-        lua::setfield(L, -2, "tosignature");
-
-        lua::pushcfunction(L, fromsignature);
-        lua::setfield(L, -2, "fromsignature");
-
-        lua::pushcfunction(L, tscan);
-        lua::setfield(L, -2, "tscan");
-
-        lua::pushcfunction(L, tresolve);
-        lua::setfield(L, -2, "tresolve");
-
-        lua::pushcfunction(L, iscfunct);
-        lua::setfield(L, -2, "iscfunction");
-
-        lua::pushcfunction(L, islfunct);
-        lua::setfield(L, -2, "islfunction");
-
-        lua::pushcfunction(L, setbuiltin);
-        lua::setfield(L, -2, "setbuiltin");
-
-        lua::pushcfunction(L, getbuiltin);
-        lua::setfield(L, -2, "getbuiltin");
-
-        lua::pushcfunction(L, getlocal);
-        lua::setfield(L, -2, "getlocal");
-
-        lua::pushcfunction(L, setlocal);
-        lua::setfield(L, -2, "setlocal");
-
-        lua::pushcfunction(L, getupvalue);
-        lua::setfield(L, -2, "getupvalue");
-
-        lua::pushcfunction(L, setupvalue);
-        lua::setfield(L, -2, "setupvalue");
-
-        lua::pushcfunction(L, getupvalues);
-        lua::setfield(L, -2, "getupvalues");
-
-        lua::pushcfunction(L, validlevel);
-        lua::setfield(L, -2, "validlevel");
-
-        lua::pushcfunction(L, getcallstack);
-        lua::setfield(L, -2, "getcallstack");
+        lua::newtable(L);
 
-        lua::pushcfunction(L, typestack);
-        lua::setfield(L, -2, "typestack");
+            luaL::makelib(L, nullptr, debug_profiler_functions);
 
-        lua::pushcfunction(L, getgc);
-        lua::setfield(L, -2, "getgc");
+        lua::setfield(L, -2, "profiler");
 
-        lua::pushcfunction(L, getbase);
-        lua::setfield(L, -2, "getbase");
     }
 
     using namespace Reflection::CAPI;
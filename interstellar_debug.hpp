@@ -5,6 +5,16 @@
 // Expansion to the debug library
 namespace INTERSTELLAR_NAMESPACE::Debug
 {
+    // Sampling profiler, folds the lua stacks seen at a fixed rate into flamegraph input
+    namespace Profiler {
+        extern bool start(API::lua_State* L, double rate = 1000, int instructions = 1000);
+        extern void stop(API::lua_State* L);
+        extern void reset(API::lua_State* L);
+        extern bool active(API::lua_State* L);
+        extern std::string folded(API::lua_State* L);
+        extern std::string json(API::lua_State* L);
+    }
+
     extern void push(API::lua_State* L, UMODULE hndle);
     extern void api();
 }
\ No newline at end of file
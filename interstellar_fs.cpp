@@ -46,7 +46,8 @@ const char* path_extension(const char* path) {
 // TODO: We need async FS operations...
 namespace INTERSTELLAR_NAMESPACE::FS {
     using namespace API;
-    std::mutex async_lock;
+    Metrics::metric async_seconds = 0;
+    Metrics::metric async_pending = 0;
 
     std::unordered_map<std::string, lua_FS_Error>& get_on_error()
     {
@@ -603,7 +604,50 @@ namespace INTERSTELLAR_NAMESPACE::FS {
         return file_content;
     }
 
-    std::vector<std::tuple<uintptr_t, int, bool, std::string>> queue_read;
+    // An async read, write or append that finished, completed by the state that started it
+    struct file_done : Tracker::completion {
+        int reference;
+        bool success;
+        bool has_content;
+        std::string content;
+        std::string failure;
+
+        file_done(int reference, bool success, std::string failure) : reference(reference), success(success), has_content(false), failure(failure) {
+            Metrics::shift(async_pending, 1);
+        }
+
+        file_done(int reference, std::string content) : reference(reference), success(true), has_content(true), content(std::move(content)) {
+            Metrics::shift(async_pending, 1);
+        }
+
+        ~file_done() {
+            Metrics::shift(async_pending, -1);
+        }
+
+        void complete(lua_State* L) override {
+            if (!success) {
+                auto& on_error = get_on_error();
+                for (auto const& handle : on_error) handle.second(L, failure);
+                if (reference > 0) Reflection::Task::reject(L, reference, failure);
+            }
+            else if (reference > 0) {
+                lua::pushref(L, reference);
+                if (has_content) lua::pushcstring(L, content);
+
+                if (lua::tcall(L, has_content ? 1 : 0, 0)) {
+                    std::string err = lua::tocstring(L, -1);
+                    lua::pop(L);
+                    auto& on_error = get_on_error();
+                    for (auto const& handle : on_error) handle.second(L, err);
+                }
+            }
+
+            if (reference > 0) {
+                luaL::rmref(L, reference);
+            }
+        }
+    };
+
     int read(lua_State* L) {
         std::string file_path = luaL::checkcstring(L, 1);
         std::filesystem::path weak_path = std::filesystem::path(root_path) / std::filesystem::path(file_path);
@@ -619,19 +663,20 @@ namespace INTERSTELLAR_NAMESPACE::FS {
             return 0;
         }
 
-        if (lua::isfunction(L, 2)) {
-            int reference = luaL::newref(L, 2);
+        bool awaited = !lua::isfunction(L, 2) && Reflection::Task::awaiting(L);
+        if (lua::isfunction(L, 2) || awaited) {
+            int reference = awaited ? Reflection::Task::awaitable(L) : luaL::newref(L, 2);
             uintptr_t id = Tracker::id(L);
 
             // TODO: use luaL::trace for errors
-            std::thread([id, reference, full_path]() {
+            Reflection::Jobs::submit(Reflection::Jobs::kind::io, [id, reference, full_path]() {
+                auto start = std::chrono::steady_clock::now();
                 std::ifstream stream(full_path, std::ios_base::binary);
                 std::string file_content((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
-                std::unique_lock<std::mutex> guard(async_lock);
-                queue_read.push_back(std::tuple(id, reference, true, file_content));
-                guard.unlock(); guard.release();
-                }).detach();
-            return 0;
+                Metrics::observe(async_seconds, start);
+                Tracker::post(id, new file_done(reference, std::move(file_content)));
+                });
+            return awaited ? 1 : 0;
         }
 
         std::ifstream stream(full_path, std::ios_base::binary);
@@ -664,7 +709,6 @@ namespace INTERSTELLAR_NAMESPACE::FS {
         return true;
     }
 
-    std::vector<std::tuple<uintptr_t, int, bool>> queue_write;
     int write(lua_State* L) {
         std::string file_path = luaL::checkcstring(L, 1);
         std::filesystem::path weak_path = std::filesystem::path(root_path) / std::filesystem::path(file_path);
@@ -698,28 +742,30 @@ namespace INTERSTELLAR_NAMESPACE::FS {
             }
         }
 
-        if (lua::isfunction(L, 3) || (lua::isboolean(L, 3) && lua::toboolean(L, 3))) {
-            int reference = (lua::isboolean(L, 3) && lua::toboolean(L, 3)) ? -1 : luaL::newref(L, 3);
+        bool awaited = !lua::isfunction(L, 3) && !lua::isboolean(L, 3) && Reflection::Task::awaiting(L);
+        if (lua::isfunction(L, 3) || (lua::isboolean(L, 3) && lua::toboolean(L, 3)) || awaited) {
+            int reference = awaited ? Reflection::Task::awaitable(L) : (lua::isboolean(L, 3) && lua::toboolean(L, 3)) ? -1 : luaL::newref(L, 3);
             uintptr_t id = Tracker::id(L);
 
             // TODO: use luaL::trace for errors
-            std::thread([id, reference, full_path, file_content]() {
+            Reflection::Jobs::submit(Reflection::Jobs::kind::io, [id, reference, full_path, file_content]() {
+                auto start = std::chrono::steady_clock::now();
                 std::ofstream outfile(full_path, std::ios::out | std::ios::binary);
 
                 if (!outfile.is_open()) {
-                    std::unique_lock<std::mutex> guard(async_lock);
-                    queue_write.push_back(std::tuple(id, reference, false));
-                    guard.unlock(); guard.release();
-                    return 0;
+                    Metrics::observe(async_seconds, start);
+                    Tracker::post(id, new file_done(reference, false, "fs.write, failed to open file for writing"));
+                    return;
                 }
 
                 outfile.write(file_content.c_str(), file_content.size());
                 outfile.close();
 
-                std::unique_lock<std::mutex> guard(async_lock);
-                queue_write.push_back(std::tuple(id, reference, true));
-                guard.unlock(); guard.release();
-                }).detach();
+                Metrics::observe(async_seconds, start);
+                Tracker::post(id, new file_done(reference, true, ""));
+                });
+
+            if (awaited) return 1;
         }
         else {
             std::ofstream outfile(full_path, std::ios::out | std::ios::binary);
@@ -763,7 +809,6 @@ namespace INTERSTELLAR_NAMESPACE::FS {
         return true;
     }
 
-    std::vector<std::tuple<uintptr_t, int, bool>> queue_append;
     int append(lua_State* L) {
         std::string file_path = luaL::checkcstring(L, 1);
         std::filesystem::path weak_path = std::filesystem::path(root_path) / std::filesystem::path(file_path);
@@ -801,31 +846,31 @@ namespace INTERSTELLAR_NAMESPACE::FS {
             return 0;
         }
 
-        if (lua::isfunction(L, 3) || (lua::isboolean(L, 3) && lua::toboolean(L, 3))) {
-            int reference = (lua::isboolean(L, 3) && lua::toboolean(L, 3)) ? -1 : luaL::newref(L, 3);
+        bool awaited = !lua::isfunction(L, 3) && !lua::isboolean(L, 3) && Reflection::Task::awaiting(L);
+        if (lua::isfunction(L, 3) || (lua::isboolean(L, 3) && lua::toboolean(L, 3)) || awaited) {
+            int reference = awaited ? Reflection::Task::awaitable(L) : (lua::isboolean(L, 3) && lua::toboolean(L, 3)) ? -1 : luaL::newref(L, 3);
             uintptr_t id = Tracker::id(L);
 
             // TODO: use luaL::trace for errors
-            std::thread([id, reference, full_path, file_content]() {
+            Reflection::Jobs::submit(Reflection::Jobs::kind::io, [id, reference, full_path, file_content]() {
+                auto start = std::chrono::steady_clock::now();
                 std::ofstream outfile;
                 outfile.open(full_path, std::ios_base::app | std::ios_base::binary);
 
                 if (!outfile.is_open()) {
-                    std::unique_lock<std::mutex> guard(async_lock);
-                    queue_append.push_back(std::tuple(id, reference, false));
-                    guard.unlock(); guard.release();
-                    return 0;
+                    Metrics::observe(async_seconds, start);
+                    Tracker::post(id, new file_done(reference, false, "fs.append, failed to open file for appending"));
+                    return;
                 }
 
                 outfile.write(file_content.c_str(), file_content.size());
                 outfile.close();
 
-                std::unique_lock<std::mutex> guard(async_lock);
-                queue_append.push_back(std::tuple(id, reference, true));
-                guard.unlock(); guard.release();
-            }).detach();
+                Metrics::observe(async_seconds, start);
+                Tracker::post(id, new file_done(reference, true, ""));
+            });
 
-            return 0;
+            return awaited ? 1 : 0;
         }
         else {
             std::ofstream outfile;
@@ -844,323 +889,94 @@ namespace INTERSTELLAR_NAMESPACE::FS {
         return 1;
     }
 
-    void runtime_threaded(lua_State* T)
-    {
-        std::unique_lock<std::mutex> guard(async_lock);
-
-        if (queue_read.size() > 0) {
-            for (auto it = queue_read.begin(); it != queue_read.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L != T) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                bool success = std::get<2>(result);
-                std::string data = std::get<3>(result);
-
-                if (!success) {
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "fs.read, failed to open file for reading");
-                }
-                else if (reference > 0) {
-                    lua::pushref(L, reference);
-                    lua::pushcstring(L, data);
-
-                    if (lua::tcall(L, 1, 0)) {
-                        std::string err = lua::tocstring(L, -1);
-                        lua::pop(L);
-                        auto& on_error = get_on_error();
-                        for (auto const& handle : on_error) handle.second(L, err);
-                    }
-                }
-
-                if (reference > 0) {
-                    luaL::rmref(L, reference);
-                }
-
-                it = queue_read.erase(it);
-            }
-        }
-
-        if (queue_write.size() > 0) {
-            for (auto it = queue_write.begin(); it != queue_write.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
+    bool log(const std::string& file_path, size_t size, size_t keep) {
+        if (file_path.size() < 1) return Log::set_file("");
 
-                if (L != T) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                bool success = std::get<2>(result);
-
-                if (!success) {
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "fs.write, failed to open file for writing");
-                }
-                else if (reference > 0) {
-                    lua::pushref(L, reference);
-
-                    if (lua::tcall(L, 0, 0)) {
-                        std::string err = lua::tocstring(L, -1);
-                        lua::pop(L);
-                        auto& on_error = get_on_error();
-                        for (auto const& handle : on_error) handle.second(L, err);
-                    }
-                }
+        std::string full_path = localize(root_path, file_path);
+        if (full_path.size() < 1) return false;
 
-                if (reference > 0) {
-                    luaL::rmref(L, reference);
-                }
+        return Log::set_file(full_path, size, keep);
+    }
 
-                it = queue_write.erase(it);
-            }
+    int log(lua_State* L) {
+        // the sink is process wide, so sandboxed states don't get to move or silence it
+        if (!Tracker::is_internal(L)) {
+            luaL::error(L, "fs.log, only internal states may redirect the log");
+            return 0;
         }
 
-        if (queue_append.size() > 0) {
-            for (auto it = queue_append.begin(); it != queue_append.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L != T) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                bool success = std::get<2>(result);
-
-                if (!success) {
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "fs.append, failed to open file for appending");
-                }
-                else if (reference > 0) {
-                    lua::pushref(L, reference);
-
-                    if (lua::tcall(L, 0, 0)) {
-                        std::string err = lua::tocstring(L, -1);
-                        lua::pop(L);
-                        auto& on_error = get_on_error();
-                        for (auto const& handle : on_error) handle.second(L, err);
-                    }
-                }
-
-                if (reference > 0) {
-                    luaL::rmref(L, reference);
-                }
-
-                it = queue_append.erase(it);
-            }
+        if (lua::gettype(L, 1) <= datatype::nil) {
+            lua::pushboolean(L, Log::set_file(""));
+            return 1;
         }
 
-        guard.unlock(); guard.release();
-    }
-
-    void runtime()
-    {
-        std::unique_lock<std::mutex> guard(async_lock);
-
-        if (queue_read.size() > 0) {
-            for (auto it = queue_read.begin(); it != queue_read.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L == nullptr || Tracker::is_threaded(L)) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                bool success = std::get<2>(result);
-                std::string data = std::get<3>(result);
-
-                if (!success) {
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "fs.read, failed to open file for reading");
-                }
-                else if (reference > 0) {
-                    lua::pushref(L, reference);
-                    lua::pushcstring(L, data);
-
-                    if (lua::tcall(L, 1, 0)) {
-                        std::string err = lua::tocstring(L, -1);
-                        lua::pop(L);
-                        auto& on_error = get_on_error();
-                        for (auto const& handle : on_error) handle.second(L, err);
-                    }
-                }
-
-                if (reference > 0) {
-                    luaL::rmref(L, reference);
-                }
+        std::string file_path = luaL::checkcstring(L, 1);
+        std::filesystem::path weak_path = std::filesystem::path(root_path) / std::filesystem::path(file_path);
+        std::filesystem::path full_path = std::filesystem::weakly_canonical(weak_path);
 
-                it = queue_read.erase(it);
-            }
+        if (full_path.string().rfind(root_path) != 0) {
+            luaL::error(L, "fs.log, attempt to escape directory");
+            return 0;
         }
 
-        if (queue_write.size() > 0) {
-            for (auto it = queue_write.begin(); it != queue_write.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L == nullptr || Tracker::is_threaded(L)) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                bool success = std::get<2>(result);
-
-                if (!success) {
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "fs.write, failed to open file for writing");
-                }
-                else if (reference > 0) {
-                    lua::pushref(L, reference);
-
-                    if (lua::tcall(L, 0, 0)) {
-                        std::string err = lua::tocstring(L, -1);
-                        lua::pop(L);
-                        auto& on_error = get_on_error();
-                        for (auto const& handle : on_error) handle.second(L, err);
-                    }
-                }
+        std::string extension = path_extension(full_path.string().c_str());
 
-                if (reference > 0) {
-                    luaL::rmref(L, reference);
-                }
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
 
-                it = queue_write.erase(it);
+        for (const std::string& disallowedExtension : disallowedExtensions) {
+            if (extension == disallowedExtension) {
+                luaL::error(L, "fs.log, forbidden extension");
+                return 0;
             }
         }
 
-        if (queue_append.size() > 0) {
-            for (auto it = queue_append.begin(); it != queue_append.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L == nullptr || Tracker::is_threaded(L)) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                bool success = std::get<2>(result);
-
-                if (!success) {
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "fs.append, failed to open file for appending");
-                }
-                else if (reference > 0) {
-                    lua::pushref(L, reference);
-
-                    if (lua::tcall(L, 0, 0)) {
-                        std::string err = lua::tocstring(L, -1);
-                        lua::pop(L);
-                        auto& on_error = get_on_error();
-                        for (auto const& handle : on_error) handle.second(L, err);
-                    }
-                }
-
-                if (reference > 0) {
-                    luaL::rmref(L, reference);
-                }
-
-                it = queue_append.erase(it);
-            }
-        }
+        size_t size = (size_t)std::max(0.0, luaL::optnumber(L, 2, 0));
+        size_t keep = (size_t)std::max(0.0, luaL::optnumber(L, 3, 0));
 
-        guard.unlock(); guard.release();
+        lua::pushboolean(L, Log::set_file(full_path.string(), size, keep));
+        return 1;
     }
 
+    static constexpr luaL_Reg fs_functions[] = {
+        { "read", read },
+        { "write", write },
+        { "isfile", isfile },
+        { "isfolder", isfolder },
+        { "readable", readable },
+        { "writeable", writeable },
+        { "scan", scan },
+        { "mkdir", mkdir },
+        { "rmdir", rmdir },
+        { "rmfile", rmfile },
+        { "rm", rm },
+        { "mv", mv },
+        { "cp", cp },
+        { "sanitize", sanitize },
+        { "extname", extname },
+        { "filename", filename },
+        { "dirname", dirname },
+        { "join", join },
+        { "forward", forward },
+        { "backward", backward },
+        { "within", within },
+        { "canonical", canonical },
+        { "log", log },
+        { nullptr, nullptr }
+    };
+
     void push(lua_State* L, UMODULE handle) {
         lua::newtable(L);
 
         lua::pushcstring(L, std::string(1, (char)std::filesystem::path::preferred_separator));
         lua::setfield(L, -2, "separator");
 
-        lua::pushcfunction(L, read);
-        lua::setfield(L, -2, "read");
-
-        lua::pushcfunction(L, write);
-        lua::setfield(L, -2, "write");
-
-        lua::pushcfunction(L, isfile);
-        lua::setfield(L, -2, "isfile");
-
-        lua::pushcfunction(L, isfolder);
-        lua::setfield(L, -2, "isfolder");
-
-        lua::pushcfunction(L, readable);
-        lua::setfield(L, -2, "readable");
-
-        lua::pushcfunction(L, writeable);
-        lua::setfield(L, -2, "writeable");
-
-        lua::pushcfunction(L, scan);
-        lua::setfield(L, -2, "scan");
-
-        lua::pushcfunction(L, mkdir);
-        lua::setfield(L, -2, "mkdir");
-
-        lua::pushcfunction(L, rmdir);
-        lua::setfield(L, -2, "rmdir");
-
-        lua::pushcfunction(L, rmfile);
-        lua::setfield(L, -2, "rmfile");
-
-        lua::pushcfunction(L, rm);
-        lua::setfield(L, -2, "rm");
-
-        lua::pushcfunction(L, mv);
-        lua::setfield(L, -2, "mv");
-
-        lua::pushcfunction(L, cp);
-        lua::setfield(L, -2, "cp");
-
-        lua::pushcfunction(L, sanitize);
-        lua::setfield(L, -2, "sanitize");
-
-        lua::pushcfunction(L, extname);
-        lua::setfield(L, -2, "extname");
-
-        lua::pushcfunction(L, filename);
-        lua::setfield(L, -2, "filename");
-
-        lua::pushcfunction(L, dirname);
-        lua::setfield(L, -2, "dirname");
-
-        lua::pushcfunction(L, join);
-        lua::setfield(L, -2, "join");
-
-        lua::pushcfunction(L, forward);
-        lua::setfield(L, -2, "forward");
-
-        lua::pushcfunction(L, backward);
-        lua::setfield(L, -2, "backward");
-
-        lua::pushcfunction(L, within);
-        lua::setfield(L, -2, "within");
-
-        lua::pushcfunction(L, canonical);
-        lua::setfield(L, -2, "canonical");
+        luaL::makelib(L, nullptr, fs_functions);
     }
 
     void api(std::string root) {
         root_path = (root.size() > 0 ? root : where());
-        Reflection::on_threaded("fs", runtime_threaded);
-        Reflection::on_runtime("fs", runtime);
+        async_seconds = Metrics::histogram("interstellar_fs_seconds", "Time taken by asynchronous file operations");
+        async_pending = Metrics::gauge("interstellar_fs_queued", "Finished file operations waiting on their state");
         Reflection::add("fs", push);
     }
 }
\ No newline at end of file
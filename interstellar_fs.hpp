@@ -39,6 +39,10 @@ namespace INTERSTELLAR_NAMESPACE::FS {
     extern bool write(const std::string& file_path, std::string file_content);
     extern bool append(const std::string& file_path, std::string file_content);
 
+    // Sends print & log output to a file under the root, rotating it past size bytes (see Log::set_file), empty goes back to stdout
+    // From lua only internal states may call fs.log, the sink is shared by every state
+    extern bool log(const std::string& file_path, size_t size = 0, size_t keep = 0);
+
     extern void push(API::lua_State* L, UMODULE hndle);
     extern void api(std::string root_path = "");
 }
\ No newline at end of file
@@ -70,6 +70,7 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
                 std::string message = msg->str;
                 this->event_queue.push([this, message]() { on_pong(message); });
             }
+            on_queued();
         });
     }
 
@@ -113,10 +114,10 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
 
     void CSocket::connect(int timeout) {
         if (is_open() || is_connecting() || is_closing()) return;
-        std::thread([this, timeout]() {
+        Reflection::Jobs::submit(Reflection::Jobs::kind::network, [this, timeout]() {
             socket.connect(timeout);
             ws_thread = std::thread([this]() { socket.run(); });
-        }).detach();
+        }, Reflection::Jobs::priority::high);
     }
 
     void CSocket::disconnect(const std::string& reason) {
@@ -169,6 +170,7 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
     void CSocket::on_error(int status, const std::string& reason) {}
     void CSocket::on_ping(const std::string& message) {}
     void CSocket::on_pong(const std::string& message) {}
+    void CSocket::on_queued() {}
 
     void CSocket::dethreader() {
         std::lock_guard<std::mutex> lock(queue_mutex);
@@ -230,103 +232,202 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
     std::vector<std::pair<uintptr_t, int>> progress_cancel;
     std::mutex progress_cancel_lock;
 
-    std::vector<std::tuple<uintptr_t, int, std::string, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t>> http_progress;
-    std::mutex http_progress_lock;
+    std::vector<std::pair<uintptr_t, int>> stream_cancel;
+    std::mutex stream_cancel_lock;
 
-    std::vector<std::tuple<uintptr_t, int, cpr::Response>> http_responses;
-    std::mutex http_response_lock;
+    // Requests are cancelled by the state & reference of their callback
+    void cancel_request(std::vector<std::pair<uintptr_t, int>>& list, std::mutex& lock, uintptr_t id, int reference)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto& cancel : list) {
+            if (cancel.first == id && cancel.second == reference) return;
+        }
+        list.push_back(std::pair<uintptr_t, int>(id, reference));
+    }
 
-    std::queue<std::tuple<uintptr_t, int, int, std::string, std::string, cpr::Body, cpr::Header, cpr::Parameters>> http_queue;
-    std::mutex http_queue_lock;
-    
-    constexpr int http_max_threads = 4;
-    std::atomic<unsigned int> http_threads = 0;
+    void uncancel_request(std::vector<std::pair<uintptr_t, int>>& list, std::mutex& lock, uintptr_t id, int reference)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        list.erase(std::remove(list.begin(), list.end(), std::pair<uintptr_t, int>(id, reference)), list.end());
+    }
 
-    void http_worker()
+    void push_response(lua_State* L, const cpr::Response& response)
     {
-        while (true) {
-            std::unique_lock<std::mutex> lock(http_queue_lock);
+        lua::newtable(L);
 
-            if (http_queue.empty()) {
-                http_threads--;
-                lock.unlock(); lock.release();
-                break;
-            }
+        lua::pushnumber(L, response.status_code);
+        lua::setfield(L, -2, "status");
 
-            auto [id, reference, reference_progress, url, method, body, headers, params] = http_queue.front();
-            http_queue.pop();
-            lock.unlock(); lock.release();
+        lua::pushcstring(L, response.text);
+        lua::setfield(L, -2, "body");
 
-            cpr::cpr_off_t last_downloadTotal = 0, last_downloadNow = 0, last_uploadTotal = 0, last_uploadNow = 0;
+        lua::pushcstring(L, response.reason);
+        lua::setfield(L, -2, "reason");
 
-            cpr::ProgressCallback progress = cpr::ProgressCallback([&](cpr::cpr_off_t downloadTotal, cpr::cpr_off_t downloadNow, cpr::cpr_off_t uploadTotal, cpr::cpr_off_t uploadNow, intptr_t) {
-                if (reference_progress == 0) return true;
-                std::lock_guard<std::mutex> cancel_lock_guard(progress_cancel_lock);
-                if (!progress_cancel.empty()) {
-                    for (auto& cancel : progress_cancel) {
-                        if (cancel.first == id && cancel.second == reference) {
-                            return false;
-                        }
-                    }
-                }
+        lua::pushcstring(L, response.url.str());
+        lua::setfield(L, -2, "url");
 
-                if (last_downloadTotal == downloadTotal && last_downloadNow == downloadNow && last_uploadTotal == uploadTotal && last_uploadNow == uploadNow) {
-                    return true;
-                }
+        lua::newtable(L);
+        for (const auto& [key, value] : response.header)
+        {
+            lua::pushcstring(L, key);
+            lua::pushcstring(L, value);
+            lua::settable(L, -3);
+        }
+        lua::setfield(L, -2, "headers");
+    }
 
-                last_downloadTotal = downloadTotal;
-                last_downloadNow = downloadNow;
-                last_uploadTotal = uploadTotal;
-                last_uploadNow = uploadNow;
+    // Progress of a http or stream request, the last one only releases the progress callback
+    struct progress_done : Tracker::completion {
+        uintptr_t id;
+        int reference;
+        int request;
+        std::string url;
+        cpr::cpr_off_t downloadTotal, downloadNow, uploadTotal, uploadNow;
+        bool finished;
 
-                std::lock_guard<std::mutex> http_lock_guard(http_progress_lock);
+        progress_done(uintptr_t id, int reference, int request, std::string url, cpr::cpr_off_t downloadTotal, cpr::cpr_off_t downloadNow, cpr::cpr_off_t uploadTotal, cpr::cpr_off_t uploadNow, bool finished = false)
+            : id(id), reference(reference), request(request), url(url), downloadTotal(downloadTotal), downloadNow(downloadNow), uploadTotal(uploadTotal), uploadNow(uploadNow), finished(finished) {}
 
-                if (Tracker::is_state(id)) {
-                    http_progress.emplace_back(std::tuple<uintptr_t, int, std::string, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t>(
-                        id, reference_progress, url,
-                        downloadTotal,
-                        downloadNow,
-                        uploadTotal,
-                        uploadNow
-                    ));
-                }
+        void complete(lua_State* L) override {
+            if (finished) {
+                luaL::rmref(L, reference);
+                return;
+            }
 
-                return true;
-            });
+            lua::pushref(L, reference);
+
+            lua::pushnumber(L, downloadTotal);
+            lua::pushnumber(L, downloadNow);
+            lua::pushnumber(L, uploadTotal);
+            lua::pushnumber(L, uploadNow);
 
-            cpr::Response response;
-            if (method == "post") {
-                response = cpr::Post(cpr::Url{ url }, body, params, headers, progress);
+            // erroring or returning false cancels the request
+            if (lua::tcall(L, 4, 1)) {
+                std::string err = lua::tocstring(L, -1);
+                auto& on_error = get_on_error();
+                for (auto const& handle : on_error) handle.second(L, "progress - " + url, err);
+                cancel_request(progress_cancel, progress_cancel_lock, id, request);
+            }
+            else if (lua::isboolean(L, -1) && lua::toboolean(L, -1) == false) {
+                cancel_request(progress_cancel, progress_cancel_lock, id, request);
             }
-            else if (method == "get") {
-                response = cpr::Get(cpr::Url{ url }, params, headers, progress);
+
+            lua::pop(L);
+        }
+    };
+
+    struct http_done : Tracker::completion {
+        uintptr_t id;
+        int reference;
+        cpr::Response response;
+
+        http_done(uintptr_t id, int reference, cpr::Response response) : id(id), reference(reference), response(std::move(response)) {}
+
+        void complete(lua_State* L) override {
+            lua::pushref(L, reference);
+            luaL::rmref(L, reference);
+            push_response(L, response);
+
+            if (lua::tcall(L, 1, 0)) {
+                std::string err = lua::tocstring(L, -1);
+                lua::pop(L);
+                auto& on_error = get_on_error();
+                for (auto const& handle : on_error) handle.second(L, "http - " + response.url.str(), err);
             }
-            else if (method == "put") {
-                response = cpr::Put(cpr::Url{ url }, body, params, headers, progress);
+
+            uncancel_request(progress_cancel, progress_cancel_lock, id, reference);
+        }
+    };
+
+    // A chunk of a stream (status 100) or its final response
+    struct stream_done : Tracker::completion {
+        uintptr_t id;
+        int reference;
+        cpr::Response response;
+
+        stream_done(uintptr_t id, int reference, cpr::Response response) : id(id), reference(reference), response(std::move(response)) {}
+
+        void complete(lua_State* L) override {
+            lua::pushref(L, reference);
+            push_response(L, response);
+
+            if (lua::tcall(L, 1, 1)) {
+                std::string err = lua::tocstring(L, -1);
+                auto& on_error = get_on_error();
+                for (auto const& handle : on_error) handle.second(L, "stream - " + response.url.str(), err);
+                cancel_request(stream_cancel, stream_cancel_lock, id, reference);
             }
-            else if (method == "delete") {
-                response = cpr::Delete(cpr::Url{ url }, params, headers, progress);
+            else if (lua::isboolean(L, -1) && lua::toboolean(L, -1) == false) {
+                cancel_request(stream_cancel, stream_cancel_lock, id, reference);
             }
-            else if (method == "patch") {
-                response = cpr::Patch(cpr::Url{ url }, body, params, headers, progress);
+
+            lua::pop(L);
+
+            if (response.status_code != 100) {
+                luaL::rmref(L, reference);
+                uncancel_request(progress_cancel, progress_cancel_lock, id, reference);
+                uncancel_request(stream_cancel, stream_cancel_lock, id, reference);
             }
+        }
+    };
 
-            if (reference_progress != 0) {
-                std::lock_guard<std::mutex> http_lock_guard(http_progress_lock);
-                if (Tracker::is_state(id)) {
-                    http_progress.emplace_back(std::tuple<uintptr_t, int, std::string, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t>(
-                        id, reference_progress, url,
-                        -1,
-                        -1,
-                        -1,
-                        -1
-                    ));
+    Metrics::metric http_seconds = 0;
+    Metrics::metric serve_seconds = 0;
+
+    void http_request(uintptr_t id, int reference, int reference_progress, std::string url, std::string method, cpr::Body body, cpr::Header headers, cpr::Parameters params)
+    {
+        cpr::cpr_off_t last_downloadTotal = 0, last_downloadNow = 0, last_uploadTotal = 0, last_uploadNow = 0;
+
+        cpr::ProgressCallback progress = cpr::ProgressCallback([&](cpr::cpr_off_t downloadTotal, cpr::cpr_off_t downloadNow, cpr::cpr_off_t uploadTotal, cpr::cpr_off_t uploadNow, intptr_t) {
+            if (reference_progress == 0) return true;
+            std::lock_guard<std::mutex> cancel_lock_guard(progress_cancel_lock);
+            if (!progress_cancel.empty()) {
+                for (auto& cancel : progress_cancel) {
+                    if (cancel.first == id && cancel.second == reference) {
+                        return false;
+                    }
                 }
             }
 
-            std::lock_guard<std::mutex> http_lock_guard(http_response_lock);
-            http_responses.emplace_back(id, reference, response);
+            if (last_downloadTotal == downloadTotal && last_downloadNow == downloadNow && last_uploadTotal == uploadTotal && last_uploadNow == uploadNow) {
+                return true;
+            }
+
+            last_downloadTotal = downloadTotal;
+            last_downloadNow = downloadNow;
+            last_uploadTotal = uploadTotal;
+            last_uploadNow = uploadNow;
+
+            Tracker::post(id, new progress_done(id, reference_progress, reference, url, downloadTotal, downloadNow, uploadTotal, uploadNow));
+
+            return true;
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        cpr::Response response;
+        if (method == "post") {
+            response = cpr::Post(cpr::Url{ url }, body, params, headers, progress);
+        }
+        else if (method == "get") {
+            response = cpr::Get(cpr::Url{ url }, params, headers, progress);
+        }
+        else if (method == "put") {
+            response = cpr::Put(cpr::Url{ url }, body, params, headers, progress);
+        }
+        else if (method == "delete") {
+            response = cpr::Delete(cpr::Url{ url }, params, headers, progress);
         }
+        else if (method == "patch") {
+            response = cpr::Patch(cpr::Url{ url }, body, params, headers, progress);
+        }
+        Metrics::observe(http_seconds, start);
+
+        if (reference_progress != 0) {
+            Tracker::post(id, new progress_done(id, reference_progress, reference, url, -1, -1, -1, -1, true));
+        }
+
+        Tracker::post(id, new http_done(id, reference, std::move(response)));
     }
 
     int http(lua_State* L)
@@ -334,8 +435,9 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
         uintptr_t id = Tracker::id(L);
 
         std::string url = luaL::checkcstring(L, 1);
-        luaL::checkfunction(L, 2);
-        int reference = luaL::newref(L, 2);
+        bool awaited = !lua::isfunction(L, 2) && Reflection::Task::awaiting(L);
+        if (!awaited) luaL::checkfunction(L, 2);
+        int reference = awaited ? 0 : luaL::newref(L, 2);
         int reference_progress = 0;
 
         std::string method = "get";
@@ -385,140 +487,93 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
             lua::pop(L);
         }
 
-        std::lock_guard<std::mutex> lock(http_queue_lock);
-        http_queue.emplace(id, reference, reference_progress, url, method, body, headers, params);
+        if (awaited) reference = Reflection::Task::awaitable(L);
 
-        if (http_threads < http_max_threads) {
-            http_threads++;
-            std::thread(http_worker).detach();
-        }
+        Reflection::Jobs::submit(Reflection::Jobs::kind::network, [id, reference, reference_progress, url, method, body, headers, params]() {
+            http_request(id, reference, reference_progress, url, method, body, headers, params);
+        });
 
-        return 0;
+        return awaited ? 1 : 0;
     }
 
-    std::vector<std::pair<uintptr_t, int>> stream_cancel;
-    std::mutex stream_cancel_lock;
-
-    std::vector<std::tuple<uintptr_t, int, cpr::Response>> stream_responses;
-    std::mutex stream_response_lock;
-
-    std::queue<std::tuple<uintptr_t, int, int, std::string, std::string, cpr::Body, cpr::Header, cpr::Parameters>> stream_queue;
-    std::mutex stream_queue_lock;
 
-    constexpr int stream_max_threads = 4;
-    std::atomic<unsigned int> stream_threads = 0;
-
-    void stream_worker()
+    void stream_request(uintptr_t id, int reference, int reference_progress, std::string url, std::string method, cpr::Body body, cpr::Header headers, cpr::Parameters params)
     {
-        while (true) {
-            std::unique_lock<std::mutex> lock(stream_queue_lock);
+        cpr::Header response_headers;
 
-            if (stream_queue.empty()) {
-                stream_threads--;
-                lock.unlock(); lock.release();
-                break;
+        cpr::HeaderCallback header_callback = cpr::HeaderCallback([&](const std::string_view& header, uintptr_t) {
+            size_t delimiter = header.find(": ");
+            if (delimiter != std::string_view::npos) {
+                std::string key(header.substr(0, delimiter));
+                std::string value(header.substr(delimiter + 2));
+                response_headers[key] = value;
             }
+            return true;
+        });
 
-            auto [id, reference, reference_progress, url, method, body, headers, params] = stream_queue.front();
-            stream_queue.pop();
-            lock.unlock(); lock.release();
-
-            cpr::Header response_headers;
-
-            cpr::HeaderCallback header_callback = cpr::HeaderCallback([&](const std::string_view& header, uintptr_t) {
-                size_t delimiter = header.find(": ");
-                if (delimiter != std::string_view::npos) {
-                    std::string key(header.substr(0, delimiter));
-                    std::string value(header.substr(delimiter + 2));
-                    response_headers[key] = value;
-                }
-                return true;
-            });
-
-            cpr::WriteCallback stream_callback = cpr::WriteCallback(
-                [&](const std::string_view& data, intptr_t) {
-                    std::lock_guard<std::mutex> cancel_lock_guard(stream_cancel_lock);
-                    if (!stream_cancel.empty()) {
-                        for (auto& cancel : stream_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                return false;
-                            }
-                        }
-                    }
-
-                    if (!data.empty()) {
-                        cpr::Response partial;
-                        partial.status_code = 100;
-                        partial.header = response_headers;
-                        partial.text = std::string(data);
-                        partial.url = url;
-                        partial.reason = "";
-                        std::lock_guard<std::mutex> stream_lock_guard(stream_response_lock);
-                        if (Tracker::is_state(id)) {
-                            stream_responses.emplace_back(id, reference, partial);
-                        }
-                    }
-                    return true;
-                }
-            );
-
-            cpr::ProgressCallback progress_callback = cpr::ProgressCallback([&](cpr::cpr_off_t downloadTotal, cpr::cpr_off_t downloadNow, cpr::cpr_off_t uploadTotal, cpr::cpr_off_t uploadNow, intptr_t) {
-                if (reference_progress == 0) return true;
-                std::lock_guard<std::mutex> cancel_lock_guard(progress_cancel_lock);
-                if (!progress_cancel.empty()) {
-                    for (auto& cancel : progress_cancel) {
+        cpr::WriteCallback stream_callback = cpr::WriteCallback(
+            [&](const std::string_view& data, intptr_t) {
+                std::lock_guard<std::mutex> cancel_lock_guard(stream_cancel_lock);
+                if (!stream_cancel.empty()) {
+                    for (auto& cancel : stream_cancel) {
                         if (cancel.first == id && cancel.second == reference) {
                             return false;
                         }
                     }
                 }
 
-                std::lock_guard<std::mutex> http_lock_guard(http_progress_lock);
-                if (Tracker::is_state(id)) {
-                    http_progress.emplace_back(std::tuple<uintptr_t, int, std::string, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t>(
-                        id, reference_progress, url,
-                        downloadTotal,
-                        downloadNow,
-                        uploadTotal,
-                        uploadNow
-                    ));
+                if (!data.empty()) {
+                    cpr::Response partial;
+                    partial.status_code = 100;
+                    partial.header = response_headers;
+                    partial.text = std::string(data);
+                    partial.url = url;
+                    partial.reason = "";
+                    Tracker::post(id, new stream_done(id, reference, std::move(partial)));
                 }
                 return true;
-            });
-
-            cpr::Response response;
-            if (method == "post") {
-                response = cpr::Post(cpr::Url{ url }, body, params, headers, header_callback, stream_callback, progress_callback);
-            }
-            else if (method == "get") {
-                response = cpr::Get(cpr::Url{ url }, params, headers, header_callback, stream_callback, progress_callback);
-            }
-            else if (method == "put") {
-                response = cpr::Put(cpr::Url{ url }, body, params, headers, header_callback, stream_callback, progress_callback);
-            }
-            else if (method == "delete") {
-                response = cpr::Delete(cpr::Url{ url }, params, headers, header_callback, stream_callback, progress_callback);
-            }
-            else if (method == "patch") {
-                response = cpr::Patch(cpr::Url{ url }, body, params, headers, header_callback, stream_callback, progress_callback);
             }
+        );
 
-            if (reference_progress != 0) {
-                std::lock_guard<std::mutex> http_lock_guard(http_progress_lock);
-                if (Tracker::is_state(id)) {
-                    http_progress.emplace_back(std::tuple<uintptr_t, int, std::string, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t>(
-                        id, reference_progress, url,
-                        -1,
-                        -1,
-                        -1,
-                        -1
-                    ));
+        cpr::ProgressCallback progress_callback = cpr::ProgressCallback([&](cpr::cpr_off_t downloadTotal, cpr::cpr_off_t downloadNow, cpr::cpr_off_t uploadTotal, cpr::cpr_off_t uploadNow, intptr_t) {
+            if (reference_progress == 0) return true;
+            std::lock_guard<std::mutex> cancel_lock_guard(progress_cancel_lock);
+            if (!progress_cancel.empty()) {
+                for (auto& cancel : progress_cancel) {
+                    if (cancel.first == id && cancel.second == reference) {
+                        return false;
+                    }
                 }
             }
 
-            std::lock_guard<std::mutex> stream_lock_guard(stream_response_lock);
-            stream_responses.emplace_back(id, reference, response);
+            Tracker::post(id, new progress_done(id, reference_progress, reference, url, downloadTotal, downloadNow, uploadTotal, uploadNow));
+            return true;
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        cpr::Response response;
+        if (method == "post") {
+            response = cpr::Post(cpr::Url{ url }, body, params, headers, header_callback, stream_callback, progress_callback);
+        }
+        else if (method == "get") {
+            response = cpr::Get(cpr::Url{ url }, params, headers, header_callback, stream_callback, progress_callback);
+        }
+        else if (method == "put") {
+            response = cpr::Put(cpr::Url{ url }, body, params, headers, header_callback, stream_callback, progress_callback);
         }
+        else if (method == "delete") {
+            response = cpr::Delete(cpr::Url{ url }, params, headers, header_callback, stream_callback, progress_callback);
+        }
+        else if (method == "patch") {
+            response = cpr::Patch(cpr::Url{ url }, body, params, headers, header_callback, stream_callback, progress_callback);
+        }
+        Metrics::observe(http_seconds, start);
+
+        if (reference_progress != 0) {
+            Tracker::post(id, new progress_done(id, reference_progress, reference, url, -1, -1, -1, -1, true));
+        }
+
+        Tracker::post(id, new stream_done(id, reference, std::move(response)));
     }
 
     int stream(lua_State* L)
@@ -577,13 +632,10 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
             lua::pop(L);
         }
 
-        std::lock_guard<std::mutex> lock(stream_queue_lock);
-        stream_queue.emplace(id, reference, reference_progress, url, method, body, headers, params);
-
-        if (stream_threads < stream_max_threads) {
-            stream_threads++;
-            std::thread(stream_worker).detach();
-        }
+        // streams hold on to their thread for as long as they run, so they get their own lane instead of starving requests & connects
+        Reflection::Jobs::submit(Reflection::Jobs::kind::stream, [id, reference, reference_progress, url, method, body, headers, params]() {
+            stream_request(id, reference, reference_progress, url, method, body, headers, params);
+        });
 
         return 0;
     }
@@ -659,6 +711,10 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
             listener->fire(L, "pong", 1);
         }
 
+        void on_queued() {
+            Tracker::wake(L);
+        }
+
         void addl(std::string name, std::string identity, int index) {
             listener->addl(this->L, name, identity, index);
         }
@@ -893,14 +949,6 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
         return 1;
     }
 
-    int socket__gc(lua_State* L)
-    {
-        if (Class::is(L, 1, "socket")) {
-            delete (LSocket*)Class::to(L, 1);
-        }
-        return 0;
-    }
-
     int socket(lua_State* L) {
         std::string url = luaL::checkcstring(L, 1);
         std::map<std::string, std::string> headers;
@@ -915,14 +963,11 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
         }
 
         if (!Class::existsbyname(L, "socket")) {
-            Class::create(L, "socket");
+            Class::create<LSocket>(L, "socket");
 
             lua::pushcfunction(L, socket__tostring);
             lua::setfield(L, -2, "__tostring");
 
-            lua::pushcfunction(L, socket__gc);
-            lua::setfield(L, -2, "__gc");
-
             lua::newtable(L);
                 lua::pushcfunction(L, socket_add);
                 lua::setfield(L, -2, "add");
@@ -997,8 +1042,7 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
             lua::pop(L);
         }
 
-        LSocket* socket = new LSocket(L, url, headers);
-        Class::spawn(L, socket, "socket");
+        Class::emplace<LSocket>(L, L, url, headers);
 
         return 1;
     }
@@ -1370,6 +1414,7 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
 
             if (!internal) {
                 waiting++;
+                Tracker::wake(L);
                 std::unique_lock<std::mutex> lock(schedule_mutex);
                 ready_to_process.wait(lock, [this] { return !processing.load() && syncing.load(); });
                 processing = true;
@@ -1550,6 +1595,7 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
             }
 
             waiting++;
+            Tracker::wake(L);
             std::unique_lock<std::mutex> lock(schedule_mutex);
             ready_to_process.wait(lock, [this] { return !processing.load() && syncing.load(); });
             processing = true;
@@ -1715,7 +1761,17 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
                     .port(this->port)
                     .address("0.0.0.0")
                     .request_handler([this](request_handle_t req) {
-                        return this->process(req);
+                        if (this->is_metrics(req)) {
+                            auto res = req->create_response(restinio::status_ok());
+                            res.append_header(restinio::http_field::content_type, "text/plain; version=0.0.4");
+                            res.set_body(Metrics::prometheus());
+                            return res.done();
+                        }
+
+                        auto start = std::chrono::steady_clock::now();
+                        auto status = this->process(req);
+                        Metrics::observe(serve_seconds, start);
+                        return status;
                     }), 4);
             }
             catch (const std::exception& ex) {
@@ -1734,6 +1790,17 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
             this->server.reset();
         }
 
+        // Answers the path with the metrics registry before any lua handler sees it, empty turns it off
+        void set_metrics(std::string path) {
+            std::lock_guard<std::mutex> lock(metrics_mutex);
+            metrics_path = path;
+        }
+
+        bool is_metrics(const request_handle_t& req) {
+            std::lock_guard<std::mutex> lock(metrics_mutex);
+            return metrics_path.size() > 0 && req->header().method() == restinio::http_method_get() && req->header().path() == metrics_path;
+        }
+
         uint16_t get_port() { return port; }
         bool get_active() { return active; }
         bool is_processing() { return processing; }
@@ -1745,6 +1812,8 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
         server_t server;
         std::mutex sync_mutex;
         std::mutex schedule_mutex;
+        std::mutex metrics_mutex;
+        std::string metrics_path;
         std::condition_variable ready_to_process;
         std::condition_variable processing_done;
         std::atomic<bool> active = false;
@@ -1931,15 +2000,6 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
         return 1;
     }
 
-    int serve_socket__gc(lua_State* L)
-    {
-        if (Class::is(L, 1, "serve.socket")) {
-            Serve_Socket* sock = (Serve_Socket*)Class::to(L, 1);
-            delete sock;
-        }
-        return 0;
-    }
-
     int serve_socket__tostring(lua_State* L)
     {
         Serve_Socket* sock = (Serve_Socket*)Class::check(L, 1, "serve.socket");
@@ -1960,10 +2020,8 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
 
     void serve_socket_push(lua_State* L, std::string path, Serve* parent, rws::ws_handle_t socket)
     {
-        Serve_Socket* sock = new Serve_Socket(path, parent, socket);
-
         if (!Class::existsbyname(L, "serve.socket")) {
-            Class::create(L, "serve.socket");
+            Class::create<Serve_Socket>(L, "serve.socket");
 
             lua::newtable(L);
 
@@ -1987,16 +2045,13 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
 
             lua::setfield(L, -2, "__index");
 
-            lua::pushcfunction(L, serve_socket__gc);
-            lua::setfield(L, -2, "__gc");
-
             lua::pushcfunction(L, serve_socket__tostring);
             lua::setfield(L, -2, "__tostring");
 
             lua::pop(L);
         }
 
-        Class::spawn(L, sock, "serve.socket");
+        Class::emplace<Serve_Socket>(L, path, parent, socket);
     }
 
     int serve_start(lua_State* L)
@@ -2027,6 +2082,13 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
         return 1;
     }
 
+    int serve_metrics(lua_State* L)
+    {
+        Serve* serve = (Serve*)Class::check(L, 1, "serve");
+        serve->set_metrics(lua::isstring(L, 2) ? luaL::checkcstring(L, 2) : "");
+        return 0;
+    }
+
     int serve_exists(lua_State* L)
     {
         Serve* serve = (Serve*)Class::check(L, 1, "serve");
@@ -2397,6 +2459,9 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
                 lua::pushcfunction(L, serve_exists);
                 lua::setfield(L, -2, "exists");
 
+                lua::pushcfunction(L, serve_metrics);
+                lua::setfield(L, -2, "metrics");
+
                 lua::pushcfunction(L, serve_handlers);
                 lua::setfield(L, -2, "handlers");
 
@@ -2452,261 +2517,6 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
 
     void runtime_threaded(lua_State* T)
     {
-        std::unique_lock<std::mutex> lock_progress(http_progress_lock);
-
-        if (http_progress.size() > 0) {
-            for (auto it = http_progress.begin(); it != http_progress.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L != T) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                std::string url = std::get<2>(result);
-                cpr::cpr_off_t downloadTotal = std::get<3>(result);
-                cpr::cpr_off_t downloadNow = std::get<4>(result);
-                cpr::cpr_off_t uploadTotal = std::get<5>(result);
-                cpr::cpr_off_t uploadNow = std::get<6>(result);
-
-                if (downloadTotal == -1 && downloadNow == -1 && uploadTotal == -1 && uploadNow == -1) {
-                    luaL::rmref(L, reference);
-                    it = http_progress.erase(it);
-                    continue;
-                }
-
-                lua::pushref(L, reference);
-
-                lua::pushnumber(L, downloadTotal);
-                lua::pushnumber(L, downloadNow);
-                lua::pushnumber(L, uploadTotal);
-                lua::pushnumber(L, uploadNow);
-
-                if (lua::tcall(L, 4, 1)) {
-                    std::string err = lua::tocstring(L, -1);
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "progress - " + url, err);
-                    std::lock_guard<std::mutex> cancel_lock_guard(progress_cancel_lock);
-                    if (!progress_cancel.empty()) {
-                        bool should = true;
-
-                        for (auto& cancel : progress_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                should = false;
-                                break;
-                            }
-                        }
-
-                        if (should) {
-                            progress_cancel.push_back(std::pair<uintptr_t, int>(id, reference));
-                        }
-                    }
-                }
-                else if (lua::isboolean(L, -1) && lua::toboolean(L, -1) == false) {
-                    std::lock_guard<std::mutex> cancel_lock_guard(progress_cancel_lock);
-                    if (!progress_cancel.empty()) {
-                        bool should = true;
-
-                        for (auto& cancel : progress_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                should = false;
-                                break;
-                            }
-                        }
-
-                        if (should) {
-                            progress_cancel.push_back(std::pair<uintptr_t, int>(id, reference));
-                        }
-                    }
-                }
-
-                lua::pop(L);
-
-                it = http_progress.erase(it);
-            }
-        }
-
-        lock_progress.unlock(); lock_progress.release();
-
-
-        std::unique_lock<std::mutex> lock_http(http_response_lock);
-
-        if (http_responses.size() > 0) {
-            for (auto it = http_responses.begin(); it != http_responses.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L != T) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                cpr::Response response = std::get<2>(result);
-
-                lua::pushref(L, reference);
-                luaL::rmref(L, reference);
-
-                lua::newtable(L);
-
-                lua::pushnumber(L, response.status_code);
-                lua::setfield(L, -2, "status");
-
-                lua::pushcstring(L, response.text);
-                lua::setfield(L, -2, "body");
-
-                lua::pushcstring(L, response.reason);
-                lua::setfield(L, -2, "reason");
-
-                lua::pushcstring(L, response.url.str());
-                lua::setfield(L, -2, "url");
-
-                lua::newtable(L);
-                for (const auto& [key, value] : response.header)
-                {
-                    lua::pushcstring(L, key);
-                    lua::pushcstring(L, value);
-                    lua::settable(L, -3);
-                }
-                lua::setfield(L, -2, "headers");
-
-                if (lua::tcall(L, 1, 0)) {
-                    std::string err = lua::tocstring(L, -1);
-                    lua::pop(L);
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "http - " + response.url.str(), err);
-                }
-
-                it = http_responses.erase(it);
-
-                std::lock_guard<std::mutex> progress_cancel_lock_guard(progress_cancel_lock);
-                if (!progress_cancel.empty()) {
-                    for (auto& cancel : progress_cancel) {
-                        if (cancel.first == id && cancel.second == reference) {
-                            progress_cancel.erase(std::remove(progress_cancel.begin(), progress_cancel.end(), cancel), progress_cancel.end());
-                        }
-                    }
-                }
-            }
-        }
-
-        lock_http.unlock(); lock_http.release();
-
-        std::unique_lock<std::mutex> lock_stream(stream_response_lock);
-
-        if (stream_responses.size() > 0)
-        {
-            for (auto it = stream_responses.begin(); it != stream_responses.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L != T) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                cpr::Response response = std::get<2>(result);
-
-                lua::pushref(L, reference);
-
-                lua::newtable(L);
-
-                lua::pushnumber(L, response.status_code);
-                lua::setfield(L, -2, "status");
-
-                lua::pushcstring(L, response.text);
-                lua::setfield(L, -2, "body");
-
-                lua::pushcstring(L, response.reason);
-                lua::setfield(L, -2, "reason");
-
-                lua::pushcstring(L, response.url.str());
-                lua::setfield(L, -2, "url");
-
-                lua::newtable(L);
-                for (const auto& [key, value] : response.header)
-                {
-                    lua::pushcstring(L, key);
-                    lua::pushcstring(L, value);
-                    lua::settable(L, -3);
-                }
-                lua::setfield(L, -2, "headers");
-
-                if (lua::tcall(L, 1, 1)) {
-                    std::string err = lua::tocstring(L, -1);
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "stream - " + response.url.str(), err);
-
-                    std::lock_guard<std::mutex> cancel_lock_guard(stream_cancel_lock);
-                    if (!stream_cancel.empty()) {
-                        bool should = true;
-
-                        for (auto& cancel : stream_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                should = false;
-                                break;
-                            }
-                        }
-
-                        if (should) {
-                            stream_cancel.push_back(std::pair<uintptr_t, int>(id, reference));
-                        }
-                    }
-                }
-                else if (lua::isboolean(L, -1) && lua::toboolean(L, -1) == false) {
-                    std::lock_guard<std::mutex> cancel_lock_guard(stream_cancel_lock);
-                    if (!stream_cancel.empty()) {
-                        bool should = true;
-
-                        for (auto& cancel : stream_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                should = false;
-                                break;
-                            }
-                        }
-
-                        if (should) {
-                            stream_cancel.push_back(std::pair<uintptr_t, int>(id, reference));
-                        }
-                    }
-                }
-
-                it = stream_responses.erase(it);
-                lua::pop(L);
-
-                if (response.status_code != 100) {
-                    luaL::rmref(L, reference);
-
-                    std::lock_guard<std::mutex> progress_cancel_lock_guard(progress_cancel_lock);
-                    if (!progress_cancel.empty()) {
-                        for (auto& cancel : progress_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                progress_cancel.erase(std::remove(progress_cancel.begin(), progress_cancel.end(), cancel), progress_cancel.end());
-                            }
-                        }
-                    }
-
-                    std::lock_guard<std::mutex> cancel_lock_guard(stream_cancel_lock);
-                    if (!stream_cancel.empty()) {
-                        for (auto& cancel : stream_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                stream_cancel.erase(std::remove(stream_cancel.begin(), stream_cancel.end(), cancel), stream_cancel.end());
-                            }
-                        }
-                    }
-                }
-            }
-            stream_responses.clear();
-        }
-
-        lock_stream.unlock(); lock_stream.release();
-
         if (sockets.size() > 0) {
             for (auto it = sockets.begin(); it != sockets.end(); ) {
                 auto& socket_entry = *it;
@@ -2750,261 +2560,6 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
 
     void runtime()
     {
-        std::unique_lock<std::mutex> lock_progress(http_progress_lock);
-
-        if (http_progress.size() > 0) {
-            for (auto it = http_progress.begin(); it != http_progress.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L == nullptr || Tracker::is_threaded(L)) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                std::string url = std::get<2>(result);
-                cpr::cpr_off_t downloadTotal = std::get<3>(result);
-                cpr::cpr_off_t downloadNow = std::get<4>(result);
-                cpr::cpr_off_t uploadTotal = std::get<5>(result);
-                cpr::cpr_off_t uploadNow = std::get<6>(result);
-
-                if (downloadTotal == -1 && downloadNow == -1 && uploadTotal == -1 && uploadNow == -1) {
-                    luaL::rmref(L, reference);
-                    it = http_progress.erase(it);
-                    continue;
-                }
-
-                lua::pushref(L, reference);
-
-                lua::pushnumber(L, downloadTotal);
-                lua::pushnumber(L, downloadNow);
-                lua::pushnumber(L, uploadTotal);
-                lua::pushnumber(L, uploadNow);
-
-                if (lua::tcall(L, 4, 1)) {
-                    std::string err = lua::tocstring(L, -1);
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "progress - " + url, err);
-                    std::lock_guard<std::mutex> cancel_lock_guard(progress_cancel_lock);
-                    if (!progress_cancel.empty()) {
-                        bool should = true;
-
-                        for (auto& cancel : progress_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                should = false;
-                                break;
-                            }
-                        }
-
-                        if (should) {
-                            progress_cancel.push_back(std::pair<uintptr_t, int>(id, reference));
-                        }
-                    }
-                }
-                else if (lua::isboolean(L, -1) && lua::toboolean(L, -1) == false) {
-                    std::lock_guard<std::mutex> cancel_lock_guard(progress_cancel_lock);
-                    if (!progress_cancel.empty()) {
-                        bool should = true;
-
-                        for (auto& cancel : progress_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                should = false;
-                                break;
-                            }
-                        }
-
-                        if (should) {
-                            progress_cancel.push_back(std::pair<uintptr_t, int>(id, reference));
-                        }
-                    }
-                }
-
-                lua::pop(L);
-
-                it = http_progress.erase(it);
-            }
-        }
-
-        lock_progress.unlock(); lock_progress.release();
-
-
-        std::unique_lock<std::mutex> lock_http(http_response_lock);
-
-        if (http_responses.size() > 0) {
-            for (auto it = http_responses.begin(); it != http_responses.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L == nullptr || Tracker::is_threaded(L)) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                cpr::Response response = std::get<2>(result);
-
-                lua::pushref(L, reference);
-                luaL::rmref(L, reference);
-
-                lua::newtable(L);
-
-                lua::pushnumber(L, response.status_code);
-                lua::setfield(L, -2, "status");
-
-                lua::pushcstring(L, response.text);
-                lua::setfield(L, -2, "body");
-
-                lua::pushcstring(L, response.reason);
-                lua::setfield(L, -2, "reason");
-
-                lua::pushcstring(L, response.url.str());
-                lua::setfield(L, -2, "url");
-
-                lua::newtable(L);
-                for (const auto& [key, value] : response.header)
-                {
-                    lua::pushcstring(L, key);
-                    lua::pushcstring(L, value);
-                    lua::settable(L, -3);
-                }
-                lua::setfield(L, -2, "headers");
-
-                if (lua::tcall(L, 1, 0)) {
-                    std::string err = lua::tocstring(L, -1);
-                    lua::pop(L);
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "http - " + response.url.str(), err);
-                }
-
-                it = http_responses.erase(it);
-
-                std::lock_guard<std::mutex> progress_cancel_lock_guard(progress_cancel_lock);
-                if (!progress_cancel.empty()) {
-                    for (auto& cancel : progress_cancel) {
-                        if (cancel.first == id && cancel.second == reference) {
-                            progress_cancel.erase(std::remove(progress_cancel.begin(), progress_cancel.end(), cancel), progress_cancel.end());
-                        }
-                    }
-                }
-            }
-        }
-
-        lock_http.unlock(); lock_http.release();
-
-        std::unique_lock<std::mutex> lock_stream(stream_response_lock);
-
-        if (stream_responses.size() > 0)
-        {
-            for (auto it = stream_responses.begin(); it != stream_responses.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L == nullptr || Tracker::is_threaded(L)) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                cpr::Response response = std::get<2>(result);
-
-                lua::pushref(L, reference);
-
-                lua::newtable(L);
-
-                lua::pushnumber(L, response.status_code);
-                lua::setfield(L, -2, "status");
-
-                lua::pushcstring(L, response.text);
-                lua::setfield(L, -2, "body");
-
-                lua::pushcstring(L, response.reason);
-                lua::setfield(L, -2, "reason");
-
-                lua::pushcstring(L, response.url.str());
-                lua::setfield(L, -2, "url");
-
-                lua::newtable(L);
-                for (const auto& [key, value] : response.header)
-                {
-                    lua::pushcstring(L, key);
-                    lua::pushcstring(L, value);
-                    lua::settable(L, -3);
-                }
-                lua::setfield(L, -2, "headers");
-
-                if (lua::tcall(L, 1, 1)) {
-                    std::string err = lua::tocstring(L, -1);
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, "stream - " + response.url.str(), err);
-
-                    std::lock_guard<std::mutex> cancel_lock_guard(stream_cancel_lock);
-                    if (!stream_cancel.empty()) {
-                        bool should = true;
-
-                        for (auto& cancel : stream_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                should = false;
-                                break;
-                            }
-                        }
-
-                        if (should) {
-                            stream_cancel.push_back(std::pair<uintptr_t, int>(id, reference));
-                        }
-                    }
-                }
-                else if (lua::isboolean(L, -1) && lua::toboolean(L, -1) == false) {
-                    std::lock_guard<std::mutex> cancel_lock_guard(stream_cancel_lock);
-                    if (!stream_cancel.empty()) {
-                        bool should = true;
-
-                        for (auto& cancel : stream_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                should = false;
-                                break;
-                            }
-                        }
-
-                        if (should) {
-                            stream_cancel.push_back(std::pair<uintptr_t, int>(id, reference));
-                        }
-                    }
-                }
-
-                it = stream_responses.erase(it);
-                lua::pop(L);
-
-                if (response.status_code != 100) {
-                    luaL::rmref(L, reference);
-
-                    std::lock_guard<std::mutex> progress_cancel_lock_guard(progress_cancel_lock);
-                    if (!progress_cancel.empty()) {
-                        for (auto& cancel : progress_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                progress_cancel.erase(std::remove(progress_cancel.begin(), progress_cancel.end(), cancel), progress_cancel.end());
-                            }
-                        }
-                    }
-
-                    std::lock_guard<std::mutex> cancel_lock_guard(stream_cancel_lock);
-                    if (!stream_cancel.empty()) {
-                        for (auto& cancel : stream_cancel) {
-                            if (cancel.first == id && cancel.second == reference) {
-                                stream_cancel.erase(std::remove(stream_cancel.begin(), stream_cancel.end(), cancel), stream_cancel.end());
-                            }
-                        }
-                    }
-                }
-            }
-            stream_responses.clear();
-        }
-
-        lock_stream.unlock(); lock_stream.release();
-
         if (sockets.size() > 0) {
             for (auto it = sockets.begin(); it != sockets.end(); ) {
                 auto& socket_entry = *it;
@@ -3046,23 +2601,21 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
         }
     }
 
+    static constexpr luaL_Reg iot_functions[] = {
+        { "http", http },
+        { "stream", stream },
+        { "socket", socket },
+        { "serve", serve },
+        { nullptr, nullptr }
+    };
+
     void push(lua_State* L, UMODULE hndle)
     {
         std::vector<std::pair<int, std::string>> to_insert;
 
         lua::newtable(L);
 
-        lua::pushcfunction(L, http);
-        lua::setfield(L, -2, "http");
-
-        lua::pushcfunction(L, stream);
-        lua::setfield(L, -2, "stream");
-
-        lua::pushcfunction(L, socket);
-        lua::setfield(L, -2, "socket");
-
-        lua::pushcfunction(L, serve);
-        lua::setfield(L, -2, "serve");
+        luaL::makelib(L, nullptr, iot_functions);
 
         lua::newtable(L);
 
@@ -3189,34 +2742,6 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
     {
         uintptr_t id = Tracker::id(L);
 
-        if (http_progress.size() > 0) {
-            for (auto it = http_progress.begin(); it != http_progress.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-
-                if ((lua_State*)id == L) {
-                    it = http_progress.erase(it);
-                    continue;
-                }
-
-                ++it;
-            }
-        }
-
-        if (http_responses.size() > 0) {
-            for (auto it = http_responses.begin(); it != http_responses.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-
-                if ((lua_State*)id == L) {
-                    it = http_responses.erase(it);
-                    continue;
-                }
-
-                ++it;
-            }
-        }
-
         if (serves.find(id) != serves.end()) {
             auto handlers = serves[id];
             for (auto& serve : handlers) {
@@ -3227,6 +2752,8 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
     }
 
     void api() {
+        http_seconds = Metrics::histogram("interstellar_iot_http_seconds", "Time taken by outgoing http requests");
+        serve_seconds = Metrics::histogram("interstellar_iot_serve_seconds", "Time taken handling incoming http requests");
         Tracker::on_close("iot", cleanup);
         Reflection::on_threaded("iot", runtime_threaded);
         Reflection::on_runtime("iot", runtime);
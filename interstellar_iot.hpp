@@ -44,6 +44,7 @@ namespace INTERSTELLAR_NAMESPACE::IOT {
         virtual void on_error(int status, const std::string& reason);
         virtual void on_ping(const std::string& message);
         virtual void on_pong(const std::string& message);
+        virtual void on_queued();
 
     private:
         static std::string parse_host(const std::string& url);
@@ -19,8 +19,8 @@
 namespace INTERSTELLAR_NAMESPACE::LXZ {
     using namespace Interstellar;
     using namespace Interstellar::API;
-    std::vector<std::tuple<uintptr_t, int, std::string>> queue;
-    std::mutex dethread_lock;
+    Metrics::metric work_seconds = 0;
+    Metrics::metric work_pending = 0;
 
     std::unordered_map<std::string, lua_LXZ_Error>& get_on_error()
     {
@@ -40,109 +40,62 @@ namespace INTERSTELLAR_NAMESPACE::LXZ {
         on_error.erase(name);
     }
 
-    void runtime_threaded(lua_State* T)
-    {
-        std::unique_lock<std::mutex> lock_guard(dethread_lock);
-
-        if (queue.size() > 0) {
-            for (auto it = queue.begin(); it != queue.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L != T) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                std::string data = std::get<2>(result);
-
-                lua::pushref(L, reference);
-                lua::pushcstring(L, data);
+    // A finished compression job, completed by the state that started it, failures hand back an empty string
+    struct job_done : Tracker::completion {
+        int reference;
+        std::string data;
 
-                if (lua::tcall(L, 1, 0)) {
-                    std::string err = lua::tocstring(L, -1);
-                    lua::pop(L);
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, err);
-                }
-
-                luaL::rmref(L, reference);
-
-                it = queue.erase(it);
-            }
+        job_done(int reference, std::string data) : reference(reference), data(std::move(data)) {
+            Metrics::shift(work_pending, 1);
         }
 
-        lock_guard.unlock(); lock_guard.release();
-    }
-
-    void runtime()
-    {
-        std::unique_lock<std::mutex> lock_guard(dethread_lock);
-
-        if (queue.size() > 0) {
-            for (auto it = queue.begin(); it != queue.end(); ) {
-                auto& result = *it;
-                uintptr_t id = std::get<0>(result);
-                lua_State* L = Tracker::is_state(id);
-
-                if (L == nullptr || Tracker::is_threaded(L)) {
-                    ++it;
-                    continue;
-                }
-
-                int reference = std::get<1>(result);
-                std::string data = std::get<2>(result);
-
-                lua::pushref(L, reference);
-                lua::pushcstring(L, data);
-
-                if (lua::tcall(L, 1, 0)) {
-                    std::string err = lua::tocstring(L, -1);
-                    lua::pop(L);
-                    auto& on_error = get_on_error();
-                    for (auto const& handle : on_error) handle.second(L, err);
-                }
+        ~job_done() {
+            Metrics::shift(work_pending, -1);
+        }
 
-                luaL::rmref(L, reference);
+        void complete(lua_State* L) override {
+            lua::pushref(L, reference);
+            lua::pushcstring(L, data);
 
-                it = queue.erase(it);
+            if (lua::tcall(L, 1, 0)) {
+                std::string err = lua::tocstring(L, -1);
+                lua::pop(L);
+                auto& on_error = get_on_error();
+                for (auto const& handle : on_error) handle.second(L, err);
             }
-        }
 
-        lock_guard.unlock(); lock_guard.release();
-    }
+            luaL::rmref(L, reference);
+        }
+    };
 
     int lua_z_compress(lua_State* L) {
         std::string input = lua::tocstring(L, 1);
 
-        if (lua::isfunction(L, 2)) {
-            int reference = luaL::newref(L, 2);
+        bool awaited = !lua::isfunction(L, 2) && Reflection::Task::awaiting(L);
+        if (lua::isfunction(L, 2) || awaited) {
+            int reference = awaited ? Reflection::Task::awaitable(L) : luaL::newref(L, 2);
+            uintptr_t id = Tracker::id(L);
 
-            std::thread([L, reference, input]() {
-                std::lock_guard<std::mutex> lock(dethread_lock);
+            Reflection::Jobs::submit(Reflection::Jobs::kind::cpu, [id, reference, input]() {
+                auto start = std::chrono::steady_clock::now();
                 try {
                     std::ostringstream compressed_stream;
                     {
                         bxz::ostream z_out(compressed_stream, bxz::z);
                         z_out << input;
                     }
-                    queue.push_back(std::tuple((uintptr_t)L, reference, compressed_stream.str()));
+                    Tracker::post(id, new job_done(reference, compressed_stream.str()));
                 }
                 catch (const std::exception& e) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
                 catch (...) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
-                }).detach();
+                Metrics::observe(work_seconds, start);
+                });
 
-            return 0;
+            return awaited ? 1 : 0;
         }
 
         try {
@@ -166,32 +119,31 @@ namespace INTERSTELLAR_NAMESPACE::LXZ {
     int lua_zstd_compress(lua_State* L) {
         std::string input = lua::tocstring(L, 1);
 
-        if (lua::isfunction(L, 2)) {
-            int reference = luaL::newref(L, 2);
+        bool awaited = !lua::isfunction(L, 2) && Reflection::Task::awaiting(L);
+        if (lua::isfunction(L, 2) || awaited) {
+            int reference = awaited ? Reflection::Task::awaitable(L) : luaL::newref(L, 2);
+            uintptr_t id = Tracker::id(L);
 
-            std::thread([L, reference, input]() {
-                std::lock_guard<std::mutex> lock(dethread_lock);
+            Reflection::Jobs::submit(Reflection::Jobs::kind::cpu, [id, reference, input]() {
+                auto start = std::chrono::steady_clock::now();
                 try {
                     std::ostringstream compressed_stream;
                     {
                         bxz::ostream zstd_out(compressed_stream, bxz::zstd);
                         zstd_out << input;
                     }
-                    queue.push_back(std::tuple((uintptr_t)L, reference, compressed_stream.str()));
+                    Tracker::post(id, new job_done(reference, compressed_stream.str()));
                 }
                 catch (const std::exception& e) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
                 catch (...) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
-                }).detach();
+                Metrics::observe(work_seconds, start);
+                });
 
-            return 0;
+            return awaited ? 1 : 0;
         }
 
         try {
@@ -215,32 +167,31 @@ namespace INTERSTELLAR_NAMESPACE::LXZ {
     int lua_bz2_compress(lua_State* L) {
         std::string input = lua::tocstring(L, 1);
 
-        if (lua::isfunction(L, 2)) {
-            int reference = luaL::newref(L, 2);
+        bool awaited = !lua::isfunction(L, 2) && Reflection::Task::awaiting(L);
+        if (lua::isfunction(L, 2) || awaited) {
+            int reference = awaited ? Reflection::Task::awaitable(L) : luaL::newref(L, 2);
+            uintptr_t id = Tracker::id(L);
 
-            std::thread([L, reference, input]() {
-                std::lock_guard<std::mutex> lock(dethread_lock);
+            Reflection::Jobs::submit(Reflection::Jobs::kind::cpu, [id, reference, input]() {
+                auto start = std::chrono::steady_clock::now();
                 try {
                     std::ostringstream compressed_stream;
                     {
                         bxz::ostream bz2_out(compressed_stream, bxz::bz2);
                         bz2_out << input;
                     }
-                    queue.push_back(std::tuple((uintptr_t)L, reference, compressed_stream.str()));
+                    Tracker::post(id, new job_done(reference, compressed_stream.str()));
                 }
                 catch (const std::exception& e) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
                 catch (...) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
-                }).detach();
+                Metrics::observe(work_seconds, start);
+                });
 
-            return 0;
+            return awaited ? 1 : 0;
         }
 
         try {
@@ -264,32 +215,31 @@ namespace INTERSTELLAR_NAMESPACE::LXZ {
     int lua_lzma_compress(lua_State* L) {
         std::string input = lua::tocstring(L, 1);
 
-        if (lua::isfunction(L, 2)) {
-            int reference = luaL::newref(L, 2);
+        bool awaited = !lua::isfunction(L, 2) && Reflection::Task::awaiting(L);
+        if (lua::isfunction(L, 2) || awaited) {
+            int reference = awaited ? Reflection::Task::awaitable(L) : luaL::newref(L, 2);
+            uintptr_t id = Tracker::id(L);
 
-            std::thread([L, reference, input]() {
-                std::lock_guard<std::mutex> lock(dethread_lock);
+            Reflection::Jobs::submit(Reflection::Jobs::kind::cpu, [id, reference, input]() {
+                auto start = std::chrono::steady_clock::now();
                 try {
                     std::ostringstream compressed_stream;
                     {
                         bxz::ostream lzma_out(compressed_stream, bxz::lzma);
                         lzma_out << input;
                     }
-                    queue.push_back(std::tuple((uintptr_t)L, reference, compressed_stream.str()));
+                    Tracker::post(id, new job_done(reference, compressed_stream.str()));
                 }
                 catch (const std::exception& e) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
                 catch (...) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
-                }).detach();
+                Metrics::observe(work_seconds, start);
+                });
 
-            return 0;
+            return awaited ? 1 : 0;
         }
 
         try {
@@ -313,11 +263,13 @@ namespace INTERSTELLAR_NAMESPACE::LXZ {
     int lua_decompress(lua_State* L) {
         std::string input = lua::tocstring(L, 1);
 
-        if (lua::isfunction(L, 2)) {
-            int reference = luaL::newref(L, 2);
+        bool awaited = !lua::isfunction(L, 2) && Reflection::Task::awaiting(L);
+        if (lua::isfunction(L, 2) || awaited) {
+            int reference = awaited ? Reflection::Task::awaitable(L) : luaL::newref(L, 2);
+            uintptr_t id = Tracker::id(L);
 
-            std::thread([L, reference, input]() {
-                std::lock_guard<std::mutex> lock(dethread_lock);
+            Reflection::Jobs::submit(Reflection::Jobs::kind::cpu, [id, reference, input]() {
+                auto start = std::chrono::steady_clock::now();
                 try {
                     std::istringstream compressed_input(input);
                     std::ostringstream decompressed_stream;
@@ -325,21 +277,18 @@ namespace INTERSTELLAR_NAMESPACE::LXZ {
                         bxz::istream data_in(compressed_input);
                         decompressed_stream << data_in.rdbuf();
                     }
-                    queue.push_back(std::tuple((uintptr_t)L, reference, decompressed_stream.str()));
+                    Tracker::post(id, new job_done(reference, decompressed_stream.str()));
                 }
                 catch (const std::exception& e) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
                 catch (...) {
-                    if (Tracker::is_state(L) != nullptr) {
-                        queue.push_back(std::tuple((uintptr_t)L, reference, ""));
-                    }
+                    Tracker::post(id, new job_done(reference, ""));
                 }
-                }).detach();
+                Metrics::observe(work_seconds, start);
+                });
 
-            return 0;
+            return awaited ? 1 : 0;
         }
 
         try {
@@ -361,45 +310,41 @@ namespace INTERSTELLAR_NAMESPACE::LXZ {
         }
     }
 
+    static constexpr luaL_Reg lxz_encode_functions[] = {
+        { "z", lua_z_compress },
+        { "zstd", lua_zstd_compress },
+        { "bz2", lua_bz2_compress },
+        { "lzma", lua_lzma_compress },
+        { nullptr, nullptr }
+    };
+
+    static constexpr luaL_Reg lxz_decode_functions[] = {
+        { "z", lua_decompress },
+        { "zstd", lua_decompress },
+        { "bz2", lua_decompress },
+        { "lzma", lua_decompress },
+        { nullptr, nullptr }
+    };
+
     void push(API::lua_State* L, UMODULE hndle) {
         lua::newtable(L);
 
         lua::newtable(L);
 
-        lua::pushcfunction(L, lua_z_compress);
-        lua::setfield(L, -2, "z");
-
-        lua::pushcfunction(L, lua_zstd_compress);
-        lua::setfield(L, -2, "zstd");
-
-        lua::pushcfunction(L, lua_bz2_compress);
-        lua::setfield(L, -2, "bz2");
-
-        lua::pushcfunction(L, lua_lzma_compress);
-        lua::setfield(L, -2, "lzma");
+        luaL::makelib(L, nullptr, lxz_encode_functions);
 
         lua::setfield(L, -2, "encode");
 
         lua::newtable(L);
 
-        lua::pushcfunction(L, lua_decompress);
-        lua::setfield(L, -2, "z");
-
-        lua::pushcfunction(L, lua_decompress);
-        lua::setfield(L, -2, "zstd");
-
-        lua::pushcfunction(L, lua_decompress);
-        lua::setfield(L, -2, "bz2");
-
-        lua::pushcfunction(L, lua_decompress);
-        lua::setfield(L, -2, "lzma");
+        luaL::makelib(L, nullptr, lxz_decode_functions);
 
         lua::setfield(L, -2, "decode");
     }
 
     void api() {
-        Reflection::on_threaded("lxz", runtime_threaded);
-        Reflection::on_runtime("lxz", runtime);
+        work_seconds = Metrics::histogram("interstellar_lxz_seconds", "Time taken by asynchronous compression jobs");
+        work_pending = Metrics::gauge("interstellar_lxz_queued", "Finished compression jobs waiting on their state");
         Reflection::add("lxz", push);
     }
 }
\ No newline at end of file
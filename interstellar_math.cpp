@@ -164,6 +164,14 @@ namespace INTERSTELLAR_NAMESPACE::Math {
         }
     }
 
+    static constexpr luaL_Reg math_roots_functions[] = {
+        { "linear", Roots::llinear },
+        { "quadric", Roots::lquadric },
+        { "cubic", Roots::lcubic },
+        { "quartic", Roots::lquartic },
+        { nullptr, nullptr }
+    };
+
     void push(lua_State* L, UMODULE hndle)
     {
         lua::pushvalue(L, indexer::global);
@@ -172,17 +180,7 @@ namespace INTERSTELLAR_NAMESPACE::Math {
 
         lua::newtable(L);
 
-        lua::pushcfunction(L, Roots::llinear);
-        lua::setfield(L, -2, "linear");
-
-        lua::pushcfunction(L, Roots::lquadric);
-        lua::setfield(L, -2, "quadric");
-
-        lua::pushcfunction(L, Roots::lcubic);
-        lua::setfield(L, -2, "cubic");
-
-        lua::pushcfunction(L, Roots::lquartic);
-        lua::setfield(L, -2, "quartic");
+        luaL::makelib(L, nullptr, math_roots_functions);
 
         lua::setfield(L, -2, "roots");
     }
@@ -273,21 +273,11 @@ namespace INTERSTELLAR_NAMESPACE::Memory {
         return 0;
     }
 
-    int module__gc(lua_State* L)
-    {
-        if (Class::is(L, 1, "module")) {
-            delete (memory_module*)Class::to(L, 1);
-        }
-        return 0;
-    }
-
     #ifdef _WIN32
         void push_module(lua_State* L, std::string name, HMODULE& hModule, MODULEINFO& moduleInfo)
         {
-            memory_module* mem_module = new memory_module({name, (uintptr_t)hModule, (uintptr_t)moduleInfo.lpBaseOfDll, moduleInfo.SizeOfImage});
-
             if (!Class::existsbyname(L, "module")) {
-                Class::create(L, "module");
+                Class::create<memory_module>(L, "module");
 
                 lua::pushcfunction(L, module__tostring);
                 lua::setfield(L, -2, "__tostring");
@@ -295,21 +285,16 @@ namespace INTERSTELLAR_NAMESPACE::Memory {
                 lua::pushcfunction(L, module__index);
                 lua::setfield(L, -2, "__index");
 
-                lua::pushcfunction(L, module__gc);
-                lua::setfield(L, -2, "__gc");
-
                 lua::pop(L);
             }
 
-            Class::spawn(L, mem_module, "module");
+            Class::emplace<memory_module>(L, memory_module{ name, (uintptr_t)hModule, (uintptr_t)moduleInfo.lpBaseOfDll, moduleInfo.SizeOfImage });
         }
     #else
         void push_module(lua_State* L, std::string name, void* module, void* base, size_t size)
         {
-            memory_module* mem_module = new memory_module({name, (uintptr_t)module, (uintptr_t)base, size});
-
             if (!Class::existsbyname(L, "module")) {
-                Class::create(L, "module");
+                Class::create<memory_module>(L, "module");
 
                 lua::pushcfunction(L, module__tostring);
                 lua::setfield(L, -2, "__tostring");
@@ -317,13 +302,10 @@ namespace INTERSTELLAR_NAMESPACE::Memory {
                 lua::pushcfunction(L, module__index);
                 lua::setfield(L, -2, "__index");
 
-                lua::pushcfunction(L, module__gc);
-                lua::setfield(L, -2, "__gc");
-
                 lua::pop(L);
             }
 
-            Class::spawn(L, mem_module, "module");
+            Class::emplace<memory_module>(L, memory_module{ name, (uintptr_t)module, (uintptr_t)base, size });
         }
     #endif
 
@@ -745,27 +727,11 @@ namespace INTERSTELLAR_NAMESPACE::Memory {
         }
     #endif
 
-    int region__gc(lua_State* L)
-    {
-        if (Class::is(L, 1, "region")) {
-            delete (memory_region*)Class::to(L, 1);
-        }
-        return 0;
-    }
-
     #ifdef _WIN32
         void push_region(lua_State* L, MEMORY_BASIC_INFORMATION& mbi)
         {
-            memory_region* mem_region = new memory_region({
-                (uintptr_t)mbi.BaseAddress,
-                mbi.RegionSize,
-                mbi.State,
-                mbi.Type,
-                mbi.Protect
-            });
-
             if (!Class::existsbyname(L, "region")) {
-                Class::create(L, "region");
+                Class::create<memory_region>(L, "region");
 
                 lua::pushcfunction(L, region__tostring);
                 lua::setfield(L, -2, "__tostring");
@@ -773,21 +739,22 @@ namespace INTERSTELLAR_NAMESPACE::Memory {
                 lua::pushcfunction(L, region__index);
                 lua::setfield(L, -2, "__index");
 
-                lua::pushcfunction(L, region__gc);
-                lua::setfield(L, -2, "__gc");
-
                 lua::pop(L);
             }
 
-            Class::spawn(L, mem_region, "region");
+            Class::emplace<memory_region>(L, memory_region{
+                (uintptr_t)mbi.BaseAddress,
+                mbi.RegionSize,
+                mbi.State,
+                mbi.Type,
+                mbi.Protect
+            });
         }
     #else
         void push_region(lua_State* L, memory_region& mbi)
         {
-            memory_region* mem_region = new memory_region(mbi);
-
             if (!Class::existsbyname(L, "region")) {
-                Class::create(L, "region");
+                Class::create<memory_region>(L, "region");
 
                 lua::pushcfunction(L, region__tostring);
                 lua::setfield(L, -2, "__tostring");
@@ -795,13 +762,10 @@ namespace INTERSTELLAR_NAMESPACE::Memory {
                 lua::pushcfunction(L, region__index);
                 lua::setfield(L, -2, "__index");
 
-                lua::pushcfunction(L, region__gc);
-                lua::setfield(L, -2, "__gc");
-
                 lua::pop(L);
             }
 
-            Class::spawn(L, mem_region, "region");
+            Class::emplace<memory_region>(L, mbi);
         }
     #endif
 
@@ -1879,176 +1843,104 @@ namespace INTERSTELLAR_NAMESPACE::Memory {
 
     }
 
-    void push(lua_State* L, UMODULE hndle)
-    {
-        lua::newtable(L);
-
-        lua::pushcfunction(L, address);
-        lua::setfield(L, -2, "address");
-
-        lua::pushcfunction(L, modules);
-        lua::setfield(L, -2, "modules");
-
-        lua::pushcfunction(L, regions);
-        lua::setfield(L, -2, "regions");
+    static constexpr luaL_Reg memory_functions[] = {
+        { "address", address },
+        { "modules", modules },
+        { "regions", regions },
+        { "module", module },
+        { "base", base },
+        { "fetch", fetch },
+        { "vtable", vtable },
+        { "index", index },
+        { "interface", _interface },
+        { "offset", offset },
+        { "relative", relative },
+        { nullptr, nullptr }
+    };
 
-        lua::pushcfunction(L, module);
-        lua::setfield(L, -2, "module");
+    static constexpr luaL_Reg memory_aob_functions[] = {
+        { "ida", aob_ida },
+        { "hex", aob_hex },
+        { nullptr, nullptr }
+    };
 
-        lua::pushcfunction(L, base);
-        lua::setfield(L, -2, "base");
+    static constexpr luaL_Reg memory_scan_functions[] = {
+        { "bool", scan_bool },
+        { "char", scan_char },
+        { "uchar", scan_uchar },
+        { "short", scan_short },
+        { "ushort", scan_ushort },
+        { "int", scan_int },
+        { "uint", scan_uint },
+        { "long", scan_long },
+        { "ulong", scan_ulong },
+        { "float", scan_float },
+        { "double", scan_double },
+        { "address", scan_address },
+        { nullptr, nullptr }
+    };
 
-        lua::pushcfunction(L, fetch);
-        lua::setfield(L, -2, "fetch");
+    static constexpr luaL_Reg memory_read_functions[] = {
+        { "bool", read_bool },
+        { "char", read_char },
+        { "uchar", read_uchar },
+        { "short", read_short },
+        { "ushort", read_ushort },
+        { "int", read_int },
+        { "uint", read_uint },
+        { "long", read_long },
+        { "ulong", read_ulong },
+        { "float", read_float },
+        { "double", read_double },
+        { "sequence", read_sequence },
+        { "address", read_address },
+        { nullptr, nullptr }
+    };
 
-        lua::pushcfunction(L, vtable);
-        lua::setfield(L, -2, "vtable");
+    static constexpr luaL_Reg memory_write_functions[] = {
+        { "bool", write_bool },
+        { "char", write_char },
+        { "uchar", write_uchar },
+        { "short", write_short },
+        { "ushort", write_ushort },
+        { "int", write_int },
+        { "uint", write_uint },
+        { "long", write_long },
+        { "ulong", write_ulong },
+        { "float", write_float },
+        { "double", write_double },
+        { "sequence", write_sequence },
+        { "address", write_address },
+        { nullptr, nullptr }
+    };
 
-        lua::pushcfunction(L, index);
-        lua::setfield(L, -2, "index");
+    void push(lua_State* L, UMODULE hndle)
+    {
+        lua::newtable(L);
 
-        lua::pushcfunction(L, _interface);
-        lua::setfield(L, -2, "interface");
+        luaL::makelib(L, nullptr, memory_functions);
 
         lua::newtable(L);
 
-        lua::pushcfunction(L, aob_ida);
-        lua::setfield(L, -2, "ida");
-
-        lua::pushcfunction(L, aob_hex);
-        lua::setfield(L, -2, "hex");
+        luaL::makelib(L, nullptr, memory_aob_functions);
 
         lua::setfield(L, -2, "aob");
 
-        lua::pushcfunction(L, offset);
-        lua::setfield(L, -2, "offset");
-
-        lua::pushcfunction(L, relative);
-        lua::setfield(L, -2, "relative");
-
         lua::newtable(L);
 
-        lua::pushcfunction(L, scan_bool);
-        lua::setfield(L, -2, "bool");
-
-        lua::pushcfunction(L, scan_char);
-        lua::setfield(L, -2, "char");
-
-        lua::pushcfunction(L, scan_uchar);
-        lua::setfield(L, -2, "uchar");
-
-        lua::pushcfunction(L, scan_short);
-        lua::setfield(L, -2, "short");
-
-        lua::pushcfunction(L, scan_ushort);
-        lua::setfield(L, -2, "ushort");
-
-        lua::pushcfunction(L, scan_int);
-        lua::setfield(L, -2, "int");
-
-        lua::pushcfunction(L, scan_uint);
-        lua::setfield(L, -2, "uint");
-
-        lua::pushcfunction(L, scan_long);
-        lua::setfield(L, -2, "long");
-
-        lua::pushcfunction(L, scan_ulong);
-        lua::setfield(L, -2, "ulong");
-
-        lua::pushcfunction(L, scan_float);
-        lua::setfield(L, -2, "float");
-
-        lua::pushcfunction(L, scan_double);
-        lua::setfield(L, -2, "double");
-
-        lua::pushcfunction(L, scan_address);
-        lua::setfield(L, -2, "address");
+        luaL::makelib(L, nullptr, memory_scan_functions);
 
         lua::setfield(L, -2, "scan");
 
         lua::newtable(L);
 
-        lua::pushcfunction(L, read_bool);
-        lua::setfield(L, -2, "bool");
-
-        lua::pushcfunction(L, read_char);
-        lua::setfield(L, -2, "char");
-
-        lua::pushcfunction(L, read_uchar);
-        lua::setfield(L, -2, "uchar");
-
-        lua::pushcfunction(L, read_short);
-        lua::setfield(L, -2, "short");
-
-        lua::pushcfunction(L, read_ushort);
-        lua::setfield(L, -2, "ushort");
-
-        lua::pushcfunction(L, read_int);
-        lua::setfield(L, -2, "int");
-
-        lua::pushcfunction(L, read_uint);
-        lua::setfield(L, -2, "uint");
-
-        lua::pushcfunction(L, read_long);
-        lua::setfield(L, -2, "long");
-
-        lua::pushcfunction(L, read_ulong);
-        lua::setfield(L, -2, "ulong");
-
-        lua::pushcfunction(L, read_float);
-        lua::setfield(L, -2, "float");
-
-        lua::pushcfunction(L, read_double);
-        lua::setfield(L, -2, "double");
-
-        lua::pushcfunction(L, read_sequence);
-        lua::setfield(L, -2, "sequence");
-
-        lua::pushcfunction(L, read_address);
-        lua::setfield(L, -2, "address");
+        luaL::makelib(L, nullptr, memory_read_functions);
 
         lua::setfield(L, -2, "read");
 
         lua::newtable(L);
 
-        lua::pushcfunction(L, write_bool);
-        lua::setfield(L, -2, "bool");
-
-        lua::pushcfunction(L, write_char);
-        lua::setfield(L, -2, "char");
-
-        lua::pushcfunction(L, write_uchar);
-        lua::setfield(L, -2, "uchar");
-
-        lua::pushcfunction(L, write_short);
-        lua::setfield(L, -2, "short");
-
-        lua::pushcfunction(L, write_ushort);
-        lua::setfield(L, -2, "ushort");
-
-        lua::pushcfunction(L, write_int);
-        lua::setfield(L, -2, "int");
-
-        lua::pushcfunction(L, write_uint);
-        lua::setfield(L, -2, "uint");
-
-        lua::pushcfunction(L, write_long);
-        lua::setfield(L, -2, "long");
-
-        lua::pushcfunction(L, write_ulong);
-        lua::setfield(L, -2, "ulong");
-
-        lua::pushcfunction(L, write_float);
-        lua::setfield(L, -2, "float");
-
-        lua::pushcfunction(L, write_double);
-        lua::setfield(L, -2, "double");
-
-        lua::pushcfunction(L, write_sequence);
-        lua::setfield(L, -2, "sequence");
-
-        lua::pushcfunction(L, write_address);
-        lua::setfield(L, -2, "address");
+        luaL::makelib(L, nullptr, memory_write_functions);
 
         lua::setfield(L, -2, "write");
     }
@@ -267,6 +267,15 @@ namespace INTERSTELLAR_NAMESPACE::OS {
         }
     }
 
+    static constexpr luaL_Reg os_argv_functions[] = {
+        { "raw", ARGV::lraw },
+        { "flags", ARGV::lflags },
+        { "options", ARGV::loptions },
+        { "exists", ARGV::lexists },
+        { "positional", ARGV::lpositional },
+        { nullptr, nullptr }
+    };
+
     void push(lua_State* L, UMODULE hndle)
     {
         lua::pushvalue(L, indexer::global);
@@ -275,20 +284,7 @@ namespace INTERSTELLAR_NAMESPACE::OS {
 
         lua::newtable(L);
 
-        lua::pushcfunction(L, ARGV::lraw);
-        lua::setfield(L, -2, "raw");
-
-        lua::pushcfunction(L, ARGV::lflags);
-        lua::setfield(L, -2, "flags");
-
-        lua::pushcfunction(L, ARGV::loptions);
-        lua::setfield(L, -2, "options");
-
-        lua::pushcfunction(L, ARGV::lexists);
-        lua::setfield(L, -2, "exists");
-
-        lua::pushcfunction(L, ARGV::lpositional);
-        lua::setfield(L, -2, "positional");
+        luaL::makelib(L, nullptr, os_argv_functions);
 
         lua::setfield(L, -2, "argv");
     }
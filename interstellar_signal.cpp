@@ -159,11 +159,16 @@ namespace INTERSTELLAR_NAMESPACE::Signal {
 
     std::vector<Handle*> handles;
 
+    void cleanup_requests(lua_State* L);
+    void cleanup_channels(lua_State* L);
+
     void cleanup(lua_State* L)
     {
         for (Handle* handle : handles) {
             handle->erase(L);
         }
+        cleanup_requests(L);
+        cleanup_channels(L);
     }
 
     Handle::Handle()
@@ -338,6 +343,9 @@ namespace INTERSTELLAR_NAMESPACE::Signal {
 
     void Handle::fire(lua_State* L, std::string name, int inputs)
     {
+        static Metrics::metric fires = Metrics::counter("interstellar_signal_fires_total", "Signals fired");
+        Metrics::add(fires);
+
         uintptr_t id = Tracker::id(L);
         auto callbacks_itr = callbacks.find(id);
         if (callbacks_itr == callbacks.end()) {
@@ -507,17 +515,44 @@ namespace INTERSTELLAR_NAMESPACE::Signal {
 
     Handle* universal;
 
-    lua_State* call_origin;
-    std::string call_name;
-    int wrapper_call(lua_State* L)
+    // What a cross-state call hands to the wrapper running inside the target, kept on the caller's stack
+    // Arguments are encoded before the target is locked and results decoded after it is let go, so the lock only covers the call itself
+    struct interstate_context {
+        lua_State* origin;
+        std::string name;
+        std::vector<std::string> arguments = {};
+        std::vector<std::string> results = {};
+        int returns = 0;
+    };
+
+    void encode_arguments(lua_State* L, interstate_context& context)
     {
-        int nargs = lua::gettop(call_origin) - 2;
+        int nargs = lua::gettop(L) - 2;
+        context.arguments.resize(nargs);
 
         for (int i = 1; i <= nargs; i++) {
-            Reflection::transfer(call_origin, L, i + 2);
+            int type = Reflection::encode(L, i + 2, context.arguments[i - 1]);
+            if (type != 0) luaL::error(L, (std::string() + "reflection unsupported datatype: " + lua::gettypename(L, type)).c_str());
+        }
+    }
+
+    int decode_arguments(lua_State* L, interstate_context& context)
+    {
+        for (const std::string& buffer : context.arguments) {
+            std::string err = Reflection::decode(L, buffer);
+            if (err.size() > 0) luaL::error(L, (std::string() + "reflection transfer error: " + err).c_str());
         }
+        return (int)context.arguments.size();
+    }
+
+    int wrapper_call(lua_State* L)
+    {
+        lua::pushvalue(L, upvalueindex(1));
+        interstate_context* context = (interstate_context*)lua::touserdata(L, -1);
+        lua::pop(L);
 
-        universal->fire(L, call_name, nargs);
+        int nargs = decode_arguments(L, *context);
+        universal->fire(L, context->name, nargs);
 
         return 0;
     }
@@ -533,20 +568,23 @@ namespace INTERSTELLAR_NAMESPACE::Signal {
         std::string name = luaL::checkcstring(L, 2);
 
         if (target != L) {
-            call_origin = L;
-            call_name = name;
+            interstate_context context{ L, name };
+            encode_arguments(L, context);
 
             if (Tracker::should_lock(target, L)) {
                 bool should_notify = !Tracker::is_threaded(target);
                 if (should_notify) Tracker::increment();
                 Tracker::cross_lock(target, L);
-                lua::pushcfunction(target, wrapper_call);
+                lua::pushlightuserdata(target, &context);
+                lua::pushcclosure(target, wrapper_call, 1);
                 lua::pcall(target, 0, 0, 0);
                 Tracker::cross_unlock(target, L);
                 if (should_notify) Tracker::decrement();
+                else Tracker::wake(target);
             }
             else {
-                lua::pushcfunction(target, wrapper_call);
+                lua::pushlightuserdata(target, &context);
+                lua::pushcclosure(target, wrapper_call, 1);
                 lua::pcall(target, 0, 0, 0);
             }
 
@@ -564,24 +602,29 @@ namespace INTERSTELLAR_NAMESPACE::Signal {
         return 0;
     }
 
-    lua_State* rcall_origin;
-    std::string rcall_name;
-    int rcall_returns;
     int wrapper_rcall(lua_State* L)
     {
-        int nargs = lua::gettop(rcall_origin) - 2;
-
-        for (int i = 1; i <= nargs; i++) {
-            Reflection::transfer(rcall_origin, L, i + 2);
-        }
-
-        rcall_returns = universal->rfire(L, rcall_name, nargs, -1);
+        lua::pushvalue(L, upvalueindex(1));
+        interstate_context* context = (interstate_context*)lua::touserdata(L, -1);
+        lua::pop(L);
 
-        for (int i = rcall_returns; i >= 1; i--) {
-            Reflection::transfer(L, rcall_origin, -i);
+        int nargs = decode_arguments(L, *context);
+        int returns = universal->rfire(L, context->name, nargs, -1);
+
+        // results stay encoded until the caller has let go of us
+        context->results.resize(returns);
+        for (int i = returns; i >= 1; i--) {
+            int type = Reflection::encode(L, -i, context->results[returns - i]);
+            if (type != 0) {
+                lua::pop(L, returns);
+                context->results.clear();
+                luaL::error(L, (std::string() + "reflection unsupported datatype: " + lua::gettypename(L, type)).c_str());
+                return 0;
+            }
         }
 
-        lua::pop(L, rcall_returns);
+        lua::pop(L, returns);
+        context->returns = returns;
 
         return 0;
     }
@@ -597,24 +640,32 @@ namespace INTERSTELLAR_NAMESPACE::Signal {
         std::string name = luaL::checkcstring(L, 2);
 
         if (target != L) {
-            rcall_origin = L;
-            rcall_name = name;
+            interstate_context context{ L, name };
+            encode_arguments(L, context);
 
             if (Tracker::should_lock(target, L)) {
                 bool should_notify = !Tracker::is_threaded(target);
                 if (should_notify) Tracker::increment();
                 Tracker::cross_lock(target, L);
-                lua::pushcfunction(target, wrapper_rcall);
+                lua::pushlightuserdata(target, &context);
+                lua::pushcclosure(target, wrapper_rcall, 1);
                 lua::pcall(target, 0, 0, 0);
                 Tracker::cross_unlock(target, L);
                 if (should_notify) Tracker::decrement();
+                else Tracker::wake(target);
             }
             else {
-                lua::pushcfunction(target, wrapper_rcall);
+                lua::pushlightuserdata(target, &context);
+                lua::pushcclosure(target, wrapper_rcall, 1);
                 lua::pcall(target, 0, 0, 0);
             }
 
-            return rcall_returns;
+            for (int i = 0; i < context.returns; i++) {
+                std::string err = Reflection::decode(L, context.results[i]);
+                if (err.size() > 0) luaL::error(L, (std::string() + "reflection transfer error: " + err).c_str());
+            }
+
+            return context.returns;
         }
 
         int nargs = lua::gettop(L) - 2;
@@ -626,21 +677,738 @@ namespace INTERSTELLAR_NAMESPACE::Signal {
         return universal->rfire(target, name, nargs, -1);
     }
 
-    void push(API::lua_State* L, UMODULE hndle) {
-        Tracker::on_close("signal", cleanup);
+    // Requests waiting on a reply, by the state that sent them
+    struct pending_request {
+        int reference = 0;
+        uint64_t timer = 0;
+        bool batched = false;
+    };
+
+    std::unordered_map<uintptr_t, std::unordered_map<uint64_t, pending_request>> requests;
+    std::mutex requests_lock;
+    std::atomic<uint64_t> request_ids = 0;
+
+    bool take_request(uintptr_t origin, uint64_t id, pending_request& request)
+    {
+        std::lock_guard<std::mutex> guard(requests_lock);
+        auto irequests = requests.find(origin);
+        if (irequests == requests.end()) return false;
+
+        auto irequest = irequests->second.find(id);
+        if (irequest == irequests->second.end()) return false;
+
+        request = irequest->second;
+        irequests->second.erase(irequest);
+        return true;
+    }
+
+    // Calls whoever waits on a request with the arguments on top of the stack
+    void settle(lua_State* L, pending_request& request, int nargs)
+    {
+        if (request.timer != 0) Reflection::Task::cancel(L, request.timer);
+
+        lua::pushref(L, request.reference);
+        luaL::rmref(L, request.reference);
+        lua::insert(L, -(nargs + 1));
+
+        if (lua::tcall(L, nargs, 0)) {
+            std::string err = lua::tocstring(L, -1);
+            lua::pop(L);
+            auto& on_error = get_on_error();
+            for (auto const& handle : on_error) handle.second(L, "request", "", err);
+        }
+    }
+
+    // The results of a batch, or why it never ran, on their way back to the state that sent it
+    struct request_reply : Tracker::completion {
+        uint64_t id;
+        std::string results;
+        std::string failure;
+
+        request_reply(uint64_t id, std::string results, std::string failure) : id(id), results(std::move(results)), failure(std::move(failure)) {}
+
+        void complete(lua_State* L) override
+        {
+            pending_request request;
+
+            // timed out already
+            if (!take_request(Tracker::id(L), id, request)) return;
+
+            if (failure.empty()) {
+                failure = Reflection::decode(L, results);
+                if (!failure.empty()) failure = "request decode error: " + failure;
+            }
+
+            if (!failure.empty()) {
+                lua::pushnil(L);
+                lua::pushcstring(L, failure);
+                settle(L, request, 2);
+                return;
+            }
+
+            if (request.batched) {
+                settle(L, request, 1);
+                return;
+            }
+
+            lua::rawgeti(L, -1, 1);
+            lua::remove(L, -2);
+            int table = lua::gettop(L);
+
+            lua::getfield(L, table, "n");
+            int count = (int)lua::tonumber(L, -1);
+            lua::pop(L);
+
+            for (int i = 1; i <= count; i++) {
+                lua::rawgeti(L, table, i);
+            }
+            lua::remove(L, table);
+
+            settle(L, request, count);
+        }
+    };
+
+    // A batch of calls on its way to the state that handles them, each call is { name, arguments..., n = #arguments }
+    struct request_call : Tracker::completion {
+        uintptr_t origin;
+        uint64_t id;
+        std::string payload;
+        bool reply;
+
+        request_call(uintptr_t origin, uint64_t id, std::string payload, bool reply) : origin(origin), id(id), payload(std::move(payload)), reply(reply) {}
+
+        void complete(lua_State* L) override
+        {
+            int top = lua::gettop(L);
+
+            std::string failure = Reflection::decode(L, payload);
+            if (!failure.empty()) {
+                lua::settop(L, top);
+                if (reply) Tracker::post(origin, new request_reply(id, "", "request decode error: " + failure));
+                return;
+            }
+
+            int calls = lua::gettop(L);
+            int count = (int)lua::objlen(L, calls);
+
+            lua::createtable(L, count, 0);
+            int results = lua::gettop(L);
+
+            for (int i = 1; i <= count; i++) {
+                lua::rawgeti(L, calls, i);
+                int entry = lua::gettop(L);
+
+                lua::rawgeti(L, entry, 1);
+                std::string name = lua::isstring(L, -1) ? lua::tocstring(L, -1) : "";
+                lua::pop(L);
+
+                lua::getfield(L, entry, "n");
+                int nargs = lua::isnumber(L, -1) ? (int)lua::tonumber(L, -1) : std::max(0, (int)lua::objlen(L, entry) - 1);
+                lua::pop(L);
+
+                for (int a = 1; a <= nargs; a++) {
+                    lua::rawgeti(L, entry, a + 1);
+                }
+
+                int returns = universal->rfire(L, name, nargs, reply ? -1 : 0);
+
+                if (reply) {
+                    lua::createtable(L, returns, 1);
+                    for (int r = 1; r <= returns; r++) {
+                        lua::pushvalue(L, entry + r);
+                        lua::rawseti(L, -2, r);
+                    }
+                    lua::pushnumber(L, returns);
+                    lua::setfield(L, -2, "n");
+                    lua::rawseti(L, results, i);
+                }
+
+                lua::settop(L, results);
+            }
+
+            if (reply) {
+                std::string encoded;
+                int type = Reflection::encode(L, results, encoded);
+                if (type != 0) {
+                    Tracker::post(origin, new request_reply(id, "", std::string() + "request unsupported datatype: " + lua::gettypename(L, type)));
+                }
+                else {
+                    Tracker::post(origin, new request_reply(id, std::move(encoded), ""));
+                }
+            }
+
+            lua::settop(L, top);
+        }
+    };
+
+    int request_timeout(lua_State* L)
+    {
+        uint64_t id = (uint64_t)lua::tonumber(L, upvalueindex(1));
+
+        pending_request request;
+        if (!take_request(Tracker::id(L), id, request)) return 0;
+
+        // our own timer is done with already
+        request.timer = 0;
+
+        lua::pushnil(L);
+        lua::pushcstring(L, "request timed out");
+        settle(L, request, 2);
+        return 0;
+    }
+
+    // Queues the batch at payload onto the target, whoever waits on it is called back with the results during our own tick
+    int send_request(lua_State* L, lua_State* target, int payload, int callback, int timeout, bool batched)
+    {
+        std::string encoded;
+        int type = Reflection::encode(L, payload, encoded);
+        if (type != 0) {
+            luaL::error(L, (std::string() + "request unsupported datatype: " + lua::gettypename(L, type)).c_str());
+            return 0;
+        }
+
+        bool awaited = !lua::isfunction(L, callback) && Reflection::Task::awaiting(L);
+        bool reply = awaited || lua::isfunction(L, callback);
+
+        uintptr_t origin = Tracker::id(L);
+        uint64_t id = ++request_ids;
+
+        if (reply) {
+            pending_request request;
+            request.batched = batched;
+            request.reference = awaited ? Reflection::Task::awaitable(L) : luaL::newref(L, callback);
+
+            if (lua::isnumber(L, timeout) && lua::tonumber(L, timeout) > 0) {
+                lua::pushnumber(L, (double)id);
+                lua::pushcclosure(L, request_timeout, 1);
+
+                // the timer takes the closure off the stack with its reference
+                request.timer = Reflection::Task::delay(L, lua::tonumber(L, timeout), -1);
+            }
+
+            std::lock_guard<std::mutex> guard(requests_lock);
+            requests[origin][id] = request;
+        }
+
+        if (!Tracker::post(target, new request_call(origin, id, std::move(encoded), reply)) && reply) {
+            Tracker::post(origin, new request_reply(id, "", "invalid lua instance"));
+        }
+
+        if (awaited) return 1;
+
+        lua::pushnumber(L, (double)id);
+        return 1;
+    }
+
+    // signal.request(state, name, arguments, callback, timeout)
+    int request(lua_State* L)
+    {
+        lua_State* target = Tracker::is_state(Class::check(L, 1, "lua.state"));
+        if (target == nullptr) {
+            luaL::error(L, "invalid lua instance");
+            return 0;
+        }
+
+        std::string name = luaL::checkcstring(L, 2);
+
+        int nargs = 0;
+        if (lua::istable(L, 3)) {
+            lua::getfield(L, 3, "n");
+            nargs = lua::isnumber(L, -1) ? (int)lua::tonumber(L, -1) : (int)lua::objlen(L, 3);
+            lua::pop(L);
+        }
+        else if (lua::gettype(L, 3) > datatype::nil) {
+            luaL::argerror(L, 3, "expected a table of arguments");
+            return 0;
+        }
+
+        // a request is just a batch of one
+        lua::createtable(L, 1, 0);
+        lua::createtable(L, nargs + 1, 1);
+        lua::pushcstring(L, name);
+        lua::rawseti(L, -2, 1);
+        for (int i = 1; i <= nargs; i++) {
+            lua::rawgeti(L, 3, i);
+            lua::rawseti(L, -2, i + 1);
+        }
+        lua::pushnumber(L, nargs);
+        lua::setfield(L, -2, "n");
+        lua::rawseti(L, -2, 1);
+
+        return send_request(L, target, lua::gettop(L), 4, 5, false);
+    }
+
+    // signal.batch(state, { { name, arguments... }, ... }, callback, timeout)
+    int batch(lua_State* L)
+    {
+        lua_State* target = Tracker::is_state(Class::check(L, 1, "lua.state"));
+        if (target == nullptr) {
+            luaL::error(L, "invalid lua instance");
+            return 0;
+        }
+
+        luaL::checktable(L, 2);
+
+        int count = (int)lua::objlen(L, 2);
+        for (int i = 1; i <= count; i++) {
+            lua::rawgeti(L, 2, i);
+            bool valid = lua::istable(L, -1);
+            if (valid) {
+                lua::rawgeti(L, -1, 1);
+                valid = lua::gettype(L, -1) == datatype::string;
+                lua::pop(L);
+            }
+            lua::pop(L);
+
+            if (!valid) {
+                luaL::argerror(L, 2, ("expected { name, arguments... } at call " + std::to_string(i)).c_str());
+                return 0;
+            }
+        }
+
+        return send_request(L, target, 2, 3, 4, true);
+    }
+
+    void cleanup_requests(lua_State* L)
+    {
+        std::lock_guard<std::mutex> guard(requests_lock);
+        requests.erase(Tracker::id(L));
+    }
+
+    // Hands a received value to whoever asked for it through recv, running on their own tick
+    struct channel_delivery : Tracker::completion {
+        std::shared_ptr<Channel> channel;
+        int reference;
+
+        channel_delivery(std::shared_ptr<Channel> channel, int reference) : channel(std::move(channel)), reference(reference) {}
+
+        void complete(lua_State* L) override
+        {
+            std::string value;
+
+            // someone else got to it first, wait for the next one
+            if (!channel->receive(value)) {
+                channel->deliver(Tracker::id(L), reference);
+                return;
+            }
+
+            lua::pushref(L, reference);
+            luaL::rmref(L, reference);
+
+            int nargs = 1;
+            std::string err = Reflection::decode(L, value);
+            if (err.size() > 0) {
+                lua::pushnil(L);
+                lua::pushcstring(L, "channel decode error: " + err);
+                nargs = 2;
+            }
+
+            if (lua::tcall(L, nargs, 0)) {
+                std::string failure = lua::tocstring(L, -1);
+                lua::pop(L);
+                auto& on_error = get_on_error();
+                for (auto const& handle : on_error) handle.second(L, "channel", "", failure);
+            }
+        }
+    };
+
+    Channel::Channel(size_t capacity)
+    {
+        capacity = std::min(capacity, max_capacity);
+        limit = std::max((size_t)1, capacity);
+
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+
+        cells.reset(new cell[size]);
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        mask = size - 1;
+    }
+
+    Channel::~Channel()
+    {
+    }
+
+    bool Channel::send(std::string&& value)
+    {
+        // the ring may be larger than what was asked for, so the limit is held by claiming a slot up front
+        size_t claimed = used.load(std::memory_order_relaxed);
+        do {
+            if (claimed >= limit) return false;
+        } while (!used.compare_exchange_weak(claimed, claimed + 1, std::memory_order_acq_rel));
+
+        size_t position = head.load(std::memory_order_relaxed);
+        cell* target;
+
+        while (true) {
+            target = &cells[position & mask];
+            size_t sequence = target->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            }
+            else if (difference < 0) {
+                used.fetch_sub(1, std::memory_order_release);
+                return false;
+            }
+            else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        target->value = std::move(value);
+        target->sequence.store(position + 1, std::memory_order_release);
+
+        notify(receivers, receivers_waiting);
+        dispatch();
+
+        return true;
+    }
+
+    bool Channel::receive(std::string& value)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        cell* target;
+
+        while (true) {
+            target = &cells[position & mask];
+            size_t sequence = target->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+            if (difference == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        value = std::move(target->value);
+        target->value.clear();
+        target->sequence.store(position + mask + 1, std::memory_order_release);
+        used.fetch_sub(1, std::memory_order_release);
+
+        notify(senders, senders_waiting);
+
+        return true;
+    }
+
+    size_t Channel::size()
+    {
+        size_t front = head.load(std::memory_order_acquire);
+        size_t back = tail.load(std::memory_order_acquire);
+        return front > back ? front - back : 0;
+    }
+
+    size_t Channel::capacity()
+    {
+        return limit;
+    }
+
+    void Channel::notify(std::vector<uintptr_t>& waiters, std::atomic<bool>& waiting)
+    {
+        if (!waiting.load()) return;
+
+        std::vector<uintptr_t> woken;
+        {
+            std::lock_guard<std::mutex> guard(waiter_mtx);
+            woken.swap(waiters);
+            waiting.store(false);
+        }
+
+        for (uintptr_t id : woken) {
+            Tracker::wake(id);
+        }
+    }
+
+    // Posts one waiting delivery per value, a state that closed in the meantime gives its turn to the next
+    void Channel::dispatch()
+    {
+        if (!delivering.load()) return;
+
+        while (true) {
+            std::pair<uintptr_t, int> next;
+            {
+                std::lock_guard<std::mutex> guard(waiter_mtx);
+                if (deliveries.empty()) {
+                    delivering.store(false);
+                    return;
+                }
+                next = deliveries.front();
+                deliveries.pop_front();
+                if (deliveries.empty()) delivering.store(false);
+            }
+
+            if (Tracker::post(next.first, new channel_delivery(shared_from_this(), next.second))) return;
+        }
+    }
+
+    void Channel::deliver(uintptr_t id, int reference)
+    {
+        {
+            std::lock_guard<std::mutex> guard(waiter_mtx);
+            deliveries.emplace_back(id, reference);
+            delivering.store(true);
+        }
+
+        if (size() > 0) dispatch();
+    }
+
+    void Channel::forget(uintptr_t id)
+    {
+        std::lock_guard<std::mutex> guard(waiter_mtx);
+        receivers.erase(std::remove(receivers.begin(), receivers.end(), id), receivers.end());
+        senders.erase(std::remove(senders.begin(), senders.end(), id), senders.end());
+        deliveries.erase(std::remove_if(deliveries.begin(), deliveries.end(), [id](auto& delivery) { return delivery.first == id; }), deliveries.end());
+        if (deliveries.empty()) delivering.store(false);
+    }
+
+    // The state gets woken on the next send, recheck after registering so a send racing us isn't missed
+    void Channel::wait_receive(uintptr_t id)
+    {
+        {
+            std::lock_guard<std::mutex> guard(waiter_mtx);
+            if (std::find(receivers.begin(), receivers.end(), id) == receivers.end()) receivers.push_back(id);
+            receivers_waiting.store(true);
+        }
+
+        if (size() > 0) notify(receivers, receivers_waiting);
+    }
+
+    void Channel::wait_send(uintptr_t id)
+    {
+        {
+            std::lock_guard<std::mutex> guard(waiter_mtx);
+            if (std::find(senders.begin(), senders.end(), id) == senders.end()) senders.push_back(id);
+            senders_waiting.store(true);
+        }
+
+        if (size() < capacity()) notify(senders, senders_waiting);
+    }
+
+    std::mutex channels_mtx;
+    std::unordered_map<std::string, std::weak_ptr<Channel>> channels;
+
+    std::shared_ptr<Channel> channel(std::string name, size_t capacity)
+    {
+        std::lock_guard<std::mutex> guard(channels_mtx);
+
+        auto res = channels.find(name);
+        if (res != channels.end()) {
+            std::shared_ptr<Channel> existing = res->second.lock();
+            if (existing) return existing;
+        }
+
+        // drop names whose channels are gone while we are here
+        for (auto it = channels.begin(); it != channels.end();) {
+            if (it->second.expired()) it = channels.erase(it);
+            else ++it;
+        }
+
+        std::shared_ptr<Channel> created = std::make_shared<Channel>(capacity);
+        channels[name] = created;
+        return created;
+    }
+
+    void cleanup_channels(lua_State* L)
+    {
+        std::vector<std::shared_ptr<Channel>> open;
+        {
+            std::lock_guard<std::mutex> guard(channels_mtx);
+            for (auto& [name, weak] : channels) {
+                if (auto existing = weak.lock()) open.push_back(existing);
+            }
+        }
+
+        uintptr_t id = Tracker::id(L);
+        for (auto& existing : open) existing->forget(id);
+    }
+
+    int channel_send(lua_State* L)
+    {
+        std::shared_ptr<Channel>* handle = Class::check<std::shared_ptr<Channel>>(L, 1);
+        if (lua::gettop(L) < 2) lua::pushnil(L);
+
+        std::string value;
+        int type = Reflection::encode(L, 2, value);
+        if (type != 0) {
+            luaL::argerror(L, 2, (std::string() + "channel unsupported datatype: " + lua::gettypename(L, type)).c_str());
+            return 0;
+        }
 
+        bool sent = (*handle)->send(std::move(value));
+        if (!sent) (*handle)->wait_send(Tracker::id(L));
+
+        lua::pushboolean(L, sent);
+        return 1;
+    }
+
+    int channel_try_recv(lua_State* L)
+    {
+        std::shared_ptr<Channel>* handle = Class::check<std::shared_ptr<Channel>>(L, 1);
+
+        std::string value;
+        if (!(*handle)->receive(value)) {
+            (*handle)->wait_receive(Tracker::id(L));
+            lua::pushboolean(L, false);
+            return 1;
+        }
+
+        lua::pushboolean(L, true);
+        std::string err = Reflection::decode(L, value);
+        if (err.size() > 0) {
+            luaL::error(L, ("channel decode error: " + err).c_str());
+            return 0;
+        }
+
+        return 2;
+    }
+
+    int channel_recv_many(lua_State* L)
+    {
+        std::shared_ptr<Channel>* handle = Class::check<std::shared_ptr<Channel>>(L, 1);
+        int limit = (int)(*handle)->capacity();
+        if (lua::isnumber(L, 2)) {
+            limit = (int)lua::tonumber(L, 2);
+            if (limit < 1) {
+                luaL::argerror(L, 2, "expected a count above 0");
+                return 0;
+            }
+        }
+
+        lua::createtable(L, std::min(limit, (int)(*handle)->size()), 0);
+
+        int count = 0;
+        std::string value;
+        std::string err;
+        while (count < limit && (*handle)->receive(value)) {
+            // whatever was taken off the ring before a bad value is still handed back, with the error after it
+            int top = lua::gettop(L);
+            err = Reflection::decode(L, value);
+            if (err.size() > 0) {
+                lua::settop(L, top);
+                break;
+            }
+            lua::rawseti(L, -2, ++count);
+        }
+
+        if (count == 0 && err.size() == 0) (*handle)->wait_receive(Tracker::id(L));
+
+        lua::pushnumber(L, count);
+        if (err.size() == 0) return 2;
+
+        lua::pushcstring(L, "channel decode error: " + err);
+        return 3;
+    }
+
+    // channel:recv(callback), the callback gets the next value during the tick its send wakes us for
+    // Without a callback inside task.async this returns an awaitable instead
+    int channel_recv(lua_State* L)
+    {
+        std::shared_ptr<Channel>* handle = Class::check<std::shared_ptr<Channel>>(L, 1);
+
+        bool awaited = !lua::isfunction(L, 2) && Reflection::Task::awaiting(L);
+        if (!awaited) luaL::checkfunction(L, 2);
+
+        int reference = awaited ? Reflection::Task::awaitable(L) : luaL::newref(L, 2);
+        (*handle)->deliver(Tracker::id(L), reference);
+
+        return awaited ? 1 : 0;
+    }
+
+    int channel_size(lua_State* L)
+    {
+        std::shared_ptr<Channel>* handle = Class::check<std::shared_ptr<Channel>>(L, 1);
+        lua::pushnumber(L, (double)(*handle)->size());
+        return 1;
+    }
+
+    int channel_capacity(lua_State* L)
+    {
+        std::shared_ptr<Channel>* handle = Class::check<std::shared_ptr<Channel>>(L, 1);
+        lua::pushnumber(L, (double)(*handle)->capacity());
+        return 1;
+    }
+
+    int channel__tostring(lua_State* L)
+    {
+        std::shared_ptr<Channel>* handle = Class::check<std::shared_ptr<Channel>>(L, 1);
+        lua::pushcstring(L, "signal.channel: " + std::to_string((*handle)->size()) + "/" + std::to_string((*handle)->capacity()));
+        return 1;
+    }
+
+    static constexpr luaL_Reg channel_methods[] = {
+        { "send", channel_send },
+        { "try_recv", channel_try_recv },
+        { "recv_many", channel_recv_many },
+        { "recv", channel_recv },
+        { "size", channel_size },
+        { "capacity", channel_capacity },
+        { nullptr, nullptr }
+    };
+
+    static constexpr luaL_Reg channel_metamethods[] = {
+        { "__len", channel_size },
+        { "__tostring", channel__tostring },
+        { nullptr, nullptr }
+    };
+
+    int channel_open(lua_State* L)
+    {
+        std::string name = luaL::checkcstring(L, 1);
+        double capacity = 64;
+        if (lua::isnumber(L, 2)) {
+            capacity = lua::tonumber(L, 2);
+            if (capacity < 1 || capacity > Channel::max_capacity) {
+                luaL::argerror(L, 2, ("expected a capacity between 1 and " + std::to_string(Channel::max_capacity)).c_str());
+                return 0;
+            }
+        }
+
+        if (!Class::existsbytype(L, Class::ClassTag<std::shared_ptr<Channel>>::get())) {
+            Class::create<std::shared_ptr<Channel>>(L, "signal.channel");
+
+            lua::newtable(L);
+
+            luaL::makelib(L, nullptr, channel_methods);
+
+            lua::setfield(L, -2, "__index");
+
+            luaL::makelib(L, nullptr, channel_metamethods);
+
+            lua::pop(L);
+        }
+
+        Class::emplace<std::shared_ptr<Channel>>(L, channel(name, (size_t)capacity));
+        return 1;
+    }
+
+    static constexpr luaL_Reg signal_functions[] = {
+        { "call", interstate_rcall },
+        { "fire", interstate_rcall },
+        { "channel", channel_open },
+        { "request", request },
+        { "batch", batch },
+        { nullptr, nullptr }
+    };
+
+    void push(API::lua_State* L, UMODULE hndle) {
         lua::newtable(L);
 
         universal->api_funcs(L);
 
-        lua::pushcfunction(L, interstate_rcall);
-        lua::pushvalue(L, -1);
-        lua::setfield(L, -3, "call");
-        lua::setfield(L, -2, "fire");
+        luaL::makelib(L, nullptr, signal_functions);
     }
 
     void api() {
         universal = create();
+        Tracker::on_close("signal", cleanup);
         Reflection::add("signal", push);
     }
 }
\ No newline at end of file
@@ -2,6 +2,10 @@
 #include "interstellar.hpp"
 #include <map>
 #include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <deque>
 
 // Interstellar: Signal
 // Interstate & C++ event system
@@ -30,6 +34,55 @@ namespace INTERSTELLAR_NAMESPACE::Signal {
         std::unordered_map<uintptr_t, std::unordered_map<std::string, std::unordered_map<std::string, int>>> callbacks;
     };
 
+    // Bounded multi-producer multi-consumer ring of encoded values shared between states
+    // Sends never block, a full channel is reported back to the sender instead
+    class Channel : public std::enable_shared_from_this<Channel> {
+    public:
+        // Capacities are clamped to max_capacity, the ring behind them is rounded up to a power of two but never holds more than asked for
+        static constexpr size_t max_capacity = (size_t)1 << 24;
+
+        Channel(size_t capacity);
+        ~Channel();
+        bool send(std::string&& value);
+        bool receive(std::string& value);
+        size_t size();
+        size_t capacity();
+        void wait_receive(uintptr_t id);
+        void wait_send(uintptr_t id);
+
+        // Calls the reference with the next value received, from a completion on the state's own tick
+        void deliver(uintptr_t id, int reference);
+
+        // Drops everything a closing state was waiting on
+        void forget(uintptr_t id);
+    private:
+        struct cell {
+            std::atomic<size_t> sequence;
+            std::string value;
+        };
+
+        void notify(std::vector<uintptr_t>& waiters, std::atomic<bool>& waiting);
+        void dispatch();
+
+        std::unique_ptr<cell[]> cells;
+        size_t mask;
+        size_t limit;
+        alignas(64) std::atomic<size_t> head = 0;
+        alignas(64) std::atomic<size_t> tail = 0;
+        alignas(64) std::atomic<size_t> used = 0; // slots claimed by senders, only given back once a receive has emptied one
+
+        std::mutex waiter_mtx;
+        std::atomic<bool> receivers_waiting = false;
+        std::atomic<bool> senders_waiting = false;
+        std::vector<uintptr_t> receivers;
+        std::vector<uintptr_t> senders;
+        std::atomic<bool> delivering = false;
+        std::deque<std::pair<uintptr_t, int>> deliveries;
+    };
+
+    // Opens a channel by name, the first open decides its capacity
+    extern std::shared_ptr<Channel> channel(std::string name, size_t capacity = 64);
+
     extern Handle* create();
     extern void push(API::lua_State* L, UMODULE hndle);
     extern void api();
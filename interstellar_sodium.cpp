@@ -1931,6 +1931,70 @@ namespace INTERSTELLAR_NAMESPACE::Sodium {
 		}
 	}
 
+	static constexpr luaL_Reg sodium_hex_functions[] = {
+		{ "encode", Hex::encodel },
+		{ "decode", Hex::decodel },
+		{ nullptr, nullptr }
+	};
+
+	static constexpr luaL_Reg sodium_base64_functions[] = {
+		{ "encode", Base64::encodel },
+		{ "decode", Base64::decodel },
+		{ "xencode", Base64::xencodel },
+		{ "xdecode", Base64::xdecodel },
+		{ nullptr, nullptr }
+	};
+
+	static constexpr luaL_Reg sodium_signature_functions[] = {
+		{ "key", Signature::keypairl },
+		{ "encode", Signature::encodel },
+		{ "decode", Signature::decodel },
+		{ nullptr, nullptr }
+	};
+
+	static constexpr luaL_Reg sodium_hash_functions[] = {
+		{ "enc256", Hash::enc256l },
+		{ "enc512", Hash::enc512l },
+		{ nullptr, nullptr }
+	};
+
+	static constexpr luaL_Reg sodium_hmac_functions[] = {
+		{ "key256", HMAC::key256l },
+		{ "enc256", HMAC::enc256l },
+		{ "key512", HMAC::key512l },
+		{ "enc512", HMAC::enc512l },
+		{ "key512256", HMAC::key512256l },
+		{ "enc512256", HMAC::enc512256l },
+		{ nullptr, nullptr }
+	};
+
+	static constexpr luaL_Reg sodium_chachapoly_functions[] = {
+		{ "key", AEAD::CHACHAPOLY::keyl },
+		{ "encode", AEAD::CHACHAPOLY::encodel },
+		{ "decode", AEAD::CHACHAPOLY::decodel },
+		{ "encrypt", AEAD::CHACHAPOLY::encryptl },
+		{ "decrypt", AEAD::CHACHAPOLY::decryptl },
+		{ nullptr, nullptr }
+	};
+
+	static constexpr luaL_Reg sodium_gcm_functions[] = {
+		{ "key", AEAD::GCM::keyl },
+		{ "encode", AEAD::GCM::encodel },
+		{ "decode", AEAD::GCM::decodel },
+		{ "encrypt", AEAD::GCM::encryptl },
+		{ "decrypt", AEAD::GCM::decryptl },
+		{ nullptr, nullptr }
+	};
+
+	static constexpr luaL_Reg sodium_aegis_functions[] = {
+		{ "key", AEAD::AEGIS::keyl },
+		{ "encode", AEAD::AEGIS::encodel },
+		{ "decode", AEAD::AEGIS::decodel },
+		{ "encrypt", AEAD::AEGIS::encryptl },
+		{ "decrypt", AEAD::AEGIS::decryptl },
+		{ nullptr, nullptr }
+	};
+
     void push(API::lua_State* L, UMODULE hndle) {
 		sodium_init();
 
@@ -1943,52 +2007,23 @@ namespace INTERSTELLAR_NAMESPACE::Sodium {
 		lua::setfield(L, -2, "random");
 		
 		lua::newtable(L);
-			lua::pushcfunction(L, Hex::encodel);
-			lua::setfield(L, -2, "encode");
-			lua::pushcfunction(L, Hex::decodel);
-			lua::setfield(L, -2, "decode");
+			luaL::makelib(L, nullptr, sodium_hex_functions);
 		lua::setfield(L, -2, "hex");
 
 		lua::newtable(L);
-			lua::pushcfunction(L, Base64::encodel);
-			lua::setfield(L, -2, "encode");
-			lua::pushcfunction(L, Base64::decodel);
-			lua::setfield(L, -2, "decode");
-			lua::pushcfunction(L, Base64::xencodel);
-			lua::setfield(L, -2, "xencode");
-			lua::pushcfunction(L, Base64::xdecodel);
-			lua::setfield(L, -2, "xdecode");
+			luaL::makelib(L, nullptr, sodium_base64_functions);
 		lua::setfield(L, -2, "base64");
 
 		lua::newtable(L);
-			lua::pushcfunction(L, Signature::keypairl);
-			lua::setfield(L, -2, "key");
-			lua::pushcfunction(L, Signature::encodel);
-			lua::setfield(L, -2, "encode");
-			lua::pushcfunction(L, Signature::decodel);
-			lua::setfield(L, -2, "decode");
+			luaL::makelib(L, nullptr, sodium_signature_functions);
 		lua::setfield(L, -2, "signature");
 
 		lua::newtable(L);
-			lua::pushcfunction(L, Hash::enc256l);
-			lua::setfield(L, -2, "enc256");
-			lua::pushcfunction(L, Hash::enc512l);
-			lua::setfield(L, -2, "enc512");
+			luaL::makelib(L, nullptr, sodium_hash_functions);
 		lua::setfield(L, -2, "hash");
 
 		lua::newtable(L);
-			lua::pushcfunction(L, HMAC::key256l);
-			lua::setfield(L, -2, "key256");
-			lua::pushcfunction(L, HMAC::enc256l);
-			lua::setfield(L, -2, "enc256");
-			lua::pushcfunction(L, HMAC::key512l);
-			lua::setfield(L, -2, "key512");
-			lua::pushcfunction(L, HMAC::enc512l);
-			lua::setfield(L, -2, "enc512");
-			lua::pushcfunction(L, HMAC::key512256l);
-			lua::setfield(L, -2, "key512256");
-			lua::pushcfunction(L, HMAC::enc512256l);
-			lua::setfield(L, -2, "enc512256");
+			luaL::makelib(L, nullptr, sodium_hmac_functions);
 		lua::setfield(L, -2, "hmac");
 
 		lua::newtable(L);
@@ -1996,42 +2031,15 @@ namespace INTERSTELLAR_NAMESPACE::Sodium {
 			using namespace AEAD;
 
 			lua::newtable(L);
-				lua::pushcfunction(L, CHACHAPOLY::keyl);
-				lua::setfield(L, -2, "key");
-				lua::pushcfunction(L, CHACHAPOLY::encodel);
-				lua::setfield(L, -2, "encode");
-				lua::pushcfunction(L, CHACHAPOLY::decodel);
-				lua::setfield(L, -2, "decode");
-				lua::pushcfunction(L, CHACHAPOLY::encryptl);
-				lua::setfield(L, -2, "encrypt");
-				lua::pushcfunction(L, CHACHAPOLY::decryptl);
-				lua::setfield(L, -2, "decrypt");
+				luaL::makelib(L, nullptr, sodium_chachapoly_functions);
 			lua::setfield(L, -2, "chachapoly");
 
 			lua::newtable(L);
-				lua::pushcfunction(L, GCM::keyl);
-				lua::setfield(L, -2, "key");
-				lua::pushcfunction(L, GCM::encodel);
-				lua::setfield(L, -2, "encode");
-				lua::pushcfunction(L, GCM::decodel);
-				lua::setfield(L, -2, "decode");
-				lua::pushcfunction(L, GCM::encryptl);
-				lua::setfield(L, -2, "encrypt");
-				lua::pushcfunction(L, GCM::decryptl);
-				lua::setfield(L, -2, "decrypt");
+				luaL::makelib(L, nullptr, sodium_gcm_functions);
 			lua::setfield(L, -2, "gcm");
 
 			lua::newtable(L);
-				lua::pushcfunction(L, AEGIS::keyl);
-				lua::setfield(L, -2, "key");
-				lua::pushcfunction(L, AEGIS::encodel);
-				lua::setfield(L, -2, "encode");
-				lua::pushcfunction(L, AEGIS::decodel);
-				lua::setfield(L, -2, "decode");
-				lua::pushcfunction(L, AEGIS::encryptl);
-				lua::setfield(L, -2, "encrypt");
-				lua::pushcfunction(L, AEGIS::decryptl);
-				lua::setfield(L, -2, "decrypt");
+				luaL::makelib(L, nullptr, sodium_aegis_functions);
 			lua::setfield(L, -2, "aegis");
 		}
 		lua::setfield(L, -2, "aead");
@@ -313,26 +313,22 @@ namespace INTERSTELLAR_NAMESPACE::Table {
         return 1;
     }
 
+    static constexpr luaL_Reg table_functions[] = {
+        { "alloc", alloc },
+        { "usage", usage },
+        { "isarray", isarray },
+        { "tojson", tojson },
+        { "fromjson", fromjson },
+        { nullptr, nullptr }
+    };
+
     void push(lua_State* L, UMODULE hndle)
     {
         lua::pushvalue(L, indexer::global);
         lua::getfield(L, -1, "table");
         lua::remove(L, -2);
 
-        lua::pushcfunction(L, alloc);
-        lua::setfield(L, -2, "alloc");
-
-        lua::pushcfunction(L, usage);
-        lua::setfield(L, -2, "usage");
-
-        lua::pushcfunction(L, isarray);
-        lua::setfield(L, -2, "isarray");
-
-        lua::pushcfunction(L, tojson);
-        lua::setfield(L, -2, "tojson");
-
-        lua::pushcfunction(L, fromjson);
-        lua::setfield(L, -2, "fromjson");
+        luaL::makelib(L, nullptr, table_functions);
     }
 
     void api() {